@@ -1,4 +1,35 @@
 // Relative import to be able to reuse the C sources.
 #include "../../src/collect_stack.h"
 #include "../../src/collect_stack.cc"
-#include "../../src/collect_stack_ios.cc"
\ No newline at end of file
+#include "../../src/collect_stack_ios.cc"
+#include "../../src/hash_map.h"
+#include "../../src/jank_dedup.h"
+#include "../../src/jank_dedup.cc"
+#include "../../src/jank_report.h"
+#include "../../src/jank_report.cc"
+#include "../../src/module_map.h"
+#include "../../src/module_map.cc"
+#include "../../src/perf_event_sampler.h"
+#include "../../src/perf_event_sampler.cc"
+#include "../../src/persistent_samples.h"
+#include "../../src/persistent_samples.cc"
+#include "../../src/profile_export.h"
+#include "../../src/profile_export.cc"
+#include "../../src/sample_ring.h"
+#include "../../src/sample_ring.cc"
+#include "../../src/aggregator.h"
+#include "../../src/aggregator.cc"
+#include "../../src/sampler.h"
+#include "../../src/sampler.cc"
+#include "../../src/sampler_stats.h"
+#include "../../src/sampler_stats.cc"
+#include "../../src/sched_state.h"
+#include "../../src/sched_state.cc"
+#include "../../src/stack_table.h"
+#include "../../src/stack_table.cc"
+#include "../../src/thread_registry.h"
+#include "../../src/thread_registry.cc"
+#include "../../src/unwind_table.h"
+#include "../../src/unwind_table.cc"
+#include "../../src/watchdog.h"
+#include "../../src/watchdog.cc"
@@ -1,3 +1,11 @@
+export 'src/calling_context_tree.dart' show StackAggregation;
+export 'src/collect_stack.dart' show FramePhase, ProfileFormat;
 export 'src/glance.dart';
+export 'src/jank_report_file_reporter.dart' show JankReportFileReporter;
+export 'src/sampler.dart' show ThreadStateSummary;
+export 'src/sampler_stats.dart';
 export 'src/constants.dart'
-    show kAndroidDefaultModulePathFilters, kIOSDefaultModulePathFilters;
+    show
+        kAndroidDefaultModulePathFilters,
+        kIOSDefaultModulePathFilters,
+        kLinuxDefaultModulePathFilters;
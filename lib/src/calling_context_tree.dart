@@ -0,0 +1,124 @@
+import 'dart:collection';
+
+import 'package:glance/src/collect_stack.dart';
+
+/// How the samples within a jank are aggregated into the reported frames.
+enum StackAggregation {
+  /// Count how many samples each frame appears in. The frames are flattened, so
+  /// a function that only calls the slow one counts the same as the slow one,
+  /// and the different call paths through a function are merged.
+  frames,
+
+  /// Build a [CallingContextTree] of the samples, and report the call paths of
+  /// the frames that were on the top of the stack the most, i.e., the functions
+  /// that actually burned the time, heaviest first.
+  callingContextTree,
+}
+
+/// A node of a [CallingContextTree], which is a frame reached through a
+/// distinct call path from the outermost frame.
+class CallingContextNode {
+  CallingContextNode._(this.frame, this.parent);
+
+  /// The frame of the node, `null` for the root of the tree.
+  final NativeFrame? frame;
+
+  /// The caller node, `null` for the root of the tree.
+  final CallingContextNode? parent;
+
+  /// The number of samples whose innermost frame is this node.
+  int selfCount = 0;
+
+  /// The number of samples passing through this node, including [selfCount].
+  int totalCount = 0;
+
+  final _children = LinkedHashMap<int, CallingContextNode>.identity();
+
+  /// The callee nodes, in order of first seen.
+  Iterable<CallingContextNode> get children => _children.values;
+
+  /// The frames from this node to the outermost one, i.e., the stack of a
+  /// sample ending at this node.
+  List<CallingContextNode> get path {
+    final path = <CallingContextNode>[];
+    for (
+      CallingContextNode? node = this;
+      node != null && node.frame != null;
+      node = node.parent
+    ) {
+      path.add(node);
+    }
+    return path;
+  }
+}
+
+/// A calling-context tree of the sampled [NativeStack]s, where the children of
+/// a node are its callees, keyed by the pc, so the same function called from
+/// two different paths are two different nodes. Each node counts the samples
+/// passing through it ([CallingContextNode.totalCount]) and the ones ending at
+/// it ([CallingContextNode.selfCount]).
+class CallingContextTree {
+  /// The root of the tree, which has no frame, the outermost frames of the
+  /// samples are its children.
+  final CallingContextNode root = CallingContextNode._(null, null);
+
+  /// The number of samples added to the tree.
+  int get sampleCount => root.totalCount;
+
+  /// Adds the [stack] whose frames are in order of innermost to outermost. The
+  /// frames without a module (e.g., filtered out by the module path filters)
+  /// are skipped, so the time spent in them is counted as the self time of
+  /// their nearest caller that is kept.
+  void add(NativeStack stack) {
+    final frames = stack.frames;
+    CallingContextNode node = root;
+    for (int i = frames.length - 1; i >= 0; --i) {
+      final frame = frames[i];
+      if (frame.module == null) {
+        continue;
+      }
+
+      CallingContextNode? child = node._children[frame.pc];
+      if (child == null) {
+        child = CallingContextNode._(frame, node);
+        node._children[frame.pc] = child;
+      }
+      child.totalCount++;
+      node = child;
+    }
+
+    if (identical(node, root)) {
+      return;
+    }
+    node.selfCount++;
+    root.totalCount++;
+  }
+
+  /// Returns the nodes with a self count, heaviest first, at most
+  /// [maxPathCount] of them. See [CallingContextNode.path] for the call path
+  /// of a node.
+  List<CallingContextNode> heaviestNodes(int maxPathCount) {
+    final nodes = <CallingContextNode>[];
+    final pending = <CallingContextNode>[root];
+    while (pending.isNotEmpty) {
+      final node = pending.removeLast();
+      if (node.selfCount > 0) {
+        nodes.add(node);
+      }
+      pending.addAll(node.children);
+    }
+
+    // Break the ties by the total count of the outermost frame, so the paths of
+    // the same hot loop stay together.
+    nodes.sort((a, b) {
+      final bySelf = b.selfCount.compareTo(a.selfCount);
+      if (bySelf != 0) {
+        return bySelf;
+      }
+      return b.path.last.totalCount.compareTo(a.path.last.totalCount);
+    });
+    return nodes.length > maxPathCount
+        ? nodes.sublist(0, maxPathCount)
+        : nodes;
+  }
+}
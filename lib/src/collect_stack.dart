@@ -9,9 +9,12 @@
 import 'dart:developer';
 import 'dart:ffi' as ffi;
 import 'dart:io';
+import 'dart:typed_data';
 
 import 'package:ffi/ffi.dart';
+import 'package:glance/src/constants.dart';
 import 'package:glance/src/logger.dart';
+import 'package:glance/src/sampler_stats.dart';
 
 /// Dl_info from dlfcn.h.
 ///
@@ -23,7 +26,290 @@ final class DlInfo extends ffi.Struct {
   external ffi.Pointer<ffi.Void> symbolAddress;
 }
 
-/// Bindings to `collect_stack.cc`
+/// The maximum number of frames of a [NativeSampleStruct], keep it in sync with
+/// the `GLANCE_MAX_STACK_DEPTH` in `sample_ring.h`.
+const int kNativeSampleMaxStackDepth = 100;
+
+/// The `GLANCE_SAMPLE_KIND_CPU` in `sample_ring.h`, see [NativeStack.isCpuTick].
+const int kNativeSampleKindCpu = 1;
+
+/// The `GLANCE_NO_SYSCALL` in `sample_ring.h`, see [NativeStack.syscall].
+const int kNoSyscall = -1;
+
+/// NativeSample from sample_ring.h.
+final class NativeSampleStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int timestamp;
+
+  @ffi.Int32()
+  external int depth;
+
+  @ffi.Int32()
+  external int kind;
+
+  @ffi.Int32()
+  external int syscall;
+
+  @ffi.Int32()
+  external int runState;
+
+  @ffi.Int32()
+  external int voluntarySwitches;
+
+  @ffi.Int32()
+  external int involuntarySwitches;
+
+  @ffi.Int32()
+  external int framePhase;
+
+  @ffi.Int32()
+  external int frameNumber;
+
+  @ffi.Array(kNativeSampleMaxStackDepth)
+  external ffi.Array<ffi.Int64> pcs;
+}
+
+/// NativeDartImageInfo from collect_stack.h.
+final class NativeDartImageInfoStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int isolateDsoBase;
+
+  @ffi.Int64()
+  external int vmDsoBase;
+
+  @ffi.Int64()
+  external int isolateInstructions;
+
+  @ffi.Int64()
+  external int vmInstructions;
+
+  external ffi.Pointer<Utf8> buildId;
+
+  external ffi.Pointer<Utf8> path;
+}
+
+/// NativeFrameInfo from module_map.h.
+final class NativeFrameInfoStruct extends ffi.Struct {
+  @ffi.Int32()
+  external int moduleId;
+
+  @ffi.Int32()
+  external int symbolId;
+}
+
+/// NativeModuleInfo from module_map.h.
+final class NativeModuleInfoStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int baseAddress;
+
+  @ffi.Int64()
+  external int startAddress;
+
+  @ffi.Int64()
+  external int endAddress;
+
+  external ffi.Pointer<Utf8> path;
+}
+
+/// NativeAggregatedFrame from aggregator.h.
+final class NativeAggregatedFrameStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int pc;
+
+  @ffi.Int64()
+  external int timestamp;
+
+  @ffi.Int64()
+  external int occurTimes;
+
+  @ffi.Int32()
+  external int moduleId;
+
+  @ffi.Int32()
+  external int symbolId;
+}
+
+/// NativeThreadSample from thread_registry.h.
+final class NativeThreadSampleStruct extends ffi.Struct {
+  @ffi.Int32()
+  external int threadId;
+
+  @ffi.Int32()
+  external int error;
+
+  external NativeSampleStruct sample;
+}
+
+/// NativeWatchdogReport from watchdog.h.
+final class NativeWatchdogReportStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int freezeId;
+
+  @ffi.Int64()
+  external int frozenInMicros;
+
+  @ffi.Int32()
+  external int error;
+
+  @ffi.Int32()
+  external int reportIndex;
+
+  external NativeSampleStruct sample;
+}
+
+/// NativeJankReportFrame from jank_report.h.
+final class NativeJankReportFrameStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int pc;
+
+  @ffi.Int64()
+  external int occurTimes;
+
+  @ffi.Int32()
+  external int moduleId;
+
+  @ffi.Int32()
+  external int pathDepth;
+}
+
+/// NativeJankFingerprint from jank_dedup.h.
+final class NativeJankFingerprintStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int fingerprint;
+
+  @ffi.Int64()
+  external int count;
+
+  @ffi.Int64()
+  external int repeats;
+
+  @ffi.Int64()
+  external int firstSeen;
+
+  @ffi.Int64()
+  external int lastSeen;
+}
+
+/// NativePersistedSamples from persistent_samples.h.
+final class NativePersistedSamplesStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int isolateInstructions;
+
+  @ffi.Int32()
+  external int cleanShutdown;
+
+  @ffi.Int32()
+  external int moduleCount;
+
+  external ffi.Pointer<NativeModuleInfoStruct> modules;
+
+  external ffi.Pointer<Utf8> header;
+
+  @ffi.Size()
+  external int sampleCount;
+
+  external ffi.Pointer<NativeSampleStruct> samples;
+}
+
+/// The number of buckets of a [NativeHistogramStruct], keep it in sync with the
+/// `GLANCE_HISTOGRAM_BUCKET_COUNT` in `sampler_stats.h`.
+const int kNativeHistogramBucketCount = 32;
+
+/// NativeHistogram from sampler_stats.h.
+final class NativeHistogramStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int count;
+
+  @ffi.Int64()
+  external int sum;
+
+  @ffi.Int64()
+  external int max;
+
+  @ffi.Array(kNativeHistogramBucketCount)
+  external ffi.Array<ffi.Int64> buckets;
+}
+
+/// NativeSamplerStats from sampler_stats.h.
+final class NativeSamplerStatsStruct extends ffi.Struct {
+  @ffi.Int64()
+  external int samplesAttempted;
+
+  @ffi.Int64()
+  external int samplesSucceeded;
+
+  @ffi.Int64()
+  external int samplesTimedOut;
+
+  @ffi.Int64()
+  external int samplesFailed;
+
+  @ffi.Int64()
+  external int framesTruncated;
+
+  external NativeHistogramStruct signalDeliveryInNanos;
+
+  external NativeHistogramStruct targetPauseInNanos;
+
+  external NativeHistogramStruct walkDepth;
+}
+
+/// The formats of [StackCapturer.exportNativeSamplerProfile], the [index]es
+/// are the values of `profile_export::Format` in `profile_export.h`.
+enum ProfileFormat {
+  /// The gzip'd protobuf of pprof, which can be opened by `go tool pprof`,
+  /// Perfetto, or speedscope.
+  pprof,
+
+  /// The collapsed stacks of `stackcollapse.pl`, one line of a stack and its
+  /// number of samples, which can be rendered by `flamegraph.pl` or
+  /// speedscope.
+  collapsed,
+}
+
+/// The phases of the UI thread marked by the binding, see
+/// [StackCapturer.setFramePhase]. The [index]es are the values of
+/// `GLANCE_FRAME_PHASE_*` in `sample_ring.h`.
+enum FramePhase {
+  /// Between the frames and the callbacks, or not marked.
+  idle,
+
+  /// The transient frame callbacks of a frame (e.g., the animations), and the
+  /// microtasks they scheduled.
+  animate,
+
+  /// Building the widgets of a frame.
+  build,
+
+  /// Laying out the render objects of a frame.
+  layout,
+
+  /// Painting and compositing the layers of a frame.
+  paint,
+
+  /// Updating the semantics tree of a frame, only if the semantics is enabled.
+  semantics,
+
+  /// The post-frame callbacks of a frame.
+  postFrame,
+
+  /// Dispatching a pointer event.
+  input,
+
+  /// The message handlers of the platform channels.
+  platformMessage,
+
+  /// The other callbacks of the platform, e.g., the metrics or the locales
+  /// changed.
+  platformEvent;
+
+  /// Returns the phase of the [index] recorded natively, or [idle] if unknown.
+  static FramePhase fromIndex(int index) {
+    return index >= 0 && index < values.length ? values[index] : idle;
+  }
+}
+
+/// Bindings to `collect_stack.cc`, `module_map.cc` and `sampler.cc`
 class CollectStackNativeBindings {
   /// Holds the symbol lookup function.
   final ffi.Pointer<T> Function<T extends ffi.NativeType>(String symbolName)
@@ -52,6 +338,71 @@ class CollectStackNativeBindings {
   late final _SetCurrentThreadAsTarget =
       _SetCurrentThreadAsTargetPtr.asFunction<void Function()>();
 
+  // ignore: non_constant_identifier_names
+  int RegisterTargetThread(ffi.Pointer<Utf8> name) {
+    return _RegisterTargetThread(name);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _RegisterTargetThreadPtr =
+      _lookup<ffi.NativeFunction<ffi.Int32 Function(ffi.Pointer<Utf8>)>>(
+        'RegisterTargetThread',
+      );
+  // ignore: non_constant_identifier_names
+  late final _RegisterTargetThread = _RegisterTargetThreadPtr
+      .asFunction<int Function(ffi.Pointer<Utf8>)>();
+
+  // ignore: non_constant_identifier_names
+  void UnregisterTargetThread() {
+    return _UnregisterTargetThread();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _UnregisterTargetThreadPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>(
+        'UnregisterTargetThread',
+      );
+  // ignore: non_constant_identifier_names
+  late final _UnregisterTargetThread = _UnregisterTargetThreadPtr
+      .asFunction<void Function()>();
+
+  // ignore: non_constant_identifier_names
+  int GetTargetThreadName(int threadId, ffi.Pointer<Utf8> out, int size) {
+    return _GetTargetThreadName(threadId, out, size);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _GetTargetThreadNamePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Int32, ffi.Pointer<Utf8>, ffi.Size)
+        >
+      >('GetTargetThreadName');
+  // ignore: non_constant_identifier_names
+  late final _GetTargetThreadName = _GetTargetThreadNamePtr
+      .asFunction<int Function(int, ffi.Pointer<Utf8>, int)>();
+
+  // ignore: non_constant_identifier_names
+  int CollectStackTracesOfAllThreads(
+    ffi.Pointer<NativeThreadSampleStruct> out,
+    int maxCount,
+  ) {
+    return _CollectStackTracesOfAllThreads(out, maxCount);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _CollectStackTracesOfAllThreadsPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Size Function(ffi.Pointer<NativeThreadSampleStruct>, ffi.Size)
+        >
+      >('CollectStackTracesOfAllThreads');
+  // ignore: non_constant_identifier_names
+  late final _CollectStackTracesOfAllThreads =
+      _CollectStackTracesOfAllThreadsPtr.asFunction<
+        int Function(ffi.Pointer<NativeThreadSampleStruct>, int)
+      >();
+
   // ignore: non_constant_identifier_names
   ffi.Pointer<Utf8> CollectStackTraceOfTargetThread(
     ffi.Pointer<ffi.Int64> buf,
@@ -89,6 +440,24 @@ class CollectStackNativeBindings {
         ffi.Pointer<Utf8> Function(ffi.Pointer<DlInfo>)
       >();
 
+  // ignore: non_constant_identifier_names
+  int GetDartImageInfo(ffi.Pointer<NativeDartImageInfoStruct> out) {
+    return _GetDartImageInfo(out);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _GetDartImageInfoPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Pointer<NativeDartImageInfoStruct>)
+        >
+      >('GetDartImageInfo');
+  // ignore: non_constant_identifier_names
+  late final _GetDartImageInfo =
+      _GetDartImageInfoPtr.asFunction<
+        int Function(ffi.Pointer<NativeDartImageInfoStruct>)
+      >();
+
   // ignore: non_constant_identifier_names
   int Dladdr(ffi.Pointer<ffi.Void> addr, ffi.Pointer<DlInfo> info) {
     return _dladdr(addr, info);
@@ -102,170 +471,2003 @@ class CollectStackNativeBindings {
       >('dladdr');
   late final _dladdr = _dladdrPtr
       .asFunction<int Function(ffi.Pointer<ffi.Void>, ffi.Pointer<DlInfo>)>();
-}
-
-class NativeFrame {
-  final NativeModule? module;
-  final int pc;
-  final int timestamp;
-  NativeFrame({this.module, required this.pc, required this.timestamp});
 
-  @override
-  bool operator ==(Object other) {
-    if (identical(this, other)) return true;
-    if (runtimeType != other.runtimeType) return false;
-    return other is NativeFrame &&
-        module == other.module &&
-        pc == other.pc &&
-        timestamp == other.timestamp;
+  // ignore: non_constant_identifier_names
+  void SetStackCopySize(int sizeInBytes) {
+    return _SetStackCopySize(sizeInBytes);
   }
 
-  @override
-  int get hashCode => Object.hash(module, pc, timestamp);
-}
-
-class NativeModule {
-  final int id;
-  final String path;
-  final int baseAddress;
-  final String symbolName;
-  NativeModule({
-    required this.id,
-    required this.path,
-    required this.baseAddress,
-    required this.symbolName,
-  });
+  // ignore: non_constant_identifier_names
+  late final _SetStackCopySizePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Size)>>(
+        'SetStackCopySize',
+      );
+  // ignore: non_constant_identifier_names
+  late final _SetStackCopySize = _SetStackCopySizePtr
+      .asFunction<void Function(int)>();
 
-  @override
-  bool operator ==(Object other) {
-    if (identical(this, other)) return true;
-    if (runtimeType != other.runtimeType) return false;
-    return other is NativeModule &&
-        id == other.id &&
-        path == other.path &&
-        baseAddress == other.baseAddress &&
-        symbolName == other.symbolName;
+  // ignore: non_constant_identifier_names
+  void SetUnwindTablesEnabled(int enabled) {
+    return _SetUnwindTablesEnabled(enabled);
   }
 
-  @override
-  int get hashCode => Object.hash(id, path, baseAddress, symbolName);
-}
-
-class NativeStack {
-  final List<NativeFrame> frames;
-  final List<NativeModule> modules;
-  NativeStack({required this.frames, required this.modules});
-}
+  // ignore: non_constant_identifier_names
+  late final _SetUnwindTablesEnabledPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int32)>>(
+        'SetUnwindTablesEnabled',
+      );
+  // ignore: non_constant_identifier_names
+  late final _SetUnwindTablesEnabled = _SetUnwindTablesEnabledPtr
+      .asFunction<void Function(int)>();
 
-ffi.DynamicLibrary _loadLib() {
-  const libName = 'glance';
-  if (Platform.isWindows) {
-    return ffi.DynamicLibrary.open('$libName.dll');
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerPerfEventsEnabled(int enabled) {
+    return _SetNativeSamplerPerfEventsEnabled(enabled);
   }
 
-  if (Platform.isAndroid) {
-    return ffi.DynamicLibrary.open('lib$libName.so');
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerPerfEventsEnabledPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int32)>>(
+        'SetNativeSamplerPerfEventsEnabled',
+      );
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerPerfEventsEnabled =
+      _SetNativeSamplerPerfEventsEnabledPtr.asFunction<void Function(int)>();
+
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerCpuTimeSampleRate(int cpuRateInMicros) {
+    return _SetNativeSamplerCpuTimeSampleRate(cpuRateInMicros);
   }
 
-  return ffi.DynamicLibrary.process();
-}
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerCpuTimeSampleRatePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int64)>>(
+        'SetNativeSamplerCpuTimeSampleRate',
+      );
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerCpuTimeSampleRate =
+      _SetNativeSamplerCpuTimeSampleRatePtr.asFunction<void Function(int)>();
 
-class StackCapturer {
-  StackCapturer({CollectStackNativeBindings? nativeBindings})
-    : _nativeBindings =
-          nativeBindings ?? CollectStackNativeBindings(_loadLib());
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerSchedStateEnabled(int enabled) {
+    return _SetNativeSamplerSchedStateEnabled(enabled);
+  }
 
-  static const _maxStackDepth = 100;
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerSchedStateEnabledPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int)>>(
+        'SetNativeSamplerSchedStateEnabled',
+      );
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerSchedStateEnabled =
+      _SetNativeSamplerSchedStateEnabledPtr.asFunction<void Function(int)>();
 
-  ffi.Pointer<ffi.Int64>? _capturedStackBuffer;
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> GetSyscallName(int number) {
+    return _GetSyscallName(number);
+  }
 
-  final CollectStackNativeBindings _nativeBindings;
+  // ignore: non_constant_identifier_names
+  late final _GetSyscallNamePtr =
+      _lookup<ffi.NativeFunction<ffi.Pointer<Utf8> Function(ffi.Int32)>>(
+        'GetSyscallName',
+      );
+  // ignore: non_constant_identifier_names
+  late final _GetSyscallName = _GetSyscallNamePtr
+      .asFunction<ffi.Pointer<Utf8> Function(int)>();
 
-  /// Set the target capture thread. This only works for the main isolate.
-  void setCurrentThreadAsTarget() {
-    _nativeBindings.SetCurrentThreadAsTarget();
+  // ignore: non_constant_identifier_names
+  void GetSamplerStats(ffi.Pointer<NativeSamplerStatsStruct> out) {
+    return _GetSamplerStats(out);
   }
 
-  /// Refer to the implementation from Flutter Engine, we should use the `Timeline.now`
-  /// as the current timestamp.
-  /// https://github.com/flutter/engine/blob/5d97d2bcdffc8b21bc0b9742f1136583f4cc8e16/runtime/dart_timestamp_provider.cc#L24
-  int _nowInMicrosSinceEpoch() {
-    return Timeline.now;
+  // ignore: non_constant_identifier_names
+  late final _GetSamplerStatsPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Void Function(ffi.Pointer<NativeSamplerStatsStruct>)>
+      >('GetSamplerStats');
+  // ignore: non_constant_identifier_names
+  late final _GetSamplerStats = _GetSamplerStatsPtr
+      .asFunction<void Function(ffi.Pointer<NativeSamplerStatsStruct>)>();
+
+  // ignore: non_constant_identifier_names
+  void SetCollectStackTimeout(int timeoutInMicros) {
+    return _SetCollectStackTimeout(timeoutInMicros);
   }
 
-  /// Capture the native stack using a signal handler. For more details,
-  /// see `CollectStackTraceOfTargetThread` in `collect_stack.cc`.
-  /// Before calling this function, call [setCurrentThreadAsTarget] first.
-  NativeStack captureStackOfTargetThread() {
-    return using((arena) {
-      _capturedStackBuffer ??= malloc.allocate<ffi.Int64>(
-        ffi.sizeOf<ffi.Int64>() * _maxStackDepth,
-      );
-      final error = _nativeBindings.CollectStackTraceOfTargetThread(
-        _capturedStackBuffer!,
-        _maxStackDepth,
+  // ignore: non_constant_identifier_names
+  late final _SetCollectStackTimeoutPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int64)>>(
+        'SetCollectStackTimeout',
       );
-      if (error != ffi.nullptr) {
-        final errorString = error.toDartString();
-        malloc.free(error);
-        GlanceLogger.log(
-          'error when calling CollectStackTraceOfTargetThread: $errorString',
-        );
-        return NativeStack(
-          frames: [],
-          modules: [],
-        ); // Something went wrong. but just discard info this time.
-      }
-
-      final dlInfo = arena.allocate<DlInfo>(ffi.sizeOf<DlInfo>());
-
-      // Process stack trace: which is a sequence of hexadecimal numbers
-      // separated by commas. For each frame try to locate base address
-      // of the module it belongs to using |dladdr|.
-      final modules = <String, NativeModule>{};
-      final frames = _capturedStackBuffer!
-          .asTypedList(_maxStackDepth)
-          .takeWhile((value) => value != 0)
-          .map((addr) {
-            final found = _nativeBindings.Dladdr(
-              ffi.Pointer<ffi.Void>.fromAddress(addr),
-              dlInfo,
-            );
-            if (found == 0) {
-              return NativeFrame(pc: addr, timestamp: _nowInMicrosSinceEpoch());
-            }
-
-            final sn = _nativeBindings.LookupSymbolName(dlInfo);
-            final symbolName = sn != ffi.nullptr ? sn.toDartString() : '';
-            malloc.free(sn);
-
-            final modulePath = dlInfo.ref.fileName.toDartString();
-            final module = modules[modulePath] ??= NativeModule(
-              id: modules.length,
-              path: modulePath,
-              baseAddress: dlInfo.ref.baseAddress.address,
-              symbolName: symbolName,
-            );
-
-            return NativeFrame(
-              module: module,
-              pc: addr,
-              timestamp: _nowInMicrosSinceEpoch(),
-            );
-          })
-          .toList(growable: false);
+  // ignore: non_constant_identifier_names
+  late final _SetCollectStackTimeout = _SetCollectStackTimeoutPtr
+      .asFunction<void Function(int)>();
 
+  // ignore: non_constant_identifier_names
+  void SetModulePathFilters(ffi.Pointer<ffi.Pointer<Utf8>> patterns, int count) {
+    return _SetModulePathFilters(patterns, count);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _SetModulePathFiltersPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Void Function(ffi.Pointer<ffi.Pointer<Utf8>>, ffi.Size)
+        >
+      >('SetModulePathFilters');
+  // ignore: non_constant_identifier_names
+  late final _SetModulePathFilters = _SetModulePathFiltersPtr
+      .asFunction<void Function(ffi.Pointer<ffi.Pointer<Utf8>>, int)>();
+
+  // ignore: non_constant_identifier_names
+  void RefreshModuleMap() {
+    return _RefreshModuleMap();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _RefreshModuleMapPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>('RefreshModuleMap');
+  // ignore: non_constant_identifier_names
+  late final _RefreshModuleMap = _RefreshModuleMapPtr
+      .asFunction<void Function()>();
+
+  // ignore: non_constant_identifier_names
+  void ResolveNativeFrames(
+    ffi.Pointer<ffi.Int64> pcs,
+    int count,
+    ffi.Pointer<NativeFrameInfoStruct> out,
+  ) {
+    return _ResolveNativeFrames(pcs, count, out);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _ResolveNativeFramesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Void Function(
+            ffi.Pointer<ffi.Int64>,
+            ffi.Size,
+            ffi.Pointer<NativeFrameInfoStruct>,
+          )
+        >
+      >('ResolveNativeFrames');
+  // ignore: non_constant_identifier_names
+  late final _ResolveNativeFrames = _ResolveNativeFramesPtr
+      .asFunction<
+        void Function(
+          ffi.Pointer<ffi.Int64>,
+          int,
+          ffi.Pointer<NativeFrameInfoStruct>,
+        )
+      >();
+
+  // ignore: non_constant_identifier_names
+  int GetNativeModule(int moduleId, ffi.Pointer<NativeModuleInfoStruct> out) {
+    return _GetNativeModule(moduleId, out);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _GetNativeModulePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int Function(ffi.Int32, ffi.Pointer<NativeModuleInfoStruct>)
+        >
+      >('GetNativeModule');
+  // ignore: non_constant_identifier_names
+  late final _GetNativeModule = _GetNativeModulePtr
+      .asFunction<int Function(int, ffi.Pointer<NativeModuleInfoStruct>)>();
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> OpenJankReportWriter(
+    ffi.Pointer<Utf8> path,
+    ffi.Pointer<ffi.Pointer<ffi.Void>> out,
+  ) {
+    return _OpenJankReportWriter(path, out);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _OpenJankReportWriterPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<Utf8> Function(
+            ffi.Pointer<Utf8>,
+            ffi.Pointer<ffi.Pointer<ffi.Void>>,
+          )
+        >
+      >('OpenJankReportWriter');
+  // ignore: non_constant_identifier_names
+  late final _OpenJankReportWriter = _OpenJankReportWriterPtr
+      .asFunction<
+        ffi.Pointer<Utf8> Function(
+          ffi.Pointer<Utf8>,
+          ffi.Pointer<ffi.Pointer<ffi.Void>>,
+        )
+      >();
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> WriteJankReport(
+    ffi.Pointer<ffi.Void> writer,
+    ffi.Pointer<Utf8> buildId,
+    int isolateInstructions,
+    ffi.Pointer<ffi.Pointer<Utf8>> headerLines,
+    int headerLineCount,
+    int timestamp,
+    ffi.Pointer<NativeJankReportFrameStruct> frames,
+    int frameCount,
+  ) {
+    return _WriteJankReport(
+      writer,
+      buildId,
+      isolateInstructions,
+      headerLines,
+      headerLineCount,
+      timestamp,
+      frames,
+      frameCount,
+    );
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _WriteJankReportPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<Utf8> Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Pointer<Utf8>,
+            ffi.Int64,
+            ffi.Pointer<ffi.Pointer<Utf8>>,
+            ffi.Size,
+            ffi.Int64,
+            ffi.Pointer<NativeJankReportFrameStruct>,
+            ffi.Size,
+          )
+        >
+      >('WriteJankReport');
+  // ignore: non_constant_identifier_names
+  late final _WriteJankReport = _WriteJankReportPtr
+      .asFunction<
+        ffi.Pointer<Utf8> Function(
+          ffi.Pointer<ffi.Void>,
+          ffi.Pointer<Utf8>,
+          int,
+          ffi.Pointer<ffi.Pointer<Utf8>>,
+          int,
+          int,
+          ffi.Pointer<NativeJankReportFrameStruct>,
+          int,
+        )
+      >();
+
+  // ignore: non_constant_identifier_names
+  void CloseJankReportWriter(ffi.Pointer<ffi.Void> writer) {
+    return _CloseJankReportWriter(writer);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _CloseJankReportWriterPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ffi.Void>)>>(
+        'CloseJankReportWriter',
+      );
+  // ignore: non_constant_identifier_names
+  late final _CloseJankReportWriter = _CloseJankReportWriterPtr
+      .asFunction<void Function(ffi.Pointer<ffi.Void>)>();
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<ffi.Void> CreateJankDeduper(int capacity, int topFrames) {
+    return _CreateJankDeduper(capacity, topFrames);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _CreateJankDeduperPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Pointer<ffi.Void> Function(ffi.Int32, ffi.Int32)>
+      >('CreateJankDeduper');
+  // ignore: non_constant_identifier_names
+  late final _CreateJankDeduper = _CreateJankDeduperPtr
+      .asFunction<ffi.Pointer<ffi.Void> Function(int, int)>();
+
+  // ignore: non_constant_identifier_names
+  void DestroyJankDeduper(ffi.Pointer<ffi.Void> deduper) {
+    return _DestroyJankDeduper(deduper);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _DestroyJankDeduperPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Pointer<ffi.Void>)>>(
+        'DestroyJankDeduper',
+      );
+  // ignore: non_constant_identifier_names
+  late final _DestroyJankDeduper = _DestroyJankDeduperPtr
+      .asFunction<void Function(ffi.Pointer<ffi.Void>)>();
+
+  // ignore: non_constant_identifier_names
+  int RecordJankReport(
+    ffi.Pointer<ffi.Void> deduper,
+    int isolateInstructions,
+    ffi.Pointer<NativeJankReportFrameStruct> frames,
+    int frameCount,
+    int timestamp,
+    ffi.Pointer<NativeJankFingerprintStruct> out,
+    ffi.Pointer<NativeJankFingerprintStruct> evicted,
+  ) {
+    return _RecordJankReport(
+      deduper,
+      isolateInstructions,
+      frames,
+      frameCount,
+      timestamp,
+      out,
+      evicted,
+    );
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _RecordJankReportPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int32 Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Int64,
+            ffi.Pointer<NativeJankReportFrameStruct>,
+            ffi.Size,
+            ffi.Int64,
+            ffi.Pointer<NativeJankFingerprintStruct>,
+            ffi.Pointer<NativeJankFingerprintStruct>,
+          )
+        >
+      >('RecordJankReport');
+  // ignore: non_constant_identifier_names
+  late final _RecordJankReport = _RecordJankReportPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Void>,
+          int,
+          ffi.Pointer<NativeJankReportFrameStruct>,
+          int,
+          int,
+          ffi.Pointer<NativeJankFingerprintStruct>,
+          ffi.Pointer<NativeJankFingerprintStruct>,
+        )
+      >(isLeaf: true);
+
+  // ignore: non_constant_identifier_names
+  int TakeJankSummaries(
+    ffi.Pointer<ffi.Void> deduper,
+    ffi.Pointer<NativeJankFingerprintStruct> out,
+    int maxCount,
+  ) {
+    return _TakeJankSummaries(deduper, out, maxCount);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _TakeJankSummariesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Size Function(
+            ffi.Pointer<ffi.Void>,
+            ffi.Pointer<NativeJankFingerprintStruct>,
+            ffi.Size,
+          )
+        >
+      >('TakeJankSummaries');
+  // ignore: non_constant_identifier_names
+  late final _TakeJankSummaries = _TakeJankSummariesPtr
+      .asFunction<
+        int Function(
+          ffi.Pointer<ffi.Void>,
+          ffi.Pointer<NativeJankFingerprintStruct>,
+          int,
+        )
+      >(isLeaf: true);
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> DecodeJankReportFile(
+    ffi.Pointer<Utf8> path,
+    ffi.Pointer<ffi.Pointer<Utf8>> out,
+  ) {
+    return _DecodeJankReportFile(path, out);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _DecodeJankReportFilePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<Utf8> Function(
+            ffi.Pointer<Utf8>,
+            ffi.Pointer<ffi.Pointer<Utf8>>,
+          )
+        >
+      >('DecodeJankReportFile');
+  // ignore: non_constant_identifier_names
+  late final _DecodeJankReportFile = _DecodeJankReportFilePtr
+      .asFunction<
+        ffi.Pointer<Utf8> Function(
+          ffi.Pointer<Utf8>,
+          ffi.Pointer<ffi.Pointer<Utf8>>,
+        )
+      >();
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> GetInternedSymbolName(int symbolId) {
+    return _GetInternedSymbolName(symbolId);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _GetInternedSymbolNamePtr =
+      _lookup<ffi.NativeFunction<ffi.Pointer<Utf8> Function(ffi.Int32)>>(
+        'GetInternedSymbolName',
+      );
+  // ignore: non_constant_identifier_names
+  late final _GetInternedSymbolName = _GetInternedSymbolNamePtr
+      .asFunction<ffi.Pointer<Utf8> Function(int)>();
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> StartNativeSampler(
+    int sampleRateInMicros,
+    int windowInMicros,
+    int memoryBudgetInBytes,
+  ) {
+    return _StartNativeSampler(
+      sampleRateInMicros,
+      windowInMicros,
+      memoryBudgetInBytes,
+    );
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _StartNativeSamplerPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<Utf8> Function(ffi.Int64, ffi.Int64, ffi.Size)
+        >
+      >('StartNativeSampler');
+  // ignore: non_constant_identifier_names
+  late final _StartNativeSampler = _StartNativeSamplerPtr
+      .asFunction<ffi.Pointer<Utf8> Function(int, int, int)>();
+
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerPersistentFile(
+    ffi.Pointer<Utf8> path,
+    int isolateInstructions,
+    ffi.Pointer<ffi.Pointer<Utf8>> headerLines,
+    int headerLineCount,
+  ) {
+    return _SetNativeSamplerPersistentFile(
+      path,
+      isolateInstructions,
+      headerLines,
+      headerLineCount,
+    );
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerPersistentFilePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Void Function(
+            ffi.Pointer<Utf8>,
+            ffi.Int64,
+            ffi.Pointer<ffi.Pointer<Utf8>>,
+            ffi.Size,
+          )
+        >
+      >('SetNativeSamplerPersistentFile');
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerPersistentFile =
+      _SetNativeSamplerPersistentFilePtr.asFunction<
+        void Function(
+          ffi.Pointer<Utf8>,
+          int,
+          ffi.Pointer<ffi.Pointer<Utf8>>,
+          int,
+        )
+      >();
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> LoadPersistedSamples(
+    ffi.Pointer<Utf8> path,
+    int windowInMicros,
+    ffi.Pointer<ffi.Pointer<NativePersistedSamplesStruct>> out,
+  ) {
+    return _LoadPersistedSamples(path, windowInMicros, out);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _LoadPersistedSamplesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<Utf8> Function(
+            ffi.Pointer<Utf8>,
+            ffi.Int64,
+            ffi.Pointer<ffi.Pointer<NativePersistedSamplesStruct>>,
+          )
+        >
+      >('LoadPersistedSamples');
+  // ignore: non_constant_identifier_names
+  late final _LoadPersistedSamples = _LoadPersistedSamplesPtr
+      .asFunction<
+        ffi.Pointer<Utf8> Function(
+          ffi.Pointer<Utf8>,
+          int,
+          ffi.Pointer<ffi.Pointer<NativePersistedSamplesStruct>>,
+        )
+      >();
+
+  // ignore: non_constant_identifier_names
+  void FreePersistedSamples(ffi.Pointer<NativePersistedSamplesStruct> samples) {
+    return _FreePersistedSamples(samples);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _FreePersistedSamplesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Void Function(ffi.Pointer<NativePersistedSamplesStruct>)
+        >
+      >('FreePersistedSamples');
+  // ignore: non_constant_identifier_names
+  late final _FreePersistedSamples = _FreePersistedSamplesPtr
+      .asFunction<void Function(ffi.Pointer<NativePersistedSamplesStruct>)>();
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> ExportNativeSamplerProfile(
+    int startTimestamp,
+    int endTimestamp,
+    int format,
+    ffi.Pointer<ffi.Pointer<ffi.Uint8>> out,
+    ffi.Pointer<ffi.Size> outSize,
+  ) {
+    return _ExportNativeSamplerProfile(
+      startTimestamp,
+      endTimestamp,
+      format,
+      out,
+      outSize,
+    );
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _ExportNativeSamplerProfilePtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Pointer<Utf8> Function(
+            ffi.Int64,
+            ffi.Int64,
+            ffi.Int32,
+            ffi.Pointer<ffi.Pointer<ffi.Uint8>>,
+            ffi.Pointer<ffi.Size>,
+          )
+        >
+      >('ExportNativeSamplerProfile');
+  // ignore: non_constant_identifier_names
+  late final _ExportNativeSamplerProfile = _ExportNativeSamplerProfilePtr
+      .asFunction<
+        ffi.Pointer<Utf8> Function(
+          int,
+          int,
+          int,
+          ffi.Pointer<ffi.Pointer<ffi.Uint8>>,
+          ffi.Pointer<ffi.Size>,
+        )
+      >();
+
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerBurst(
+    int burstRateInMicros,
+    int burstDurationInMicros,
+    int frameBudgetInMicros,
+  ) {
+    return _SetNativeSamplerBurst(
+      burstRateInMicros,
+      burstDurationInMicros,
+      frameBudgetInMicros,
+    );
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerBurstPtr =
+      _lookup<
+        ffi.NativeFunction<ffi.Void Function(ffi.Int64, ffi.Int64, ffi.Int64)>
+      >('SetNativeSamplerBurst');
+  // ignore: non_constant_identifier_names
+  late final _SetNativeSamplerBurst = _SetNativeSamplerBurstPtr
+      .asFunction<void Function(int, int, int)>();
+
+  // ignore: non_constant_identifier_names
+  void RequestNativeSamplerBurst() {
+    return _RequestNativeSamplerBurst();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _RequestNativeSamplerBurstPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>(
+        'RequestNativeSamplerBurst',
+      );
+  // ignore: non_constant_identifier_names
+  late final _RequestNativeSamplerBurst = _RequestNativeSamplerBurstPtr
+      .asFunction<void Function()>(isLeaf: true);
+
+  // ignore: non_constant_identifier_names
+  void SetFramePhase(int phase, int frameNumber) {
+    return _SetFramePhase(phase, frameNumber);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _SetFramePhasePtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function(ffi.Int32, ffi.Int64)>>(
+        'SetFramePhase',
+      );
+  // ignore: non_constant_identifier_names
+  late final _SetFramePhase = _SetFramePhasePtr
+      .asFunction<void Function(int, int)>(isLeaf: true);
+
+  // ignore: non_constant_identifier_names
+  void MarkFrameBegin() {
+    return _MarkFrameBegin();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _MarkFrameBeginPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>('MarkFrameBegin');
+  // ignore: non_constant_identifier_names
+  late final _MarkFrameBegin = _MarkFrameBeginPtr.asFunction<void Function()>(
+    isLeaf: true,
+  );
+
+  // ignore: non_constant_identifier_names
+  void MarkFrameEnd() {
+    return _MarkFrameEnd();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _MarkFrameEndPtr = _lookup<ffi.NativeFunction<ffi.Void Function()>>(
+    'MarkFrameEnd',
+  );
+  // ignore: non_constant_identifier_names
+  late final _MarkFrameEnd = _MarkFrameEndPtr.asFunction<void Function()>(
+    isLeaf: true,
+  );
+
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> StartWatchdog(int timeoutInMicros) {
+    return _StartWatchdog(timeoutInMicros);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _StartWatchdogPtr =
+      _lookup<ffi.NativeFunction<ffi.Pointer<Utf8> Function(ffi.Int64)>>(
+        'StartWatchdog',
+      );
+  // ignore: non_constant_identifier_names
+  late final _StartWatchdog = _StartWatchdogPtr
+      .asFunction<ffi.Pointer<Utf8> Function(int)>();
+
+  // ignore: non_constant_identifier_names
+  void StopWatchdog() {
+    return _StopWatchdog();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _StopWatchdogPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>('StopWatchdog');
+  // ignore: non_constant_identifier_names
+  late final _StopWatchdog = _StopWatchdogPtr.asFunction<void Function()>();
+
+  // ignore: non_constant_identifier_names
+  int TakeWatchdogReport(ffi.Pointer<NativeWatchdogReportStruct> out) {
+    return _TakeWatchdogReport(out);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _TakeWatchdogReportPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Int32 Function(ffi.Pointer<NativeWatchdogReportStruct>)
+        >
+      >('TakeWatchdogReport');
+  // ignore: non_constant_identifier_names
+  late final _TakeWatchdogReport = _TakeWatchdogReportPtr
+      .asFunction<int Function(ffi.Pointer<NativeWatchdogReportStruct>)>();
+
+  // ignore: non_constant_identifier_names
+  void MarkUiTaskBegin() {
+    return _MarkUiTaskBegin();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _MarkUiTaskBeginPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>('MarkUiTaskBegin');
+  // ignore: non_constant_identifier_names
+  late final _MarkUiTaskBegin = _MarkUiTaskBeginPtr.asFunction<void Function()>(
+    isLeaf: true,
+  );
+
+  // ignore: non_constant_identifier_names
+  void MarkUiTaskEnd() {
+    return _MarkUiTaskEnd();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _MarkUiTaskEndPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>('MarkUiTaskEnd');
+  // ignore: non_constant_identifier_names
+  late final _MarkUiTaskEnd = _MarkUiTaskEndPtr.asFunction<void Function()>(
+    isLeaf: true,
+  );
+
+  // ignore: non_constant_identifier_names
+  void StopNativeSampler() {
+    return _StopNativeSampler();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _StopNativeSamplerPtr =
+      _lookup<ffi.NativeFunction<ffi.Void Function()>>('StopNativeSampler');
+  // ignore: non_constant_identifier_names
+  late final _StopNativeSampler = _StopNativeSamplerPtr
+      .asFunction<void Function()>();
+
+  // ignore: non_constant_identifier_names
+  int GetNativeSamplerCapacity() {
+    return _GetNativeSamplerCapacity();
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _GetNativeSamplerCapacityPtr =
+      _lookup<ffi.NativeFunction<ffi.Size Function()>>(
+        'GetNativeSamplerCapacity',
+      );
+  // ignore: non_constant_identifier_names
+  late final _GetNativeSamplerCapacity = _GetNativeSamplerCapacityPtr
+      .asFunction<int Function()>();
+
+  // ignore: non_constant_identifier_names
+  int ReadNativeSamples(
+    int start,
+    int end,
+    ffi.Pointer<NativeSampleStruct> out,
+    int maxCount,
+  ) {
+    return _ReadNativeSamples(start, end, out, maxCount);
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _ReadNativeSamplesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Size Function(
+            ffi.Int64,
+            ffi.Int64,
+            ffi.Pointer<NativeSampleStruct>,
+            ffi.Size,
+          )
+        >
+      >('ReadNativeSamples');
+  // ignore: non_constant_identifier_names
+  late final _ReadNativeSamples = _ReadNativeSamplesPtr
+      .asFunction<
+        int Function(int, int, ffi.Pointer<NativeSampleStruct>, int)
+      >();
+
+  // ignore: non_constant_identifier_names
+  int AggregateNativeSamples(
+    int start,
+    int end,
+    int occurTimesThreshold,
+    ffi.Pointer<NativeAggregatedFrameStruct> out,
+    int maxCount,
+  ) {
+    return _AggregateNativeSamples(
+      start,
+      end,
+      occurTimesThreshold,
+      out,
+      maxCount,
+    );
+  }
+
+  // ignore: non_constant_identifier_names
+  late final _AggregateNativeSamplesPtr =
+      _lookup<
+        ffi.NativeFunction<
+          ffi.Size Function(
+            ffi.Int64,
+            ffi.Int64,
+            ffi.Int64,
+            ffi.Pointer<NativeAggregatedFrameStruct>,
+            ffi.Size,
+          )
+        >
+      >('AggregateNativeSamples');
+  // ignore: non_constant_identifier_names
+  late final _AggregateNativeSamples = _AggregateNativeSamplesPtr
+      .asFunction<
+        int Function(
+          int,
+          int,
+          int,
+          ffi.Pointer<NativeAggregatedFrameStruct>,
+          int,
+        )
+      >();
+}
+
+class NativeFrame {
+  final NativeModule? module;
+  final int pc;
+  final int timestamp;
+  NativeFrame({this.module, required this.pc, required this.timestamp});
+
+  @override
+  bool operator ==(Object other) {
+    if (identical(this, other)) return true;
+    if (runtimeType != other.runtimeType) return false;
+    return other is NativeFrame &&
+        module == other.module &&
+        pc == other.pc &&
+        timestamp == other.timestamp;
+  }
+
+  @override
+  int get hashCode => Object.hash(module, pc, timestamp);
+}
+
+class NativeModule {
+  final int id;
+  final String path;
+  final int baseAddress;
+  final String symbolName;
+  NativeModule({
+    required this.id,
+    required this.path,
+    required this.baseAddress,
+    required this.symbolName,
+  });
+
+  @override
+  bool operator ==(Object other) {
+    if (identical(this, other)) return true;
+    if (runtimeType != other.runtimeType) return false;
+    return other is NativeModule &&
+        id == other.id &&
+        path == other.path &&
+        baseAddress == other.baseAddress &&
+        symbolName == other.symbolName;
+  }
+
+  @override
+  int get hashCode => Object.hash(id, path, baseAddress, symbolName);
+}
+
+class NativeStack {
+  final List<NativeFrame> frames;
+  final List<NativeModule> modules;
+
+  /// Whether the stack is sampled on the CPU time of the thread instead of the
+  /// wall clock, i.e., the thread was running on a CPU, see
+  /// [StackCapturer.setNativeSamplerCpuTimeSampleRate].
+  final bool isCpuTick;
+
+  /// The number of the syscall the thread was in when sampled, or [kNoSyscall]
+  /// if it was not in one, it can't be told from the registers, or the
+  /// scheduling state is not read, see
+  /// [StackCapturer.setNativeSamplerSchedStateEnabled] and
+  /// [StackCapturer.getSyscallName].
+  final int syscall;
+
+  /// The run state of the thread when sampled, the character code of the
+  /// state in `/proc/<pid>/task/<tid>/stat`, e.g., `R` running, `S` sleeping
+  /// or `D` uninterruptible sleep, or 0 if not read, see
+  /// [StackCapturer.setNativeSamplerSchedStateEnabled].
+  final int runState;
+
+  /// The context switches of the thread since the previous sample that read
+  /// them, so the samples of a time range sum up to its context switches.
+  final int voluntaryContextSwitches;
+
+  final int involuntaryContextSwitches;
+
+  /// The phase of the UI thread and the number of its frame when the stack was
+  /// sampled, see [StackCapturer.setFramePhase]. The [frameNumber] wraps
+  /// around at 32 bits.
+  final FramePhase framePhase;
+
+  final int frameNumber;
+  NativeStack({
+    required this.frames,
+    required this.modules,
+    this.isCpuTick = false,
+    this.syscall = kNoSyscall,
+    this.runState = 0,
+    this.voluntaryContextSwitches = 0,
+    this.involuntaryContextSwitches = 0,
+    this.framePhase = FramePhase.idle,
+    this.frameNumber = 0,
+  });
+}
+
+ffi.DynamicLibrary _loadLib() {
+  const libName = 'glance';
+  if (Platform.isWindows) {
+    return ffi.DynamicLibrary.open('$libName.dll');
+  }
+
+  if (Platform.isAndroid || Platform.isLinux) {
+    return ffi.DynamicLibrary.open('lib$libName.so');
+  }
+
+  return ffi.DynamicLibrary.process();
+}
+
+/// The Dart AOT snapshot image of the process, with the values printed in the
+/// header of [StackTrace.current].
+class DartImageInfo {
+  const DartImageInfo({
+    required this.buildId,
+    required this.isolateDsoBase,
+    required this.vmDsoBase,
+    required this.isolateInstructions,
+    required this.vmInstructions,
+  });
+
+  /// The build id in hex, or empty if the image has no build id.
+  final String buildId;
+  final int isolateDsoBase;
+  final int vmDsoBase;
+  final int isolateInstructions;
+  final int vmInstructions;
+
+  /// Reads the info from the loaded `libapp.so` or `App.framework` natively,
+  /// which is cheaper than formatting and parsing [StackTrace.current]. The
+  /// image is looked up once and cached for the process lifetime. Returns null
+  /// if the image is not loaded, e.g., in JIT mode. For more details, see
+  /// `GetDartImageInfo` in `collect_stack.cc`.
+  static DartImageInfo? load({CollectStackNativeBindings? nativeBindings}) {
+    final bindings = nativeBindings ?? CollectStackNativeBindings(_loadLib());
+    return using((arena) {
+      final out = arena<NativeDartImageInfoStruct>();
+      if (bindings.GetDartImageInfo(out) == 0) {
+        return null;
+      }
+      return DartImageInfo(
+        buildId: out.ref.buildId.toDartString(),
+        isolateDsoBase: out.ref.isolateDsoBase,
+        vmDsoBase: out.ref.vmDsoBase,
+        isolateInstructions: out.ref.isolateInstructions,
+        vmInstructions: out.ref.vmInstructions,
+      );
+    });
+  }
+}
+
+/// Appends the jank reports to the file of [path] in the compact binary format,
+/// see `jank_report.h`. The file is opened on the first [write].
+class JankReportWriter {
+  JankReportWriter(this.path, {CollectStackNativeBindings? nativeBindings})
+    : _nativeBindings =
+          nativeBindings ?? CollectStackNativeBindings(_loadLib());
+
+  final String path;
+
+  final CollectStackNativeBindings _nativeBindings;
+
+  ffi.Pointer<ffi.Void> _writer = ffi.nullptr;
+
+  /// Appends a report of the [frames], the [headerLines] are the header of the
+  /// Dart stack trace, see `DartStackTraceInfo`. The `pathDepth` of a frame is
+  /// `AggregatedNativeFrame.pathDepth`. Returns false if failed.
+  bool write({
+    required String buildId,
+    required int isolateInstructions,
+    required List<String> headerLines,
+    required int timestamp,
+    required List<({NativeFrame frame, int occurTimes, int? pathDepth})> frames,
+  }) {
+    return using((arena) {
+      if (_writer == ffi.nullptr) {
+        final out = arena<ffi.Pointer<ffi.Void>>();
+        final error = _nativeBindings.OpenJankReportWriter(
+          path.toNativeUtf8(allocator: arena),
+          out,
+        );
+        if (!_checkError('OpenJankReportWriter', error)) {
+          return false;
+        }
+        _writer = out.value;
+      }
+
+      final nativeHeaderLines = arena<ffi.Pointer<Utf8>>(headerLines.length);
+      for (int i = 0; i < headerLines.length; ++i) {
+        nativeHeaderLines[i] = headerLines[i].toNativeUtf8(allocator: arena);
+      }
+      final nativeFrames = arena<NativeJankReportFrameStruct>(frames.length);
+      for (int i = 0; i < frames.length; ++i) {
+        final frame = frames[i];
+        nativeFrames[i]
+          ..pc = frame.frame.pc
+          ..occurTimes = frame.occurTimes
+          ..moduleId = frame.frame.module?.id ?? -1
+          ..pathDepth = frame.pathDepth ?? -1;
+      }
+
+      final error = _nativeBindings.WriteJankReport(
+        _writer,
+        buildId.toNativeUtf8(allocator: arena),
+        isolateInstructions,
+        nativeHeaderLines,
+        headerLines.length,
+        timestamp,
+        nativeFrames,
+        frames.length,
+      );
+      return _checkError('WriteJankReport', error);
+    });
+  }
+
+  /// Closes the file, a following [write] opens it again.
+  void close() {
+    if (_writer != ffi.nullptr) {
+      _nativeBindings.CloseJankReportWriter(_writer);
+      _writer = ffi.nullptr;
+    }
+  }
+
+  /// Decodes the jank reports file of [path] to the text of the Glance stack
+  /// traces, which can be passed to `flutter symbolize`. Returns null if failed.
+  static String? decodeFile(
+    String path, {
+    CollectStackNativeBindings? nativeBindings,
+  }) {
+    final bindings = nativeBindings ?? CollectStackNativeBindings(_loadLib());
+    return using((arena) {
+      final out = arena<ffi.Pointer<Utf8>>();
+      final error = bindings.DecodeJankReportFile(
+        path.toNativeUtf8(allocator: arena),
+        out,
+      );
+      if (!_checkError('DecodeJankReportFile', error)) {
+        return null;
+      }
+      final text = out.value.toDartString();
+      malloc.free(out.value);
+      return text;
+    });
+  }
+
+  static bool _checkError(String function, ffi.Pointer<Utf8> error) {
+    if (error == ffi.nullptr) {
+      return true;
+    }
+    final errorString = error.toDartString();
+    malloc.free(error);
+    GlanceLogger.log('error when calling $function: $errorString');
+    return false;
+  }
+}
+
+/// A fingerprint of the jank reports recorded by a [JankDeduper], see
+/// `NativeJankFingerprint`. The timestamps are the ones passed to
+/// [JankDeduper.record].
+typedef JankFingerprint = ({
+  int fingerprint,
+  int count,
+  int repeats,
+  int firstSeen,
+  int lastSeen,
+});
+
+/// Folds the repeats of the same jank report over a session by their
+/// fingerprint, see `jank_dedup.h`. At most [capacity] fingerprints are kept,
+/// the least recently seen one is evicted to make room.
+class JankDeduper {
+  JankDeduper({
+    this.capacity = kMaxJankFingerprints,
+    this.topFrames = kJankFingerprintTopFrames,
+    CollectStackNativeBindings? nativeBindings,
+  }) : _nativeBindings =
+           nativeBindings ?? CollectStackNativeBindings(_loadLib());
+
+  final int capacity;
+
+  final int topFrames;
+
+  final CollectStackNativeBindings _nativeBindings;
+
+  ffi.Pointer<ffi.Void> _deduper = ffi.nullptr;
+
+  /// Fingerprints the report of the [frames] and records it at [timestamp].
+  /// [isNew] is whether the fingerprint is seen for the first time (or again
+  /// after it was evicted), otherwise the report is a repeat to be folded into
+  /// the [takeSummaries]. [evicted] is the fingerprint evicted to make room,
+  /// whose repeats are not summarized anymore. Returns null if failed.
+  ({bool isNew, JankFingerprint fingerprint, JankFingerprint? evicted})?
+  record({
+    required int isolateInstructions,
+    required List<({NativeFrame frame, int occurTimes})> frames,
+    required int timestamp,
+  }) {
+    if (!_ensureCreated()) {
+      return null;
+    }
+
+    return using((arena) {
+      final nativeFrames = arena<NativeJankReportFrameStruct>(frames.length);
+      for (int i = 0; i < frames.length; ++i) {
+        final frame = frames[i];
+        nativeFrames[i]
+          ..pc = frame.frame.pc
+          ..occurTimes = frame.occurTimes
+          ..moduleId = frame.frame.module?.id ?? -1
+          ..pathDepth = -1;
+      }
+      final out = arena<NativeJankFingerprintStruct>();
+      final evicted = arena<NativeJankFingerprintStruct>();
+      final isNew = _nativeBindings.RecordJankReport(
+        _deduper,
+        isolateInstructions,
+        nativeFrames,
+        frames.length,
+        timestamp,
+        out,
+        evicted,
+      );
+      return (
+        isNew: isNew != 0,
+        fingerprint: _toJankFingerprint(out.ref),
+        evicted: evicted.ref.fingerprint != 0
+            ? _toJankFingerprint(evicted.ref)
+            : null,
+      );
+    });
+  }
+
+  /// Takes the fingerprints repeated since they were last reported or taken,
+  /// the most recently seen first, and resets their repeats.
+  List<JankFingerprint> takeSummaries() {
+    if (_deduper == ffi.nullptr) {
+      return const [];
+    }
+
+    return using((arena) {
+      const batchSize = 16;
+      final out = arena<NativeJankFingerprintStruct>(batchSize);
+      final summaries = <JankFingerprint>[];
+      while (true) {
+        final count = _nativeBindings.TakeJankSummaries(
+          _deduper,
+          out,
+          batchSize,
+        );
+        for (int i = 0; i < count; ++i) {
+          summaries.add(_toJankFingerprint(out[i]));
+        }
+        if (count < batchSize) {
+          break;
+        }
+      }
+      return summaries;
+    });
+  }
+
+  /// Drops all the fingerprints, a following [record] starts over.
+  void dispose() {
+    if (_deduper != ffi.nullptr) {
+      _nativeBindings.DestroyJankDeduper(_deduper);
+      _deduper = ffi.nullptr;
+    }
+  }
+
+  bool _ensureCreated() {
+    if (_deduper == ffi.nullptr) {
+      _deduper = _nativeBindings.CreateJankDeduper(capacity, topFrames);
+      if (_deduper == ffi.nullptr) {
+        GlanceLogger.log('error when calling CreateJankDeduper: $capacity');
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static JankFingerprint _toJankFingerprint(NativeJankFingerprintStruct ref) {
+    return (
+      fingerprint: ref.fingerprint,
+      count: ref.count,
+      repeats: ref.repeats,
+      firstSeen: ref.firstSeen,
+      lastSeen: ref.lastSeen,
+    );
+  }
+}
+
+class StackCapturer {
+  StackCapturer({CollectStackNativeBindings? nativeBindings})
+    : _nativeBindings =
+          nativeBindings ?? CollectStackNativeBindings(_loadLib());
+
+  static const _maxStackDepth = kNativeSampleMaxStackDepth;
+
+  /// The maximum number of threads captured by [captureStacksOfAllThreads], keep
+  /// it in sync with the `ThreadRegistry::kMaxThreads` in `thread_registry.h`.
+  static const _maxTargetThreads = 32;
+
+  static const _maxThreadNameLength = 64;
+
+  ffi.Pointer<ffi.Int64>? _capturedStackBuffer;
+
+  ffi.Pointer<NativeFrameInfoStruct>? _frameInfoBuffer;
+
+  ffi.Pointer<NativeSampleStruct>? _nativeSamplesBuffer;
+
+  int _nativeSamplesBufferCount = 0;
+
+  final CollectStackNativeBindings _nativeBindings;
+
+  /// The module infos resolved by the native module map, the module ids are
+  /// stable for the process lifetime.
+  final Map<int, ({String path, int baseAddress})> _moduleInfos = {};
+
+  /// The symbol names interned by the native module map.
+  final Map<int, String> _symbolNames = {};
+
+  /// Set the target capture thread. This only works for the main isolate.
+  void setCurrentThreadAsTarget() {
+    _nativeBindings.SetCurrentThreadAsTarget();
+  }
+
+  /// Refer to the implementation from Flutter Engine, we should use the `Timeline.now`
+  /// as the current timestamp.
+  /// https://github.com/flutter/engine/blob/5d97d2bcdffc8b21bc0b9742f1136583f4cc8e16/runtime/dart_timestamp_provider.cc#L24
+  int _nowInMicrosSinceEpoch() {
+    return Timeline.now;
+  }
+
+  /// Capture the native stack using a signal handler. For more details,
+  /// see `CollectStackTraceOfTargetThread` in `collect_stack.cc`.
+  /// Before calling this function, call [setCurrentThreadAsTarget] first.
+  NativeStack captureStackOfTargetThread() {
+    _capturedStackBuffer ??= malloc.allocate<ffi.Int64>(
+      ffi.sizeOf<ffi.Int64>() * _maxStackDepth,
+    );
+    final error = _nativeBindings.CollectStackTraceOfTargetThread(
+      _capturedStackBuffer!,
+      _maxStackDepth,
+    );
+    if (error != ffi.nullptr) {
+      final errorString = error.toDartString();
+      malloc.free(error);
+      GlanceLogger.log(
+        'error when calling CollectStackTraceOfTargetThread: $errorString',
+      );
       return NativeStack(
-        frames: frames,
-        modules: modules.values.toList(growable: false),
+        frames: [],
+        modules: [],
+      ); // Something went wrong. but just discard info this time.
+    }
+
+    _nativeBindings.RefreshModuleMap();
+    return _toNativeStack(_capturedStackBuffer!, _nowInMicrosSinceEpoch);
+  }
+
+  /// Register the current thread to be captured by [captureStacksOfAllThreads]
+  /// with the [name]. Returns the id of the thread, or -1 on failure. For more
+  /// details, see `RegisterTargetThread` in `thread_registry.cc`.
+  ///
+  /// Note that an isolate may run on different threads over time, the thread
+  /// should be registered from the code pinned to it.
+  int registerCurrentThread(String name) {
+    return using((arena) {
+      return _nativeBindings.RegisterTargetThread(
+        name.toNativeUtf8(allocator: arena),
+      );
+    });
+  }
+
+  /// Unregister the current thread registered by [registerCurrentThread], which
+  /// must be called before the thread exits.
+  void unregisterCurrentThread() {
+    _nativeBindings.UnregisterTargetThread();
+  }
+
+  /// Capture the native stacks of all the registered threads in one pass, e.g.,
+  /// to correlate the jank across the UI thread and the raster thread. For more
+  /// details, see `CollectStackTracesOfAllThreads` in `thread_registry.cc`.
+  List<({int threadId, String threadName, NativeStack stack})>
+  captureStacksOfAllThreads() {
+    return using((arena) {
+      final samples = arena.allocate<NativeThreadSampleStruct>(
+        ffi.sizeOf<NativeThreadSampleStruct>() * _maxTargetThreads,
+      );
+      final name = arena.allocate<Utf8>(_maxThreadNameLength);
+      final count = _nativeBindings.CollectStackTracesOfAllThreads(
+        samples,
+        _maxTargetThreads,
+      );
+
+      _nativeBindings.RefreshModuleMap();
+      final stacks = <({int threadId, String threadName, NativeStack stack})>[];
+      for (int i = 0; i < count; ++i) {
+        final threadId = samples[i].threadId;
+        final threadName =
+            _nativeBindings.GetTargetThreadName(
+                  threadId,
+                  name,
+                  _maxThreadNameLength,
+                ) !=
+                0
+            ? name.toDartString()
+            : '';
+        final timestamp = samples[i].sample.timestamp;
+        // The `pcs` follows the `thread_id` and `error` in `NativeThreadSample`,
+        // and the `timestamp`, `depth`, `kind`, `syscall`, `run_state`, the
+        // switches and the frame phase in `NativeSample`.
+        final pcs = ffi.Pointer<ffi.Int64>.fromAddress(
+          samples.address +
+              i * ffi.sizeOf<NativeThreadSampleStruct>() +
+              2 * ffi.sizeOf<ffi.Int32>() +
+              ffi.sizeOf<ffi.Int64>() +
+              8 * ffi.sizeOf<ffi.Int32>(),
+        );
+        stacks.add((
+          threadId: threadId,
+          threadName: threadName,
+          stack: samples[i].error != 0
+              ? NativeStack(frames: [], modules: [])
+              : _toNativeStack(
+                  pcs,
+                  () => timestamp,
+                  sample: samples[i].sample,
+                ),
+        ));
+      }
+      return stacks;
+    });
+  }
+
+  /// Set the size of the stack copied while the target thread is stopped, the
+  /// stack is walked on the copy after the thread is resumed, so the thread is
+  /// stopped for a shorter time. 0 walks the stack while the thread is stopped.
+  /// For more details, see `SetStackCopySize` in `collect_stack.cc`.
+  void setStackCopySize(int sizeInBytes) {
+    _nativeBindings.SetStackCopySize(sizeInBytes);
+  }
+
+  /// Set whether to fall back to the unwind tables built from `.eh_frame` for
+  /// the frames without frame pointers. The tables of the loaded modules are
+  /// built when it's enabled, which takes a while and some memory.
+  /// For more details, see `SetUnwindTablesEnabled` in `unwind_table.cc`.
+  void setUnwindTablesEnabled(bool enabled) {
+    _nativeBindings.SetUnwindTablesEnabled(enabled ? 1 : 0);
+  }
+
+  /// Set whether the native sampler started afterwards samples the target
+  /// thread with `perf_event_open` instead of the signals, which falls back to
+  /// the signals if it's denied or not supported.
+  /// For more details, see `PerfEventSampler` in `perf_event_sampler.h`.
+  void setNativeSamplerPerfEventsEnabled(bool enabled) {
+    _nativeBindings.SetNativeSamplerPerfEventsEnabled(enabled ? 1 : 0);
+  }
+
+  /// Set the native sampler started afterwards to also sample the target thread
+  /// every [rateInMicros] of its CPU time, the samples of which are read by
+  /// [readNativeSamples] with [NativeStack.isCpuTick], but are not aggregated by
+  /// [aggregateNativeSamples]. 0 disables it. Not supported on iOS.
+  /// For more details, see `SetNativeSamplerCpuTimeSampleRate` in `sampler.h`.
+  void setNativeSamplerCpuTimeSampleRate(int rateInMicros) {
+    _nativeBindings.SetNativeSamplerCpuTimeSampleRate(rateInMicros);
+  }
+
+  /// Set whether the native sampler started by [startNativeSampler] afterwards
+  /// reads the run state and the context switches of the target thread for
+  /// every sample, see [NativeStack.runState], and the syscall it's in, see
+  /// [NativeStack.syscall]. For more details, see
+  /// `SetNativeSamplerSchedStateEnabled` in `sched_state.h`.
+  void setNativeSamplerSchedStateEnabled(bool enabled) {
+    _nativeBindings.SetNativeSamplerSchedStateEnabled(enabled ? 1 : 0);
+  }
+
+  /// Get the name of the syscall of [number] of the platform, e.g., `futex`, or
+  /// `null` if it's not one of the syscalls that mostly block, see
+  /// [NativeStack.syscall].
+  String? getSyscallName(int number) {
+    if (number == kNoSyscall) {
+      return null;
+    }
+    final name = _nativeBindings.GetSyscallName(number);
+    return name == ffi.nullptr ? null : name.toDartString();
+  }
+
+  /// Get the self-overhead of capturing the stacks since the process started.
+  /// For more details, see `GetSamplerStats` in `sampler_stats.cc`.
+  SamplerStats getSamplerStats() {
+    return using((arena) {
+      final stats = arena<NativeSamplerStatsStruct>();
+      _nativeBindings.GetSamplerStats(stats);
+      return SamplerStats(
+        samplesAttempted: stats.ref.samplesAttempted,
+        samplesSucceeded: stats.ref.samplesSucceeded,
+        samplesTimedOut: stats.ref.samplesTimedOut,
+        samplesFailed: stats.ref.samplesFailed,
+        framesTruncated: stats.ref.framesTruncated,
+        signalDeliveryInNanoseconds: _toSamplerHistogram(
+          stats.ref.signalDeliveryInNanos,
+        ),
+        targetPauseInNanoseconds: _toSamplerHistogram(
+          stats.ref.targetPauseInNanos,
+        ),
+        walkDepth: _toSamplerHistogram(stats.ref.walkDepth),
+      );
+    });
+  }
+
+  SamplerHistogram _toSamplerHistogram(NativeHistogramStruct histogram) {
+    return SamplerHistogram(
+      count: histogram.count,
+      sum: histogram.sum,
+      max: histogram.max,
+      buckets: List.generate(
+        kNativeHistogramBucketCount,
+        (i) => histogram.buckets[i],
+        growable: false,
+      ),
+    );
+  }
+
+  /// Set how long capturing the stack waits for the target thread to be sampled,
+  /// a capture that times out is dropped. For more details, see
+  /// `SetCollectStackTimeout` in `collect_stack.cc`.
+  void setCollectStackTimeout(int timeoutInMicros) {
+    _nativeBindings.SetCollectStackTimeout(timeoutInMicros);
+  }
+
+  /// Set the module path filters, only the frames of the modules whose paths
+  /// match one of the [modulePathFilters] (e.g., `kAndroidDefaultModulePathFilters`)
+  /// are resolved. For more details, see `SetModulePathFilters` in `module_map.cc`.
+  void setModulePathFilters(List<String> modulePathFilters) {
+    if (modulePathFilters.isEmpty) {
+      _nativeBindings.SetModulePathFilters(ffi.nullptr, 0);
+      return;
+    }
+
+    using((arena) {
+      final patterns = arena.allocate<ffi.Pointer<Utf8>>(
+        ffi.sizeOf<ffi.Pointer<Utf8>>() * modulePathFilters.length,
+      );
+      for (int i = 0; i < modulePathFilters.length; ++i) {
+        patterns[i] = modulePathFilters[i].toNativeUtf8(allocator: arena);
+      }
+      _nativeBindings.SetModulePathFilters(patterns, modulePathFilters.length);
+    });
+  }
+
+  /// Start sampling the target thread every [sampleRateInMicros] on a native
+  /// thread, which keeps the samples of the latest [windowInMicros] that fit in
+  /// [memoryBudgetInBytes]. For more details, see `StartNativeSampler` in `sampler.cc`.
+  /// Before calling this function, call [setCurrentThreadAsTarget] first.
+  ///
+  /// Returns `false` if the native sampler can not be started.
+  bool startNativeSampler(
+    int sampleRateInMicros,
+    int windowInMicros,
+    int memoryBudgetInBytes,
+  ) {
+    final error = _nativeBindings.StartNativeSampler(
+      sampleRateInMicros,
+      windowInMicros,
+      memoryBudgetInBytes,
+    );
+    if (error != ffi.nullptr) {
+      final errorString = error.toDartString();
+      malloc.free(error);
+      GlanceLogger.log('error when calling StartNativeSampler: $errorString');
+      return false;
+    }
+
+    // Allocate the buffer for reading the samples once, so reading the samples
+    // doesn't allocate the native memory every time.
+    _freeNativeSamplesBuffer();
+    _nativeSamplesBufferCount = _nativeBindings.GetNativeSamplerCapacity();
+    _nativeSamplesBuffer = malloc.allocate<NativeSampleStruct>(
+      ffi.sizeOf<NativeSampleStruct>() * _nativeSamplesBufferCount,
+    );
+
+    return true;
+  }
+
+  /// Keep the samples of the native sampler started afterwards in a file mapped
+  /// into memory at [path], so they survive a crash or the process being killed
+  /// and can be loaded by [loadPersistedSamples] on the next launch. The
+  /// [isolateInstructions] and [headerLines] of the Dart stack trace are stored
+  /// with the samples. A `null` [path] keeps the samples in memory. For more
+  /// details, see `SetNativeSamplerPersistentFile` in `sampler.cc`.
+  void setNativeSamplerPersistentFile(
+    String? path,
+    int isolateInstructions,
+    List<String> headerLines,
+  ) {
+    using((arena) {
+      final nativeHeaderLines = arena<ffi.Pointer<Utf8>>(headerLines.length);
+      for (int i = 0; i < headerLines.length; ++i) {
+        nativeHeaderLines[i] = headerLines[i].toNativeUtf8(allocator: arena);
+      }
+      _nativeBindings.SetNativeSamplerPersistentFile(
+        path?.toNativeUtf8(allocator: arena) ?? ffi.nullptr,
+        isolateInstructions,
+        nativeHeaderLines,
+        headerLines.length,
+      );
+    });
+  }
+
+  /// Load the samples persisted at [path] by the native sampler of a previous
+  /// run (see [setNativeSamplerPersistentFile]), only the samples within
+  /// [windowInMicros] before the newest one are loaded, and the [stacks] are in
+  /// order of oldest to newest. The pcs are resolved against the modules of the
+  /// previous run. Returns `null` if there is no valid file. For more details,
+  /// see `LoadPersistedSamples` in `persistent_samples.cc`.
+  ({
+    bool cleanShutdown,
+    int isolateInstructions,
+    List<String> headerLines,
+    List<NativeStack> stacks,
+  })?
+  loadPersistedSamples(String path, int windowInMicros) {
+    return using((arena) {
+      final out = arena<ffi.Pointer<NativePersistedSamplesStruct>>();
+      final error = _nativeBindings.LoadPersistedSamples(
+        path.toNativeUtf8(allocator: arena),
+        windowInMicros,
+        out,
+      );
+      if (error != ffi.nullptr) {
+        final errorString = error.toDartString();
+        malloc.free(error);
+        GlanceLogger.log(
+          'error when calling LoadPersistedSamples: $errorString',
+        );
+        return null;
+      }
+
+      final persisted = out.value.ref;
+      // Sorted by the start addresses, the ids are the indexes in the file.
+      final modules = <({int start, int end, NativeModule module})>[];
+      for (int i = 0; i < persisted.moduleCount; ++i) {
+        final moduleInfo = persisted.modules[i];
+        modules.add((
+          start: moduleInfo.startAddress,
+          end: moduleInfo.endAddress,
+          module: NativeModule(
+            id: i,
+            path: moduleInfo.path.toDartString(),
+            baseAddress: moduleInfo.baseAddress,
+            symbolName: '',
+          ),
+        ));
+      }
+
+      final stacks = <NativeStack>[];
+      for (int i = 0; i < persisted.sampleCount; ++i) {
+        final sample = persisted.samples[i];
+        final timestamp = sample.timestamp;
+        final stackModules = <int, NativeModule>{};
+        final frames = List<NativeFrame>.generate(sample.depth, (j) {
+          final pc = sample.pcs[j];
+          final module = _findPersistedModule(modules, pc);
+          if (module != null) {
+            stackModules[module.id] = module;
+          }
+          return NativeFrame(module: module, pc: pc, timestamp: timestamp);
+        }, growable: false);
+        stacks.add(
+          NativeStack(
+            frames: frames,
+            modules: stackModules.values.toList(growable: false),
+            isCpuTick: sample.kind == kNativeSampleKindCpu,
+            syscall: sample.syscall,
+            runState: sample.runState,
+            voluntaryContextSwitches: sample.voluntarySwitches,
+            involuntaryContextSwitches: sample.involuntarySwitches,
+            framePhase: FramePhase.fromIndex(sample.framePhase),
+            frameNumber: sample.frameNumber,
+          ),
+        );
+      }
+
+      final header = persisted.header.toDartString();
+      final result = (
+        cleanShutdown: persisted.cleanShutdown != 0,
+        isolateInstructions: persisted.isolateInstructions,
+        headerLines: header.isEmpty ? <String>[] : header.split('\n'),
+        stacks: stacks,
+      );
+      _nativeBindings.FreePersistedSamples(out.value);
+      return result;
+    });
+  }
+
+  static NativeModule? _findPersistedModule(
+    List<({int start, int end, NativeModule module})> modules,
+    int pc,
+  ) {
+    // Find the last module that starts at or before the pc.
+    int low = 0;
+    int high = modules.length;
+    while (low < high) {
+      final middle = (low + high) >> 1;
+      if (modules[middle].start <= pc) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    if (low == 0 || pc >= modules[low - 1].end) {
+      return null;
+    }
+    return modules[low - 1].module;
+  }
+
+  /// Export the samples of the native sampler within [timestampRange] (see
+  /// [readNativeSamples]) in [format], which keeps the call stacks lost by
+  /// aggregating the frames. Returns `null` if the native sampler is not
+  /// started. For more details, see `ExportNativeSamplerProfile` in
+  /// `sampler.cc`.
+  Uint8List? exportNativeSamplerProfile(
+    ProfileFormat format,
+    List<int> timestampRange,
+  ) {
+    return using((arena) {
+      final out = arena<ffi.Pointer<ffi.Uint8>>();
+      final outSize = arena<ffi.Size>();
+      final error = _nativeBindings.ExportNativeSamplerProfile(
+        timestampRange[0],
+        timestampRange[1],
+        format.index,
+        out,
+        outSize,
+      );
+      if (error != ffi.nullptr) {
+        final errorString = error.toDartString();
+        malloc.free(error);
+        GlanceLogger.log(
+          'error when calling ExportNativeSamplerProfile: $errorString',
+        );
+        return null;
+      }
+
+      final profile = Uint8List.fromList(out.value.asTypedList(outSize.value));
+      malloc.free(out.value);
+      return profile;
+    });
+  }
+
+  /// Enable the adaptive sample rate of the native sampler, which samples every
+  /// [burstRateInMicros] for [burstDurationInMicros] once a burst is requested
+  /// by [requestNativeSamplerBurst], or a frame marked by [markFrameBegin] runs
+  /// longer than [frameBudgetInMicros]. 0 [burstRateInMicros] disables it. For
+  /// more details, see `SetNativeSamplerBurst` in `sampler.cc`.
+  void setNativeSamplerBurst(
+    int burstRateInMicros,
+    int burstDurationInMicros,
+    int frameBudgetInMicros,
+  ) {
+    _nativeBindings.SetNativeSamplerBurst(
+      burstRateInMicros,
+      burstDurationInMicros,
+      frameBudgetInMicros,
+    );
+  }
+
+  /// Request a burst of the high rate sampling, see [setNativeSamplerBurst].
+  /// This is a cheap native call, which can be called on the UI thread.
+  void requestNativeSamplerBurst() {
+    _nativeBindings.RequestNativeSamplerBurst();
+  }
+
+  /// Mark the beginning of a frame, see [setNativeSamplerBurst]. This is a cheap
+  /// native call, which can be called on the UI thread for every frame.
+  void markFrameBegin() {
+    _nativeBindings.MarkFrameBegin();
+  }
+
+  /// Mark the end of the frame marked by [markFrameBegin].
+  void markFrameEnd() {
+    _nativeBindings.MarkFrameEnd();
+  }
+
+  /// Set the phase of the UI thread and the number of its frame, which are
+  /// recorded with every sample taken until the next call, see
+  /// [NativeStack.framePhase]. This is a leaf call of a single store, cheap
+  /// enough to be called on every phase change. For more details, see
+  /// `SetFramePhase` in `collect_stack.h`.
+  void setFramePhase(FramePhase phase, int frameNumber) {
+    _nativeBindings.SetFramePhase(phase.index, frameNumber);
+  }
+
+  /// Start watching the UI thread on a native thread, which reports a task
+  /// marked by [markUiTaskBegin] and [markUiTaskEnd] that runs longer than
+  /// [timeoutInMicros] while it's still running, see [takeWatchdogReports].
+  /// For more details, see `StartWatchdog` in `watchdog.h`. Before calling this
+  /// function, call [setCurrentThreadAsTarget] first.
+  ///
+  /// Returns `false` if the watchdog can not be started.
+  bool startWatchdog(int timeoutInMicros) {
+    final error = _nativeBindings.StartWatchdog(timeoutInMicros);
+    if (error != ffi.nullptr) {
+      final errorString = error.toDartString();
+      malloc.free(error);
+      GlanceLogger.log('error when calling StartWatchdog: $errorString');
+      return false;
+    }
+
+    return true;
+  }
+
+  /// Stop the watchdog started by [startWatchdog].
+  void stopWatchdog() {
+    _nativeBindings.StopWatchdog();
+  }
+
+  /// Take the reports of the watchdog not taken yet, in order of oldest to
+  /// newest. The reports of a freeze have the same `freezeId`, and the [NativeStack]
+  /// is empty if the stack of the UI thread could not be collected.
+  List<
+    ({int freezeId, int frozenInMicros, int reportIndex, NativeStack stack})
+  >
+  takeWatchdogReports() {
+    return using((arena) {
+      final report = arena.allocate<NativeWatchdogReportStruct>(
+        ffi.sizeOf<NativeWatchdogReportStruct>(),
+      );
+      // The `pcs` follows the `freeze_id`, `frozen_in_micros`, `error` and
+      // `report_index` in `NativeWatchdogReport`, and the `timestamp`, `depth`,
+      // `kind`, `syscall`, `run_state`, the switches and the frame phase in
+      // `NativeSample`.
+      final pcs = ffi.Pointer<ffi.Int64>.fromAddress(
+        report.address +
+            2 * ffi.sizeOf<ffi.Int64>() +
+            2 * ffi.sizeOf<ffi.Int32>() +
+            ffi.sizeOf<ffi.Int64>() +
+            8 * ffi.sizeOf<ffi.Int32>(),
+      );
+
+      final reports =
+          <
+            ({
+              int freezeId,
+              int frozenInMicros,
+              int reportIndex,
+              NativeStack stack,
+            })
+          >[];
+      bool isModuleMapRefreshed = false;
+      while (_nativeBindings.TakeWatchdogReport(report) != 0) {
+        if (!isModuleMapRefreshed) {
+          _nativeBindings.RefreshModuleMap();
+          isModuleMapRefreshed = true;
+        }
+        final timestamp = report.ref.sample.timestamp;
+        reports.add((
+          freezeId: report.ref.freezeId,
+          frozenInMicros: report.ref.frozenInMicros,
+          reportIndex: report.ref.reportIndex,
+          stack: report.ref.error != 0
+              ? NativeStack(frames: [], modules: [])
+              : _toNativeStack(
+                  pcs,
+                  () => timestamp,
+                  sample: report.ref.sample,
+                ),
+        ));
+      }
+      return reports;
+    });
+  }
+
+  /// Mark the beginning of a task on the UI thread (e.g., a frame, or a handler
+  /// of an event), see [startWatchdog]. This is a cheap native call, which can
+  /// be called on the UI thread for every task.
+  void markUiTaskBegin() {
+    _nativeBindings.MarkUiTaskBegin();
+  }
+
+  /// Mark the end of the task marked by [markUiTaskBegin].
+  void markUiTaskEnd() {
+    _nativeBindings.MarkUiTaskEnd();
+  }
+
+  /// Stop the native sampler started by [startNativeSampler].
+  void stopNativeSampler() {
+    _nativeBindings.StopNativeSampler();
+    _freeNativeSamplesBuffer();
+  }
+
+  /// Read the [NativeStack]s collected by the native sampler within the
+  /// [timestampRange], in order of newest to oldest.
+  List<NativeStack> readNativeSamples(List<int> timestampRange) {
+    final samples = _nativeSamplesBuffer;
+    if (samples == null) {
+      return [];
+    }
+
+    final count = _nativeBindings.ReadNativeSamples(
+      timestampRange[0],
+      timestampRange[1],
+      samples,
+      _nativeSamplesBufferCount,
+    );
+
+    _nativeBindings.RefreshModuleMap();
+    final stacks = <NativeStack>[];
+    for (int i = count - 1; i >= 0; --i) {
+      final timestamp = samples[i].timestamp;
+      // The `pcs` follows the `timestamp`, `depth`, `kind`, `syscall`,
+      // `run_state`, the switches and the frame phase in `NativeSample`.
+      final pcs = ffi.Pointer<ffi.Int64>.fromAddress(
+        samples.address +
+            i * ffi.sizeOf<NativeSampleStruct>() +
+            ffi.sizeOf<ffi.Int64>() +
+            8 * ffi.sizeOf<ffi.Int32>(),
+      );
+      stacks.add(_toNativeStack(pcs, () => timestamp, sample: samples[i]));
+    }
+    return stacks;
+  }
+
+  /// Aggregate the frames collected by the native sampler within the [timestampRange]
+  /// by occurrence times, at most [maxCount] frames that occur more than
+  /// [occurTimesThreshold] are returned. For more details, see `AggregateNativeSamples`
+  /// in `sampler.cc`.
+  List<({NativeFrame frame, int occurTimes})> aggregateNativeSamples(
+    List<int> timestampRange,
+    int occurTimesThreshold,
+    int maxCount,
+  ) {
+    return using((arena) {
+      final out = arena.allocate<NativeAggregatedFrameStruct>(
+        ffi.sizeOf<NativeAggregatedFrameStruct>() * maxCount,
+      );
+      final count = _nativeBindings.AggregateNativeSamples(
+        timestampRange[0],
+        timestampRange[1],
+        occurTimesThreshold,
+        out,
+        maxCount,
+      );
+
+      final modules = <int, NativeModule>{};
+      final frames = <({NativeFrame frame, int occurTimes})>[];
+      for (int i = 0; i < count; ++i) {
+        final aggregatedFrame = out[i];
+        final moduleId = aggregatedFrame.moduleId;
+        final moduleInfo = _getModuleInfo(moduleId);
+        final module = moduleInfo == null
+            ? null
+            : modules[moduleId] ??= NativeModule(
+                id: moduleId,
+                path: moduleInfo.path,
+                baseAddress: moduleInfo.baseAddress,
+                symbolName: _getSymbolName(aggregatedFrame.symbolId),
+              );
+        frames.add((
+          frame: NativeFrame(
+            module: module,
+            pc: aggregatedFrame.pc,
+            timestamp: aggregatedFrame.timestamp,
+          ),
+          occurTimes: aggregatedFrame.occurTimes,
+        ));
+      }
+      return frames;
+    });
+  }
+
+  void _freeNativeSamplesBuffer() {
+    if (_nativeSamplesBuffer != null) {
+      malloc.free(_nativeSamplesBuffer!);
+      _nativeSamplesBuffer = null;
+      _nativeSamplesBufferCount = 0;
+    }
+  }
+
+  /// Process stack trace: which is a sequence of pcs terminated with 0. Resolve
+  /// the modules and symbol names of all the frames in one call to the native
+  /// module map, see `ResolveNativeFrames` in `module_map.cc`. The module map is
+  /// refreshed by `RefreshModuleMap` once per batch of stacks before.
+  NativeStack _toNativeStack(
+    ffi.Pointer<ffi.Int64> pcs,
+    int Function() timestamp, {
+    NativeSampleStruct? sample,
+  }) {
+    int depth = 0;
+    while (depth < _maxStackDepth && pcs[depth] != 0) {
+      ++depth;
+    }
+
+    final frameInfos = _frameInfoBuffer ??= malloc
+        .allocate<NativeFrameInfoStruct>(
+          ffi.sizeOf<NativeFrameInfoStruct>() * _maxStackDepth,
+        );
+    _nativeBindings.ResolveNativeFrames(pcs, depth, frameInfos);
+
+    final modules = <int, NativeModule>{};
+    final frames = List<NativeFrame>.generate(depth, (i) {
+      final addr = pcs[i];
+      final frameInfo = frameInfos[i];
+      final moduleId = frameInfo.moduleId;
+      final moduleInfo = _getModuleInfo(moduleId);
+      if (moduleInfo == null) {
+        return NativeFrame(pc: addr, timestamp: timestamp());
+      }
+
+      final module = modules[moduleId] ??= NativeModule(
+        id: moduleId,
+        path: moduleInfo.path,
+        baseAddress: moduleInfo.baseAddress,
+        symbolName: _getSymbolName(frameInfo.symbolId),
+      );
+
+      return NativeFrame(module: module, pc: addr, timestamp: timestamp());
+    }, growable: false);
+
+    return NativeStack(
+      frames: frames,
+      modules: modules.values.toList(growable: false),
+      isCpuTick: sample?.kind == kNativeSampleKindCpu,
+      syscall: sample?.syscall ?? kNoSyscall,
+      runState: sample?.runState ?? 0,
+      voluntaryContextSwitches: sample?.voluntarySwitches ?? 0,
+      involuntaryContextSwitches: sample?.involuntarySwitches ?? 0,
+      framePhase: FramePhase.fromIndex(sample?.framePhase ?? 0),
+      frameNumber: sample?.frameNumber ?? 0,
+    );
+  }
+
+  ({String path, int baseAddress})? _getModuleInfo(int moduleId) {
+    if (moduleId < 0) {
+      return null;
+    }
+
+    final moduleInfo = _moduleInfos[moduleId];
+    if (moduleInfo != null) {
+      return moduleInfo;
+    }
+
+    return using((arena) {
+      final out = arena.allocate<NativeModuleInfoStruct>(
+        ffi.sizeOf<NativeModuleInfoStruct>(),
+      );
+      if (_nativeBindings.GetNativeModule(moduleId, out) == 0) {
+        return null;
+      }
+
+      return _moduleInfos[moduleId] = (
+        path: out.ref.path.toDartString(),
+        baseAddress: out.ref.baseAddress,
       );
     });
   }
 
+  String _getSymbolName(int symbolId) {
+    if (symbolId < 0) {
+      return '';
+    }
+
+    return _symbolNames[symbolId] ??= () {
+      // The interned symbol name is owned by the native module map, do not free it.
+      final sn = _nativeBindings.GetInternedSymbolName(symbolId);
+      return sn != ffi.nullptr ? sn.toDartString() : '';
+    }();
+  }
+
   void dispose() {
     if (_capturedStackBuffer != null) {
       malloc.free(_capturedStackBuffer!);
       _capturedStackBuffer = null;
     }
+    if (_frameInfoBuffer != null) {
+      malloc.free(_frameInfoBuffer!);
+      _frameInfoBuffer = null;
+    }
+    _freeNativeSamplesBuffer();
   }
 }
@@ -4,10 +4,45 @@ const int kDefaultJankThreshold = 16;
 /// The default sample rate for measuring performance in milliseconds.
 const int kDefaultSampleRateInMilliseconds = 10;
 
+/// The default time window in milliseconds of the samples kept by the native sampler.
+const int kDefaultSamplesWindowInMilliseconds = 6000;
+
+/// The default memory budget in bytes of the samples kept by the native sampler.
+const int kDefaultSamplesMemoryBudgetInBytes = 1024 * 1024;
+
+/// The default sample rate in microseconds of the bursts of the adaptive sample rate.
+const int kDefaultBurstSampleRateInMicroseconds = 1000;
+
+/// The default duration in milliseconds of the bursts of the adaptive sample rate.
+const int kDefaultBurstDurationInMilliseconds = 500;
+
+/// The default time window in milliseconds of the samples recovered from a
+/// previous run that did not shut down cleanly.
+const int kDefaultRecoveredSamplesWindowInMilliseconds = 5000;
+
+/// The default timeout in microseconds of capturing the stack of the target thread.
+const int kDefaultCollectStackTimeoutInMicroseconds = 50000;
+
 /// Limits the maximum number of stack traces to 99. Any stack traces exceeding
 /// `kMaxStackTraces` will be dropped.
 const int kMaxStackTraces = 99;
 
+/// Limits the number of call paths reported by `StackAggregation.callingContextTree`,
+/// the frames of the paths are still limited by `kMaxStackTraces`.
+const int kMaxHeaviestPaths = 5;
+
+/// Limits the number of the fingerprints of the jank reports kept for folding
+/// their repeats, see `GlanceConfiguration.dedupJankReports`. The least
+/// recently seen one is evicted once it's full.
+const int kMaxJankFingerprints = 256;
+
+/// The number of the heaviest frames of a jank report that make up its fingerprint.
+const int kJankFingerprintTopFrames = 8;
+
+/// The default interval in milliseconds of the summaries of the repeated jank
+/// reports, see `GlanceConfiguration.dedupJankReports`.
+const int kDefaultJankSummaryIntervalInMilliseconds = 60000;
+
 /// Default filters for filtering module paths for Android.
 /// This filter only includes `libflutter.so` and `libapp.so` by default.
 const kAndroidDefaultModulePathFilters = <String>[
@@ -22,6 +57,13 @@ const kIOSDefaultModulePathFilters = <String>[
   r'(.*)Flutter.framework(.*)',
 ];
 
+/// Default filters for filtering module paths for Linux desktop.
+/// This filter only includes `libflutter_linux_gtk.so` and `libapp.so` by default.
+const kLinuxDefaultModulePathFilters = <String>[
+  r'(.*)libflutter_linux_gtk.so',
+  r'(.*)libapp.so',
+];
+
 /// The header line used in Glance stack traces.
 ///
 /// This string is used to identify the start of a stack trace in the
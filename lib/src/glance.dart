@@ -1,8 +1,13 @@
 import 'dart:async';
+import 'dart:typed_data';
 
 import 'package:flutter/foundation.dart';
+import 'package:glance/src/calling_context_tree.dart' show StackAggregation;
+import 'package:glance/src/collect_stack.dart' show FramePhase, ProfileFormat;
 import 'package:glance/src/constants.dart';
 import 'package:glance/src/glance_impl.dart';
+import 'package:glance/src/sampler.dart' show ThreadStateSummary;
+import 'package:glance/src/sampler_stats.dart';
 import 'package:flutter/widgets.dart' show WidgetsFlutterBinding;
 
 /// A custom binding that connects [WidgetsFlutterBinding] and [Glance] to detect
@@ -43,20 +48,114 @@ abstract class JankDetectedReporter extends GlanceReporter<JankReport> {}
 /// A report containing information about detected jank. Currently, it only includes
 /// the stack trace when UI jank occurs.
 class JankReport {
-  const JankReport({required this.stackTrace});
+  const JankReport({
+    required this.stackTrace,
+    this.isRecovered = false,
+    this.onCpuStackTrace,
+    this.offCpuStackTrace,
+    this.threadState,
+    this.framePhases,
+    this.frozenDuration,
+    this.fingerprint,
+    this.occurrences = 1,
+    this.isSummary = false,
+    this.firstSeen,
+    this.lastSeen,
+  });
 
   /// The stack traces captured when UI jank was detected.
   final StackTrace stackTrace;
 
+  /// Whether the report is recovered from the samples of a previous run that
+  /// crashed or was killed, see [GlanceConfiguration.persistentSamplesPath].
+  final bool isRecovered;
+
+  /// The frames the UI thread was running on a CPU in during the jank, heaviest
+  /// first, see [GlanceConfiguration.sampleCpuTime]. `null` if the CPU time is
+  /// not sampled.
+  final StackTrace? onCpuStackTrace;
+
+  /// The frames the UI thread was blocked in during the jank (e.g., waiting for
+  /// a lock, I/O or a platform channel), heaviest first, see
+  /// [GlanceConfiguration.sampleCpuTime]. `null` if the CPU time is not sampled.
+  final StackTrace? offCpuStackTrace;
+
+  /// What the UI thread was doing over the samples of the jank, e.g., sleeping
+  /// in `futex` or `read`, and how many times it was switched out, see
+  /// [GlanceConfiguration.sampleThreadState]. `null` if it's not sampled.
+  final ThreadStateSummary? threadState;
+
+  /// The number of the samples of the jank the UI thread took in each phase of
+  /// the frames, e.g., mostly in [FramePhase.layout] if the layout is slow, see
+  /// [GlanceConfiguration.markFramePhases]. `null` if they're not marked.
+  final Map<FramePhase, int>? framePhases;
+
+  /// How long the UI thread had been stuck in a task when the report was taken
+  /// by the watchdog, while the task was still running, see
+  /// [GlanceConfiguration.onUiThreadFrozen]. `null` if the report is of a jank
+  /// detected after it ended.
+  final Duration? frozenDuration;
+
+  /// The fingerprint of the [stackTrace], the same for the reports of the same
+  /// jank within a session, see [GlanceConfiguration.dedupJankReports]. `null`
+  /// if the reports are not deduplicated.
+  final int? fingerprint;
+
+  /// The number of the janks this report stands for, which is the repeats
+  /// folded since the jank of the [fingerprint] was last reported if it's a
+  /// [isSummary], otherwise 1.
+  final int occurrences;
+
+  /// Whether the report is a summary of the repeats of a jank reported before,
+  /// see [GlanceConfiguration.dedupJankReports]. The [stackTrace] is the one of
+  /// the first report of the [fingerprint].
+  final bool isSummary;
+
+  /// When the jank of the [fingerprint] was first and last seen within the
+  /// session, only set with [isSummary].
+  final DateTime? firstSeen;
+
+  /// See [firstSeen].
+  final DateTime? lastSeen;
+
   @override
   bool operator ==(Object other) {
     if (identical(this, other)) return true;
     if (runtimeType != other.runtimeType) return false;
-    return other is JankReport && stackTrace == other.stackTrace;
+    return other is JankReport &&
+        stackTrace == other.stackTrace &&
+        isRecovered == other.isRecovered &&
+        onCpuStackTrace == other.onCpuStackTrace &&
+        offCpuStackTrace == other.offCpuStackTrace &&
+        threadState == other.threadState &&
+        mapEquals(framePhases, other.framePhases) &&
+        frozenDuration == other.frozenDuration &&
+        fingerprint == other.fingerprint &&
+        occurrences == other.occurrences &&
+        isSummary == other.isSummary &&
+        firstSeen == other.firstSeen &&
+        lastSeen == other.lastSeen;
   }
 
   @override
-  int get hashCode => stackTrace.hashCode;
+  int get hashCode => Object.hash(
+    stackTrace,
+    isRecovered,
+    onCpuStackTrace,
+    offCpuStackTrace,
+    threadState,
+    framePhases == null
+        ? null
+        : Object.hashAllUnordered(
+            framePhases!.entries.map((e) => (e.key, e.value)),
+          ),
+    frozenDuration,
+    fingerprint,
+    occurrences,
+    isSummary,
+    firstSeen,
+    lastSeen,
+  );
 }
 
 /// Configuration class for [Glance]
@@ -64,8 +163,23 @@ class GlanceConfiguration {
   const GlanceConfiguration({
     this.jankThreshold = kDefaultJankThreshold,
     this.reporters = const [],
-    List<String> modulePathFilters = const [],
+    this.modulePathFilters = const [],
     this.sampleRateInMilliseconds = kDefaultSampleRateInMilliseconds,
+    this.adaptiveSampleRate = false,
+    this.persistentSamplesPath,
+    this.recoveredSamplesWindowInMilliseconds =
+        kDefaultRecoveredSamplesWindowInMilliseconds,
+    this.stackAggregation = StackAggregation.frames,
+    this.useUnwindTables = false,
+    this.usePerfEvents = false,
+    this.sampleCpuTime = false,
+    this.sampleThreadState = false,
+    this.markFramePhases = false,
+    this.watchdogTimeoutInMilliseconds,
+    this.onUiThreadFrozen,
+    this.dedupJankReports = false,
+    this.jankSummaryIntervalInMilliseconds =
+        kDefaultJankSummaryIntervalInMilliseconds,
   });
 
   /// The threshold in milliseconds for detecting UI jank. Defaults to [kDefaultJankThreshold].
@@ -74,9 +188,108 @@ class GlanceConfiguration {
   /// A list of reporters that will handle the reporting of UI jank.
   final List<GlanceReporter> reporters;
 
+  /// Only the frames of the modules whose paths match one of the regular expressions
+  /// are reported, e.g., [kAndroidDefaultModulePathFilters], [kIOSDefaultModulePathFilters]
+  /// or [kLinuxDefaultModulePathFilters].
+  /// The matching is done once per loaded module natively, not per frame.
+  /// All frames are reported if it's empty, which is the default.
+  final List<String> modulePathFilters;
+
   /// The interval in milliseconds for capture the stack traces. Defaults to [kDefaultSampleRateInMilliseconds].
   /// Lower value will capture more accuracy stack traces, but will impace the performance.
   final int sampleRateInMilliseconds;
+
+  /// Whether to sample at [sampleRateInMilliseconds] normally, and switch to a
+  /// burst of [kDefaultBurstSampleRateInMicroseconds] once a frame runs past the
+  /// [jankThreshold], which resolves the short jank without sampling at a high
+  /// rate all the time. The rate decays back after [kDefaultBurstDurationInMilliseconds].
+  /// Defaults to `false`.
+  final bool adaptiveSampleRate;
+
+  /// If not `null`, the samples are kept in a file mapped into memory at this
+  /// path (e.g., under the app's cache directory), so they survive a crash or
+  /// the app being killed by an ANR. If the previous run did not call [Glance.end]
+  /// before it was gone, a [JankReport] of its last [recoveredSamplesWindowInMilliseconds]
+  /// samples is reported with [JankReport.isRecovered] on [Glance.start].
+  /// Writing a sample stays plain memory stores. Defaults to `null`.
+  final String? persistentSamplesPath;
+
+  /// See [persistentSamplesPath]. Defaults to [kDefaultRecoveredSamplesWindowInMilliseconds].
+  final int recoveredSamplesWindowInMilliseconds;
+
+  /// How the samples within a jank are aggregated into the [JankReport.stackTrace].
+  /// With [StackAggregation.callingContextTree], the stack trace is the call
+  /// paths of the functions that burned the most time, heaviest first, each
+  /// numbered from `#00`. Defaults to [StackAggregation.frames].
+  final StackAggregation stackAggregation;
+
+  /// Whether to keep walking the stack through the frames without frame
+  /// pointers (e.g., of `libflutter.so` and `libc`) with the unwind tables
+  /// built from their `.eh_frame`, instead of ending the stack there. Building
+  /// the tables takes some time on [Glance.start] and about 1MB of memory.
+  /// Only supported on the 64-bit Android, iOS always keeps the frame pointers.
+  /// Defaults to `false`.
+  final bool useUnwindTables;
+
+  /// Whether to sample with `perf_event_open` instead of the signals on Android,
+  /// so the stacks are collected by the kernel without interrupting the UI
+  /// thread from user space, which makes a higher [sampleRateInMilliseconds]
+  /// cheaper. Only the time the UI thread is running on a CPU is sampled, the
+  /// time it's blocked is not. Falls back to the signals if `perf_event_open`
+  /// is denied, e.g., by `perf_event_paranoid`. Defaults to `false`.
+  final bool usePerfEvents;
+
+  /// Whether to also sample the UI thread every [sampleRateInMilliseconds] of
+  /// its CPU time on Android, so a [JankReport] tells the functions that burned
+  /// the CPU ([JankReport.onCpuStackTrace]) from the ones the UI thread was
+  /// blocked in ([JankReport.offCpuStackTrace]). The [JankReport.stackTrace]
+  /// stays of the wall clock. Ignored with [usePerfEvents]. Defaults to `false`.
+  final bool sampleCpuTime;
+
+  /// Whether to also read the run state and the context switches of the UI
+  /// thread with every sample, and the syscall it's in, so a [JankReport]
+  /// tells whether the UI thread was running, or sleeping in which syscall
+  /// (e.g., `futex` for a lock, `read` for I/O), see [JankReport.threadState].
+  /// There are no context switches on iOS. Ignored with [usePerfEvents].
+  /// Defaults to `false`.
+  final bool sampleThreadState;
+
+  /// Whether to mark the phase of the frame the UI thread is in (e.g., the
+  /// build, layout or paint, or a pointer event or platform message handler
+  /// between the frames) with every sample, so a [JankReport] tells which
+  /// phase of the frame was slow, see [JankReport.framePhases]. Marking a phase
+  /// is a single store into the native memory. Defaults to `false`.
+  final bool markFramePhases;
+
+  /// If not `null`, a native watchdog thread reports the UI thread stuck in a
+  /// frame, a pointer event or a platform message handler for this many
+  /// milliseconds while it's still stuck, to [onUiThreadFrozen]. Unlike the
+  /// [reporters], which are called once a jank ends, this reports the freezes
+  /// that never end, e.g., before the app is killed by an ANR. A freeze is
+  /// reported once it lasts the timeout, then twice the timeout, 4 times and
+  /// so on. Marking a task is a single store into the native memory.
+  final int? watchdogTimeoutInMilliseconds;
+
+  /// Called with the reports of the watchdog, see [watchdogTimeoutInMilliseconds]
+  /// and [JankReport.frozenDuration]. As the UI isolate is frozen, it's called
+  /// on the isolate of the sampler instead, so it must be able to be sent to
+  /// another isolate (e.g., a top-level or static function), and must not
+  /// rely on the states of the UI isolate.
+  final void Function(JankReport report)? onUiThreadFrozen;
+
+  /// Whether to report a jank to the [reporters] only the first time it's seen
+  /// within the session, instead of every time it comes back. The janks are
+  /// told apart by the fingerprint of the heaviest frames of their stack
+  /// traces (see [JankReport.fingerprint]), so one alternating with others is
+  /// still folded. The repeats are reported every [jankSummaryIntervalInMilliseconds]
+  /// as a [JankReport.isSummary] per jank, with the [JankReport.occurrences].
+  /// At most [kMaxJankFingerprints] janks are kept, the least recently seen one
+  /// is summarized and forgotten to make room. Otherwise only a jank of the
+  /// same stack trace as the previous one is dropped. Defaults to `false`.
+  final bool dedupJankReports;
+
+  /// See [dedupJankReports]. Defaults to [kDefaultJankSummaryIntervalInMilliseconds].
+  final int jankSummaryIntervalInMilliseconds;
 }
 
 /// The [Glance] is a singleton class for handling the monitoring functionality of UI jank detection.
@@ -129,6 +342,10 @@ abstract class Glance {
     return _instance!;
   }
 
+  /// The [GlanceSamplerInspector] of [instance].
+  static GlanceSamplerInspector get samplerInspector =>
+      instance as GlanceSamplerInspector;
+
   /// Starts monitoring UI jank with the given configuration.
   /// If no configuration is provided, the default configuration is used.
   Future<void> start({
@@ -138,3 +355,27 @@ abstract class Glance {
   /// Ends the Glance monitoring.
   Future<void> end();
 }
+
+/// Inspects the sampler of [Glance.instance], see [Glance.samplerInspector].
+///
+/// Kept apart from [Glance], so the implementations and the fakes of [Glance]
+/// don't have to implement it.
+abstract class GlanceSamplerInspector {
+  /// Gets the self-overhead of sampling the stack traces since the process
+  /// started, e.g., the samples that timed out and how long the UI thread is
+  /// paused, which can be used to back off the sampling on the devices where it
+  /// is expensive. Returns `null` if Glance is not started.
+  SamplerStats? getSamplerStats();
+
+  /// Exports the samples of the native sampler within [timestampRange] (in
+  /// microseconds of `Timeline.now`), or all the samples still in the buffer if
+  /// it's `null`, in [format], which keeps the full call stacks and can be
+  /// opened by the standard profile tooling. The Dart AOT frames are named by
+  /// `libapp.so+offset`, which can be symbolized offline with the build id of
+  /// the mapping. The profile is encoded off the UI isolate. Returns `null` if
+  /// Glance is not started, or the native sampler is not supported on the device.
+  Future<Uint8List?> exportProfile({
+    ProfileFormat format = ProfileFormat.pprof,
+    List<int>? timestampRange,
+  });
+}
@@ -1,18 +1,28 @@
+import 'dart:async';
 import 'dart:developer';
 import 'dart:typed_data';
 import 'dart:ui';
 
 import 'package:flutter/foundation.dart' show listEquals;
+import 'package:flutter/rendering.dart' show PipelineOwner;
 import 'package:flutter/scheduler.dart' show SchedulerPhase;
 import 'package:flutter/services.dart' show BinaryMessenger, MessageHandler;
 import 'package:flutter/widgets.dart';
+import 'package:glance/src/collect_stack.dart'
+    show
+        DartImageInfo,
+        FramePhase,
+        JankDeduper,
+        JankFingerprint,
+        ProfileFormat;
 import 'package:glance/src/constants.dart';
 import 'package:glance/src/glance.dart';
 import 'package:glance/src/sampler.dart';
+import 'package:glance/src/sampler_stats.dart';
 import 'package:meta/meta.dart' show visibleForTesting, internal;
 
 /// No-op implementation of [Glance].
-class GlanceNoOpImpl implements Glance {
+class GlanceNoOpImpl implements Glance, GlanceSamplerInspector {
   @override
   Future<void> end() async {}
 
@@ -20,10 +30,19 @@ class GlanceNoOpImpl implements Glance {
   Future<void> start({
     GlanceConfiguration config = const GlanceConfiguration(),
   }) async {}
+
+  @override
+  SamplerStats? getSamplerStats() => null;
+
+  @override
+  Future<Uint8List?> exportProfile({
+    ProfileFormat format = ProfileFormat.pprof,
+    List<int>? timestampRange,
+  }) async => null;
 }
 
 /// Implementation of [Glance]
-class GlanceImpl implements Glance {
+class GlanceImpl implements Glance, GlanceSamplerInspector {
   static Glance create(bool isNoOp) {
     if (isNoOp) {
       return GlanceNoOpImpl();
@@ -32,10 +51,24 @@ class GlanceImpl implements Glance {
     return GlanceImpl._();
   }
 
-  GlanceImpl._();
+  GlanceImpl._()
+    : _loadDartImageInfo = DartImageInfo.load,
+      _createJankDeduper = JankDeduper.new;
 
   @visibleForTesting
-  GlanceImpl.forTesting(Sampler sampler) : _sampler = sampler;
+  GlanceImpl.forTesting(
+    Sampler sampler, {
+    DartImageInfo? Function()? loadDartImageInfo,
+    JankDeduper Function()? createJankDeduper,
+  }) : _sampler = sampler,
+       _loadDartImageInfo = loadDartImageInfo,
+       _createJankDeduper = createJankDeduper ?? JankDeduper.new;
+
+  /// Reads the [DartImageInfo] natively, falls back to parsing the
+  /// [StackTrace.current] if it's null or returns null.
+  final DartImageInfo? Function()? _loadDartImageInfo;
+
+  final JankDeduper Function() _createJankDeduper;
 
   Sampler? _sampler;
 
@@ -47,8 +80,29 @@ class GlanceImpl implements Glance {
 
   GlanceStackTraceImpl? _previousStackTrace;
 
+  /// Folds the repeated janks, see [GlanceConfiguration.dedupJankReports].
+  JankDeduper? _jankDeduper;
+
+  /// The stack traces of the fingerprints of the [_jankDeduper] reported,
+  /// which are reported again by their summaries.
+  final Map<int, GlanceStackTraceImpl> _fingerprintStackTraces = {};
+
+  Timer? _jankSummaryTimer;
+
   DartStackTraceInfo? _dartStackTraceInfo;
 
+  /// Whether the reports have the [JankReport.onCpuStackTrace] and the
+  /// [JankReport.offCpuStackTrace], see [GlanceConfiguration.sampleCpuTime].
+  bool _sampleCpuTime = false;
+
+  /// Whether the reports have the [JankReport.threadState], see
+  /// [GlanceConfiguration.sampleThreadState].
+  bool _sampleThreadState = false;
+
+  /// Whether the reports have the [JankReport.framePhases], see
+  /// [GlanceConfiguration.markFramePhases].
+  bool _markFramePhases = false;
+
   @override
   Future<void> start({
     GlanceConfiguration config = const GlanceConfiguration(),
@@ -58,20 +112,59 @@ class GlanceImpl implements Glance {
     }
 
     _started = true;
-    _dartStackTraceInfo ??= parseDartStackTraceInfo(
-      StackTrace.current.toString(),
-    );
+    _dartStackTraceInfo ??= _readDartStackTraceInfo();
 
     final jankThreshold = config.jankThreshold;
     final sampleRateInMilliseconds = config.sampleRateInMilliseconds;
     _reporters = List.of(config.reporters, growable: false);
+    final onUiThreadFrozen = config.onUiThreadFrozen;
+    final watchdogTimeoutInMilliseconds = onUiThreadFrozen != null
+        ? config.watchdogTimeoutInMilliseconds ?? 0
+        : 0;
 
     _sampler ??= await Sampler.create(
       SamplerConfig(
         jankThreshold: jankThreshold,
         sampleRateInMilliseconds: sampleRateInMilliseconds,
+        modulePathFilters: config.modulePathFilters,
+        burstSampleRateInMicroseconds: config.adaptiveSampleRate
+            ? kDefaultBurstSampleRateInMicroseconds
+            : 0,
+        persistentSamplesPath: config.persistentSamplesPath,
+        persistentSamplesIsolateInstructions:
+            _dartStackTraceInfo?.isolateInstructions ?? 0,
+        persistentSamplesHeaderLines:
+            _dartStackTraceInfo?.dartStackTraceHeaderLines ?? const [],
+        recoveredSamplesWindowInMilliseconds:
+            config.recoveredSamplesWindowInMilliseconds,
+        stackAggregation: config.stackAggregation,
+        useUnwindTables: config.useUnwindTables,
+        usePerfEvents: config.usePerfEvents,
+        cpuTimeSampleRateInMicroseconds: config.sampleCpuTime
+            ? sampleRateInMilliseconds * 1000
+            : 0,
+        readSchedState: config.sampleThreadState,
+        markFramePhases: config.markFramePhases,
+        watchdogTimeoutInMilliseconds: watchdogTimeoutInMilliseconds,
+        onWatchdogReport: onUiThreadFrozen != null
+            ? watchdogReportCallback(
+                _dartStackTraceInfo ?? const DartStackTraceInfo(0, []),
+                onUiThreadFrozen,
+              )
+            : null,
       ),
     );
+    _sampleCpuTime = config.sampleCpuTime && !config.usePerfEvents;
+    _sampleThreadState = config.sampleThreadState && !config.usePerfEvents;
+    _markFramePhases = config.markFramePhases;
+    if (config.dedupJankReports) {
+      _jankDeduper = _createJankDeduper();
+      _jankSummaryTimer = Timer.periodic(
+        Duration(milliseconds: config.jankSummaryIntervalInMilliseconds),
+        (_) => _reportJankSummaries(),
+      );
+    }
+    _reportRecoveredSamples();
 
     _checkJank = (int start, int end) {
       if (_sampler == null) {
@@ -80,10 +173,42 @@ class GlanceImpl implements Glance {
 
       final totalSpan = (end - start) / 1000.0;
       if (totalSpan > jankThreshold) {
+        if (config.adaptiveSampleRate) {
+          _sampler!.requestSampleBurst();
+        }
         _report(start, end);
       }
     };
     GlanceWidgetBinding.instance.onCheckJank = _checkJank!;
+    if (config.adaptiveSampleRate) {
+      GlanceWidgetBinding.instance.onFrameBegin = _sampler!.markFrameBegin;
+      GlanceWidgetBinding.instance.onFrameEnd = _sampler!.markFrameEnd;
+    }
+    if (config.markFramePhases) {
+      GlanceWidgetBinding.instance.onFramePhase = _sampler!.setFramePhase;
+    }
+    if (watchdogTimeoutInMilliseconds > 0) {
+      GlanceWidgetBinding.instance.onTaskBegin = _sampler!.markUiTaskBegin;
+      GlanceWidgetBinding.instance.onTaskEnd = _sampler!.markUiTaskEnd;
+    }
+  }
+
+  /// Creates the [SamplerConfig.onWatchdogReport] that reports to
+  /// [onUiThreadFrozen], which is called on the isolate of the sampler, so it
+  /// only captures the [dartStackTraceInfo] and the [onUiThreadFrozen].
+  @visibleForTesting
+  static void Function(WatchdogReport report) watchdogReportCallback(
+    DartStackTraceInfo dartStackTraceInfo,
+    void Function(JankReport report) onUiThreadFrozen,
+  ) {
+    return (WatchdogReport report) {
+      onUiThreadFrozen(
+        JankReport(
+          stackTrace: GlanceStackTraceImpl(report.frames, dartStackTraceInfo),
+          frozenDuration: Duration(microseconds: report.frozenInMicroseconds),
+        ),
+      );
+    };
   }
 
   @override
@@ -92,12 +217,59 @@ class GlanceImpl implements Glance {
       return;
     }
     GlanceWidgetBinding.instance.onCheckJank = null;
+    GlanceWidgetBinding.instance.onFrameBegin = null;
+    GlanceWidgetBinding.instance.onFrameEnd = null;
+    GlanceWidgetBinding.instance.onFramePhase = null;
+    GlanceWidgetBinding.instance.onTaskBegin = null;
+    GlanceWidgetBinding.instance.onTaskEnd = null;
     _checkJank = null;
+    _reportJankSummaries();
+    _jankSummaryTimer?.cancel();
+    _jankSummaryTimer = null;
+    _jankDeduper?.dispose();
+    _jankDeduper = null;
+    _fingerprintStackTraces.clear();
     _sampler?.close();
     _sampler = null;
     _dartStackTraceInfo = null;
   }
 
+  @override
+  SamplerStats? getSamplerStats() {
+    return _sampler?.getSamplerStats();
+  }
+
+  @override
+  Future<Uint8List?> exportProfile({
+    ProfileFormat format = ProfileFormat.pprof,
+    List<int>? timestampRange,
+  }) async {
+    return _sampler?.exportProfile(format, timestampRange: timestampRange);
+  }
+
+  /// Reports the samples of the previous run that did not shut down cleanly,
+  /// see [GlanceConfiguration.persistentSamplesPath].
+  void _reportRecoveredSamples() {
+    final recoveredSamples = _sampler!.takeRecoveredSamples();
+    if (recoveredSamples == null) {
+      return;
+    }
+
+    final report = JankReport(
+      stackTrace: GlanceStackTraceImpl(
+        recoveredSamples.frames,
+        DartStackTraceInfo(
+          recoveredSamples.isolateInstructions,
+          recoveredSamples.headerLines,
+        ),
+      ),
+      isRecovered: true,
+    );
+    for (final reporter in _reporters) {
+      reporter.report(report);
+    }
+  }
+
   Future<void> _report(int start, int end) async {
     final timestampRange = [start, end];
 
@@ -111,19 +283,112 @@ class GlanceImpl implements Glance {
       frames,
       _dartStackTraceInfo ?? const DartStackTraceInfo(0, []),
     );
-    if (straceTrace == _previousStackTrace) {
+    int? fingerprint;
+    final jankDeduper = _jankDeduper;
+    if (jankDeduper != null) {
+      final recorded = jankDeduper.record(
+        isolateInstructions:
+            straceTrace.dartStackTraceInfo.isolateInstructions,
+        frames: [
+          for (final frame in frames)
+            (frame: frame.frame, occurTimes: frame.occurTimes),
+        ],
+        timestamp: DateTime.now().microsecondsSinceEpoch,
+      );
+      if (recorded != null) {
+        final evicted = recorded.evicted;
+        if (evicted != null) {
+          _reportJankSummary(evicted);
+          _fingerprintStackTraces.remove(evicted.fingerprint);
+        }
+        // A repeat is folded into the next summary, so the extras below are
+        // not even read.
+        if (!recorded.isNew) {
+          return;
+        }
+        fingerprint = recorded.fingerprint.fingerprint;
+        _fingerprintStackTraces[fingerprint] = straceTrace;
+      }
+    }
+    if (fingerprint == null && straceTrace == _previousStackTrace) {
       return;
     }
 
-    final report = JankReport(stackTrace: straceTrace);
-
     _previousStackTrace = straceTrace;
 
+    final cpuTimeSplit = _sampleCpuTime
+        ? await _sampler?.getCpuTimeSplit(timestampRange)
+        : null;
+    final threadState = _sampleThreadState
+        ? await _sampler?.getThreadStateSummary(timestampRange)
+        : null;
+    final framePhases = _markFramePhases
+        ? await _sampler?.getFramePhases(timestampRange)
+        : null;
+    final report = JankReport(
+      stackTrace: straceTrace,
+      onCpuStackTrace: cpuTimeSplit != null
+          ? GlanceStackTraceImpl(
+              cpuTimeSplit.onCpu,
+              straceTrace.dartStackTraceInfo,
+            )
+          : null,
+      offCpuStackTrace: cpuTimeSplit != null
+          ? GlanceStackTraceImpl(
+              cpuTimeSplit.offCpu,
+              straceTrace.dartStackTraceInfo,
+            )
+          : null,
+      threadState: threadState,
+      framePhases: framePhases,
+      fingerprint: fingerprint,
+    );
+
     for (final reporter in _reporters) {
       reporter.report(report);
     }
   }
 
+  /// Reports the summaries of the janks repeated since they were last
+  /// reported, see [GlanceConfiguration.dedupJankReports].
+  void _reportJankSummaries() {
+    final jankDeduper = _jankDeduper;
+    if (jankDeduper == null) {
+      return;
+    }
+
+    for (final summary in jankDeduper.takeSummaries()) {
+      _reportJankSummary(summary);
+    }
+  }
+
+  void _reportJankSummary(JankFingerprint summary) {
+    final stackTrace = _fingerprintStackTraces[summary.fingerprint];
+    if (stackTrace == null || summary.repeats == 0) {
+      return;
+    }
+
+    final report = JankReport(
+      stackTrace: stackTrace,
+      fingerprint: summary.fingerprint,
+      occurrences: summary.repeats,
+      isSummary: true,
+      firstSeen: DateTime.fromMicrosecondsSinceEpoch(summary.firstSeen),
+      lastSeen: DateTime.fromMicrosecondsSinceEpoch(summary.lastSeen),
+    );
+    for (final reporter in _reporters) {
+      reporter.report(report);
+    }
+  }
+
+  DartStackTraceInfo? _readDartStackTraceInfo() {
+    final dartImageInfo = _loadDartImageInfo?.call();
+    if (dartImageInfo != null) {
+      return DartStackTraceInfo.fromDartImageInfo(dartImageInfo);
+    }
+    return parseDartStackTraceInfo(StackTrace.current.toString());
+  }
+
   /// Parse the Dart [StackTrace.current], get the header contents, and parse the
   /// `isolate_instructions` value.
   ///
@@ -193,9 +458,43 @@ class DartStackTraceInfo {
     this.isolateInstructions,
     this.dartStackTraceHeaderLines,
   );
+
+  /// Synthesizes the header lines of [StackTrace.current] from the
+  /// [DartImageInfo], e.g.,
+  /// ```
+  /// *** *** *** *** *** *** *** *** *** *** *** *** *** *** *** ***
+  /// build_id: 'a8a967193ee33ac7a4852e7160590972'
+  /// isolate_dso_base: 1016b8000, vm_dso_base: 1016b8000
+  /// isolate_instructions: 1016c6700, vm_instructions: 1016bc000
+  /// ```
+  /// The `pid` and `os` lines are omitted, which are not needed by
+  /// `flutter symbolize`.
+  factory DartStackTraceInfo.fromDartImageInfo(DartImageInfo info) {
+    String hex(int value) => value.toRadixString(16);
+    return DartStackTraceInfo(info.isolateInstructions, [
+      kGlanceStackTraceHeaderLine,
+      if (info.buildId.isNotEmpty) "build_id: '${info.buildId}'",
+      'isolate_dso_base: ${hex(info.isolateDsoBase)}, '
+          'vm_dso_base: ${hex(info.vmDsoBase)}',
+      'isolate_instructions: ${hex(info.isolateInstructions)}, '
+          'vm_instructions: ${hex(info.vmInstructions)}',
+    ]);
+  }
+
   final int isolateInstructions;
   final List<String> dartStackTraceHeaderLines;
 
+  /// The `build_id` of the header lines, e.g., `a8a967193ee33ac7a4852e7160590972`
+  /// of `build_id: 'a8a967193ee33ac7a4852e7160590972'`, or empty if not found.
+  String get buildId {
+    for (final line in dartStackTraceHeaderLines) {
+      if (line.startsWith('build_id:')) {
+        return line.substring('build_id:'.length).trim().replaceAll("'", '');
+      }
+    }
+    return '';
+  }
+
   @override
   bool operator ==(Object other) {
     if (identical(this, other)) return true;
@@ -277,7 +576,10 @@ class GlanceStackTraceImpl implements StackTrace {
       }
 
       stringBuffer.write('    ');
-      stringBuffer.write('#${i.toString().padLeft(2, '0')}');
+      // The call paths of `StackAggregation.callingContextTree` are numbered
+      // separately.
+      final index = stackTrace.pathDepth ?? i;
+      stringBuffer.write('#${index.toString().padLeft(2, '0')}');
       stringBuffer.write(kGlanceStackTraceLineSpilt);
       stringBuffer.write('abs');
       stringBuffer.write(kGlanceStackTraceLineSpilt);
@@ -308,6 +610,10 @@ typedef CheckJankCallback = void Function(int start, int end);
 mixin GlanceWidgetBindingMixin on WidgetsFlutterBinding {
   int _beginFrameStartInMicros = 0;
 
+  int _frameNumber = 0;
+
+  FramePhase _framePhase = FramePhase.idle;
+
   CheckJankCallback? _onCheckJank;
   @internal
   CheckJankCallback? get onCheckJank => _onCheckJank;
@@ -316,10 +622,103 @@ mixin GlanceWidgetBindingMixin on WidgetsFlutterBinding {
     _onCheckJank = callback;
   }
 
+  /// Called before a frame begins, and after it's drawn, so the native sampler
+  /// can notice a long frame while it's still in progress.
+  @internal
+  VoidCallback? onFrameBegin;
+  @internal
+  VoidCallback? onFrameEnd;
+
+  /// Called when the UI thread enters a phase of a frame or a callback, with
+  /// the number of the latest frame, see [GlanceConfiguration.markFramePhases].
+  void Function(FramePhase phase, int frameNumber)? _onFramePhase;
+  @internal
+  void Function(FramePhase phase, int frameNumber)? get onFramePhase =>
+      _onFramePhase;
+  @internal
+  set onFramePhase(void Function(FramePhase phase, int frameNumber)? callback) {
+    _onFramePhase = callback;
+    if (callback != null && !_hasPostFrameCallback) {
+      // Only added once the phases are marked, the persistent frame callbacks
+      // can't be removed. Runs after the `drawFrame` of the `RendererBinding`.
+      _hasPostFrameCallback = true;
+      addPersistentFrameCallback((_) => _setFramePhase(FramePhase.postFrame));
+    }
+  }
+
+  bool _hasPostFrameCallback = false;
+
+  /// Called when the UI thread begins and ends a task, i.e., a frame, or a
+  /// handler of an event or a platform message, so the watchdog can notice
+  /// the UI thread stuck in one, see [GlanceConfiguration.onUiThreadFrozen].
+  @internal
+  VoidCallback? onTaskBegin;
+  @internal
+  VoidCallback? onTaskEnd;
+
+  /// The tasks in progress, a handler can run within another task, e.g., a
+  /// platform message handled synchronously during a frame.
+  int _taskDepth = 0;
+
+  /// The root is flushed before the pipeline owners of the views, so it marks
+  /// the phases of them, without changing the tree of the pipeline owners.
+  @override
+  PipelineOwner createRootPipelineOwner() {
+    return _FramePhasePipelineOwner(_setFramePhase);
+  }
+
+  void _setFramePhase(FramePhase phase) {
+    if (phase == _framePhase) {
+      return;
+    }
+    _framePhase = phase;
+    _onFramePhase?.call(phase, _frameNumber);
+  }
+
+  /// Runs [func] in the [phase], and goes back to the current one after it.
+  T _runInFramePhase<T>(FramePhase phase, T Function() func) {
+    final previousPhase = _framePhase;
+    _setFramePhase(phase);
+    try {
+      return func();
+    } finally {
+      _setFramePhase(previousPhase);
+    }
+  }
+
+  void _beginTask() {
+    if (_taskDepth++ == 0) {
+      onTaskBegin?.call();
+    }
+  }
+
+  void _endTask() {
+    // E.g., the callbacks are set in the middle of a frame.
+    if (_taskDepth == 0) {
+      return;
+    }
+    if (--_taskDepth == 0) {
+      onTaskEnd?.call();
+    }
+  }
+
+  /// Runs [func] as a task, see [onTaskBegin].
+  T _runTask<T>(T Function() func) {
+    _beginTask();
+    try {
+      return func();
+    } finally {
+      _endTask();
+    }
+  }
+
   @visibleForTesting
-  T traceFunctionCall<T>(T Function() func) {
+  T traceFunctionCall<T>(
+    T Function() func, {
+    FramePhase phase = FramePhase.platformEvent,
+  }) {
     int start = Timeline.now;
-    final ret = func();
+    final ret = _runTask(() => _runInFramePhase(phase, func));
     // Only check jank if not in rendering phase, because if it is in rendering phase,
     // the jank has been checked by the rendering phase jank check
     if (schedulerPhase == SchedulerPhase.idle) {
@@ -332,30 +731,42 @@ mixin GlanceWidgetBindingMixin on WidgetsFlutterBinding {
   @override
   void handleBeginFrame(Duration? rawTimeStamp) {
     _beginFrameStartInMicros = Timeline.now;
+    ++_frameNumber;
+    _beginTask();
+    onFrameBegin?.call();
+    _setFramePhase(FramePhase.animate);
     super.handleBeginFrame(rawTimeStamp);
   }
 
   @override
   void handleDrawFrame() {
+    // The persistent frame callbacks start with building the widgets.
+    _setFramePhase(FramePhase.build);
     super.handleDrawFrame();
+    _setFramePhase(FramePhase.idle);
+    onFrameEnd?.call();
+    _endTask();
     _onCheckJank?.call(_beginFrameStartInMicros, Timeline.now);
   }
 
   @override
   BinaryMessenger createBinaryMessenger() {
-    return _DefaultBinaryMessengerProxy(super.createBinaryMessenger(), (
-      start,
-      end,
-    ) {
-      _onCheckJank?.call(start, end);
-    });
+    return _DefaultBinaryMessengerProxy(
+      super.createBinaryMessenger(),
+      (start, end) {
+        _onCheckJank?.call(start, end);
+      },
+      (handler) => _runTask(
+        () => _runInFramePhase(FramePhase.platformMessage, handler),
+      ),
+    );
   }
 
   @override
   void handlePointerEvent(PointerEvent event) {
     traceFunctionCall(() {
       super.handlePointerEvent(event);
-    });
+    }, phase: FramePhase.input);
   }
 
   @override
@@ -384,12 +795,80 @@ mixin GlanceWidgetBindingMixin on WidgetsFlutterBinding {
   }
 }
 
+/// The root [PipelineOwner] without render objects of its own, the same as the
+/// default one, which marks the phases of a frame before its children are
+/// flushed, see [FramePhase]. The marks only cost a comparison until
+/// [GlanceWidgetBindingMixin.onFramePhase] is set.
+class _FramePhasePipelineOwner extends PipelineOwner {
+  _FramePhasePipelineOwner(this._setFramePhase)
+    // Never sends an update, but it's required by the root.
+    : super(onSemanticsUpdate: (_) {});
+
+  final void Function(FramePhase phase) _setFramePhase;
+
+  /// Same as the default root pipeline owner of [RendererBinding], which can't
+  /// manage a root node without handling its semantics.
+  @override
+  set rootNode(RenderObject? _) {
+    assert(() {
+      throw FlutterError.fromParts(<DiagnosticsNode>[
+        ErrorSummary(
+          'Cannot set a rootNode on the default root pipeline owner.',
+        ),
+        ErrorDescription(
+          'The root pipeline owner of GlanceWidgetBinding only marks the '
+          'phases of the frames, and does not define a proper '
+          'onSemanticsUpdate callback to handle semantics for a root node.',
+        ),
+        ErrorHint(
+          'Add a child pipeline owner which manages the root node to the '
+          'RendererBinding.rootPipelineOwner instead.',
+        ),
+      ]);
+    }());
+  }
+
+  @override
+  void flushLayout() {
+    _setFramePhase(FramePhase.layout);
+    super.flushLayout();
+  }
+
+  @override
+  void flushCompositingBits() {
+    _setFramePhase(FramePhase.paint);
+    super.flushCompositingBits();
+  }
+
+  @override
+  void flushPaint() {
+    _setFramePhase(FramePhase.paint);
+    super.flushPaint();
+  }
+
+  @override
+  void flushSemantics() {
+    _setFramePhase(FramePhase.semantics);
+    super.flushSemantics();
+  }
+}
+
 /// A proxy for the `_DefaultBinaryMessenger` to trace the time consumed in the
 /// [MessageHandler] set by the user.
 class _DefaultBinaryMessengerProxy implements BinaryMessenger {
-  const _DefaultBinaryMessengerProxy(this._proxy, this._onCheckJank);
+  const _DefaultBinaryMessengerProxy(
+    this._proxy,
+    this._onCheckJank,
+    this._runHandler,
+  );
   final BinaryMessenger _proxy;
   final CheckJankCallback _onCheckJank;
+
+  /// Runs the synchronous part of a handler as a task of the UI thread in the
+  /// [FramePhase.platformMessage].
+  final Future<ByteData?>? Function(Future<ByteData?>? Function() handler)
+  _runHandler;
+
   @override
   Future<void> handlePlatformMessage(
     String channel,
@@ -413,7 +892,8 @@ class _DefaultBinaryMessengerProxy implements BinaryMessenger {
           ? handler
           : (ByteData? message) {
               final start = Timeline.now;
-              return handler(message)!.whenComplete(() {
+              // Only the synchronous part of the handler is in the phase.
+              return _runHandler(() => handler(message))!.whenComplete(() {
                 _onCheckJank(start, Timeline.now);
               });
             },
@@ -0,0 +1,54 @@
+import 'package:glance/src/collect_stack.dart';
+import 'package:glance/src/glance.dart';
+import 'package:glance/src/glance_impl.dart';
+import 'package:meta/meta.dart' show visibleForTesting;
+
+/// A [JankDetectedReporter] which appends the [JankReport]s to the file of
+/// [path] in a compact binary format instead of the text of the stack traces,
+/// which is much smaller to upload and store. See `jank_report.h` for the format.
+///
+/// Use [decode] (or the `glance_decode` host tool) to get the text of the
+/// reports back, which can be passed to `flutter symbolize`.
+class JankReportFileReporter extends JankDetectedReporter {
+  JankReportFileReporter(String path) : _writer = JankReportWriter(path);
+
+  @visibleForTesting
+  JankReportFileReporter.withWriter(this._writer);
+
+  final JankReportWriter _writer;
+
+  @override
+  void report(JankReport info) {
+    final stackTrace = info.stackTrace;
+    if (stackTrace is! GlanceStackTraceImpl) {
+      return;
+    }
+
+    final dartStackTraceInfo = stackTrace.dartStackTraceInfo;
+    _writer.write(
+      buildId: dartStackTraceInfo.buildId,
+      isolateInstructions: dartStackTraceInfo.isolateInstructions,
+      headerLines: dartStackTraceInfo.dartStackTraceHeaderLines,
+      timestamp: DateTime.now().microsecondsSinceEpoch,
+      frames: [
+        for (final frame in stackTrace.stackTraces)
+          (
+            frame: frame.frame,
+            occurTimes: frame.occurTimes,
+            pathDepth: frame.pathDepth,
+          ),
+      ],
+    );
+  }
+
+  /// Closes the file, the following reports open it again.
+  void close() {
+    _writer.close();
+  }
+
+  /// Decodes the reports of the file of [path] to the text of the stack traces,
+  /// the reports are separated by an empty line. Returns null if failed.
+  static String? decode(String path) {
+    return JankReportWriter.decodeFile(path);
+  }
+}
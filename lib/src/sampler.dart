@@ -1,16 +1,22 @@
 import 'dart:async';
 import 'dart:collection';
 import 'dart:isolate';
+import 'dart:math' show max, min;
+import 'dart:typed_data';
 
-import 'package:flutter/foundation.dart' show compute;
+import 'package:flutter/foundation.dart' show compute, mapEquals;
+import 'package:glance/src/calling_context_tree.dart';
 import 'package:glance/src/collect_stack.dart';
 import 'package:glance/src/constants.dart';
 import 'package:glance/src/logger.dart';
+import 'package:glance/src/sampler_stats.dart';
 import 'package:meta/meta.dart' show visibleForTesting;
 
 abstract class _Request {}
 
-abstract class _Response {}
+abstract class _Response {
+  int get id;
+}
 
 class _ShutdownRequest implements _Request {}
 
@@ -23,10 +29,70 @@ class _GetSamplesRequest implements _Request {
 @visibleForTesting
 class GetSamplesResponse implements _Response {
   const GetSamplesResponse(this.id, this.data);
+  @override
   final int id;
   final List<AggregatedNativeFrame> data;
 }
 
+class _GetCpuTimeSplitRequest implements _Request {
+  const _GetCpuTimeSplitRequest(this.id, this.timestampRange);
+  final int id;
+  final List<int> timestampRange;
+}
+
+@visibleForTesting
+class GetCpuTimeSplitResponse implements _Response {
+  const GetCpuTimeSplitResponse(this.id, this.data);
+  @override
+  final int id;
+  final CpuTimeSplit? data;
+}
+
+class _GetThreadStateRequest implements _Request {
+  const _GetThreadStateRequest(this.id, this.timestampRange);
+  final int id;
+  final List<int> timestampRange;
+}
+
+@visibleForTesting
+class GetThreadStateResponse implements _Response {
+  const GetThreadStateResponse(this.id, this.data);
+  @override
+  final int id;
+  final ThreadStateSummary? data;
+}
+
+class _GetFramePhasesRequest implements _Request {
+  const _GetFramePhasesRequest(this.id, this.timestampRange);
+  final int id;
+  final List<int> timestampRange;
+}
+
+@visibleForTesting
+class GetFramePhasesResponse implements _Response {
+  const GetFramePhasesResponse(this.id, this.data);
+  @override
+  final int id;
+  final Map<FramePhase, int>? data;
+}
+
+class _ExportProfileRequest implements _Request {
+  const _ExportProfileRequest(this.id, this.format, this.timestampRange);
+  final int id;
+  final ProfileFormat format;
+  final List<int>? timestampRange;
+}
+
+@visibleForTesting
+class ExportProfileResponse implements _Response {
+  const ExportProfileResponse(this.id, this.data);
+  @override
+  final int id;
+
+  /// The profile, which is moved to the receiving isolate without a copy.
+  final TransferableTypedData? data;
+}
+
 SamplerProcessor _defaultSamplerProcessorFactory(SamplerConfig config) {
   return SamplerProcessor(config, StackCapturer());
 }
@@ -36,26 +102,266 @@ class SamplerConfig {
     required this.jankThreshold,
     this.sampleRateInMilliseconds = kDefaultSampleRateInMilliseconds,
     this.samplerProcessorFactory = _defaultSamplerProcessorFactory,
+    this.useNativeSampler = true,
+    this.samplesWindowInMilliseconds = kDefaultSamplesWindowInMilliseconds,
+    this.samplesMemoryBudgetInBytes = kDefaultSamplesMemoryBudgetInBytes,
+    this.modulePathFilters = const [],
+    this.collectStackTimeoutInMicroseconds =
+        kDefaultCollectStackTimeoutInMicroseconds,
+    this.stackCopySizeInBytes = 0,
+    this.useUnwindTables = false,
+    this.usePerfEvents = false,
+    this.cpuTimeSampleRateInMicroseconds = 0,
+    this.readSchedState = false,
+    this.markFramePhases = false,
+    this.burstSampleRateInMicroseconds = 0,
+    this.burstDurationInMilliseconds = kDefaultBurstDurationInMilliseconds,
+    this.persistentSamplesPath,
+    this.persistentSamplesIsolateInstructions = 0,
+    this.persistentSamplesHeaderLines = const [],
+    this.recoveredSamplesWindowInMilliseconds =
+        kDefaultRecoveredSamplesWindowInMilliseconds,
+    this.stackAggregation = StackAggregation.frames,
+    this.watchdogTimeoutInMilliseconds = 0,
+    this.onWatchdogReport,
   });
 
   final int jankThreshold;
 
   final int sampleRateInMilliseconds;
 
+  /// Whether to capture the stack traces on a native thread (see `sampler.cc`),
+  /// so the sampling cadence doesn't depend on the Dart event loop. Falls back to
+  /// the Dart loop if the native sampler can not be started.
+  final bool useNativeSampler;
+
+  /// The time window in milliseconds of the samples kept by the native sampler.
+  /// The samples older than the window are overwritten.
+  final int samplesWindowInMilliseconds;
+
+  /// The maximum memory in bytes used for keeping the samples by the native
+  /// sampler, which takes precedence over [samplesWindowInMilliseconds].
+  final int samplesMemoryBudgetInBytes;
+
+  /// See `GlanceConfiguration.modulePathFilters`.
+  final List<String> modulePathFilters;
+
+  /// How long capturing a stack waits for the target thread to be sampled. The
+  /// sample is dropped if it times out.
+  final int collectStackTimeoutInMicroseconds;
+
+  /// If not 0, only the registers and this many bytes of the stack are copied
+  /// while the target thread is stopped, and the frames are walked on the copy
+  /// afterwards. This shortens the pause of the target thread, but the frames
+  /// beyond the copy are dropped. 0 walks the stack while the thread is stopped.
+  final int stackCopySizeInBytes;
+
+  /// Whether to fall back to the unwind tables built from `.eh_frame` for the
+  /// frames without frame pointers (e.g., of the system libraries), which
+  /// otherwise end the stack. Building the tables takes about 1MB for the
+  /// usual modules. Only supported on the 64-bit Android.
+  final bool useUnwindTables;
+
+  /// Whether the native sampler samples with `perf_event_open` instead of the
+  /// signals, so the kernel collects the stacks without running any code on the
+  /// target thread, which makes the higher sample rates cheaper. The target
+  /// thread is only sampled while it's running on a CPU. Falls back to the
+  /// signals if it's denied (e.g., by `perf_event_paranoid`) or not supported,
+  /// e.g., on iOS.
+  final bool usePerfEvents;
+
+  /// If not 0, the native sampler also samples the target thread every this
+  /// many microseconds of its CPU time, so the time of a jank can be split into
+  /// the time the thread was running on a CPU and the time it was blocked, see
+  /// [Sampler.getCpuTimeSplit]. The CPU ticks are not in the aggregated frames
+  /// of a jank. Ignored with [usePerfEvents], whose samples are all taken on
+  /// the CPU time. Not supported on iOS.
+  final int cpuTimeSampleRateInMicroseconds;
+
+  /// Whether the native sampler also reads the run state and the context
+  /// switches of the target thread for every sample, so a jank can be told
+  /// apart by what the thread was waiting for, see [Sampler.getThreadStateSummary].
+  /// Costs a read of a `/proc` file per sample. Ignored with [usePerfEvents].
+  final bool readSchedState;
+
+  /// Whether the UI thread marks its phases with [Sampler.setFramePhase], so
+  /// the samples of a jank can be counted by phase, see [Sampler.getFramePhases].
+  final bool markFramePhases;
+
+  /// If not 0, the native sampler samples every this many microseconds for
+  /// [burstDurationInMilliseconds] once a frame runs longer than the
+  /// [jankThreshold] or a burst is requested by [Sampler.requestSampleBurst],
+  /// and decays back to [sampleRateInMilliseconds] afterwards.
+  final int burstSampleRateInMicroseconds;
+
+  /// How long a burst of [burstSampleRateInMicroseconds] lasts.
+  final int burstDurationInMilliseconds;
+
+  /// If not `null`, the native sampler keeps the samples in a file mapped into
+  /// memory at this path instead of the heap, so the samples of a run that
+  /// crashes or is killed (e.g., by an ANR) can be recovered on the next launch,
+  /// see [Sampler.takeRecoveredSamples].
+  final String? persistentSamplesPath;
+
+  /// The `isolate_instructions` of the Dart stack trace of this run, which is
+  /// stored with the persistent samples, see `DartStackTraceInfo`.
+  final int persistentSamplesIsolateInstructions;
+
+  /// The header lines of the Dart stack trace of this run, which are stored
+  /// with the persistent samples, see `DartStackTraceInfo`.
+  final List<String> persistentSamplesHeaderLines;
+
+  /// The time window in milliseconds before the last sample of the previous run
+  /// that is recovered, see [persistentSamplesPath].
+  final int recoveredSamplesWindowInMilliseconds;
+
+  /// How the samples within a jank are aggregated, see [StackAggregation].
+  final StackAggregation stackAggregation;
+
+  /// If not 0, a native watchdog thread reports the UI thread stuck in a task
+  /// (marked by [Sampler.markUiTaskBegin] and [Sampler.markUiTaskEnd]) for
+  /// this many milliseconds while it's still stuck, so a freeze that never
+  /// ends (e.g., an ANR) is still reported. See `StartWatchdog` in `watchdog.h`.
+  final int watchdogTimeoutInMilliseconds;
+
+  /// Called with the reports of the watchdog, see [watchdogTimeoutInMilliseconds].
+  /// It's called on the isolate of the [SamplerProcessor], so it must not rely
+  /// on the states of the UI isolate.
+  final void Function(WatchdogReport report)? onWatchdogReport;
+
   /// The factory used to create a [SamplerProcessor]. This allows us to inject
   /// the [SamplerProcessor] in tests.
   final SamplerProcessorFactory samplerProcessorFactory;
 }
 
+/// The aggregated samples of a previous run that did not shut down cleanly, see
+/// [SamplerConfig.persistentSamplesPath].
+class RecoveredSamples {
+  const RecoveredSamples({
+    required this.frames,
+    required this.isolateInstructions,
+    required this.headerLines,
+  });
+
+  final List<AggregatedNativeFrame> frames;
+
+  /// The `isolate_instructions` of the Dart stack trace of the previous run.
+  final int isolateInstructions;
+
+  /// The header lines of the Dart stack trace of the previous run.
+  final List<String> headerLines;
+}
+
+/// A report of the UI thread stuck in a task, taken by the watchdog while the
+/// task is still running, see [SamplerConfig.watchdogTimeoutInMilliseconds].
+class WatchdogReport {
+  const WatchdogReport({
+    required this.freezeId,
+    required this.frozenInMicroseconds,
+    required this.reportIndex,
+    required this.frames,
+  });
+
+  /// The same for all the reports of a freeze, which is reported once it has
+  /// lasted the timeout, then twice the timeout, 4 times and so on.
+  final int freezeId;
+
+  /// How long the task has been running when the report is taken.
+  final int frozenInMicroseconds;
+
+  /// The index of the report within the freeze, from 0.
+  final int reportIndex;
+
+  /// The aggregated samples of the freeze if the native sampler is started,
+  /// otherwise the frames of the stack taken by the watchdog, innermost first.
+  final List<AggregatedNativeFrame> frames;
+}
+
+/// The frames of a jank split by whether the target thread was running on a
+/// CPU, see [SamplerConfig.cpuTimeSampleRateInMicroseconds].
+class CpuTimeSplit {
+  const CpuTimeSplit({required this.onCpu, required this.offCpu});
+
+  /// The frames of the CPU ticks, heaviest first, the
+  /// [AggregatedNativeFrame.occurTimes] is the number of the CPU ticks.
+  final List<AggregatedNativeFrame> onCpu;
+
+  /// The frames the thread was blocked in (e.g., waiting for a lock, I/O or
+  /// the other threads), heaviest first. The time of a frame is estimated by
+  /// its wall time minus its CPU time, the [AggregatedNativeFrame.occurTimes]
+  /// is the time in wall ticks.
+  final List<AggregatedNativeFrame> offCpu;
+}
+
+/// The scheduling state of the target thread over the samples of a jank, see
+/// [SamplerConfig.readSchedState].
+class ThreadStateSummary {
+  const ThreadStateSummary({
+    required this.runStates,
+    required this.syscalls,
+    required this.voluntaryContextSwitches,
+    required this.involuntaryContextSwitches,
+  });
+
+  /// The number of the samples in each run state, e.g., `running`, `sleeping`
+  /// or `disk sleep` (the uninterruptible sleep, usually of I/O).
+  final Map<String, int> runStates;
+
+  /// The number of the samples in each syscall, e.g., `futex` or `read`. A
+  /// syscall without a name is keyed by its number.
+  final Map<String, int> syscalls;
+
+  /// The times the thread gave up the CPU, e.g., to wait for a lock or I/O.
+  final int voluntaryContextSwitches;
+
+  /// The times the thread was preempted, e.g., by the other threads on a busy
+  /// CPU.
+  final int involuntaryContextSwitches;
+
+  @override
+  bool operator ==(Object other) {
+    if (identical(this, other)) return true;
+    if (runtimeType != other.runtimeType) return false;
+    return other is ThreadStateSummary &&
+        mapEquals(runStates, other.runStates) &&
+        mapEquals(syscalls, other.syscalls) &&
+        voluntaryContextSwitches == other.voluntaryContextSwitches &&
+        involuntaryContextSwitches == other.involuntaryContextSwitches;
+  }
+
+  @override
+  int get hashCode => Object.hash(
+    Object.hashAllUnordered(runStates.entries.map((e) => (e.key, e.value))),
+    Object.hashAllUnordered(syscalls.entries.map((e) => (e.key, e.value))),
+    voluntaryContextSwitches,
+    involuntaryContextSwitches,
+  );
+
+  @override
+  String toString() =>
+      'ThreadStateSummary(runStates: $runStates, syscalls: $syscalls, '
+      'voluntaryContextSwitches: $voluntaryContextSwitches, '
+      'involuntaryContextSwitches: $involuntaryContextSwitches)';
+}
+
 /// Class to start a dedicated isolate for collecting stack traces.
 class Sampler {
-  Sampler._(this._processorIsolate, this._responses, this._commands) {
+  Sampler._(
+    this._processor,
+    this._processorIsolate,
+    this._responses,
+    this._commands,
+    this._recoveredSamples,
+  ) {
     _responses.listen(_handleResponsesFromIsolate);
   }
 
   static Future<Sampler> create(SamplerConfig config) async {
     final processor = config.samplerProcessorFactory(config);
     processor.setCurrentThreadAsTarget();
+    // Must be done before the sampler isolate starts the native sampler, which
+    // replaces the file of the previous run.
+    final recoveredSamples = processor.recoverPersistedSamples();
 
     // Create a receive port and add its initial message handler
     final initPort = RawReceivePort();
@@ -83,11 +389,23 @@ class Sampler {
     final receivePort = msg[0] as ReceivePort;
     final sendPort = msg[1] as SendPort;
 
-    return Sampler._(isolate, receivePort, sendPort);
+    return Sampler._(
+      processor,
+      isolate,
+      receivePort,
+      sendPort,
+      recoveredSamples,
+    );
   }
 
+  /// The [SamplerProcessor] of the UI isolate, which is only used for the calls
+  /// that must be made on the UI thread.
+  final SamplerProcessor _processor;
+
   final Isolate _processorIsolate;
 
+  RecoveredSamples? _recoveredSamples;
+
   final SendPort _commands;
   final ReceivePort _responses;
   final Map<int, Completer<Object?>> _activeRequests = {};
@@ -106,8 +424,121 @@ class Sampler {
     return response.data;
   }
 
+  /// Splits the samples within [timestampRange] by whether the target thread
+  /// was running on a CPU, see [CpuTimeSplit]. Returns `null` if the CPU time
+  /// is not sampled, see [SamplerConfig.cpuTimeSampleRateInMicroseconds].
+  Future<CpuTimeSplit?> getCpuTimeSplit(List<int> timestampRange) async {
+    if (_closed) throw StateError('Closed');
+    final completer = Completer<Object?>.sync();
+    final id = _idCounter++;
+    _activeRequests[id] = completer;
+    _commands.send(_GetCpuTimeSplitRequest(id, timestampRange));
+    final response = (await completer.future) as GetCpuTimeSplitResponse;
+    return response.data;
+  }
+
+  /// Summarizes the scheduling state of the target thread over the samples
+  /// within [timestampRange], see [ThreadStateSummary]. Returns `null` if it's
+  /// not read, see [SamplerConfig.readSchedState].
+  Future<ThreadStateSummary?> getThreadStateSummary(
+    List<int> timestampRange,
+  ) async {
+    if (_closed) throw StateError('Closed');
+    final completer = Completer<Object?>.sync();
+    final id = _idCounter++;
+    _activeRequests[id] = completer;
+    _commands.send(_GetThreadStateRequest(id, timestampRange));
+    final response = (await completer.future) as GetThreadStateResponse;
+    return response.data;
+  }
+
+  /// Counts the samples within [timestampRange] by the phase of the UI thread,
+  /// see [SamplerProcessor.summarizeFramePhases]. Returns `null` if the phases
+  /// are not marked, see [SamplerConfig.markFramePhases].
+  Future<Map<FramePhase, int>?> getFramePhases(List<int> timestampRange) async {
+    if (_closed) throw StateError('Closed');
+    final completer = Completer<Object?>.sync();
+    final id = _idCounter++;
+    _activeRequests[id] = completer;
+    _commands.send(_GetFramePhasesRequest(id, timestampRange));
+    final response = (await completer.future) as GetFramePhasesResponse;
+    return response.data;
+  }
+
+  /// Sets the phase of the UI thread and the number of its frame, which are
+  /// recorded with the samples, see [SamplerConfig.markFramePhases]. Must be
+  /// called on the UI thread.
+  void setFramePhase(FramePhase phase, int frameNumber) {
+    if (_closed) return;
+    _processor.setFramePhase(phase, frameNumber);
+  }
+
+  /// Marks the beginning of a frame, see [SamplerConfig.burstSampleRateInMicroseconds].
+  /// Must be called on the UI thread.
+  void markFrameBegin() {
+    if (_closed) return;
+    _processor.markFrameBegin();
+  }
+
+  /// Marks the end of the frame marked by [markFrameBegin].
+  void markFrameEnd() {
+    if (_closed) return;
+    _processor.markFrameEnd();
+  }
+
+  /// Marks the beginning of a task on the UI thread, see
+  /// [SamplerConfig.watchdogTimeoutInMilliseconds]. Must be called on the UI thread.
+  void markUiTaskBegin() {
+    if (_closed) return;
+    _processor.markUiTaskBegin();
+  }
+
+  /// Marks the end of the task marked by [markUiTaskBegin].
+  void markUiTaskEnd() {
+    if (_closed) return;
+    _processor.markUiTaskEnd();
+  }
+
+  /// Starts a burst of [SamplerConfig.burstSampleRateInMicroseconds] sampling,
+  /// e.g., when a jank is detected.
+  void requestSampleBurst() {
+    if (_closed) return;
+    _processor.requestSampleBurst();
+  }
+
+  /// Takes the samples recovered from a previous run that did not shut down
+  /// cleanly, see [SamplerConfig.persistentSamplesPath]. Returns `null` if there
+  /// is none, or they are already taken.
+  RecoveredSamples? takeRecoveredSamples() {
+    final recoveredSamples = _recoveredSamples;
+    _recoveredSamples = null;
+    return recoveredSamples;
+  }
+
+  /// Gets the self-overhead of sampling, see [SamplerStats].
+  SamplerStats getSamplerStats() {
+    return _processor.getSamplerStats();
+  }
+
+  /// Exports the native samples within [timestampRange] in [format], or all
+  /// the samples in the buffer if it's `null`. The profile is encoded and
+  /// compressed on the sampler isolate. Returns `null` if the native sampler is
+  /// not used, see [SamplerConfig.useNativeSampler].
+  Future<Uint8List?> exportProfile(
+    ProfileFormat format, {
+    List<int>? timestampRange,
+  }) async {
+    if (_closed) return null;
+    final completer = Completer<Object?>.sync();
+    final id = _idCounter++;
+    _activeRequests[id] = completer;
+    _commands.send(_ExportProfileRequest(id, format, timestampRange));
+    final response = (await completer.future) as ExportProfileResponse;
+    return response.data?.materialize().asUint8List();
+  }
+
   void _handleResponsesFromIsolate(dynamic message) {
-    final GetSamplesResponse response = message as GetSamplesResponse;
+    final _Response response = message as _Response;
     final completer = _activeRequests.remove(response.id)!;
 
     if (response is RemoteError) {
@@ -131,6 +562,23 @@ class Sampler {
         receivePort.close();
       } else if (message is _GetSamplesRequest) {
         processor.getStackTrace(sendPort, message.id, message.timestampRange);
+      } else if (message is _GetCpuTimeSplitRequest) {
+        processor.getCpuTimeSplit(sendPort, message.id, message.timestampRange);
+      } else if (message is _GetFramePhasesRequest) {
+        processor.getFramePhases(sendPort, message.id, message.timestampRange);
+      } else if (message is _GetThreadStateRequest) {
+        processor.getThreadStateSummary(
+          sendPort,
+          message.id,
+          message.timestampRange,
+        );
+      } else if (message is _ExportProfileRequest) {
+        processor.exportProfile(
+          sendPort,
+          message.id,
+          message.format,
+          message.timestampRange,
+        );
       } else {
         // Not reachable.
         assert(false);
@@ -152,21 +600,37 @@ class Sampler {
 }
 
 class AggregatedNativeFrame {
-  AggregatedNativeFrame(this.frame, {this.occurTimes = 1});
+  AggregatedNativeFrame(
+    this.frame, {
+    this.occurTimes = 1,
+    this.selfOccurTimes = 0,
+    this.pathDepth,
+  });
   NativeFrame frame;
   int occurTimes = 1;
 
+  /// The number of samples in which the frame is the innermost one, which is
+  /// only counted by [StackAggregation.callingContextTree].
+  int selfOccurTimes;
+
+  /// The index of the frame in its call path from the innermost frame, which
+  /// is only set by [StackAggregation.callingContextTree], a 0 starts the next
+  /// path.
+  int? pathDepth;
+
   @override
   bool operator ==(Object other) {
     if (identical(this, other)) return true;
     if (runtimeType != other.runtimeType) return false;
     return other is AggregatedNativeFrame &&
         frame == other.frame &&
-        occurTimes == other.occurTimes;
+        occurTimes == other.occurTimes &&
+        selfOccurTimes == other.selfOccurTimes &&
+        pathDepth == other.pathDepth;
   }
 
   @override
-  int get hashCode => Object.hash(frame, occurTimes);
+  int get hashCode => Object.hash(frame, occurTimes, selfOccurTimes, pathDepth);
 }
 
 typedef SamplerProcessorFactory =
@@ -185,12 +649,121 @@ class SamplerProcessor {
   /// https://github.com/dart-lang/sdk/blob/bcaf745a9be6c4af0c338c43e6304c9e1c4c5535/runtime/vm/profiler.cc#L642
   static const _bufferCount = 641;
 
+  static const _maxTimestamp = 0x7FFFFFFFFFFFFFFF;
+
   RingBuffer<NativeStack>? _buffer;
 
+  bool _isNativeSamplerStarted = false;
+
+  Timer? _watchdogTimer;
+
   void setCurrentThreadAsTarget() {
     _stackCapturer.setCurrentThreadAsTarget();
   }
 
+  /// See [Sampler.markFrameBegin].
+  void markFrameBegin() {
+    _stackCapturer.markFrameBegin();
+  }
+
+  /// See [Sampler.markFrameEnd].
+  void markFrameEnd() {
+    _stackCapturer.markFrameEnd();
+  }
+
+  /// See [Sampler.setFramePhase].
+  void setFramePhase(FramePhase phase, int frameNumber) {
+    _stackCapturer.setFramePhase(phase, frameNumber);
+  }
+
+  /// See [Sampler.markUiTaskBegin].
+  void markUiTaskBegin() {
+    _stackCapturer.markUiTaskBegin();
+  }
+
+  /// See [Sampler.markUiTaskEnd].
+  void markUiTaskEnd() {
+    _stackCapturer.markUiTaskEnd();
+  }
+
+  /// See [Sampler.getSamplerStats].
+  SamplerStats getSamplerStats() {
+    return _stackCapturer.getSamplerStats();
+  }
+
+  /// See [Sampler.requestSampleBurst].
+  void requestSampleBurst() {
+    _stackCapturer.requestNativeSamplerBurst();
+  }
+
+  /// Exports the native samples within [timestampRange] (all of them if it's
+  /// `null`) in [format], see [Sampler.exportProfile]. The profile (`null` if
+  /// the native sampler is not used) is sent to the [sendPort].
+  void exportProfile(
+    SendPort sendPort,
+    int messageId,
+    ProfileFormat format,
+    List<int>? timestampRange,
+  ) {
+    Uint8List? profile;
+    if (_config.useNativeSampler) {
+      profile = _stackCapturer.exportNativeSamplerProfile(
+        format,
+        timestampRange ?? [0, _maxTimestamp],
+      );
+    }
+    sendPort.send(
+      ExportProfileResponse(
+        messageId,
+        profile != null ? TransferableTypedData.fromList([profile]) : null,
+      ),
+    );
+  }
+
+  /// Loads the samples persisted by the previous run at
+  /// [SamplerConfig.persistentSamplesPath], and aggregates the ones within
+  /// [SamplerConfig.recoveredSamplesWindowInMilliseconds] the same way as the
+  /// samples of a jank, see [SamplerConfig.stackAggregation]. Returns `null` if the previous run shut down cleanly,
+  /// or there is nothing to recover.
+  RecoveredSamples? recoverPersistedSamples() {
+    final path = _config.persistentSamplesPath;
+    if (path == null || !_config.useNativeSampler) {
+      return null;
+    }
+
+    final persisted = _stackCapturer.loadPersistedSamples(
+      path,
+      _config.recoveredSamplesWindowInMilliseconds * 1000,
+    );
+    if (persisted == null ||
+        persisted.cleanShutdown ||
+        persisted.stacks.isEmpty) {
+      return null;
+    }
+
+    // The timestamps are of the previous run, all the loaded ones are in range.
+    final stacks = wallTicksOf(persisted.stacks);
+    final List<AggregatedNativeFrame> frames;
+    if (_config.stackAggregation == StackAggregation.callingContextTree) {
+      frames = aggregateCallingContextTree(stacks, [0, _maxTimestamp]);
+    } else {
+      final buffer = RingBuffer<NativeStack>(stacks.length);
+      for (final stack in stacks) {
+        buffer.write(stack);
+      }
+      frames = aggregateStacks(_config, buffer, [0, _maxTimestamp]);
+    }
+    if (frames.isEmpty) {
+      return null;
+    }
+
+    return RecoveredSamples(
+      frames: frames,
+      isolateInstructions: persisted.isolateInstructions,
+      headerLines: persisted.headerLines,
+    );
+  }
+
   /// Retrieves the aggregated [NativeFrame]s.
   ///
   /// The [NativeFrame]s are aggregated in a separate isolate using the [compute] function
@@ -201,19 +774,136 @@ class SamplerProcessor {
     List<int> timestampRange,
   ) async {
     assert(isRunning);
-    assert(_buffer != null, 'Make sure you call `loop` first');
+    assert(
+      _buffer != null || _isNativeSamplerStarted,
+      'Make sure you call `loop` first',
+    );
 
-    final stacktrace = aggregateStacks(_config, _buffer!, timestampRange);
-    sendPort.send(GetSamplesResponse(messageId, stacktrace));
+    sendPort.send(GetSamplesResponse(messageId, _aggregate(timestampRange)));
   }
 
+  List<AggregatedNativeFrame> _aggregate(List<int> timestampRange) {
+    if (_config.stackAggregation == StackAggregation.callingContextTree) {
+      final stacks = _isNativeSamplerStarted
+          ? wallTicksOf(_stackCapturer.readNativeSamples(timestampRange))
+          : _buffer!.readAllReversed();
+      return aggregateCallingContextTree(stacks, timestampRange);
+    }
+    return _isNativeSamplerStarted
+        ? _aggregateNativeSamples(_config, _stackCapturer, timestampRange)
+        : aggregateStacks(_config, _buffer!, timestampRange);
+  }
+
+  /// Splits the samples of the native sampler within [timestampRange] by
+  /// whether the target thread was running on a CPU, see [splitCpuTime]. The
+  /// result (`null` if the CPU time is not sampled) is sent to the [sendPort].
+  void getCpuTimeSplit(
+    SendPort sendPort,
+    int messageId,
+    List<int> timestampRange,
+  ) {
+    assert(isRunning);
+    CpuTimeSplit? split;
+    if (_isNativeSamplerStarted && _samplesCpuTime) {
+      split = splitCpuTime(
+        _stackCapturer.readNativeSamples(timestampRange),
+        timestampRange,
+        _config.sampleRateInMilliseconds * 1000,
+        _config.cpuTimeSampleRateInMicroseconds,
+      );
+    }
+    sendPort.send(GetCpuTimeSplitResponse(messageId, split));
+  }
+
+  /// Summarizes the scheduling state of the samples of the native sampler
+  /// within [timestampRange], see [summarizeThreadState]. The result (`null`
+  /// if it's not read) is sent to the [sendPort].
+  void getThreadStateSummary(
+    SendPort sendPort,
+    int messageId,
+    List<int> timestampRange,
+  ) {
+    assert(isRunning);
+    ThreadStateSummary? summary;
+    if (_isNativeSamplerStarted && _readsSchedState) {
+      summary = summarizeThreadState(
+        wallTicksOf(_stackCapturer.readNativeSamples(timestampRange)),
+        _stackCapturer.getSyscallName,
+      );
+    }
+    sendPort.send(GetThreadStateResponse(messageId, summary));
+  }
+
+  /// Counts the samples of the native sampler within [timestampRange] by the
+  /// phase of the UI thread, see [summarizeFramePhases]. The result (`null` if
+  /// the phases are not marked) is sent to the [sendPort].
+  void getFramePhases(
+    SendPort sendPort,
+    int messageId,
+    List<int> timestampRange,
+  ) {
+    assert(isRunning);
+    Map<FramePhase, int>? phases;
+    if (_isNativeSamplerStarted && _config.markFramePhases) {
+      phases = summarizeFramePhases(
+        wallTicksOf(_stackCapturer.readNativeSamples(timestampRange)),
+      );
+    }
+    sendPort.send(GetFramePhasesResponse(messageId, phases));
+  }
+
+  bool get _readsSchedState =>
+      _config.readSchedState && !_config.usePerfEvents;
+
+  bool get _samplesCpuTime =>
+      _config.cpuTimeSampleRateInMicroseconds > 0 && !_config.usePerfEvents;
+
   /// Start an infinite loop to capture the [NativeStack] at intervals specified
   /// by [SamplerConfig.sampleRateInMilliseconds]. The [NativeStack]s are stored
   /// in a [RingBuffer], and you can get the aggregated [NativeFrame]s using [getStackTrace].
   ///
+  /// If [SamplerConfig.useNativeSampler] is `true`, the [NativeStack]s are captured
+  /// and stored by the native sampler instead, and this function returns immediately.
+  ///
   /// The loop will stop after you call [close].
   Future<void> loop() async {
     final sampleRateInMilliseconds = _config.sampleRateInMilliseconds;
+    _stackCapturer.setModulePathFilters(_config.modulePathFilters);
+    _stackCapturer.setCollectStackTimeout(
+      _config.collectStackTimeoutInMicroseconds,
+    );
+    _stackCapturer.setStackCopySize(_config.stackCopySizeInBytes);
+    if (_config.useUnwindTables) {
+      _stackCapturer.setUnwindTablesEnabled(true);
+    }
+    _startWatchdog();
+    if (_config.useNativeSampler) {
+      _stackCapturer.setNativeSamplerPerfEventsEnabled(_config.usePerfEvents);
+      _stackCapturer.setNativeSamplerCpuTimeSampleRate(
+        _samplesCpuTime ? _config.cpuTimeSampleRateInMicroseconds : 0,
+      );
+      _stackCapturer.setNativeSamplerSchedStateEnabled(_readsSchedState);
+      _stackCapturer.setNativeSamplerBurst(
+        _config.burstSampleRateInMicroseconds,
+        _config.burstDurationInMilliseconds * 1000,
+        _config.jankThreshold * 1000,
+      );
+      _stackCapturer.setNativeSamplerPersistentFile(
+        _config.persistentSamplesPath,
+        _config.persistentSamplesIsolateInstructions,
+        _config.persistentSamplesHeaderLines,
+      );
+      _isNativeSamplerStarted = _startNativeSampler();
+      if (!_isNativeSamplerStarted && _config.persistentSamplesPath != null) {
+        // E.g., the file can't be created, keep the samples in memory instead.
+        _stackCapturer.setNativeSamplerPersistentFile(null, 0, const []);
+        _isNativeSamplerStarted = _startNativeSampler();
+      }
+      if (_isNativeSamplerStarted) {
+        return;
+      }
+    }
+
     _buffer ??= RingBuffer<NativeStack>(_bufferCount);
 
     try {
@@ -231,23 +921,331 @@ class SamplerProcessor {
     }
   }
 
+  bool _startNativeSampler() {
+    return _stackCapturer.startNativeSampler(
+      _config.sampleRateInMilliseconds * 1000,
+      _config.samplesWindowInMilliseconds * 1000,
+      _config.samplesMemoryBudgetInBytes,
+    );
+  }
+
+  void _startWatchdog() {
+    final timeoutInMicros = _config.watchdogTimeoutInMilliseconds * 1000;
+    if (timeoutInMicros <= 0 ||
+        !_stackCapturer.startWatchdog(timeoutInMicros)) {
+      return;
+    }
+
+    // The reports are kept natively until taken, polling them as often as the
+    // watchdog checks the UI thread doesn't delay them any further.
+    final pollIntervalInMicros = max(min(timeoutInMicros ~/ 4, 50000), 1000);
+    _watchdogTimer = Timer.periodic(
+      Duration(microseconds: pollIntervalInMicros),
+      (_) => _deliverWatchdogReports(),
+    );
+  }
+
+  void _deliverWatchdogReports() {
+    final reports = _stackCapturer.takeWatchdogReports();
+    final onWatchdogReport = _config.onWatchdogReport;
+    if (onWatchdogReport == null) {
+      return;
+    }
+
+    for (final report in reports) {
+      try {
+        onWatchdogReport(
+          WatchdogReport(
+            freezeId: report.freezeId,
+            frozenInMicroseconds: report.frozenInMicros,
+            reportIndex: report.reportIndex,
+            frames: _framesOfFreeze(report.frozenInMicros, report.stack),
+          ),
+        );
+      } catch (e, st) {
+        GlanceLogger.log('error when reporting a freeze: $e\n$st');
+      }
+    }
+  }
+
+  /// The aggregated samples of the [frozenInMicros] before the [stack] taken by
+  /// the watchdog, or the frames of the [stack] if there are none.
+  List<AggregatedNativeFrame> _framesOfFreeze(
+    int frozenInMicros,
+    NativeStack stack,
+  ) {
+    if (stack.frames.isNotEmpty &&
+        (_isNativeSamplerStarted || _buffer != null)) {
+      final end = stack.frames.first.timestamp;
+      final frames = _aggregate([end - frozenInMicros, end]);
+      if (frames.isNotEmpty) {
+        return frames;
+      }
+    }
+
+    return stack.frames
+        .where((frame) => frame.module != null)
+        .map((frame) => AggregatedNativeFrame(frame))
+        .toList(growable: false);
+  }
+
   void close() {
     isRunning = false;
+    _watchdogTimer?.cancel();
+    if (_watchdogTimer != null) {
+      _stackCapturer.stopWatchdog();
+      _watchdogTimer = null;
+    }
     _buffer = null;
+    if (_isNativeSamplerStarted) {
+      _stackCapturer.stopNativeSampler();
+      _isNativeSamplerStarted = false;
+    }
     _stackCapturer.dispose();
   }
 
+  /// Aggregate the [NativeFrame]s collected by the native sampler by occurrence
+  /// times, which works the same as [aggregateStacks], but the counts are kept
+  /// up to date natively between the calls instead of rescanning all the samples.
+  static List<AggregatedNativeFrame> _aggregateNativeSamples(
+    SamplerConfig config,
+    StackCapturer stackCapturer,
+    List<int> timestampRange,
+  ) {
+    // The native aggregation weights the samples by their intervals, so the
+    // threshold and the occurrence times are in the samples of the base rate.
+    final maxOccurTimes =
+        config.jankThreshold / config.sampleRateInMilliseconds;
+    return stackCapturer
+        .aggregateNativeSamples(
+          timestampRange,
+          maxOccurTimes.floor(),
+          kMaxStackTraces,
+        )
+        .map((e) => AggregatedNativeFrame(e.frame, occurTimes: e.occurTimes))
+        .toList(growable: false);
+  }
+
+  /// Returns the wall ticks of [stacks], which skips the CPU ticks taken along
+  /// with them (see [SamplerConfig.cpuTimeSampleRateInMicroseconds]), or all
+  /// the [stacks] if they are all CPU ticks, e.g., of `perf_event_open`.
+  @visibleForTesting
+  static List<NativeStack> wallTicksOf(List<NativeStack> stacks) {
+    final wallTicks = stacks
+        .where((stack) => !stack.isCpuTick)
+        .toList(growable: false);
+    return wallTicks.isEmpty ? stacks : wallTicks;
+  }
+
+  /// The names of the run states of [NativeStack.runState], the same as the
+  /// ones of `/proc/<pid>/task/<tid>/status`.
+  static const _runStateNames = {
+    'R': 'running',
+    'S': 'sleeping',
+    'D': 'disk sleep',
+    'T': 'stopped',
+    't': 'tracing stop',
+    'X': 'dead',
+    'Z': 'zombie',
+    'P': 'parked',
+    'I': 'idle',
+  };
+
+  /// Counts the run states and the syscalls of the [stacks], and sums up their
+  /// context switches, see [ThreadStateSummary]. The syscalls are named by
+  /// [syscallName], e.g., [StackCapturer.getSyscallName].
+  @visibleForTesting
+  static ThreadStateSummary summarizeThreadState(
+    List<NativeStack> stacks,
+    String? Function(int number) syscallName,
+  ) {
+    final runStates = <String, int>{};
+    final syscalls = <String, int>{};
+    int voluntaryContextSwitches = 0;
+    int involuntaryContextSwitches = 0;
+    for (final stack in stacks) {
+      if (stack.runState != 0) {
+        final state = String.fromCharCode(stack.runState);
+        final name = _runStateNames[state] ?? state;
+        runStates[name] = (runStates[name] ?? 0) + 1;
+      }
+      if (stack.syscall != kNoSyscall) {
+        final name = syscallName(stack.syscall) ?? '${stack.syscall}';
+        syscalls[name] = (syscalls[name] ?? 0) + 1;
+      }
+      voluntaryContextSwitches += stack.voluntaryContextSwitches;
+      involuntaryContextSwitches += stack.involuntaryContextSwitches;
+    }
+
+    return ThreadStateSummary(
+      runStates: runStates,
+      syscalls: syscalls,
+      voluntaryContextSwitches: voluntaryContextSwitches,
+      involuntaryContextSwitches: involuntaryContextSwitches,
+    );
+  }
+
+  /// Counts the [stacks] by their [NativeStack.framePhase] in a single pass.
+  /// The phases without a stack are left out. The stacks of a single frame
+  /// can be picked out by their [NativeStack.frameNumber] beforehand.
+  @visibleForTesting
+  static Map<FramePhase, int> summarizeFramePhases(List<NativeStack> stacks) {
+    final phases = <FramePhase, int>{};
+    for (final stack in stacks) {
+      phases[stack.framePhase] = (phases[stack.framePhase] ?? 0) + 1;
+    }
+    return phases;
+  }
+
+  /// Splits the [stacks] within [timestampRange] into the frames the thread
+  /// was running on a CPU, by the CPU ticks, and the frames it was blocked
+  /// in, by the wall time of a frame minus its CPU time, see [CpuTimeSplit].
+  ///
+  /// A wall tick stands for the time since the previous one, at most
+  /// [wallRateInMicros] (e.g., a burst ticks faster), and a CPU tick stands for
+  /// [cpuRateInMicros]. A frame is counted once per sample, e.g., recursion.
+  @visibleForTesting
+  static CpuTimeSplit splitCpuTime(
+    List<NativeStack> stacks,
+    List<int> timestampRange,
+    int wallRateInMicros,
+    int cpuRateInMicros,
+  ) {
+    int startTimestamp = timestampRange[0];
+    int endTimestamp = timestampRange[1];
+
+    final inRange = stacks.where((stack) {
+      if (stack.frames.isEmpty) {
+        return false;
+      }
+      final timestamp = stack.frames.last.timestamp;
+      return timestamp >= startTimestamp && timestamp <= endTimestamp;
+    }).toList();
+    inRange.sort(
+      (a, b) => a.frames.last.timestamp.compareTo(b.frames.last.timestamp),
+    );
+
+    final frames = <int, NativeFrame>{};
+    final cpuTicks = <int, int>{};
+    final wallMicros = <int, int>{};
+    int? previousWallTimestamp;
+    for (final stack in inRange) {
+      final pcs = <int>{};
+      for (final frame in stack.frames) {
+        if (frame.module != null && pcs.add(frame.pc)) {
+          frames[frame.pc] = frame;
+        }
+      }
+
+      if (stack.isCpuTick) {
+        for (final pc in pcs) {
+          cpuTicks[pc] = (cpuTicks[pc] ?? 0) + 1;
+        }
+        continue;
+      }
+
+      final timestamp = stack.frames.last.timestamp;
+      final weight = previousWallTimestamp == null
+          ? wallRateInMicros
+          : min(timestamp - previousWallTimestamp, wallRateInMicros);
+      previousWallTimestamp = timestamp;
+      for (final pc in pcs) {
+        wallMicros[pc] = (wallMicros[pc] ?? 0) + weight;
+      }
+    }
+
+    final onCpu = [
+      for (final entry in cpuTicks.entries)
+        AggregatedNativeFrame(frames[entry.key]!, occurTimes: entry.value),
+    ]..sort((a, b) => b.occurTimes.compareTo(a.occurTimes));
+
+    final offCpu = <AggregatedNativeFrame>[];
+    for (final entry in wallMicros.entries) {
+      final offCpuMicros =
+          entry.value - (cpuTicks[entry.key] ?? 0) * cpuRateInMicros;
+      // At least a wall tick, the rest is the noise of the sampling.
+      if (offCpuMicros >= wallRateInMicros) {
+        offCpu.add(
+          AggregatedNativeFrame(
+            frames[entry.key]!,
+            occurTimes: offCpuMicros ~/ wallRateInMicros,
+          ),
+        );
+      }
+    }
+    offCpu.sort((a, b) => b.occurTimes.compareTo(a.occurTimes));
+
+    return CpuTimeSplit(
+      onCpu: onCpu.take(kMaxStackTraces).toList(growable: false),
+      offCpu: offCpu.take(kMaxStackTraces).toList(growable: false),
+    );
+  }
+
+  /// Aggregate the [stacks] within [timestampRange] into a [CallingContextTree],
+  /// and flatten the call paths of its heaviest nodes (at most [kMaxHeaviestPaths]
+  /// of them), each from the innermost frame to the outermost one, see
+  /// [AggregatedNativeFrame.pathDepth]. The [AggregatedNativeFrame.occurTimes]
+  /// is the total count of the node, and the [AggregatedNativeFrame.selfOccurTimes]
+  /// is the self count.
+  @visibleForTesting
+  static List<AggregatedNativeFrame> aggregateCallingContextTree(
+    List<NativeStack> stacks,
+    List<int> timestampRange,
+  ) {
+    int startTimestamp = timestampRange[0];
+    int endTimestamp = timestampRange[1];
+
+    final tree = CallingContextTree();
+    for (final nativeStack in stacks) {
+      if (nativeStack.frames.isEmpty) {
+        continue;
+      }
+      final timestamp = nativeStack.frames.last.timestamp;
+      if (timestamp < startTimestamp || timestamp > endTimestamp) {
+        continue;
+      }
+      tree.add(nativeStack);
+    }
+
+    final frames = <AggregatedNativeFrame>[];
+    for (final node in tree.heaviestNodes(kMaxHeaviestPaths)) {
+      final path = node.path;
+      for (int i = 0; i < path.length; ++i) {
+        if (frames.length >= kMaxStackTraces) {
+          return frames;
+        }
+        frames.add(
+          AggregatedNativeFrame(
+            path[i].frame!,
+            occurTimes: path[i].totalCount,
+            selfOccurTimes: path[i].selfCount,
+            pathDepth: i,
+          ),
+        );
+      }
+    }
+    return frames;
+  }
+
   /// Aggregate the [NativeFrame]s by occurrence times.
+  ///
+  /// A stack is weighted by the time since the previous one in the
+  /// [timestampRange], at most [SamplerConfig.sampleRateInMilliseconds], the
+  /// same as the native aggregation, so the stacks of a burst of the adaptive
+  /// rate count as a fraction of a stack of the base rate. The first stack,
+  /// or one not after the previous one, counts as one.
   @visibleForTesting
   static List<AggregatedNativeFrame> aggregateStacks(
     SamplerConfig config,
     RingBuffer<NativeStack> buffer,
     List<int> timestampRange,
   ) {
+    final weights = Map<AggregatedNativeFrame, double>.identity();
+
     void addOrUpdateAggregatedNativeFrame(
-      SamplerConfig config,
       LinkedHashMap<int, AggregatedNativeFrame> aggregatedFrameMap,
       NativeFrame frame,
+      double weight,
     ) {
       if (frame.module == null) {
         return;
@@ -255,12 +1253,12 @@ class SamplerProcessor {
       final pc = frame.pc;
       if (aggregatedFrameMap.containsKey(pc)) {
         final aggregatedFrame = aggregatedFrameMap[pc]!;
-        final occurTimes = aggregatedFrame.occurTimes + 1;
-        aggregatedFrame.occurTimes = occurTimes;
         aggregatedFrame.frame = frame;
+        weights[aggregatedFrame] = weights[aggregatedFrame]! + weight;
       } else {
         final aggregatedFrame = AggregatedNativeFrame(frame);
         aggregatedFrameMap[pc] = aggregatedFrame;
+        weights[aggregatedFrame] = weight;
       }
     }
 
@@ -269,6 +1267,19 @@ class SamplerProcessor {
 
     final maxOccurTimes =
         config.jankThreshold / config.sampleRateInMilliseconds;
+    final sampleRateInMicros = config.sampleRateInMilliseconds * 1000;
+
+    // From the newest to the oldest.
+    final stacks = buffer
+        .readAllReversed()
+        .where((nativeStack) {
+          if (nativeStack.frames.isEmpty) {
+            return false;
+          }
+          final timestamp = nativeStack.frames.last.timestamp;
+          return timestamp >= startTimestamp && timestamp <= endTimestamp;
+        })
+        .toList(growable: false);
 
     final parentFrameMap =
         LinkedHashMap<
@@ -276,53 +1287,34 @@ class SamplerProcessor {
           LinkedHashMap<int, AggregatedNativeFrame>
         >.identity();
 
-    for (final nativeStack in buffer.readAllReversed()) {
-      if (nativeStack.frames.isEmpty) {
-        continue;
-      }
-
-      final parentFrame = nativeStack.frames.last;
-      bool isInclude =
-          parentFrame.timestamp >= startTimestamp &&
-          parentFrame.timestamp <= endTimestamp;
-      if (!isInclude) {
-        continue;
+    for (int i = 0; i < stacks.length; ++i) {
+      final frames = stacks[i].frames;
+      final parentFrame = frames.last;
+      double weight = 1;
+      if (i + 1 < stacks.length) {
+        final interval =
+            parentFrame.timestamp - stacks[i + 1].frames.last.timestamp;
+        if (interval > 0 && interval < sampleRateInMicros) {
+          weight = interval / sampleRateInMicros;
+        }
       }
 
-      int parentFramePc = parentFrame.pc;
-      bool isContainParentFrame = parentFrameMap.containsKey(parentFramePc);
-
-      if (isContainParentFrame) {
-        final aggregatedFrameMap = parentFrameMap[parentFramePc]!;
-        final frames = nativeStack.frames;
-
-        // Aggregate from parent.
-        for (int i = frames.length - 1; i >= 0; --i) {
-          addOrUpdateAggregatedNativeFrame(
-            config,
-            aggregatedFrameMap,
-            frames[i],
-          );
-        }
-      } else {
-        final aggregatedFrameMap =
-            LinkedHashMap<int, AggregatedNativeFrame>.identity();
-        final frames = nativeStack.frames;
-        for (int i = frames.length - 1; i >= 0; --i) {
-          addOrUpdateAggregatedNativeFrame(
-            config,
-            aggregatedFrameMap,
-            frames[i],
-          );
-        }
-        parentFrameMap.putIfAbsent(parentFramePc, () => aggregatedFrameMap);
+      // Aggregate from parent.
+      final aggregatedFrameMap = parentFrameMap.putIfAbsent(
+        parentFrame.pc,
+        () => LinkedHashMap<int, AggregatedNativeFrame>.identity(),
+      );
+      for (int j = frames.length - 1; j >= 0; --j) {
+        addOrUpdateAggregatedNativeFrame(aggregatedFrameMap, frames[j], weight);
       }
     }
 
     List<AggregatedNativeFrame> allFrameList = <AggregatedNativeFrame>[];
     for (final entry in parentFrameMap.entries) {
       for (final jankFrame in entry.value.values.toList().reversed) {
-        if (jankFrame.occurTimes > maxOccurTimes) {
+        final weight = weights[jankFrame]!;
+        if (weight > maxOccurTimes) {
+          jankFrame.occurTimes = weight.round();
           allFrameList.add(jankFrame);
         }
 
@@ -0,0 +1,138 @@
+/// A histogram with log2 buckets, the bucket 0 counts the values <= 0, and the
+/// bucket i counts the values in [2^(i-1), 2^i). See `NativeHistogram` in
+/// `sampler_stats.h`.
+class SamplerHistogram {
+  const SamplerHistogram({
+    required this.count,
+    required this.sum,
+    required this.max,
+    required this.buckets,
+  });
+
+  /// The number of the recorded values.
+  final int count;
+
+  /// The sum of the recorded values.
+  final int sum;
+
+  /// The maximum recorded value.
+  final int max;
+
+  /// The number of the recorded values of each bucket.
+  final List<int> buckets;
+
+  /// The mean of the recorded values, or 0 if there is none.
+  double get mean => count == 0 ? 0 : sum / count;
+
+  /// An upper bound of the value at the [percentile] (from 0.0 to 1.0), which
+  /// is the upper bound of the bucket containing it, capped by [max].
+  int valueAtPercentile(double percentile) {
+    assert(percentile >= 0 && percentile <= 1);
+    if (count == 0) {
+      return 0;
+    }
+    final target = (percentile * count).ceil().clamp(1, count);
+    int seen = 0;
+    for (int i = 0; i < buckets.length; ++i) {
+      seen += buckets[i];
+      if (seen >= target) {
+        final upperBound = i == 0 ? 0 : (1 << i) - 1;
+        return upperBound < max ? upperBound : max;
+      }
+    }
+    return max;
+  }
+
+  /// The difference of the values recorded since the [previous] one, note that
+  /// the [max] can't be subtracted, and is kept as is.
+  SamplerHistogram operator -(SamplerHistogram previous) {
+    return SamplerHistogram(
+      count: count - previous.count,
+      sum: sum - previous.sum,
+      max: max,
+      buckets: List.generate(
+        buckets.length,
+        (i) =>
+            buckets[i] -
+            (i < previous.buckets.length ? previous.buckets[i] : 0),
+      ),
+    );
+  }
+
+  @override
+  String toString() {
+    return 'SamplerHistogram(count: $count, mean: ${mean.toStringAsFixed(1)}, '
+        'p50: ${valueAtPercentile(0.5)}, p99: ${valueAtPercentile(0.99)}, '
+        'max: $max)';
+  }
+}
+
+/// The self-overhead of sampling the stack traces since the process started,
+/// see `GetSamplerStats` in `sampler_stats.h`.
+///
+/// The counters are never reset, subtract a previous [SamplerStats] to get the
+/// overhead of a period.
+class SamplerStats {
+  const SamplerStats({
+    required this.samplesAttempted,
+    required this.samplesSucceeded,
+    required this.samplesTimedOut,
+    required this.samplesFailed,
+    required this.framesTruncated,
+    required this.signalDeliveryInNanoseconds,
+    required this.targetPauseInNanoseconds,
+    required this.walkDepth,
+  });
+
+  final int samplesAttempted;
+
+  final int samplesSucceeded;
+
+  /// The samples dropped because the target thread was not sampled in time,
+  /// see `GlanceConfiguration` and `SetCollectStackTimeout`.
+  final int samplesTimedOut;
+
+  /// The samples failed for the reasons other than timing out.
+  final int samplesFailed;
+
+  /// The samples with more frames than a sample can hold, where the outermost
+  /// frames are dropped.
+  final int framesTruncated;
+
+  /// The latency from requesting a sample to the target thread being stopped.
+  final SamplerHistogram signalDeliveryInNanoseconds;
+
+  /// How long the target thread is paused for a sample.
+  final SamplerHistogram targetPauseInNanoseconds;
+
+  /// The number of frames of the samples.
+  final SamplerHistogram walkDepth;
+
+  /// The difference of the stats since the [previous] one.
+  SamplerStats operator -(SamplerStats previous) {
+    return SamplerStats(
+      samplesAttempted: samplesAttempted - previous.samplesAttempted,
+      samplesSucceeded: samplesSucceeded - previous.samplesSucceeded,
+      samplesTimedOut: samplesTimedOut - previous.samplesTimedOut,
+      samplesFailed: samplesFailed - previous.samplesFailed,
+      framesTruncated: framesTruncated - previous.framesTruncated,
+      signalDeliveryInNanoseconds:
+          signalDeliveryInNanoseconds - previous.signalDeliveryInNanoseconds,
+      targetPauseInNanoseconds:
+          targetPauseInNanoseconds - previous.targetPauseInNanoseconds,
+      walkDepth: walkDepth - previous.walkDepth,
+    );
+  }
+
+  @override
+  String toString() {
+    return 'SamplerStats(samplesAttempted: $samplesAttempted, '
+        'samplesSucceeded: $samplesSucceeded, '
+        'samplesTimedOut: $samplesTimedOut, '
+        'samplesFailed: $samplesFailed, '
+        'framesTruncated: $framesTruncated, '
+        'signalDeliveryInNanoseconds: $signalDeliveryInNanoseconds, '
+        'targetPauseInNanoseconds: $targetPauseInNanoseconds, '
+        'walkDepth: $walkDepth)';
+  }
+}
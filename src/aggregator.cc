@@ -0,0 +1,293 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "aggregator.h"
+
+#include <algorithm>
+
+namespace glance
+{
+    SampleAggregator::SampleAggregator(int64_t sample_rate_in_micros)
+        : low_position_(0),
+          high_position_(0),
+          occur_times_threshold_(0),
+          sample_rate_in_micros_(sample_rate_in_micros),
+          newest_timestamp_(0),
+          wall_samples_only_(false)
+    {
+    }
+
+    void SampleAggregator::Reset(uint64_t position)
+    {
+        groups_.Clear();
+        frames_.Clear();
+        hot_frames_.clear();
+        weights_.clear();
+        newest_timestamp_ = 0;
+        low_position_ = position;
+        high_position_ = position;
+    }
+
+    void SampleAggregator::set_wall_samples_only(bool wall_samples_only)
+    {
+        if (wall_samples_only != wall_samples_only_)
+        {
+            // The samples counted so far would not be removed the same way.
+            wall_samples_only_ = wall_samples_only;
+            Reset(low_position_);
+        }
+    }
+
+    uint64_t SampleAggregator::NewestPositionOfGroup(uword parent_pc)
+    {
+        const GroupCount *group = groups_.Find(parent_pc);
+        return group != nullptr ? group->newest_position : 0;
+    }
+
+    int64_t SampleAggregator::WeightOf(const NativeSample &sample)
+    {
+        if (sample_rate_in_micros_ <= 0)
+        {
+            return 1;
+        }
+
+        // The first sample, or the one after a gap, covers the base interval.
+        int64_t weight = sample_rate_in_micros_;
+        if (newest_timestamp_ != 0)
+        {
+            weight = std::min(std::max<int64_t>(sample.timestamp - newest_timestamp_, 0), sample_rate_in_micros_);
+        }
+        newest_timestamp_ = sample.timestamp;
+        return weight;
+    }
+
+    bool SampleAggregator::IsCounted(const NativeSample &sample) const
+    {
+        return sample.depth > 0 && (!wall_samples_only_ || sample.kind == GLANCE_SAMPLE_KIND_WALL);
+    }
+
+    void SampleAggregator::UpdateHotFrame(const FrameKey &key, FrameCount *count)
+    {
+        int64_t unit = std::max<int64_t>(sample_rate_in_micros_, 1);
+        bool is_hot = count->weight > occur_times_threshold_ * unit;
+        if (is_hot && count->hot_index == -1)
+        {
+            count->hot_index = static_cast<int32_t>(hot_frames_.size());
+            hot_frames_.push_back(key);
+        }
+        else if (!is_hot && count->hot_index != -1)
+        {
+            // Swap with the last one and pop.
+            int32_t index = count->hot_index;
+            count->hot_index = -1;
+            const FrameKey last = hot_frames_.back();
+            hot_frames_.pop_back();
+            if (static_cast<size_t>(index) < hot_frames_.size())
+            {
+                hot_frames_[index] = last;
+                frames_.Find(last)->hot_index = index;
+            }
+        }
+    }
+
+    void SampleAggregator::Add(uint64_t position, const NativeSample &sample)
+    {
+        if (!IsCounted(sample))
+        {
+            weights_.push_back(0);
+            return;
+        }
+        size_t depth = static_cast<size_t>(sample.depth);
+        int64_t weight = WeightOf(sample);
+        weights_.push_back(weight);
+
+        uword parent_pc = static_cast<uword>(sample.pcs[depth - 1]);
+        GroupCount *group = groups_.FindOrInsert(parent_pc, {0, position});
+        group->samples++;
+        group->newest_position = position;
+
+        ModuleMap::Instance().Resolve(sample.pcs, depth, frame_infos_);
+        for (size_t i = 0; i < depth; ++i)
+        {
+            if (frame_infos_[i].module_id == -1)
+            {
+                continue;
+            }
+
+            FrameKey key{parent_pc, static_cast<uword>(sample.pcs[i])};
+            FrameCount *count = frames_.FindOrInsert(
+                key,
+                {0,
+                 0,
+                 sample.timestamp,
+                 static_cast<int32_t>(depth - 1 - i),
+                 frame_infos_[i].module_id,
+                 frame_infos_[i].symbol_id,
+                 -1});
+            count->occur_times++;
+            count->weight += weight;
+            count->timestamp = sample.timestamp;
+            UpdateHotFrame(key, count);
+        }
+    }
+
+    void SampleAggregator::Remove(const NativeSample &sample, int64_t weight)
+    {
+        if (!IsCounted(sample))
+        {
+            return;
+        }
+        size_t depth = static_cast<size_t>(sample.depth);
+
+        uword parent_pc = static_cast<uword>(sample.pcs[depth - 1]);
+        GroupCount *group = groups_.Find(parent_pc);
+        if (group != nullptr && --group->samples <= 0)
+        {
+            groups_.Erase(parent_pc);
+        }
+
+        ModuleMap::Instance().Resolve(sample.pcs, depth, frame_infos_);
+        for (size_t i = 0; i < depth; ++i)
+        {
+            if (frame_infos_[i].module_id == -1)
+            {
+                continue;
+            }
+
+            FrameKey key{parent_pc, static_cast<uword>(sample.pcs[i])};
+            FrameCount *count = frames_.Find(key);
+            if (count == nullptr)
+            {
+                // The module path filters are changed after the sample is added.
+                continue;
+            }
+            count->occur_times--;
+            count->weight -= weight;
+            UpdateHotFrame(key, count);
+            if (count->occur_times <= 0)
+            {
+                frames_.Erase(key);
+            }
+        }
+    }
+
+    size_t SampleAggregator::Aggregate(const SampleRing &ring,
+                                       int64_t start,
+                                       int64_t end,
+                                       int64_t occur_times_threshold,
+                                       NativeAggregatedFrame *out,
+                                       size_t max_count)
+    {
+        if (occur_times_threshold < 0)
+        {
+            occur_times_threshold = 0;
+        }
+
+        uint64_t low = ring.LowerBound(start);
+        uint64_t high = end == INT64_MAX ? ring.write_position() : ring.LowerBound(end + 1);
+        if (high < low)
+        {
+            high = low;
+        }
+
+        // The loaded modules are checked once per aggregation, not per sample.
+        ModuleMap::Instance().Refresh();
+
+        // Only moving the window forward is incremental, start over otherwise.
+        if (occur_times_threshold != occur_times_threshold_ ||
+            low < low_position_ || high < high_position_ || low > high_position_)
+        {
+            occur_times_threshold_ = occur_times_threshold;
+            Reset(low);
+        }
+
+        for (uint64_t position = low_position_; position < low; ++position)
+        {
+            if (!ring.ReadAt(position, &sample_))
+            {
+                // The sample leaving the window is already overwritten, so its
+                // counts can't be removed.
+                Reset(low);
+                break;
+            }
+            Remove(sample_, weights_.front());
+            weights_.pop_front();
+        }
+        low_position_ = low;
+
+        if (high_position_ == low_position_)
+        {
+            // The first sample counted follows the one before the window, if
+            // it's still in the ring. The CPU ticks may be in between.
+            constexpr uint64_t kMaxLookBehind = 32;
+            for (uint64_t position = low_position_; position > 0 && low_position_ - position < kMaxLookBehind;
+                 --position)
+            {
+                if (!ring.ReadAt(position - 1, &sample_))
+                {
+                    break;
+                }
+                if (IsCounted(sample_))
+                {
+                    newest_timestamp_ = sample_.timestamp;
+                    break;
+                }
+            }
+        }
+
+        for (uint64_t position = high_position_; position < high; ++position)
+        {
+            if (ring.ReadAt(position, &sample_))
+            {
+                Add(position, sample_);
+            }
+            else
+            {
+                weights_.push_back(0);
+            }
+        }
+        high_position_ = high;
+
+        std::vector<const FrameKey *> hot_frames;
+        hot_frames.reserve(hot_frames_.size());
+        for (const FrameKey &key : hot_frames_)
+        {
+            hot_frames.push_back(&key);
+        }
+        // The groups of the newer samples come first, and the frames of a group are
+        // ordered from the innermost to the outermost. Only the reported ones are
+        // sorted.
+        size_t count = std::min(max_count, hot_frames.size());
+        int64_t unit = std::max<int64_t>(sample_rate_in_micros_, 1);
+        std::partial_sort(hot_frames.begin(), hot_frames.begin() + count, hot_frames.end(),
+                          [this](const FrameKey *a, const FrameKey *b)
+                          {
+                              if (a->parent_pc != b->parent_pc)
+                              {
+                                  uint64_t a_position = NewestPositionOfGroup(a->parent_pc);
+                                  uint64_t b_position = NewestPositionOfGroup(b->parent_pc);
+                                  if (a_position != b_position)
+                                  {
+                                      return a_position > b_position;
+                                  }
+                                  return a->parent_pc < b->parent_pc;
+                              }
+                              int32_t a_depth = frames_.Find(*a)->depth_from_root;
+                              int32_t b_depth = frames_.Find(*b)->depth_from_root;
+                              if (a_depth != b_depth)
+                              {
+                                  return a_depth > b_depth;
+                              }
+                              return a->pc < b->pc; });
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const FrameCount *frame = frames_.Find(*hot_frames[i]);
+            out[i] = {static_cast<int64_t>(hot_frames[i]->pc),
+                      frame->timestamp,
+                      (frame->weight + unit / 2) / unit,
+                      frame->module_id,
+                      frame->symbol_id};
+        }
+        return count;
+    }
+} // namespace glance
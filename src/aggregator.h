@@ -0,0 +1,155 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef AGGREGATOR_H_
+#define AGGREGATOR_H_
+
+#include <deque>
+#include <vector>
+
+#include "collect_stack.h"
+#include "hash_map.h"
+#include "module_map.h"
+#include "sample_ring.h"
+
+/// A frame aggregated by `AggregateNativeSamples`.
+struct NativeAggregatedFrame
+{
+    int64_t pc;
+    // The timestamp of the newest sample containing the frame.
+    int64_t timestamp;
+    // In the samples of the base rate, see `SampleAggregator`.
+    int64_t occur_times;
+    int32_t module_id;
+    int32_t symbol_id;
+};
+
+namespace glance
+{
+    /// Aggregates the frames of the samples in a timestamp window by occurrence
+    /// times, the same way as `SamplerProcessor.aggregateStacks` does: the samples
+    /// are grouped by the outermost frame, and only the frames with a module that
+    /// occur more than the threshold are reported.
+    ///
+    /// The counts are kept between queries. A query only adds the samples entering
+    /// the window and removes the samples leaving it, which is cheap for the bursts
+    /// of jank reports over mostly the same samples. The frames above the threshold
+    /// are tracked as their counts change, so a query doesn't scan all the frames.
+    ///
+    /// A sample is weighted by the time since the previous one, at most the base
+    /// rate, the same as `WriteProfile`, so the samples of a burst of the
+    /// adaptive rate count as a fraction of a sample of the base rate, and the
+    /// occurrence times are in the samples of the base rate.
+    ///
+    /// Must be used from one thread at a time.
+    class SampleAggregator
+    {
+    public:
+        /// A |sample_rate_in_micros| of 0 counts every sample as one.
+        explicit SampleAggregator(int64_t sample_rate_in_micros);
+
+        ~SampleAggregator() = default;
+
+        /// Aggregates the samples of |ring| within [|start|, |end|], and copies at
+        /// most |max_count| frames that occur more than |occur_times_threshold| to
+        /// |out|. Returns the number of frames copied.
+        size_t Aggregate(const SampleRing &ring,
+                         int64_t start,
+                         int64_t end,
+                         int64_t occur_times_threshold,
+                         NativeAggregatedFrame *out,
+                         size_t max_count);
+
+        /// Only aggregates the wall ticks, which skips the CPU ticks taken along
+        /// with them, see `StartCpuTimeSampling`. Changing it starts the counts
+        /// over on the next `Aggregate`.
+        void set_wall_samples_only(bool wall_samples_only);
+
+    private:
+        struct FrameKey
+        {
+            uword parent_pc;
+            uword pc;
+
+            bool operator==(const FrameKey &other) const
+            {
+                return parent_pc == other.parent_pc && pc == other.pc;
+            }
+        };
+
+        struct FrameKeyHash
+        {
+            size_t operator()(const FrameKey &key) const
+            {
+                return static_cast<size_t>(HashWord(key.parent_pc ^ HashWord(key.pc)));
+            }
+        };
+
+        struct FrameCount
+        {
+            // The number of the samples, which erases the frame once it's 0.
+            int64_t occur_times;
+            // The sum of the weights of the samples, see `WeightOf`.
+            int64_t weight;
+            int64_t timestamp;
+            int32_t depth_from_root;
+            int32_t module_id;
+            int32_t symbol_id;
+            // The index in |hot_frames_|, or -1 if not above the threshold.
+            int32_t hot_index;
+        };
+
+        struct GroupCount
+        {
+            int64_t samples;
+            // The position of the newest sample of the group, the groups are
+            // reported from the newest to the oldest.
+            uint64_t newest_position;
+        };
+
+        void Reset(uint64_t position);
+
+        /// Returns the weight of |sample| following the sample counted last, and
+        /// updates |newest_timestamp_|.
+        int64_t WeightOf(const NativeSample &sample);
+
+        bool IsCounted(const NativeSample &sample) const;
+
+        void Add(uint64_t position, const NativeSample &sample);
+
+        void Remove(const NativeSample &sample, int64_t weight);
+
+        void UpdateHotFrame(const FrameKey &key, FrameCount *count);
+
+        uint64_t NewestPositionOfGroup(uword parent_pc);
+
+        HashMap<uword, GroupCount, WordHash> groups_;
+
+        HashMap<FrameKey, FrameCount, FrameKeyHash> frames_;
+
+        std::vector<FrameKey> hot_frames_;
+
+        // The window of positions [|low_position_|, |high_position_|) counted.
+        uint64_t low_position_;
+
+        uint64_t high_position_;
+
+        int64_t occur_times_threshold_;
+
+        const int64_t sample_rate_in_micros_;
+
+        // The weight of each position of the window, so a sample leaving it is
+        // removed by the weight it's added with.
+        std::deque<int64_t> weights_;
+
+        // The timestamp of the newest sample counted, 0 if none.
+        int64_t newest_timestamp_;
+
+        bool wall_samples_only_;
+
+        NativeSample sample_;
+
+        NativeFrameInfo frame_infos_[GLANCE_MAX_STACK_DEPTH];
+    };
+} // namespace glance
+
+#endif // AGGREGATOR_H_
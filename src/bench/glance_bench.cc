@@ -0,0 +1,301 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+// Micro-benchmarks of the capture path, which report the p50/p99/max of:
+//
+// - The round trip of `CollectStackTraceOfTargetThread`, from sending the signal
+//   to the walked stack being handed back.
+// - How long the target thread is paused, see `g_last_target_pause_in_nanos_`.
+// - The cost of `StackWalker::Walk` per frame.
+// - Looking up the symbol name of a pc with `dladdr` and `LookupSymbolName`.
+//
+// The target threads are synthetic, they recurse to a given depth of frames with
+// frame pointers and spin there, so the numbers of different stack depths can be
+// compared.
+//
+// Usage: glance_bench [iterations] [depth...]
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "collect_stack.h"
+#include "sample_ring.h"
+#include "thread_registry.h"
+
+#define BENCH_NOINLINE __attribute__((noinline))
+
+namespace glance
+{
+    namespace
+    {
+        constexpr size_t kDefaultIterations = 2000;
+
+        constexpr int kDefaultDepths[] = {8, 32, 96};
+
+        // Enough for the deepest stack walked by `BenchWalk`.
+        constexpr size_t kMaxWalkFrames = 1024;
+
+        class Stats
+        {
+        public:
+            void Add(int64_t value) { values_.push_back(value); }
+
+            void Print(const char *name, const char *unit, double scale = 1.0)
+            {
+                if (values_.empty())
+                {
+                    printf("  %-28s no samples\n", name);
+                    return;
+                }
+
+                std::sort(values_.begin(), values_.end());
+                printf("  %-28s p50 %10.1f %s  p99 %10.1f %s  max %10.1f %s  (n=%zu)\n",
+                       name,
+                       Percentile(0.50) * scale, unit,
+                       Percentile(0.99) * scale, unit,
+                       values_.back() * scale, unit,
+                       values_.size());
+            }
+
+        private:
+            double Percentile(double percentile)
+            {
+                size_t index = static_cast<size_t>(percentile * (values_.size() - 1) + 0.5);
+                return static_cast<double>(values_[index]);
+            }
+
+            std::vector<int64_t> values_;
+        };
+
+        // A thread with |depth| frames spinning at the innermost frame until
+        // |stop| is set.
+        struct SyntheticTarget
+        {
+            int depth = 0;
+            std::atomic<int32_t> id{-1};
+            std::atomic<bool> ready{false};
+            std::atomic<bool> stop{false};
+            std::atomic<uint64_t> spins{0};
+        };
+
+        BENCH_NOINLINE void Spin(SyntheticTarget *target)
+        {
+            target->id.store(RegisterTargetThread("bench"));
+            target->ready.store(true);
+            while (!target->stop.load(std::memory_order_relaxed))
+            {
+                target->spins.fetch_add(1, std::memory_order_relaxed);
+            }
+            UnregisterTargetThread();
+        }
+
+        BENCH_NOINLINE int Recurse(SyntheticTarget *target, int depth)
+        {
+            if (depth <= 0)
+            {
+                Spin(target);
+                return 0;
+            }
+            int result = Recurse(target, depth - 1);
+            // Keeps the call from being turned into a tail call, which drops a frame.
+            asm volatile("" ::: "memory");
+            return result + 1;
+        }
+
+        BENCH_NOINLINE int RecurseAndRun(int depth, void (*callback)(void *), void *data)
+        {
+            if (depth <= 0)
+            {
+                callback(data);
+                return 0;
+            }
+            int result = RecurseAndRun(depth - 1, callback, data);
+            asm volatile("" ::: "memory");
+            return result + 1;
+        }
+
+        size_t CountFrames(const int64_t *pcs, size_t size)
+        {
+            size_t depth = 0;
+            while (depth < size && pcs[depth] != 0)
+            {
+                ++depth;
+            }
+            return depth;
+        }
+
+        void BenchCollect(int depth, size_t iterations, size_t stack_copy_size)
+        {
+            SetStackCopySize(stack_copy_size);
+
+            SyntheticTarget target;
+            target.depth = depth;
+            std::thread thread([&target]()
+                               { Recurse(&target, target.depth); });
+            while (!target.ready.load())
+            {
+                std::this_thread::yield();
+            }
+            if (target.id.load() == -1)
+            {
+                printf("  failed to register the target thread\n");
+                target.stop.store(true);
+                thread.join();
+                return;
+            }
+            ThreadRegistry::Instance().SetDefaultTarget(target.id.load());
+
+            Stats round_trip;
+            Stats pause;
+            Stats frames;
+            size_t errors = 0;
+            int64_t pcs[GLANCE_MAX_STACK_DEPTH];
+            for (size_t i = 0; i < iterations; ++i)
+            {
+                int64_t start = GetCurrentMonotonicNanos();
+                char *error = CollectStackTraceOfTargetThread(pcs, GLANCE_MAX_STACK_DEPTH);
+                int64_t end = GetCurrentMonotonicNanos();
+                if (error != nullptr)
+                {
+                    free(error);
+                    ++errors;
+                    continue;
+                }
+                round_trip.Add(end - start);
+                pause.Add(g_last_target_pause_in_nanos_);
+                frames.Add(static_cast<int64_t>(CountFrames(pcs, GLANCE_MAX_STACK_DEPTH)));
+            }
+
+            target.stop.store(true);
+            thread.join();
+            ThreadRegistry::Instance().SetDefaultTarget(-1);
+
+            printf("CollectStackTraceOfTargetThread depth=%d stack_copy_size=%zu errors=%zu\n",
+                   depth, stack_copy_size, errors);
+            round_trip.Print("round trip", "us", 1e-3);
+            pause.Print("target paused", "us", 1e-3);
+            frames.Print("frames walked", "");
+        }
+
+        struct WalkBench
+        {
+            size_t iterations;
+            Stats walk;
+            Stats per_frame;
+            size_t frames;
+        };
+
+        BENCH_NOINLINE void WalkCurrentStack(void *data)
+        {
+            WalkBench *bench = static_cast<WalkBench *>(data);
+
+            TargetThread self{-1, pthread_self(), GetCurrentOsThreadId(), 0, 0};
+            if (!GetCurrentThreadStackBounds(&self.stack_lower, &self.stack_upper))
+            {
+                return;
+            }
+
+            static int64_t pcs[kMaxWalkFrames];
+            Buffer buffer{kMaxWalkFrames, pcs};
+            uword fp = reinterpret_cast<uword>(__builtin_frame_address(0));
+            uword pc = reinterpret_cast<uword>(&WalkCurrentStack);
+            for (size_t i = 0; i < bench->iterations; ++i)
+            {
+                int64_t start = GetCurrentMonotonicNanos();
+                StackWalker stack_walker(self, &buffer, pc, fp, fp, fp);
+                stack_walker.Walk();
+                int64_t end = GetCurrentMonotonicNanos();
+
+                bench->frames = CountFrames(pcs, kMaxWalkFrames);
+                bench->walk.Add(end - start);
+                // In picoseconds, the walk of a frame takes a few nanoseconds.
+                bench->per_frame.Add((end - start) * 1000 / static_cast<int64_t>(std::max<size_t>(bench->frames, 1)));
+            }
+        }
+
+        void BenchWalk(int depth, size_t iterations)
+        {
+            WalkBench bench{iterations, {}, {}, 0};
+            RecurseAndRun(depth, &WalkCurrentStack, &bench);
+
+            printf("StackWalker::Walk depth=%d frames=%zu\n", depth, bench.frames);
+            bench.walk.Print("walk", "us", 1e-3);
+            bench.per_frame.Print("per frame", "ns", 1e-3);
+        }
+
+        void BenchLookupSymbolName(size_t iterations)
+        {
+            // The exported functions of the executable and of libc, so both the
+            // executable and a shared library are looked up.
+            const void *addresses[] = {
+                reinterpret_cast<const void *>(&RegisterTargetThread),
+                reinterpret_cast<const void *>(&GetCurrentMonotonicNanos),
+                reinterpret_cast<const void *>(&LookupSymbolName),
+                reinterpret_cast<const void *>(&printf),
+                reinterpret_cast<const void *>(&malloc),
+            };
+            constexpr size_t kAddressCount = sizeof(addresses) / sizeof(addresses[0]);
+
+            Stats dladdr_stats;
+            Stats lookup;
+            size_t unresolved = 0;
+            for (size_t i = 0; i < iterations; ++i)
+            {
+                const void *address = addresses[i % kAddressCount];
+                Dl_info info;
+                int64_t start = GetCurrentMonotonicNanos();
+                int found = dladdr(address, &info);
+                int64_t middle = GetCurrentMonotonicNanos();
+                char *name = found != 0 ? LookupSymbolName(&info) : nullptr;
+                int64_t end = GetCurrentMonotonicNanos();
+
+                dladdr_stats.Add(middle - start);
+                if (name == nullptr)
+                {
+                    ++unresolved;
+                    continue;
+                }
+                lookup.Add(end - middle);
+                free(name);
+            }
+
+            printf("LookupSymbolName unresolved=%zu\n", unresolved);
+            dladdr_stats.Print("dladdr", "us", 1e-3);
+            lookup.Print("LookupSymbolName", "us", 1e-3);
+        }
+    } // namespace
+} // namespace glance
+
+int main(int argc, char **argv)
+{
+    size_t iterations = glance::kDefaultIterations;
+    std::vector<int> depths;
+    if (argc > 1)
+    {
+        iterations = static_cast<size_t>(strtoul(argv[1], nullptr, 10));
+    }
+    for (int i = 2; i < argc; ++i)
+    {
+        depths.push_back(atoi(argv[i]));
+    }
+    if (depths.empty())
+    {
+        depths.assign(std::begin(glance::kDefaultDepths), std::end(glance::kDefaultDepths));
+    }
+
+    for (int depth : depths)
+    {
+        glance::BenchCollect(depth, iterations, 0);
+        glance::BenchCollect(depth, iterations, 16 * 1024);
+    }
+    for (int depth : depths)
+    {
+        glance::BenchWalk(depth, iterations);
+    }
+    glance::BenchLookupSymbolName(iterations);
+    return 0;
+}
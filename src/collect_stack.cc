@@ -7,10 +7,16 @@
 // Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
 
 #include "collect_stack.h"
+#include "sample_ring.h"
+#include "sampler_stats.h"
+#include "unwind_table.h"
 
 #include <cstring>
+#include <mutex>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
+#include <vector>
 #include <cxxabi.h> // NOLINT
 #include <dlfcn.h>  // NOLINT
 
@@ -24,6 +30,8 @@
 // +-------------+
 intptr_t kHostSavedCallerPcSlotFromFp = 1;
 intptr_t kHostSavedCallerFpSlotFromFp = 0;
+// The stack pointer of the caller, i.e., the CFA.
+intptr_t kHostCallerSpSlotFromFp = 2;
 #elif defined(HOST_ARCH_RISCV32) || defined(HOST_ARCH_RISCV64)
 // +-------------+
 // |             | <- FP
@@ -34,6 +42,7 @@ intptr_t kHostSavedCallerFpSlotFromFp = 0;
 // +-------------+
 intptr_t kHostSavedCallerPcSlotFromFp = -1;
 intptr_t kHostSavedCallerFpSlotFromFp = -2;
+intptr_t kHostCallerSpSlotFromFp = 0;
 #else
 #error What architecture?
 #endif
@@ -50,14 +59,96 @@ intptr_t kHostSavedCallerFpSlotFromFp = -2;
 
 namespace glance
 {
-    pthread_t g_target_thread_ = 0;
+    std::atomic<int64_t> g_collect_stack_timeout_in_micros_(50000);
 
-    uword StackWalker::stack_lower_ = 0;
+    std::atomic<size_t> g_stack_copy_size_(0);
 
-    uword StackWalker::stack_upper_ = 0;
+    // Found once by `GetDartImageInfo`, and never freed as the strings are
+    // handed out.
+    std::mutex g_dart_image_mutex_;
+
+    DartImage *g_dart_image_ = nullptr;
+
+    thread_local int64_t g_last_target_pause_in_nanos_ = 0;
+
+    thread_local int32_t g_last_target_syscall_ = GLANCE_NO_SYSCALL;
+
+    // Read by the signal handler, which must not take a lock.
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "g_frame_phase_ must be lock-free");
+
+    std::atomic<uint64_t> g_frame_phase_(GLANCE_FRAME_PHASE_IDLE);
+
+    thread_local uint64_t g_last_target_frame_phase_ = GLANCE_FRAME_PHASE_IDLE;
+
+    int64_t GetCurrentMonotonicNanos()
+    {
+        struct timespec ts;
+#if defined(DART_HOST_OS_MACOS)
+        clock_gettime(CLOCK_UPTIME_RAW, &ts);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    int64_t GetCurrentMonotonicMicros()
+    {
+        struct timespec ts;
+#if defined(DART_HOST_OS_MACOS)
+        // `fml::TimePoint::Now()` is backed by `mach_absolute_time` on Apple
+        // platforms, which is `CLOCK_UPTIME_RAW`.
+        clock_gettime(CLOCK_UPTIME_RAW, &ts);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+        return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    uint8_t *GetStackSnapshotBuffer(size_t size)
+    {
+        static thread_local std::vector<uint8_t> buffer;
+        if (buffer.size() < size)
+        {
+            buffer.resize(size);
+        }
+        return buffer.data();
+    }
+
+    void CaptureStackSnapshot(const TargetThread &thread,
+                              uword pc,
+                              uword fp,
+                              uword sp,
+                              uword dart_sp,
+                              uword lr,
+                              StackSnapshot *snapshot)
+    {
+        snapshot->pc = pc;
+        snapshot->fp = fp;
+        snapshot->sp = sp;
+        snapshot->dart_sp = dart_sp;
+        snapshot->lr = lr;
+        snapshot->stack_base = 0;
+        snapshot->size = 0;
+
+        // The Dart frames may be below the C stack pointer (e.g., on ARM64).
+        uword base = dart_sp < sp ? dart_sp : sp;
+        if (base < thread.stack_lower || base >= thread.stack_upper)
+        {
+            return;
+        }
+
+        size_t size = thread.stack_upper - base;
+        if (size > snapshot->capacity)
+        {
+            size = snapshot->capacity;
+        }
+        memcpy(snapshot->data, reinterpret_cast<const void *>(base), size);
+        snapshot->stack_base = base;
+        snapshot->size = size;
+    }
 
     StackWalker::StackWalker(
-        pthread_t target_thread,
+        const TargetThread &target_thread,
         Buffer *buffer,
         uword pc,
         uword fp,
@@ -65,11 +156,43 @@ namespace glance
         uword dart_sp)
         : target_thread_(target_thread),
           buffer_(buffer),
+          snapshot_(nullptr),
           original_pc_(pc),
           original_fp_(fp),
           original_sp_(sp),
-          original_dart_sp_(dart_sp)
+          original_dart_sp_(dart_sp),
+          original_lr_(0)
+    {
+    }
+
+    void StackWalker::UseSnapshot(const StackSnapshot *snapshot)
+    {
+        snapshot_ = snapshot;
+    }
+
+    void StackWalker::UseLinkRegister(uword lr)
+    {
+        original_lr_ = lr;
+    }
+
+    uword StackWalker::ReadStackWord(uword *address)
     {
+        if (snapshot_ == nullptr)
+        {
+            return *address;
+        }
+
+        uword offset = reinterpret_cast<uword>(address) - snapshot_->stack_base;
+        if (reinterpret_cast<uword>(address) < snapshot_->stack_base ||
+            offset + sizeof(uword) > snapshot_->size)
+        {
+            // Outside the copy, ends the walk.
+            return 0;
+        }
+
+        uword value;
+        memcpy(&value, snapshot_->data + offset, sizeof(uword));
+        return value;
     }
 
     void StackWalker::Walk()
@@ -77,7 +200,11 @@ namespace glance
         intptr_t frame = 0;
         uword lower_bound = 0;
         uword stack_upper = 0;
-        if (!GetAndValidateThreadStackBounds(original_fp_, original_sp_, &lower_bound, &stack_upper))
+        bool use_unwind_tables = g_use_unwind_tables_.load(std::memory_order_relaxed);
+        // The frame pointer may be used as a general register by the innermost
+        // frames, which is fine as long as they have the unwind tables.
+        uword fp_to_validate = use_unwind_tables ? original_sp_ : original_fp_;
+        if (!GetAndValidateThreadStackBounds(fp_to_validate, original_sp_, &lower_bound, &stack_upper))
         {
             buffer_->pcs[frame++] = 0;
             return;
@@ -85,6 +212,12 @@ namespace glance
 
         buffer_->pcs[frame++] = original_pc_;
 
+        if (use_unwind_tables)
+        {
+            WalkWithUnwindTables(frame, lower_bound, stack_upper);
+            return;
+        }
+
         uword *pc = reinterpret_cast<uword *>(original_pc_);
         uword *fp = reinterpret_cast<uword *>(original_fp_);
         uword *previous_fp = fp;
@@ -97,7 +230,7 @@ namespace glance
 
         size_t maxFrameSize = buffer_->size - 1;
 
-        while (frame < maxFrameSize)
+        while (static_cast<size_t>(frame) < maxFrameSize)
         {
             pc = CallerPC(fp);
             previous_fp = fp;
@@ -138,6 +271,112 @@ namespace glance
         buffer_->pcs[frame++] = 0;
     }
 
+    void StackWalker::WalkWithUnwindTables(intptr_t frame, uword lower_bound, uword stack_upper)
+    {
+        const UnwindTables &unwind_tables = UnwindTables::Instance();
+        size_t maxFrameSize = buffer_->size - 1;
+        uword pc = original_pc_;
+        uword fp = original_fp_;
+        uword sp = original_sp_;
+        bool is_innermost = true;
+
+        while (static_cast<size_t>(frame) < maxFrameSize)
+        {
+            uword caller_pc = 0;
+            uword caller_fp = 0;
+            uword caller_sp = 0;
+            UnwindRow row;
+            // A return address is after the call, which may be the first pc of the
+            // next function if the call doesn't return.
+            if (unwind_tables.Find(is_innermost ? pc : pc - 1, &row))
+            {
+                uword cfa = (row.cfa_register() == UnwindRow::kStackPointer ? sp : fp) + row.cfa_offset();
+                if (row.ra_offset == UnwindRow::kInRegister)
+                {
+                    // The link register only holds the return address of the
+                    // innermost frame.
+                    if (!is_innermost || original_lr_ == 0)
+                    {
+                        break;
+                    }
+                    caller_pc = original_lr_;
+                }
+                else
+                {
+                    uword address = cfa + row.ra_offset;
+                    if (!IsStackWord(address, lower_bound, stack_upper))
+                    {
+                        break;
+                    }
+                    caller_pc = ReadStackWord(reinterpret_cast<uword *>(address));
+                }
+
+                if (row.fp_offset == UnwindRow::kInRegister)
+                {
+                    caller_fp = fp;
+                }
+                else
+                {
+                    uword address = cfa + row.fp_offset;
+                    if (!IsStackWord(address, lower_bound, stack_upper))
+                    {
+                        break;
+                    }
+                    caller_fp = ReadStackWord(reinterpret_cast<uword *>(address));
+                }
+                caller_sp = cfa;
+            }
+            else
+            {
+                // E.g., the Dart frames, which always keep the frame pointers.
+                uword *fp_address = reinterpret_cast<uword *>(fp);
+                if (!ValidFramePointer(fp_address, lower_bound, stack_upper))
+                {
+                    break;
+                }
+                caller_pc = reinterpret_cast<uword>(CallerPC(fp_address));
+                caller_fp = reinterpret_cast<uword>(CallerFP(fp_address));
+                caller_sp = reinterpret_cast<uword>(fp_address + kHostCallerSpSlotFromFp);
+            }
+
+#if defined(HOST_ARCH_ARM64)
+            // Strip the pointer authentication code of a signed return address,
+            // the user space addresses are at most 48 bits.
+            caller_pc &= (static_cast<uword>(1) << 48) - 1;
+#endif
+
+            if (caller_pc == 0 || (caller_pc + 1) < caller_pc)
+            {
+                // See `Walk`.
+                break;
+            }
+
+            if (caller_sp < sp || caller_sp > stack_upper ||
+                (caller_sp == sp && caller_pc == pc))
+            {
+                // The stack only grows towards the callers, and a frame can't be
+                // its own caller.
+                break;
+            }
+
+            // Move the lower bound up.
+            lower_bound = caller_sp;
+
+            buffer_->pcs[frame++] = caller_pc;
+            pc = caller_pc;
+            fp = caller_fp;
+            sp = caller_sp;
+            is_innermost = false;
+        }
+
+        buffer_->pcs[frame++] = 0;
+    }
+
+    bool StackWalker::IsStackWord(uword address, uword lower_bound, uword stack_upper) const
+    {
+        return address >= lower_bound && address + sizeof(uword) <= stack_upper;
+    }
+
     uword *StackWalker::CallerPC(uword *fp)
     {
         uword *caller_pc_ptr = fp + kHostSavedCallerPcSlotFromFp;
@@ -145,7 +384,7 @@ namespace glance
         // `1 << 3` is the `kWordSize` from https://github.com/dart-lang/sdk/blob/3cc6105316be32e2d48b1b9b253247ad4fc89698/runtime/vm/profiler.cc#L295
         MSAN_UNPOISON(caller_pc_ptr, 1 << 3);
         ASAN_UNPOISON(caller_pc_ptr, 1 << 3);
-        return reinterpret_cast<uword *>(*caller_pc_ptr);
+        return reinterpret_cast<uword *>(ReadStackWord(caller_pc_ptr));
     }
 
     uword *StackWalker::CallerFP(uword *fp)
@@ -155,7 +394,7 @@ namespace glance
         // `1 << 3` is the `kWordSize` from https://github.com/dart-lang/sdk/blob/3cc6105316be32e2d48b1b9b253247ad4fc89698/runtime/vm/profiler.cc#L304
         MSAN_UNPOISON(caller_fp_ptr, 1 << 3);
         ASAN_UNPOISON(caller_fp_ptr, 1 << 3);
-        return reinterpret_cast<uword *>(*caller_fp_ptr);
+        return reinterpret_cast<uword *>(ReadStackWord(caller_fp_ptr));
     }
 
     bool StackWalker::ValidFramePointer(uword *fp, uword &lower_bound, uword &stack_upper)
@@ -203,14 +442,14 @@ namespace glance
         uword *stack_lower,
         uword *stack_upper)
     {
-        if (!GetCurrentStackBoundsIfNeeded(target_thread_))
+        *stack_lower = target_thread_.stack_lower;
+        *stack_upper = target_thread_.stack_upper;
+        if (snapshot_ != nullptr)
         {
-            return false;
+            // Only the frames within the copy can be walked.
+            *stack_upper = snapshot_->stack_base + snapshot_->size;
         }
 
-        *stack_lower = stack_lower_;
-        *stack_upper = stack_upper_;
-
         if ((*stack_lower == 0) || (*stack_upper == 0))
         {
             return false;
@@ -226,12 +465,27 @@ namespace glance
     }
 } // namespace glance
 
-extern "C" void SetCurrentThreadAsTarget()
+extern "C" void SetStackCopySize(size_t size_in_bytes)
+{
+    glance::g_stack_copy_size_.store(size_in_bytes);
+}
+
+extern "C" void SetCollectStackTimeout(int64_t timeout_in_micros)
+{
+    glance::g_collect_stack_timeout_in_micros_.store(timeout_in_micros > 0 ? timeout_in_micros : 0);
+}
+
+extern "C" void SetFramePhase(int32_t phase, int64_t frame_number)
 {
-    glance::g_target_thread_ = pthread_self();
+    uint64_t word = (static_cast<uint64_t>(frame_number) << glance::kFramePhaseBits) |
+                    (static_cast<uint64_t>(phase) & glance::kFramePhaseMask);
+    glance::g_frame_phase_.store(word, std::memory_order_relaxed);
 }
 
-extern "C" char *CollectStackTraceOfTargetThread(int64_t *buf, size_t buf_size);
+extern "C" uint64_t GetCollectStackTimeoutCount()
+{
+    return static_cast<uint64_t>(glance::SamplerStats::Instance().timed_out());
+}
 
 extern "C" char *LookupSymbolName(Dl_info *info)
 {
@@ -249,4 +503,28 @@ extern "C" char *LookupSymbolName(Dl_info *info)
     }
 
     return strdup(info->dli_sname);
-}
\ No newline at end of file
+}
+
+extern "C" int GetDartImageInfo(NativeDartImageInfo *out)
+{
+    std::lock_guard<std::mutex> lock(glance::g_dart_image_mutex_);
+    if (glance::g_dart_image_ == nullptr)
+    {
+        glance::DartImage image;
+        if (!glance::FindDartImage(&image))
+        {
+            // Not loaded yet, look it up again next time.
+            return 0;
+        }
+        glance::g_dart_image_ = new glance::DartImage(image);
+    }
+
+    const glance::DartImage &image = *glance::g_dart_image_;
+    out->isolate_dso_base = static_cast<int64_t>(image.dso_base);
+    out->vm_dso_base = static_cast<int64_t>(image.dso_base);
+    out->isolate_instructions = static_cast<int64_t>(image.isolate_instructions);
+    out->vm_instructions = static_cast<int64_t>(image.vm_instructions);
+    out->build_id = image.build_id.c_str();
+    out->path = image.path.c_str();
+    return 1;
+}
@@ -11,6 +11,10 @@
 
 #include <pthread.h>
 #include <dlfcn.h> // NOLINT
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 
 // Borrowed from https://github.com/dart-lang/sdk/blob/main/runtime/platform/globals.h#L107
 
@@ -62,23 +66,199 @@
 
 typedef uintptr_t uword;
 
+struct NativeSample;
+
 struct Buffer
 {
     size_t size;
     int64_t *pcs;
 };
 
+/// The Dart AOT snapshot image of the process, with the values printed in the
+/// header of `StackTrace.current`, see `GetDartImageInfo`.
+///
+/// |build_id| is in hex, or empty if the image has no build id. The strings are
+/// owned by the library and live as long as the process.
+struct NativeDartImageInfo
+{
+    int64_t isolate_dso_base;
+    int64_t vm_dso_base;
+    int64_t isolate_instructions;
+    int64_t vm_instructions;
+    const char *build_id;
+    const char *path;
+};
+
 namespace glance
 {
 
-    extern pthread_t g_target_thread_;
+    /// A thread registered to be sampled, see `ThreadRegistry`.
+    ///
+    /// The stack bounds are looked up once when the thread is registered, the
+    /// stack of a thread doesn't move.
+    struct TargetThread
+    {
+        int32_t id;
+        pthread_t thread;
+        // The thread id of the OS (e.g., `gettid()` on Android).
+        uint64_t os_thread_id;
+        uword stack_lower;
+        uword stack_upper;
+    };
+
+    /// How long `CollectStackTraceOfTargetThread` waits for the target thread to
+    /// be sampled, see `SetCollectStackTimeout`.
+    extern std::atomic<int64_t> g_collect_stack_timeout_in_micros_;
+
+    /// The size of the stack copied by `CaptureStackSnapshot`, or 0 to walk the
+    /// stack while the target thread is stopped, see `SetStackCopySize`.
+    extern std::atomic<size_t> g_stack_copy_size_;
+
+    /// The registers and a copy of the stack (from the stack pointer upward) of a
+    /// stopped thread, which is walked after the thread is resumed, so the thread
+    /// is only stopped for a `memcpy`.
+    struct StackSnapshot
+    {
+        uword pc;
+        uword fp;
+        uword sp;
+        uword dart_sp;
+        // The link register, or 0 if the architecture has none.
+        uword lr;
+        // The address of the stack copied to |data|.
+        uword stack_base;
+        // Owned by the collecting thread, see `GetStackSnapshotBuffer`.
+        uint8_t *data;
+        size_t capacity;
+        size_t size;
+    };
+
+    /// Returns a buffer of at least |size| bytes owned by the calling thread, which
+    /// is allocated once and reused by the following calls.
+    uint8_t *GetStackSnapshotBuffer(size_t size);
+
+    /// Copies the registers and the stack of the stopped |thread| to |snapshot|,
+    /// at most |snapshot->capacity| bytes.
+    ///
+    /// Async-signal-safe.
+    void CaptureStackSnapshot(const TargetThread &thread,
+                              uword pc,
+                              uword fp,
+                              uword sp,
+                              uword dart_sp,
+                              uword lr,
+                              StackSnapshot *snapshot);
+
+    /// Returns the current monotonic time in microseconds. This is the same clock
+    /// as `Timeline.now` on the Dart side (`fml::TimePoint::Now()` in the engine),
+    /// so native timestamps can be compared with the jank timestamp range directly.
+    ///
+    /// Async-signal-safe.
+    int64_t GetCurrentMonotonicMicros();
+
+    /// Same as `GetCurrentMonotonicMicros` in nanoseconds, for timing the capture
+    /// path.
+    ///
+    /// Async-signal-safe.
+    int64_t GetCurrentMonotonicNanos();
+
+    /// How long in nanoseconds the target thread was paused by the last successful
+    /// `CollectStackTrace` call of the calling thread, i.e., the time spent in the
+    /// signal handler on Android, or between suspending and resuming the thread
+    /// on iOS. The time of the kernel delivering the signal is not included.
+    extern thread_local int64_t g_last_target_pause_in_nanos_;
+
+    /// The number of the syscall the target thread was in when it was stopped by
+    /// the last successful `CollectStackTrace` call of the calling thread, read
+    /// from the saved registers if the pc is at (or right after) the syscall
+    /// instruction, otherwise `GLANCE_NO_SYSCALL`. Only read if
+    /// `g_read_sched_state_` is set. See `GetSyscallName`.
+    extern thread_local int32_t g_last_target_syscall_;
+
+    /// The bits of the phase in a word of `g_frame_phase_`.
+    constexpr uint64_t kFramePhaseBits = 8;
+
+    constexpr uint64_t kFramePhaseMask = (uint64_t{1} << kFramePhaseBits) - 1;
+
+    /// The phase of the UI thread (one of the `GLANCE_FRAME_PHASE_*`) in the
+    /// low `kFramePhaseBits` bits and the number of its frame above them, set
+    /// by `SetFramePhase`. It's a single word, so the binding updates it with a
+    /// plain store and the stopped thread is never seen halfway through it.
+    extern std::atomic<uint64_t> g_frame_phase_;
+
+    /// The `g_frame_phase_` when the target thread was stopped by the last
+    /// successful `CollectStackTrace` call of the calling thread, read by the
+    /// signal handler on Android, or while the thread is suspended on iOS, so
+    /// it's exact to the sample. See `SetFramePhaseOf`.
+    extern thread_local uint64_t g_last_target_frame_phase_;
+
+    /// Returns the thread id of the OS of the calling thread.
+    ///
+    /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+    uint64_t GetCurrentOsThreadId();
+
+    /// Gets the stack bounds of the calling thread.
+    ///
+    /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+    bool GetCurrentThreadStackBounds(uword *stack_lower, uword *stack_upper);
+
+    /// The loaded Dart AOT snapshot image, see `NativeDartImageInfo`. The isolate
+    /// and the vm snapshots are in the same image.
+    struct DartImage
+    {
+        std::string path;
+        std::string build_id;
+        uword dso_base;
+        uword isolate_instructions;
+        uword vm_instructions;
+    };
+
+    /// Finds the Dart AOT snapshot image (`libapp.so` or `App.framework`) in the
+    /// loaded images. Returns false if it's not loaded.
+    ///
+    /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+    bool FindDartImage(DartImage *out);
+
+    /// Collects the stack trace of |thread| into the given |buf| buffer, see
+    /// `CollectStackTraceOfTargetThread`.
+    ///
+    /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+    char *CollectStackTrace(const TargetThread &thread, int64_t *buf, size_t buf_size);
+
+    /// Starts sampling |thread| every |cpu_rate_in_micros| of its CPU time: a
+    /// timer on the CPU clock of the thread signals the thread itself, whose
+    /// signal handler walks its stack to a buffer drained by `TakeCpuTimeSample`.
+    /// So the thread is only sampled while it's running on a CPU, and nothing
+    /// waits for it. Replaces the timer of the previous call, must be called from
+    /// the thread calling `TakeCpuTimeSample`.
+    ///
+    /// Returns false if it's not supported, e.g., on iOS.
+    ///
+    /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+    bool StartCpuTimeSampling(const TargetThread &thread, int64_t cpu_rate_in_micros);
+
+    /// Stops the timer started by `StartCpuTimeSampling`, the samples not taken
+    /// yet are dropped by the next start.
+    ///
+    /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+    void StopCpuTimeSampling();
+
+    /// Moves the oldest sample of `StartCpuTimeSampling` to |out|, whose kind is
+    /// `GLANCE_SAMPLE_KIND_CPU`. Returns the number of the ticks of the timer it
+    /// stands for, which is more than 1 if the ticks are missed, e.g., the CPU
+    /// timers are only checked on the scheduler tick of the kernel (usually
+    /// every 4ms). Returns 0 if there is none. Must only be called from one
+    /// thread, e.g., the sampler thread.
+    ///
+    /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+    size_t TakeCpuTimeSample(NativeSample *out);
 
     /// Borrowed from https://github.com/dart-lang/sdk/blob/3cc6105316be32e2d48b1b9b253247ad4fc89698/runtime/vm/profiler.cc#L217
     class StackWalker
     {
     public:
         StackWalker(
-            pthread_t target_thread,
+            const TargetThread &target_thread,
             Buffer *buffer,
             uword pc,
             uword fp,
@@ -87,11 +267,28 @@ namespace glance
 
         ~StackWalker() = default;
 
-        bool GetCurrentStackBoundsIfNeeded(pthread_t target_thread);
+        /// Walks the copy of the stack in |snapshot| instead of the live stack,
+        /// the frames outside the copy are dropped.
+        void UseSnapshot(const StackSnapshot *snapshot);
+
+        /// The link register of the innermost frame, which holds the return
+        /// address until the function saves it. Only used with the unwind tables,
+        /// see `UnwindTables`.
+        void UseLinkRegister(uword lr);
 
         void Walk();
 
     private:
+        /// Same as `Walk`, but steps the frames that have an `UnwindRow` with the
+        /// row, and the other ones (e.g., the Dart frames) by the frame pointers.
+        void WalkWithUnwindTables(intptr_t frame, uword lower_bound, uword stack_upper);
+
+        /// Returns whether [|address|, |address| + a word) is within the walked
+        /// stack.
+        bool IsStackWord(uword address, uword lower_bound, uword stack_upper) const;
+
+        uword ReadStackWord(uword *address);
+
         uword *CallerPC(uword *fp);
 
         uword *CallerFP(uword *fp);
@@ -109,28 +306,52 @@ namespace glance
             uword *stack_lower,
             uword *stack_upper);
 
-        static uword stack_lower_;
-
-        static uword stack_upper_;
-
-        pthread_t target_thread_;
+        const TargetThread &target_thread_;
 
         Buffer *buffer_;
 
-        // const uword stack_upper_;
+        const StackSnapshot *snapshot_;
+
         const uword original_pc_;
         const uword original_fp_;
         const uword original_sp_;
         const uword original_dart_sp_;
+        uword original_lr_;
         uword lower_bound_;
     };
 
 }
 
+// Registers the current thread as the target thread (see `RegisterTargetThread`),
+// which is sampled by `CollectStackTraceOfTargetThread` and the native sampler.
 extern "C" void SetCurrentThreadAsTarget();
 
 extern "C" char *CollectStackTraceOfTargetThread(int64_t *buf, size_t buf_size);
 
+// Sets the size of the stack copied while the target thread is stopped, the
+// frames are walked on the copy after the thread is resumed. The frames beyond
+// the copy are dropped. 0 (the default) walks the stack while the thread is
+// stopped.
+extern "C" void SetStackCopySize(size_t size_in_bytes);
+
+// Sets how long `CollectStackTraceOfTargetThread` waits for the target thread to
+// be sampled, 50ms by default.
+extern "C" void SetCollectStackTimeout(int64_t timeout_in_micros);
+
+// Returns the number of `CollectStackTraceOfTargetThread` calls that timed out.
+extern "C" uint64_t GetCollectStackTimeoutCount();
+
 extern "C" char *LookupSymbolName(Dl_info *info);
 
+// Gets the Dart AOT snapshot image of the process to |out| by walking the loaded
+// image, instead of parsing the header of `StackTrace.current`. The image is
+// looked up once and cached for the process lifetime. Returns 0 if not found.
+extern "C" int GetDartImageInfo(NativeDartImageInfo *out);
+
+// Sets the phase of the UI thread (one of the `GLANCE_FRAME_PHASE_*`) and the
+// number of its frame, which are recorded with every sample taken until the
+// next call. A single relaxed store, called by the binding through a leaf FFI
+// call on every phase change.
+extern "C" void SetFramePhase(int32_t phase, int64_t frame_number);
+
 #endif // COLLECT_STACK_H_
\ No newline at end of file
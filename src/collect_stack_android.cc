@@ -6,30 +6,51 @@
 // Modifications and new contributions
 // Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
 
+#include <algorithm>
 #include <atomic>
+#include <elf.h>
+#include <link.h>
+#include <memory>
+#include <mutex>
+#include <sched.h>
+#include <semaphore.h>
 #include <signal.h>
+#include <time.h>
 #include <ucontext.h>
 #include <sys/errno.h>
+#include <sys/syscall.h>
 #include <chrono>
 #include <unistd.h>
 #include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "collect_stack.h"
+#include "hash_map.h"
+#include "module_map.h"
+#include "sample_ring.h"
+#include "sampler_stats.h"
+#include "sched_state.h"
+#include "unwind_table.h"
+
+// Not defined by the older glibc.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 namespace glance
 {
 
-  std::atomic<Buffer *> buffer_to_fill;
-
-  bool StackWalker::GetCurrentStackBoundsIfNeeded(pthread_t target_thread)
+  uint64_t GetCurrentOsThreadId()
   {
-    if (stack_lower_ != 0 && stack_upper_ != 0)
-    {
-      return true;
-    }
+    return static_cast<uint64_t>(syscall(SYS_gettid));
+  }
 
+  bool GetCurrentThreadStackBounds(uword *stack_lower, uword *stack_upper)
+  {
     pthread_attr_t attr;
-    if (pthread_getattr_np(target_thread, &attr) != 0)
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
     {
       return false;
     }
@@ -43,11 +64,343 @@ namespace glance
       return false;
     }
 
-    stack_lower_ = reinterpret_cast<uword>(base);
-    stack_upper_ = stack_lower_ + size;
+    *stack_lower = reinterpret_cast<uword>(base);
+    *stack_upper = *stack_lower + size;
     return true;
   }
 
+  namespace
+  {
+    // The file name of the Dart AOT snapshot.
+    constexpr char kDartImageFileName[] = "libapp.so";
+
+    bool IsDartImage(const char *path)
+    {
+      if (path == nullptr)
+      {
+        return false;
+      }
+      size_t length = strlen(path);
+      size_t name_length = sizeof(kDartImageFileName) - 1;
+      if (length < name_length || strcmp(path + length - name_length, kDartImageFileName) != 0)
+      {
+        return false;
+      }
+      return length == name_length || path[length - name_length - 1] == '/';
+    }
+
+    // The dynamic entries are relocated in place by glibc but not by bionic, an
+    // address below the load base is still relative to it.
+    uword DynamicEntryAddress(uword base, ElfW(Addr) address)
+    {
+      return address >= base ? address : base + address;
+    }
+
+    size_t AlignNote(size_t size)
+    {
+      return (size + 3) & ~static_cast<size_t>(3);
+    }
+
+    // Reads the GNU build id from the `PT_NOTE` segments, which is the `build_id`
+    // printed by the Dart VM in hex.
+    std::string ReadBuildId(const struct dl_phdr_info *info)
+    {
+      static constexpr char kHexDigits[] = "0123456789abcdef";
+      for (int i = 0; i < info->dlpi_phnum; ++i)
+      {
+        const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+        if (phdr.p_type != PT_NOTE)
+        {
+          continue;
+        }
+
+        uword note = info->dlpi_addr + phdr.p_vaddr;
+        uword end = note + phdr.p_memsz;
+        while (note + sizeof(ElfW(Nhdr)) <= end)
+        {
+          const ElfW(Nhdr) *header = reinterpret_cast<const ElfW(Nhdr) *>(note);
+          uword name = note + sizeof(ElfW(Nhdr));
+          uword desc = name + AlignNote(header->n_namesz);
+          uword next = desc + AlignNote(header->n_descsz);
+          if (next > end)
+          {
+            break;
+          }
+
+          if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 &&
+              memcmp(reinterpret_cast<const void *>(name), "GNU", 4) == 0)
+          {
+            const uint8_t *bytes = reinterpret_cast<const uint8_t *>(desc);
+            std::string build_id;
+            for (size_t j = 0; j < header->n_descsz; ++j)
+            {
+              build_id += kHexDigits[bytes[j] >> 4];
+              build_id += kHexDigits[bytes[j] & 0xf];
+            }
+            return build_id;
+          }
+          note = next;
+        }
+      }
+      return "";
+    }
+
+    // Returns the number of the symbols of a `DT_GNU_HASH` table, which is the
+    // end of the longest chain.
+    size_t GnuHashSymbolCount(const uint32_t *gnu_hash)
+    {
+      uint32_t bucket_count = gnu_hash[0];
+      uint32_t symbol_offset = gnu_hash[1];
+      uint32_t bloom_size = gnu_hash[2];
+      const uint32_t *buckets = reinterpret_cast<const uint32_t *>(
+          reinterpret_cast<uword>(gnu_hash + 4) + bloom_size * sizeof(ElfW(Addr)));
+      const uint32_t *chains = buckets + bucket_count;
+
+      uint32_t last = 0;
+      for (uint32_t i = 0; i < bucket_count; ++i)
+      {
+        if (buckets[i] > last)
+        {
+          last = buckets[i];
+        }
+      }
+      if (last < symbol_offset)
+      {
+        return symbol_offset;
+      }
+      // The last symbol of a chain has the lowest bit set.
+      while ((chains[last - symbol_offset] & 1) == 0)
+      {
+        ++last;
+      }
+      return last + 1;
+    }
+
+    // Looks up |name| in the dynamic symbol table of the module. The Dart
+    // snapshot only exports a few symbols, a linear scan is enough.
+    uword LookupDynamicSymbol(const struct dl_phdr_info *info, const char *name)
+    {
+      const ElfW(Dyn) *dynamic = nullptr;
+      for (int i = 0; i < info->dlpi_phnum; ++i)
+      {
+        if (info->dlpi_phdr[i].p_type == PT_DYNAMIC)
+        {
+          dynamic = reinterpret_cast<const ElfW(Dyn) *>(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+          break;
+        }
+      }
+      if (dynamic == nullptr)
+      {
+        return 0;
+      }
+
+      uword base = info->dlpi_addr;
+      const ElfW(Sym) *symbols = nullptr;
+      const char *strings = nullptr;
+      size_t symbol_count = 0;
+      for (; dynamic->d_tag != DT_NULL; ++dynamic)
+      {
+        switch (dynamic->d_tag)
+        {
+        case DT_SYMTAB:
+          symbols = reinterpret_cast<const ElfW(Sym) *>(DynamicEntryAddress(base, dynamic->d_un.d_ptr));
+          break;
+        case DT_STRTAB:
+          strings = reinterpret_cast<const char *>(DynamicEntryAddress(base, dynamic->d_un.d_ptr));
+          break;
+        case DT_HASH:
+          // The `nchain` of the table is the number of the symbols.
+          symbol_count = reinterpret_cast<const uint32_t *>(DynamicEntryAddress(base, dynamic->d_un.d_ptr))[1];
+          break;
+        case DT_GNU_HASH:
+          if (symbol_count == 0)
+          {
+            symbol_count = GnuHashSymbolCount(
+                reinterpret_cast<const uint32_t *>(DynamicEntryAddress(base, dynamic->d_un.d_ptr)));
+          }
+          break;
+        default:
+          break;
+        }
+      }
+      if (symbols == nullptr || strings == nullptr)
+      {
+        return 0;
+      }
+
+      for (size_t i = 0; i < symbol_count; ++i)
+      {
+        const ElfW(Sym) &symbol = symbols[i];
+        if (symbol.st_name != 0 && symbol.st_shndx != SHN_UNDEF &&
+            strcmp(strings + symbol.st_name, name) == 0)
+        {
+          return base + symbol.st_value;
+        }
+      }
+      return 0;
+    }
+  } // namespace
+
+  uint64_t ModuleMap::LoadedModulesGeneration()
+  {
+    struct Generation
+    {
+      bool has_adds_and_subs;
+      uint64_t value;
+    } generation{false, 0};
+
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t size, void *data) -> int
+        {
+          Generation *generation = reinterpret_cast<Generation *>(data);
+          if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+          {
+            // Both are monotonically increasing, so is the sum, no need to walk
+            // the remaining modules.
+            generation->has_adds_and_subs = true;
+            generation->value = info->dlpi_adds + info->dlpi_subs;
+            return 1;
+          }
+
+          // The `dlpi_adds` and `dlpi_subs` are not available before Android R,
+          // fall back to hashing the list of the loaded modules, counting them
+          // would miss a `dlclose` followed by a `dlopen`.
+          generation->value = HashWord(generation->value ^ static_cast<uint64_t>(info->dlpi_addr));
+          generation->value = HashWord(generation->value ^ reinterpret_cast<uint64_t>(info->dlpi_phdr));
+          return 0;
+        },
+        &generation);
+
+    return generation.value;
+  }
+
+  void ModuleMap::EnumerateLoadedModules(std::vector<LoadedModule> *modules)
+  {
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t /*size*/, void *data) -> int
+        {
+          std::vector<LoadedModule> *modules = reinterpret_cast<std::vector<LoadedModule> *>(data);
+
+          uword start_address = UINTPTR_MAX;
+          uword end_address = 0;
+          uword base_address = info->dlpi_addr;
+          for (int i = 0; i < info->dlpi_phnum; ++i)
+          {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            if (phdr.p_type != PT_LOAD)
+            {
+              continue;
+            }
+
+            uword segment_start = info->dlpi_addr + phdr.p_vaddr;
+            if (phdr.p_offset == 0)
+            {
+              // The segment maps the ELF header, which is the `dli_fbase` of `dladdr`.
+              base_address = segment_start;
+            }
+            if ((phdr.p_flags & PF_X) == 0)
+            {
+              continue;
+            }
+            if (segment_start < start_address)
+            {
+              start_address = segment_start;
+            }
+            if (segment_start + phdr.p_memsz > end_address)
+            {
+              end_address = segment_start + phdr.p_memsz;
+            }
+          }
+
+          if (start_address < end_address)
+          {
+            modules->push_back({info->dlpi_name != nullptr ? info->dlpi_name : "",
+                                base_address,
+                                start_address,
+                                end_address,
+                                ReadBuildId(info)});
+          }
+          return 0;
+        },
+        modules);
+  }
+
+  void UnwindTables::EnumerateSections(std::vector<Section> *sections)
+  {
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t /*size*/, void *data) -> int
+        {
+          std::vector<Section> *sections = reinterpret_cast<std::vector<Section> *>(data);
+
+          uword start_address = UINTPTR_MAX;
+          uword end_address = 0;
+          const uint8_t *eh_frame_hdr = nullptr;
+          for (int i = 0; i < info->dlpi_phnum; ++i)
+          {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            uword segment_start = info->dlpi_addr + phdr.p_vaddr;
+            if (phdr.p_type == PT_GNU_EH_FRAME)
+            {
+              eh_frame_hdr = reinterpret_cast<const uint8_t *>(segment_start);
+            }
+            else if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X) != 0)
+            {
+              start_address = std::min(start_address, segment_start);
+              end_address = std::max(end_address, static_cast<uword>(segment_start + phdr.p_memsz));
+            }
+          }
+
+          if (eh_frame_hdr != nullptr && start_address < end_address)
+          {
+            // The pcs of the CFI are relative to the load bias.
+            sections->push_back({info->dlpi_addr, start_address, end_address, eh_frame_hdr});
+          }
+          return 0;
+        },
+        sections);
+  }
+
+  bool FindDartImage(DartImage *out)
+  {
+    struct Search
+    {
+      DartImage *image;
+      bool found;
+    } search{out, false};
+
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t /*size*/, void *data) -> int
+        {
+          if (!IsDartImage(info->dlpi_name))
+          {
+            return 0;
+          }
+
+          Search *search = reinterpret_cast<Search *>(data);
+          DartImage *image = search->image;
+          image->path = info->dlpi_name;
+          image->dso_base = info->dlpi_addr;
+          for (int i = 0; i < info->dlpi_phnum; ++i)
+          {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            if (phdr.p_type == PT_LOAD && phdr.p_offset == 0)
+            {
+              // The segment maps the ELF header, which is the `isolate_dso_base`.
+              image->dso_base = info->dlpi_addr + phdr.p_vaddr;
+              break;
+            }
+          }
+          image->build_id = ReadBuildId(info);
+          image->isolate_instructions = LookupDynamicSymbol(info, "_kDartIsolateSnapshotInstructions");
+          image->vm_instructions = LookupDynamicSymbol(info, "_kDartVmSnapshotInstructions");
+          search->found = image->isolate_instructions != 0;
+          return 1;
+        },
+        &search);
+
+    return search.found;
+  }
+
   uword GetProgramCounter(const mcontext_t &mcontext)
   {
 #if defined(HOST_ARCH_IA32)
@@ -115,6 +468,21 @@ namespace glance
 #endif // HOST_ARCH_...
   }
 
+  uword GetLinkRegister(const mcontext_t &mcontext)
+  {
+#if defined(HOST_ARCH_ARM)
+    return static_cast<uword>(mcontext.arm_lr);
+#elif defined(HOST_ARCH_ARM64)
+    return static_cast<uword>(mcontext.regs[30]);
+#elif defined(HOST_ARCH_RISCV32) || defined(HOST_ARCH_RISCV64)
+    return static_cast<uword>(mcontext.__gregs[REG_RA]);
+#else
+    // The return address is always on the stack.
+    (void)mcontext;
+    return 0;
+#endif
+  }
+
   uword GetDartStackPointer(const mcontext_t &mcontext)
   {
 #if defined(HOST_ARCH_ARM64)
@@ -124,91 +492,741 @@ namespace glance
 #endif
   }
 
-  constexpr intptr_t kObscureSignal = SIGPWR;
+  // The readable code of the loaded modules, so `ReadCode` can load it in the
+  // signal handler. A snapshot is never freed, a handler may still be reading
+  // it when a newer one is published.
+  struct CodeRanges
+  {
+    // The [start, end) of the readable executable segments, sorted.
+    std::vector<std::pair<uword, uword>> ranges;
+  };
 
-  void DumpHandler(int signal, siginfo_t *info, void *context)
+  std::mutex code_ranges_mutex;
+
+  // Guarded by |code_ranges_mutex|.
+  bool has_code_ranges = false;
+
+  uint64_t code_ranges_generation = 0;
+
+  std::vector<std::unique_ptr<CodeRanges>> code_ranges_snapshots;
+
+  std::atomic<const CodeRanges *> current_code_ranges(nullptr);
+
+  // Publishes the code ranges of the modules loaded since the last call, done
+  // by the collecting threads before the signal is sent.
+  void UpdateCodeRangesIfNeeded()
   {
-    if (signal != kObscureSignal)
+    std::lock_guard<std::mutex> lock(code_ranges_mutex);
+    uint64_t generation = ModuleMap::LoadedModulesGeneration();
+    if (has_code_ranges && generation == code_ranges_generation)
     {
       return;
     }
+    has_code_ranges = true;
+    code_ranges_generation = generation;
 
-    Buffer *buffer = buffer_to_fill.load();
+    std::unique_ptr<CodeRanges> snapshot(new CodeRanges());
+    dl_iterate_phdr(
+        [](struct dl_phdr_info *info, size_t /*size*/, void *data) -> int
+        {
+          CodeRanges *code_ranges = reinterpret_cast<CodeRanges *>(data);
+          for (int i = 0; i < info->dlpi_phnum; ++i)
+          {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            // An execute-only segment, e.g., of the system libraries of some
+            // Android versions, can't be loaded from.
+            if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X) != 0 && (phdr.p_flags & PF_R) != 0)
+            {
+              uword start = info->dlpi_addr + phdr.p_vaddr;
+              code_ranges->ranges.emplace_back(start, start + phdr.p_filesz);
+            }
+          }
+          return 0;
+        },
+        snapshot.get());
+    std::sort(snapshot->ranges.begin(), snapshot->ranges.end());
 
-    ucontext_t *ucontext = reinterpret_cast<ucontext_t *>(context);
-    mcontext_t mcontext = ucontext->uc_mcontext;
+    current_code_ranges.store(snapshot.get(), std::memory_order_release);
+    code_ranges_snapshots.push_back(std::move(snapshot));
+  }
+
+  // Copies the |size| bytes of the code at |address| to |out|. Returns false if
+  // the code is not in the readable code of a loaded module published by
+  // `UpdateCodeRangesIfNeeded`, e.g., an execute-only segment or the JIT code,
+  // where a load might crash.
+  //
+  // Async-signal-safe.
+  bool ReadCode(uword address, void *out, size_t size)
+  {
+    const CodeRanges *code_ranges = current_code_ranges.load(std::memory_order_acquire);
+    if (code_ranges == nullptr || address + size < address)
+    {
+      return false;
+    }
+
+    const std::vector<std::pair<uword, uword>> &ranges = code_ranges->ranges;
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), address,
+                               [](uword address, const std::pair<uword, uword> &range)
+                               { return address < range.first; });
+    if (it == ranges.begin() || address + size > (it - 1)->second)
+    {
+      return false;
+    }
+    memcpy(out, reinterpret_cast<const void *>(address), size);
+    return true;
+  }
+
+  // Returns the number of the syscall the thread was in when it was signalled,
+  // see `g_last_target_syscall_`. A blocking syscall interrupted by a signal of
+  // `SA_RESTART` is rewound to the syscall instruction, a returned one (e.g.,
+  // with `EINTR`) is right before the pc. Only the code of the modules is
+  // read, see `ReadCode`.
+  //
+  // Async-signal-safe.
+  int32_t GetInFlightSyscall(const mcontext_t &mcontext)
+  {
+    uword pc = GetProgramCounter(mcontext);
+#if defined(HOST_ARCH_ARM64)
+    // `svc #0`, the number is in x8, which the syscall keeps.
+    constexpr uint32_t kSvc = 0xd4000001;
+    uint32_t code[2];
+    if (ReadCode(pc - sizeof(uint32_t), code, sizeof(code)) && (code[0] == kSvc || code[1] == kSvc))
+    {
+      return static_cast<int32_t>(mcontext.regs[8]);
+    }
+#elif defined(HOST_ARCH_X64)
+    // `syscall`. A rewound one is at the pc, with the number restored to rax
+    // from orig_rax. A returned one is right before the pc, with the result in
+    // rax, and orig_rax is not in the signal frame, so the number is only known
+    // from the `mov $number, %eax` (or `xor %eax, %eax` of 0) the libc stubs
+    // load it with right before the `syscall`.
+    uint8_t code[9];
+    if (ReadCode(pc - 7, code, sizeof(code)))
+    {
+      if (code[7] == 0x0f && code[8] == 0x05)
+      {
+        return static_cast<int32_t>(mcontext.gregs[REG_RAX]);
+      }
+      if (code[5] == 0x0f && code[6] == 0x05)
+      {
+        if (code[0] == 0xb8)
+        {
+          int32_t number;
+          memcpy(&number, &code[1], sizeof(number));
+          return number;
+        }
+        if (code[3] == 0x31 && code[4] == 0xc0)
+        {
+          return 0;
+        }
+      }
+    }
+#elif defined(HOST_ARCH_ARM)
+    // `svc #0` of the ARM or the Thumb mode, the number is in r7.
+    if ((mcontext.arm_cpsr & (1 << 5)) != 0)
+    {
+      uint16_t code[2];
+      if (ReadCode(pc - sizeof(uint16_t), code, sizeof(code)) && (code[0] == 0xdf00 || code[1] == 0xdf00))
+      {
+        return static_cast<int32_t>(mcontext.arm_r7);
+      }
+    }
+    else
+    {
+      uint32_t code[2];
+      if (ReadCode(pc - sizeof(uint32_t), code, sizeof(code)) &&
+          (code[0] == 0xef000000 || code[1] == 0xef000000))
+      {
+        return static_cast<int32_t>(mcontext.arm_r7);
+      }
+    }
+#elif defined(HOST_ARCH_RISCV32) || defined(HOST_ARCH_RISCV64)
+    // `ecall`, the number is in a7.
+    constexpr uint32_t kEcall = 0x00000073;
+    uint32_t code[2];
+    if (ReadCode(pc - sizeof(uint32_t), code, sizeof(code)) && (code[0] == kEcall || code[1] == kEcall))
+    {
+      return static_cast<int32_t>(mcontext.__gregs[REG_A0 + 7]);
+    }
+#endif // HOST_ARCH_...
+    // The syscalls of ia32 go through the vdso, whose entry is not told apart.
+    return GLANCE_NO_SYSCALL;
+  }
+
+  constexpr intptr_t kObscureSignal = SIGPWR;
+
+  // The maximum number of the concurrent `CollectStackTrace` calls.
+  constexpr size_t kMaxDumpRequests = 8;
+
+  // The phases of a `DumpRequest`, in the low bits of `DumpRequest::state`.
+  enum DumpPhase : uint64_t
+  {
+    // Can be claimed by a collector.
+    kDumpFree = 0,
+    // Claimed by a collector which is filling the request.
+    kDumpFilling = 1,
+    // The target thread is signalled, waiting for `DumpHandler`.
+    kDumpPending = 2,
+    // Taken by `DumpHandler`, the collector must wait for it.
+    kDumpWalking = 3,
+    // Walked, `done` is posted.
+    kDumpDone = 4,
+  };
+
+  constexpr uint64_t kDumpPhaseBits = 3;
+
+  constexpr uint64_t kDumpPhaseMask = (1 << kDumpPhaseBits) - 1;
+
+  // A slot of sampling a target thread handed to `DumpHandler`.
+  //
+  // |state| is (generation << kDumpPhaseBits | phase), the generation is bumped
+  // every time the slot is claimed, so a late signal of a request that is given
+  // up can't take a newer request of the same slot.
+  struct DumpRequest
+  {
+    std::atomic<uint64_t> state;
+    // The |thread.thread| of the pending request, read by `DumpHandler` to find
+    // the requests of its thread while the slot may be given up and reused.
+    std::atomic<pthread_t> pending_thread;
+    // A copy, so a late signal never reads a thread that is unregistered. Only
+    // read by `DumpHandler` once it has taken the request.
+    TargetThread thread;
+    Buffer buffer;
+    // Filled instead of walking the stack if |snapshot.capacity| is not 0, see
+    // `SetStackCopySize`.
+    StackSnapshot snapshot;
+    // When `DumpHandler` took the request, see `SamplerStats`.
+    int64_t handled_in_nanos;
+    // The time spent in `DumpHandler`, see `g_last_target_pause_in_nanos_`.
+    int64_t pause_in_nanos;
+    // See `g_last_target_syscall_`.
+    int32_t syscall;
+    // See `g_last_target_frame_phase_`.
+    uint64_t frame_phase;
+    // Posted by `DumpHandler` when the walk is finished, `sem_post` is
+    // async-signal-safe, so the collector wakes as soon as the sample is taken.
+    sem_t done;
+  };
+
+  DumpRequest dump_requests[kMaxDumpRequests];
+
+  std::mutex install_handler_mutex;
+
+  std::atomic<bool> is_handler_installed(false);
+
+  struct sigaction previous_action;
+
+  uint64_t DumpState(uint64_t generation, DumpPhase phase)
+  {
+    return (generation << kDumpPhaseBits) | phase;
+  }
+
+  // The payload of the signal is the index of the slot and the generation of
+  // the request.
+  uintptr_t ToDumpPayload(size_t index, uint64_t generation)
+  {
+    return static_cast<uintptr_t>((generation << 8) | index);
+  }
+
+  // Walks the stack of the current thread for the request in |index| of
+  // |generation|. Returns false if the request is not pending (e.g., given up
+  // by the collector or the slot is reused).
+  bool ServeDumpRequest(size_t index, uint64_t generation, const mcontext_t &mcontext)
+  {
+    DumpRequest &request = dump_requests[index];
+    uint64_t expected = DumpState(generation, kDumpPending);
+    // Take the request, so the collector knows that the walk is started and
+    // doesn't give up on it.
+    if (!request.state.compare_exchange_strong(expected,
+                                               DumpState(generation, kDumpWalking),
+                                               std::memory_order_acq_rel))
+    {
+      return false;
+    }
+
+    int64_t start = GetCurrentMonotonicNanos();
     uword pc = GetProgramCounter(mcontext);
     uword fp = GetFramePointer(mcontext);
     uword sp = GetCStackPointer(mcontext);
     uword dart_sp = GetDartStackPointer(mcontext);
+    uword lr = GetLinkRegister(mcontext);
+    // Only read along with the scheduling state, see `SetNativeSamplerSchedStateEnabled`.
+    request.syscall = g_read_sched_state_.load(std::memory_order_relaxed) ? GetInFlightSyscall(mcontext)
+                                                                          : GLANCE_NO_SYSCALL;
+    request.frame_phase = g_frame_phase_.load(std::memory_order_relaxed);
 
-    glance::StackWalker stack_walker(glance::g_target_thread_, buffer, pc, fp, sp, dart_sp);
-    stack_walker.Walk();
+    if (request.snapshot.capacity != 0)
+    {
+      // The walk is done by the collector after the thread is resumed.
+      CaptureStackSnapshot(request.thread, pc, fp, sp, dart_sp, lr, &request.snapshot);
+    }
+    else
+    {
+      glance::StackWalker stack_walker(request.thread, &request.buffer, pc, fp, sp, dart_sp);
+      stack_walker.UseLinkRegister(lr);
+      stack_walker.Walk();
+    }
 
-    buffer_to_fill.store(nullptr); // Signal completion
+    request.handled_in_nanos = start;
+    request.pause_in_nanos = GetCurrentMonotonicNanos() - start;
+    request.state.store(DumpState(generation, kDumpDone), std::memory_order_release);
+    sem_post(&request.done); // Signal completion
+    return true;
   }
 
-} // namespace glance
+  // The number of the samples of the CPU timer not taken by the sampler thread
+  // yet, a power of 2. The sampler thread takes them on every tick.
+  constexpr size_t kCpuTimeSampleSlots = 64;
 
-// Collect stack trace of the target thread previously set by
-// SetCurrentThreadAsTarget into the given |buf| buffer.
-//
-// Stack trace is collected as a sequence of PC (program counter values) for
-// each frame and is terminated with 0 value.
-//
-// On success returns nullptr otherwise returns a string containing the error.
-//
-// Returned string must be freed by the caller.
-extern "C" char *CollectStackTraceOfTargetThread(int64_t *buf, size_t buf_size)
-{
-  // TODO: this function is not thread safe and should probably use locking.
+  // The samples of the CPU timer (see `StartCpuTimeSampling`), written by
+  // `DumpHandler` on the target thread and taken by `TakeCpuTimeSample`, a
+  // single producer and a single consumer.
+  NativeSample cpu_time_samples[kCpuTimeSampleSlots];
+
+  // The number of the ticks each sample stands for, see `TakeCpuTimeSample`.
+  size_t cpu_time_sample_ticks[kCpuTimeSampleSlots];
 
-  // Register a signal handler for the |kObscureSignal| signal which will dump
-  // the stack for us.
-  struct sigaction new_act, old_act;
-  new_act.sa_sigaction = &glance::DumpHandler;
-  new_act.sa_flags = SA_RESTART | SA_SIGINFO;
-  int result = sigaction(glance::kObscureSignal, &new_act, &old_act);
-  if (result != 0)
+  std::atomic<uint64_t> cpu_time_samples_written(0);
+
+  std::atomic<uint64_t> cpu_time_samples_taken(0);
+
+  // (generation << 1 | armed) of the CPU timer, the generation is in the
+  // payload of the signals of the timer, so a late signal of a deleted timer is
+  // ignored.
+  std::atomic<uint64_t> cpu_time_state(0);
+
+  // Tags the payload of the signals of the CPU timer, the low 16 bits are the
+  // generation, which also fits the 32-bit `sival_ptr`.
+  constexpr uintptr_t kCpuTimePayloadTag = 0x474c0000;
+
+  constexpr uintptr_t kCpuTimeGenerationMask = 0xffff;
+
+  uintptr_t ToCpuTimePayload(uint64_t generation)
   {
-    // Failed to register the signal handler. Report an error.
-    char buf[512];
-    strerror_r(errno, buf, sizeof(buf));
-    return strdup(buf);
+    return kCpuTimePayloadTag | static_cast<uintptr_t>(generation & kCpuTimeGenerationMask);
   }
 
-  Buffer buffer{buf_size, buf};
-  glance::buffer_to_fill = &buffer;
+  // The number of `DumpHandler`s serving a tick of the CPU timer, which must be
+  // waited for before |cpu_time_thread| is changed.
+  std::atomic<int32_t> cpu_time_handlers(0);
+
+  // A copy of the thread of the timer, only changed while it's disarmed.
+  TargetThread cpu_time_thread;
+
+  std::mutex cpu_time_mutex;
+
+  // Guarded by |cpu_time_mutex|.
+  timer_t cpu_time_timer;
 
-  result = pthread_kill(glance::g_target_thread_, glance::kObscureSignal);
-  if (result != 0)
+  bool has_cpu_time_timer = false;
+
+  // Walks the stack of the current thread for a tick of the CPU timer of
+  // |payload| and its |overrun| missed ticks, if the timer is still armed for
+  // this thread.
+  void ServeCpuTimeTick(uintptr_t payload, int overrun, const mcontext_t &mcontext)
   {
-    // Failed to send the signal.
-    char buf[512];
-    strerror_r(errno, buf, sizeof(buf));
+    cpu_time_handlers.fetch_add(1);
+    uint64_t state = cpu_time_state.load();
+    if ((state & 1) != 0 && ToCpuTimePayload(state >> 1) == payload &&
+        pthread_equal(cpu_time_thread.thread, pthread_self()))
+    {
+      uint64_t written = cpu_time_samples_written.load(std::memory_order_relaxed);
+      // Dropped if the sampler thread falls behind.
+      if (written - cpu_time_samples_taken.load(std::memory_order_acquire) < kCpuTimeSampleSlots)
+      {
+        size_t index = written & (kCpuTimeSampleSlots - 1);
+        cpu_time_sample_ticks[index] = 1 + static_cast<size_t>(std::max(overrun, 0));
+        NativeSample &sample = cpu_time_samples[index];
+        sample.timestamp = GetCurrentMonotonicMicros();
+        sample.kind = GLANCE_SAMPLE_KIND_CPU;
+        sample.syscall = g_read_sched_state_.load(std::memory_order_relaxed) ? GetInFlightSyscall(mcontext)
+                                                                             : GLANCE_NO_SYSCALL;
+        // Running by definition, e.g., a syscall that keeps the CPU busy.
+        sample.run_state = 'R';
+        sample.voluntary_switches = 0;
+        sample.involuntary_switches = 0;
+        SetFramePhaseOf(g_frame_phase_.load(std::memory_order_relaxed), &sample);
+        Buffer buffer{GLANCE_MAX_STACK_DEPTH, sample.pcs};
+        glance::StackWalker stack_walker(cpu_time_thread, &buffer, GetProgramCounter(mcontext),
+                                         GetFramePointer(mcontext), GetCStackPointer(mcontext),
+                                         GetDartStackPointer(mcontext));
+        stack_walker.UseLinkRegister(GetLinkRegister(mcontext));
+        stack_walker.Walk();
+        int32_t depth = 0;
+        while (depth < GLANCE_MAX_STACK_DEPTH && sample.pcs[depth] != 0)
+        {
+          ++depth;
+        }
+        sample.depth = depth;
+        cpu_time_samples_written.store(written + 1, std::memory_order_release);
+      }
+    }
+    cpu_time_handlers.fetch_sub(1);
+  }
 
-    // Restore old action.
-    sigaction(glance::kObscureSignal, &old_act, nullptr);
-    return strdup(buf);
+  void DumpHandler(int signal, siginfo_t *info, void *context)
+  {
+    if (signal != kObscureSignal)
+    {
+      return;
+    }
+
+    ucontext_t *ucontext = reinterpret_cast<ucontext_t *>(context);
+    const mcontext_t &mcontext = ucontext->uc_mcontext;
+
+    uintptr_t payload = reinterpret_cast<uintptr_t>(info->si_value.sival_ptr);
+    bool is_cpu_time_tick = info->si_code == SI_TIMER &&
+                            (payload & ~kCpuTimeGenerationMask) == kCpuTimePayloadTag;
+    if (is_cpu_time_tick)
+    {
+      ServeCpuTimeTick(payload, info->si_overrun, mcontext);
+    }
+
+    bool is_dump_request = info->si_code == SI_QUEUE && info->si_pid == getpid();
+    bool is_ours = is_cpu_time_tick || is_dump_request;
+    if (is_dump_request)
+    {
+      size_t index = payload & 0xff;
+      if (index < kMaxDumpRequests)
+      {
+        ServeDumpRequest(index, payload >> 8, mcontext);
+      }
+    }
+
+    // The non-realtime signals are not queued, a signal sent while another one is
+    // pending (e.g., a tick of the CPU timer) is lost, so serve all the pending
+    // requests of this thread.
+    pthread_t self = pthread_self();
+    for (size_t i = 0; i < kMaxDumpRequests; ++i)
+    {
+      uint64_t state = dump_requests[i].state.load(std::memory_order_acquire);
+      if ((state & kDumpPhaseMask) != kDumpPending)
+      {
+        continue;
+      }
+      // The thread is of the request of |state| only if the slot is not reused
+      // in between, otherwise the request of the newer generation is served by
+      // its own signal.
+      pthread_t thread = dump_requests[i].pending_thread.load(std::memory_order_acquire);
+      if (pthread_equal(thread, self) &&
+          dump_requests[i].state.load(std::memory_order_acquire) == state)
+      {
+        ServeDumpRequest(i, state >> kDumpPhaseBits, mcontext);
+      }
+    }
+
+    if (is_ours)
+    {
+      return;
+    }
+
+    // Not requested by us, pass it on to the handler installed before ours.
+    if ((previous_action.sa_flags & SA_SIGINFO) != 0 &&
+        previous_action.sa_sigaction != nullptr)
+    {
+      previous_action.sa_sigaction(signal, info, context);
+    }
+    else if (previous_action.sa_handler != SIG_DFL &&
+             previous_action.sa_handler != SIG_IGN &&
+             previous_action.sa_handler != nullptr)
+    {
+      previous_action.sa_handler(signal);
+    }
   }
 
-  // Wait for signal handler to trigger, but not too long.
-  //
-  // Note: can't use wait/notify here because it is not signal safe.
-  int i = 0;
-  while (glance::buffer_to_fill.load() != nullptr && i++ < 50)
+  // Installs `DumpHandler` for the |kObscureSignal| signal, only once for the
+  // whole process instead of for every sample.
+  int InstallDumpHandlerIfNeeded()
   {
-    usleep(1000);
+    if (is_handler_installed.load(std::memory_order_acquire))
+    {
+      return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(install_handler_mutex);
+    if (is_handler_installed.load(std::memory_order_relaxed))
+    {
+      return 0;
+    }
+
+    for (size_t i = 0; i < kMaxDumpRequests; ++i)
+    {
+      if (sem_init(&dump_requests[i].done, 0, 0) != 0)
+      {
+        int error = errno;
+        while (i-- > 0)
+        {
+          sem_destroy(&dump_requests[i].done);
+        }
+        return error;
+      }
+    }
+
+    struct sigaction new_act;
+    memset(&new_act, 0, sizeof(new_act));
+    sigemptyset(&new_act.sa_mask);
+    new_act.sa_sigaction = &DumpHandler;
+    new_act.sa_flags = SA_RESTART | SA_SIGINFO;
+    if (sigaction(kObscureSignal, &new_act, &previous_action) != 0)
+    {
+      int error = errno;
+      for (size_t i = 0; i < kMaxDumpRequests; ++i)
+      {
+        sem_destroy(&dump_requests[i].done);
+      }
+      return error;
+    }
+
+    is_handler_installed.store(true, std::memory_order_release);
+    return 0;
   }
 
-  // Restore old action.
-  sigaction(glance::kObscureSignal, &old_act, nullptr);
+  // Claims a free slot. Returns the index of the slot and the generation of the
+  // request in |generation|, or -1 if all the slots are in use.
+  int ClaimDumpRequest(uint64_t *generation)
+  {
+    for (size_t i = 0; i < kMaxDumpRequests; ++i)
+    {
+      uint64_t state = dump_requests[i].state.load(std::memory_order_relaxed);
+      if ((state & kDumpPhaseMask) != kDumpFree)
+      {
+        continue;
+      }
+
+      uint64_t next_generation = (state >> kDumpPhaseBits) + 1;
+      if (dump_requests[i].state.compare_exchange_strong(state,
+                                                         DumpState(next_generation, kDumpFilling),
+                                                         std::memory_order_acquire))
+      {
+        *generation = next_generation;
+        return static_cast<int>(i);
+      }
+    }
+    return -1;
+  }
 
-  if (glance::buffer_to_fill.load() != nullptr)
+  // Waits for `DumpHandler` to post |done| until |timeout_in_micros| passed.
+  // Returns false if timed out.
+  bool WaitForDump(sem_t *done, int64_t timeout_in_micros)
   {
-    glance::buffer_to_fill.store(nullptr);
-    return strdup("signal handler did not trigger within 50ms");
+    // `sem_timedwait` only takes the realtime clock.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    int64_t nanos = deadline.tv_nsec + (timeout_in_micros % 1000000) * 1000;
+    deadline.tv_sec += timeout_in_micros / 1000000 + nanos / 1000000000;
+    deadline.tv_nsec = nanos % 1000000000;
+
+    while (sem_timedwait(done, &deadline) != 0)
+    {
+      if (errno != EINTR)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  char *CollectStackTrace(const TargetThread &thread, int64_t *buf, size_t buf_size)
+  {
+    // Register a signal handler for the |kObscureSignal| signal which will dump
+    // the stack for us.
+    int result = InstallDumpHandlerIfNeeded();
+    if (result != 0)
+    {
+      // Failed to register the signal handler. Report an error.
+      SamplerStats::Instance().RecordFailure();
+      char buf[512];
+      strerror_r(result, buf, sizeof(buf));
+      return strdup(buf);
+    }
+
+    if (g_use_unwind_tables_.load(std::memory_order_relaxed))
+    {
+      // Built before the signal handler may look up the new modules.
+      UnwindTables::Instance().UpdateIfNeeded();
+    }
+
+    if (g_read_sched_state_.load(std::memory_order_relaxed))
+    {
+      // Published before the signal handler may read the code of the new modules.
+      UpdateCodeRangesIfNeeded();
+    }
+
+    uint64_t generation = 0;
+    int index = ClaimDumpRequest(&generation);
+    if (index == -1)
+    {
+      SamplerStats::Instance().RecordFailure();
+      return strdup("too many concurrent stack trace collections");
+    }
+
+    DumpRequest &request = dump_requests[index];
+    request.thread = thread;
+    request.buffer = {buf_size, buf};
+    size_t stack_copy_size = g_stack_copy_size_.load(std::memory_order_relaxed);
+    request.snapshot.capacity = stack_copy_size;
+    request.snapshot.data = stack_copy_size != 0 ? GetStackSnapshotBuffer(stack_copy_size) : nullptr;
+    request.pending_thread.store(thread.thread, std::memory_order_relaxed);
+    request.state.store(DumpState(generation, kDumpPending), std::memory_order_release);
+
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    info.si_signo = kObscureSignal;
+    info.si_code = SI_QUEUE;
+    info.si_pid = getpid();
+    info.si_uid = getuid();
+    info.si_value.sival_ptr = reinterpret_cast<void *>(ToDumpPayload(index, generation));
+    int64_t sent_in_nanos = GetCurrentMonotonicNanos();
+    if (syscall(SYS_rt_tgsigqueueinfo, getpid(), static_cast<pid_t>(thread.os_thread_id),
+                kObscureSignal, &info) != 0)
+    {
+      // Failed to send the signal.
+      int error = errno;
+      request.state.store(DumpState(generation, kDumpFree), std::memory_order_release);
+      SamplerStats::Instance().RecordFailure();
+      char buf[512];
+      strerror_r(error, buf, sizeof(buf));
+      return strdup(buf);
+    }
+
+    if (!WaitForDump(&request.done, g_collect_stack_timeout_in_micros_.load()))
+    {
+      // Give up on the request, unless the signal handler has already taken it,
+      // in which case the walk is in progress, and must be waited for since the
+      // buffer is owned by the caller.
+      uint64_t expected = DumpState(generation, kDumpPending);
+      if (request.state.compare_exchange_strong(expected,
+                                                DumpState(generation, kDumpFree),
+                                                std::memory_order_acq_rel))
+      {
+        SamplerStats::Instance().RecordTimeout();
+        return strdup("signal handler did not trigger within the timeout");
+      }
+
+      while (sem_wait(&request.done) != 0 && errno == EINTR)
+      {
+      }
+    }
+
+    if (request.snapshot.capacity != 0)
+    {
+      const StackSnapshot &snapshot = request.snapshot;
+      glance::StackWalker stack_walker(thread, &request.buffer, snapshot.pc, snapshot.fp, snapshot.sp, snapshot.dart_sp);
+      stack_walker.UseSnapshot(&snapshot);
+      stack_walker.UseLinkRegister(snapshot.lr);
+      stack_walker.Walk();
+    }
+
+    g_last_target_pause_in_nanos_ = request.pause_in_nanos;
+    g_last_target_syscall_ = request.syscall;
+    g_last_target_frame_phase_ = request.frame_phase;
+    SamplerStats::Instance().RecordSuccess(buf, buf_size,
+                                           request.handled_in_nanos - sent_in_nanos,
+                                           request.pause_in_nanos);
+    request.state.store(DumpState(generation, kDumpFree), std::memory_order_release);
+    return nullptr; // Success.
+  }
+
+  namespace
+  {
+    // Disarms and deletes the timer, and waits for the handlers still serving
+    // its ticks. Must be called with |cpu_time_mutex| held.
+    void DeleteCpuTimeTimer()
+    {
+      cpu_time_state.store(cpu_time_state.load() & ~static_cast<uint64_t>(1));
+      if (has_cpu_time_timer)
+      {
+        timer_delete(cpu_time_timer);
+        has_cpu_time_timer = false;
+      }
+      while (cpu_time_handlers.load() != 0)
+      {
+        sched_yield();
+      }
+    }
+  } // namespace
+
+  bool StartCpuTimeSampling(const TargetThread &thread, int64_t cpu_rate_in_micros)
+  {
+    if (cpu_rate_in_micros <= 0 || InstallDumpHandlerIfNeeded() != 0)
+    {
+      return false;
+    }
+
+    if (g_read_sched_state_.load(std::memory_order_relaxed))
+    {
+      UpdateCodeRangesIfNeeded();
+    }
+
+    std::lock_guard<std::mutex> lock(cpu_time_mutex);
+    DeleteCpuTimeTimer();
+
+    clockid_t clock;
+    if (pthread_getcpuclockid(thread.thread, &clock) != 0)
+    {
+      return false;
+    }
+
+    cpu_time_thread = thread;
+    // The samples of the previous timer are not taken anymore.
+    cpu_time_samples_taken.store(cpu_time_samples_written.load());
+    uint64_t generation = (cpu_time_state.load() >> 1) + 1;
+
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = kObscureSignal;
+    event.sigev_notify_thread_id = static_cast<pid_t>(thread.os_thread_id);
+    event.sigev_value.sival_ptr = reinterpret_cast<void *>(ToCpuTimePayload(generation));
+    if (timer_create(clock, &event, &cpu_time_timer) != 0)
+    {
+      return false;
+    }
+    has_cpu_time_timer = true;
+    // Armed before the timer, so the first tick is not ignored.
+    cpu_time_state.store((generation << 1) | 1);
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = cpu_rate_in_micros / 1000000;
+    spec.it_interval.tv_nsec = (cpu_rate_in_micros % 1000000) * 1000;
+    spec.it_value = spec.it_interval;
+    if (timer_settime(cpu_time_timer, 0, &spec, nullptr) != 0)
+    {
+      DeleteCpuTimeTimer();
+      return false;
+    }
+    return true;
+  }
+
+  void StopCpuTimeSampling()
+  {
+    std::lock_guard<std::mutex> lock(cpu_time_mutex);
+    DeleteCpuTimeTimer();
+  }
+
+  size_t TakeCpuTimeSample(NativeSample *out)
+  {
+    uint64_t taken = cpu_time_samples_taken.load(std::memory_order_relaxed);
+    if (taken == cpu_time_samples_written.load(std::memory_order_acquire))
+    {
+      return 0;
+    }
+
+    size_t index = taken & (kCpuTimeSampleSlots - 1);
+    size_t ticks = cpu_time_sample_ticks[index];
+    const NativeSample &sample = cpu_time_samples[index];
+    out->timestamp = sample.timestamp;
+    out->depth = sample.depth;
+    out->kind = sample.kind;
+    out->syscall = sample.syscall;
+    out->run_state = sample.run_state;
+    out->voluntary_switches = sample.voluntary_switches;
+    out->involuntary_switches = sample.involuntary_switches;
+    out->frame_phase = sample.frame_phase;
+    out->frame_number = sample.frame_number;
+    memcpy(out->pcs, sample.pcs, sizeof(int64_t) * std::min<size_t>(sample.depth + 1, GLANCE_MAX_STACK_DEPTH));
+    cpu_time_samples_taken.store(taken + 1, std::memory_order_release);
+    return ticks;
   }
 
-  return nullptr; // Success.
-}
+} // namespace glance
@@ -1,17 +1,27 @@
 #include <assert.h>             // NOLINT
+#include <dlfcn.h>              // NOLINT
 #include <errno.h>              // NOLINT
+#include <mach-o/dyld.h>        // NOLINT
+#include <mach-o/loader.h>      // NOLINT
 #include <mach/kern_return.h>   // NOLINT
 #include <mach/mach.h>          // NOLINT
 #include <mach/thread_act.h>    // NOLINT
 #include <mach/thread_status.h> // NOLINT
+#include <string.h>             // NOLINT
 #include <stdbool.h>            // NOLINT
 #include <sys/sysctl.h>         // NOLINT
 #include <sys/types.h>          // NOLINT
 #include <unistd.h>             // NOLINT
 
 #include <iostream>
+#include <string>
 
 #include "collect_stack.h"
+#include "module_map.h"
+#include "sample_ring.h"
+#include "sampler_stats.h"
+#include "sched_state.h"
+#include "unwind_table.h"
 
 // Borrowed from https://github.com/dart-lang/sdk/blob/master/runtime/vm/thread_interrupter_macos.cc
 
@@ -33,19 +43,166 @@ typedef arm_thread_state32_t __thread_state_flavor_t;
 
 namespace glance
 {
-    bool StackWalker::GetCurrentStackBoundsIfNeeded(pthread_t target_thread)
+    namespace
     {
-        if (stack_lower_ != 0 && stack_upper_ != 0)
+        // Returns the `LC_UUID` of the image in hex, which is the Mach-O
+        // counterpart of the GNU build id, or empty if not found.
+        std::string ReadImageUuid(const struct mach_header *header)
         {
-            return true;
+            static constexpr char kHexDigits[] = "0123456789abcdef";
+
+            uintptr_t command_address = reinterpret_cast<uintptr_t>(header);
+            if (header->magic == MH_MAGIC_64)
+            {
+                command_address += sizeof(struct mach_header_64);
+            }
+            else
+            {
+                command_address += sizeof(struct mach_header);
+            }
+            for (uint32_t i = 0; i < header->ncmds; ++i)
+            {
+                const struct load_command *command = reinterpret_cast<const struct load_command *>(command_address);
+                if (command->cmd == LC_UUID)
+                {
+                    const struct uuid_command *uuid = reinterpret_cast<const struct uuid_command *>(command);
+                    std::string result;
+                    for (size_t j = 0; j < sizeof(uuid->uuid); ++j)
+                    {
+                        result += kHexDigits[uuid->uuid[j] >> 4];
+                        result += kHexDigits[uuid->uuid[j] & 0xf];
+                    }
+                    return result;
+                }
+                command_address += command->cmdsize;
+            }
+            return "";
         }
+    } // namespace
+
+    uint64_t GetCurrentOsThreadId()
+    {
+        uint64_t thread_id = 0;
+        pthread_threadid_np(nullptr, &thread_id);
+        return thread_id;
+    }
 
-        stack_upper_ = reinterpret_cast<uword>(pthread_get_stackaddr_np(target_thread));
-        stack_lower_ = stack_upper_ - pthread_get_stacksize_np(target_thread);
+    bool GetCurrentThreadStackBounds(uword *stack_lower, uword *stack_upper)
+    {
+        pthread_t self = pthread_self();
+        *stack_upper = reinterpret_cast<uword>(pthread_get_stackaddr_np(self));
+        *stack_lower = *stack_upper - pthread_get_stacksize_np(self);
 
         return true;
     }
 
+    uint64_t ModuleMap::LoadedModulesGeneration()
+    {
+        // Images are hardly ever unloaded on iOS, the count changes whenever an
+        // image is added.
+        return _dyld_image_count();
+    }
+
+    void ModuleMap::EnumerateLoadedModules(std::vector<LoadedModule> *modules)
+    {
+        uint32_t image_count = _dyld_image_count();
+        for (uint32_t i = 0; i < image_count; ++i)
+        {
+            const struct mach_header *header = _dyld_get_image_header(i);
+            const char *name = _dyld_get_image_name(i);
+            if (header == nullptr)
+            {
+                continue;
+            }
+            intptr_t slide = _dyld_get_image_vmaddr_slide(i);
+
+            uintptr_t command_address = reinterpret_cast<uintptr_t>(header);
+            if (header->magic == MH_MAGIC_64)
+            {
+                command_address += sizeof(struct mach_header_64);
+            }
+            else
+            {
+                command_address += sizeof(struct mach_header);
+            }
+
+            for (uint32_t j = 0; j < header->ncmds; ++j)
+            {
+                const struct load_command *command = reinterpret_cast<const struct load_command *>(command_address);
+                uword start_address = 0;
+                uword end_address = 0;
+                if (command->cmd == LC_SEGMENT_64)
+                {
+                    const struct segment_command_64 *segment = reinterpret_cast<const struct segment_command_64 *>(command);
+                    if (strcmp(segment->segname, SEG_TEXT) == 0)
+                    {
+                        start_address = static_cast<uword>(segment->vmaddr + slide);
+                        end_address = start_address + static_cast<uword>(segment->vmsize);
+                    }
+                }
+                else if (command->cmd == LC_SEGMENT)
+                {
+                    const struct segment_command *segment = reinterpret_cast<const struct segment_command *>(command);
+                    if (strcmp(segment->segname, SEG_TEXT) == 0)
+                    {
+                        start_address = static_cast<uword>(segment->vmaddr + slide);
+                        end_address = start_address + static_cast<uword>(segment->vmsize);
+                    }
+                }
+
+                if (start_address < end_address)
+                {
+                    modules->push_back({name != nullptr ? name : "",
+                                        reinterpret_cast<uword>(header),
+                                        start_address,
+                                        end_address,
+                                        ReadImageUuid(header)});
+                    break;
+                }
+                command_address += command->cmdsize;
+            }
+        }
+    }
+
+    void UnwindTables::EnumerateSections(std::vector<Section> *sections)
+    {
+        // The arm64 ABI of Apple requires the frame pointers, so the frame
+        // pointer chain is complete without the compact unwind info.
+    }
+
+    bool FindDartImage(DartImage *out)
+    {
+        static constexpr char kDartImageName[] = "App.framework/App";
+
+        uint32_t image_count = _dyld_image_count();
+        for (uint32_t i = 0; i < image_count; ++i)
+        {
+            const struct mach_header *header = _dyld_get_image_header(i);
+            const char *name = _dyld_get_image_name(i);
+            if (header == nullptr || name == nullptr || strstr(name, kDartImageName) == nullptr)
+            {
+                continue;
+            }
+
+            out->path = name;
+            out->dso_base = reinterpret_cast<uword>(header);
+            out->build_id = ReadImageUuid(header);
+
+            // The image is already loaded, `RTLD_NOLOAD` only takes a reference
+            // to look up the exported symbols, which is never released as the
+            // image lives as long as the process.
+            void *handle = dlopen(name, RTLD_NOLOAD | RTLD_LAZY);
+            if (handle == nullptr)
+            {
+                return false;
+            }
+            out->isolate_instructions = reinterpret_cast<uword>(dlsym(handle, "kDartIsolateSnapshotInstructions"));
+            out->vm_instructions = reinterpret_cast<uword>(dlsym(handle, "kDartVmSnapshotInstructions"));
+            return out->isolate_instructions != 0;
+        }
+        return false;
+    }
+
     struct InterruptedThreadState
     {
         uintptr_t pc;
@@ -53,17 +210,90 @@ namespace glance
         uintptr_t dsp;
         uintptr_t fp;
         uintptr_t lr;
+        // The register of the number of a syscall, see `ReadInFlightSyscall`.
+        uintptr_t syscall_number;
     };
 
+    namespace
+    {
+        // Returns the number of the syscall the thread of |its| was in when it was
+        // suspended, see `g_last_target_syscall_`. The saved pc of a thread blocked
+        // in a syscall is right after the syscall instruction. The Mach traps are
+        // negative, the same as the numbers of `libsyscall`.
+        //
+        // Reads the code, so it's called after the thread is resumed.
+        int32_t ReadInFlightSyscall(const InterruptedThreadState &its)
+        {
+            // Only read along with the scheduling state, see
+            // `SetNativeSamplerSchedStateEnabled`.
+            if (!g_read_sched_state_.load(std::memory_order_relaxed))
+            {
+                return GLANCE_NO_SYSCALL;
+            }
+
+#if defined(HOST_ARCH_ARM64)
+            // `svc #0x80`, the number is in x16.
+            constexpr uint32_t kSvc = 0xd4001001;
+            uint32_t code[2];
+            vm_size_t size = 0;
+            if (vm_read_overwrite(mach_task_self(), its.pc - sizeof(uint32_t), sizeof(code),
+                                  reinterpret_cast<vm_address_t>(code), &size) == KERN_SUCCESS &&
+                size == sizeof(code) && (code[0] == kSvc || code[1] == kSvc))
+            {
+                return static_cast<int32_t>(static_cast<int64_t>(its.syscall_number));
+            }
+#elif defined(HOST_ARCH_X64)
+            // `syscall`, the class of the number is in the upper bits of rax.
+            constexpr uintptr_t kMachClass = 0x1000000;
+            constexpr uintptr_t kUnixClass = 0x2000000;
+            uint8_t code[2];
+            vm_size_t size = 0;
+            if (vm_read_overwrite(mach_task_self(), its.pc - sizeof(code), sizeof(code),
+                                  reinterpret_cast<vm_address_t>(code), &size) == KERN_SUCCESS &&
+                size == sizeof(code) && code[0] == 0x0f && code[1] == 0x05)
+            {
+                uintptr_t number = its.syscall_number & 0xffffff;
+                switch (its.syscall_number & ~static_cast<uintptr_t>(0xffffff))
+                {
+                case kMachClass:
+                    return -static_cast<int32_t>(number);
+                case kUnixClass:
+                    return static_cast<int32_t>(number);
+                default:
+                    break;
+                }
+            }
+#endif // HOST_ARCH_...
+            return GLANCE_NO_SYSCALL;
+        }
+    } // namespace
+
     class ThreadInterrupterMacOS
     {
     public:
-        explicit ThreadInterrupterMacOS(pthread_t os_thread) : os_thread_(os_thread)
+        explicit ThreadInterrupterMacOS(const TargetThread &target_thread)
+            : target_thread_(target_thread), os_thread_(target_thread.thread)
         {
-            mach_thread_ = pthread_mach_thread_np(os_thread);
+            mach_thread_ = pthread_mach_thread_np(os_thread_);
+            suspend_nanos_ = GetCurrentMonotonicNanos();
             res = thread_suspend(mach_thread_);
+            suspended_nanos_ = GetCurrentMonotonicNanos();
+            // Read while the thread is suspended, so it's the phase of the sample.
+            frame_phase_ = g_frame_phase_.load(std::memory_order_relaxed);
         }
 
+        bool is_suspended() const { return res == KERN_SUCCESS; }
+
+        /// The time of `thread_suspend`, the counterpart of delivering the signal
+        /// on Android, see `SamplerStats`.
+        int64_t signal_delivery_in_nanos() const { return suspended_nanos_ - suspend_nanos_; }
+
+        /// The registers read by the last `CollectSample` or `CollectSnapshot`.
+        const InterruptedThreadState &interrupted_state() const { return its_; }
+
+        /// The `g_frame_phase_` while the thread is suspended.
+        uint64_t frame_phase() const { return frame_phase_; }
+
         void
         CollectSample(int64_t *buf, size_t buf_size)
         {
@@ -80,13 +310,33 @@ namespace glance
             {
                 return;
             }
-            InterruptedThreadState its = ProcessState(state);
+            its_ = ProcessState(state);
 
             Buffer buffer{buf_size, buf};
-            glance::StackWalker stack_walker(os_thread_, &buffer, its.pc, its.fp, its.csp, its.dsp);
+            glance::StackWalker stack_walker(target_thread_, &buffer, its_.pc, its_.fp, its_.csp, its_.dsp);
+            stack_walker.UseLinkRegister(its_.lr);
             stack_walker.Walk();
         }
 
+        bool CollectSnapshot(StackSnapshot *snapshot)
+        {
+            if (res != KERN_SUCCESS)
+            {
+                return false;
+            }
+            auto count = static_cast<mach_msg_type_number_t>(THREAD_STATE_FLAVOR_SIZE);
+            __thread_state_flavor_t state;
+            if (thread_get_state(mach_thread_, THREAD_STATE_FLAVOR,
+                                 reinterpret_cast<thread_state_t>(&state), &count) != KERN_SUCCESS)
+            {
+                return false;
+            }
+            its_ = ProcessState(state);
+
+            CaptureStackSnapshot(target_thread_, its_.pc, its_.fp, its_.csp, its_.dsp, its_.lr, snapshot);
+            return true;
+        }
+
         ~ThreadInterrupterMacOS()
         {
             if (res != KERN_SUCCESS)
@@ -94,6 +344,7 @@ namespace glance
                 return;
             }
             res = thread_resume(mach_thread_);
+            g_last_target_pause_in_nanos_ = GetCurrentMonotonicNanos() - suspend_nanos_;
         }
 
     private:
@@ -106,18 +357,21 @@ namespace glance
             its.csp = state.__rsp;
             its.dsp = state.__rsp;
             its.lr = 0;
+            its.syscall_number = state.__rax;
 #elif defined(HOST_ARCH_ARM64)
             its.pc = state.__pc;
             its.fp = state.__fp;
             its.csp = state.__sp;
             its.dsp = state.__sp;
             its.lr = state.__lr;
+            its.syscall_number = state.__x[16];
 #elif defined(HOST_ARCH_ARM)
             its.pc = state.__pc;
             its.fp = state.__r[7];
             its.csp = state.__sp;
             its.dsp = state.__sp;
             its.lr = state.__lr;
+            its.syscall_number = state.__r[12];
 #endif // HOST_ARCH_...
 
 #if defined(HOST_ARCH_ARM64)
@@ -129,15 +383,88 @@ namespace glance
         }
 
         kern_return_t res;
+        InterruptedThreadState its_{};
+        const TargetThread &target_thread_;
         pthread_t os_thread_;
         mach_port_t mach_thread_;
+        int64_t suspend_nanos_;
+        int64_t suspended_nanos_;
+        uint64_t frame_phase_;
     };
-} // namespace glance
 
-extern "C" char *CollectStackTraceOfTargetThread(int64_t *buf, size_t buf_size)
-{
-    glance::ThreadInterrupterMacOS interrupter(glance::g_target_thread_);
-    interrupter.CollectSample(buf, buf_size);
+    char *CollectStackTrace(const TargetThread &thread, int64_t *buf, size_t buf_size)
+    {
+        if (pthread_equal(thread.thread, pthread_self()))
+        {
+            // Suspending the calling thread never returns.
+            return strdup("can not collect the stack trace of the calling thread");
+        }
+
+        int64_t signal_delivery_in_nanos = 0;
+        InterruptedThreadState its{};
+        size_t stack_copy_size = g_stack_copy_size_.load(std::memory_order_relaxed);
+        if (stack_copy_size == 0)
+        {
+            {
+                ThreadInterrupterMacOS interrupter(thread);
+                if (!interrupter.is_suspended())
+                {
+                    SamplerStats::Instance().RecordFailure();
+                    return strdup("failed to suspend the target thread");
+                }
+                interrupter.CollectSample(buf, buf_size);
+                signal_delivery_in_nanos = interrupter.signal_delivery_in_nanos();
+                its = interrupter.interrupted_state();
+                g_last_target_frame_phase_ = interrupter.frame_phase();
+            }
+            g_last_target_syscall_ = ReadInFlightSyscall(its);
+
+            SamplerStats::Instance().RecordSuccess(buf, buf_size, signal_delivery_in_nanos,
+                                                   g_last_target_pause_in_nanos_);
+            return nullptr;
+        }
+
+        StackSnapshot snapshot;
+        snapshot.data = GetStackSnapshotBuffer(stack_copy_size);
+        snapshot.capacity = stack_copy_size;
+        {
+            // Only keep the thread suspended while copying the stack.
+            ThreadInterrupterMacOS interrupter(thread);
+            if (!interrupter.CollectSnapshot(&snapshot))
+            {
+                SamplerStats::Instance().RecordFailure();
+                return strdup("failed to suspend the target thread");
+            }
+            signal_delivery_in_nanos = interrupter.signal_delivery_in_nanos();
+            its = interrupter.interrupted_state();
+            g_last_target_frame_phase_ = interrupter.frame_phase();
+        }
+        g_last_target_syscall_ = ReadInFlightSyscall(its);
+
+        Buffer buffer{buf_size, buf};
+        StackWalker stack_walker(thread, &buffer, snapshot.pc, snapshot.fp, snapshot.sp, snapshot.dart_sp);
+        stack_walker.UseSnapshot(&snapshot);
+        stack_walker.UseLinkRegister(snapshot.lr);
+        stack_walker.Walk();
+
+        SamplerStats::Instance().RecordSuccess(buf, buf_size, signal_delivery_in_nanos,
+                                               g_last_target_pause_in_nanos_);
+        return nullptr;
+    }
+
+    // There is no timer on the CPU time of a thread that signals the thread.
+    bool StartCpuTimeSampling(const TargetThread &thread, int64_t cpu_rate_in_micros)
+    {
+        return false;
+    }
+
+    void StopCpuTimeSampling()
+    {
+    }
+
+    size_t TakeCpuTimeSample(NativeSample *out)
+    {
+        return 0;
+    }
+} // namespace glance
 
-    return nullptr;
-}
\ No newline at end of file
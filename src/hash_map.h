@@ -0,0 +1,195 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef HASH_MAP_H_
+#define HASH_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace glance
+{
+    /// The finalizer of splitmix64, spreads the poorly distributed bits of pcs and
+    /// addresses over the whole word.
+    inline uint64_t HashWord(uint64_t value)
+    {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ull;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebull;
+        value ^= value >> 31;
+        return value;
+    }
+
+    struct WordHash
+    {
+        size_t operator()(uint64_t value) const { return static_cast<size_t>(HashWord(value)); }
+    };
+
+    /// A hash map with open addressing and linear probing, which stores the
+    /// entries in a single flat array, so the lookups don't chase pointers and
+    /// updating a value of an existing key never allocates.
+    ///
+    /// The entries are erased with backward shifting instead of tombstones, so the
+    /// probe sequences don't degrade when keys come and go (e.g., sliding windows).
+    ///
+    /// Pointers to the values are invalidated by `FindOrInsert` and `Erase`.
+    template <typename Key, typename Value, typename Hash>
+    class HashMap
+    {
+    public:
+        explicit HashMap(size_t initial_capacity = 64)
+            : entries_(RoundUpToPowerOfTwo(initial_capacity)),
+              size_(0)
+        {
+        }
+
+        size_t size() const { return size_; }
+
+        Value *Find(const Key &key)
+        {
+            size_t mask = entries_.size() - 1;
+            for (size_t i = Hash()(key) & mask;; i = (i + 1) & mask)
+            {
+                Entry &entry = entries_[i];
+                if (!entry.occupied)
+                {
+                    return nullptr;
+                }
+                if (entry.key == key)
+                {
+                    return &entry.value;
+                }
+            }
+        }
+
+        /// Returns the value of |key|, inserts |value| if |key| is not found.
+        Value *FindOrInsert(const Key &key, const Value &value, bool *inserted = nullptr)
+        {
+            // Keep the load factor under 1/2 so the probe sequences stay short.
+            if ((size_ + 1) * 2 > entries_.size())
+            {
+                Grow();
+            }
+
+            size_t mask = entries_.size() - 1;
+            for (size_t i = Hash()(key) & mask;; i = (i + 1) & mask)
+            {
+                Entry &entry = entries_[i];
+                if (!entry.occupied)
+                {
+                    entry.occupied = true;
+                    entry.key = key;
+                    entry.value = value;
+                    ++size_;
+                    if (inserted != nullptr)
+                    {
+                        *inserted = true;
+                    }
+                    return &entry.value;
+                }
+                if (entry.key == key)
+                {
+                    if (inserted != nullptr)
+                    {
+                        *inserted = false;
+                    }
+                    return &entry.value;
+                }
+            }
+        }
+
+        bool Erase(const Key &key)
+        {
+            size_t mask = entries_.size() - 1;
+            size_t i = Hash()(key) & mask;
+            for (;; i = (i + 1) & mask)
+            {
+                if (!entries_[i].occupied)
+                {
+                    return false;
+                }
+                if (entries_[i].key == key)
+                {
+                    break;
+                }
+            }
+
+            // Shift the following entries of the probe sequence back into the hole.
+            entries_[i].occupied = false;
+            for (size_t j = (i + 1) & mask; entries_[j].occupied; j = (j + 1) & mask)
+            {
+                size_t home = Hash()(entries_[j].key) & mask;
+                bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+                if (stays)
+                {
+                    continue;
+                }
+                entries_[i] = entries_[j];
+                entries_[j].occupied = false;
+                i = j;
+            }
+            --size_;
+            return true;
+        }
+
+        void Clear()
+        {
+            for (Entry &entry : entries_)
+            {
+                entry.occupied = false;
+            }
+            size_ = 0;
+        }
+
+        template <typename Callback>
+        void ForEach(Callback callback)
+        {
+            for (Entry &entry : entries_)
+            {
+                if (entry.occupied)
+                {
+                    callback(entry.key, entry.value);
+                }
+            }
+        }
+
+    private:
+        struct Entry
+        {
+            bool occupied = false;
+            Key key;
+            Value value;
+        };
+
+        static size_t RoundUpToPowerOfTwo(size_t value)
+        {
+            size_t result = 2;
+            while (result < value)
+            {
+                result <<= 1;
+            }
+            return result;
+        }
+
+        void Grow()
+        {
+            std::vector<Entry> entries(entries_.size() * 2);
+            entries.swap(entries_);
+            size_ = 0;
+            for (Entry &entry : entries)
+            {
+                if (entry.occupied)
+                {
+                    FindOrInsert(entry.key, entry.value);
+                }
+            }
+        }
+
+        std::vector<Entry> entries_;
+
+        size_t size_;
+    };
+} // namespace glance
+
+#endif // HASH_MAP_H_
@@ -0,0 +1,200 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "jank_dedup.h"
+
+#include <algorithm>
+
+namespace glance
+{
+    JankDeduper::JankDeduper(size_t capacity, size_t top_frames)
+        : capacity_(capacity),
+          top_frames_(top_frames),
+          entries_(),
+          index_(capacity * 2),
+          head_(kNil),
+          tail_(kNil),
+          scratch_()
+    {
+        entries_.reserve(capacity);
+    }
+
+    uint64_t JankDeduper::Fingerprint(int64_t isolate_instructions,
+                                      const NativeJankReportFrame *frames,
+                                      size_t frame_count)
+    {
+        int64_t max_occur_times = 0;
+        for (size_t i = 0; i < frame_count; ++i)
+        {
+            if (frames[i].pc >= isolate_instructions)
+            {
+                max_occur_times = std::max(max_occur_times, frames[i].occur_times);
+            }
+        }
+
+        scratch_.clear();
+        for (size_t i = 0; i < frame_count; ++i)
+        {
+            const NativeJankReportFrame &frame = frames[i];
+            if (frame.pc >= isolate_instructions && frame.occur_times * 2 >= max_occur_times)
+            {
+                scratch_.emplace_back(frame.occur_times, frame.pc - isolate_instructions);
+            }
+        }
+
+        // The heaviest first, the ties by offset so the cut is deterministic.
+        size_t top_count = std::min(top_frames_, scratch_.size());
+        std::partial_sort(scratch_.begin(), scratch_.begin() + top_count, scratch_.end(),
+                          [](const std::pair<int64_t, int64_t> &a, const std::pair<int64_t, int64_t> &b)
+                          {
+                              return a.first != b.first ? a.first > b.first : a.second < b.second;
+                          });
+        std::sort(scratch_.begin(), scratch_.begin() + top_count,
+                  [](const std::pair<int64_t, int64_t> &a, const std::pair<int64_t, int64_t> &b)
+                  {
+                      return a.second < b.second;
+                  });
+
+        uint64_t hash = HashWord(top_count);
+        for (size_t i = 0; i < top_count; ++i)
+        {
+            hash = HashWord(hash ^ static_cast<uint64_t>(scratch_[i].second));
+        }
+        // 0 is the `NativeJankFingerprint` of nothing evicted.
+        return hash != 0 ? hash : 1;
+    }
+
+    bool JankDeduper::Record(uint64_t fingerprint,
+                             int64_t timestamp,
+                             NativeJankFingerprint *out,
+                             NativeJankFingerprint *evicted)
+    {
+        evicted->fingerprint = 0;
+
+        uint32_t *found = index_.Find(fingerprint);
+        if (found != nullptr)
+        {
+            uint32_t index = *found;
+            NativeJankFingerprint &entry = entries_[index].fingerprint;
+            ++entry.count;
+            ++entry.repeats;
+            entry.last_seen = timestamp;
+            Unlink(index);
+            PushFront(index);
+            *out = entry;
+            return false;
+        }
+
+        uint32_t index;
+        if (entries_.size() < capacity_)
+        {
+            index = static_cast<uint32_t>(entries_.size());
+            entries_.push_back(Entry());
+        }
+        else
+        {
+            index = tail_;
+            *evicted = entries_[index].fingerprint;
+            Unlink(index);
+            index_.Erase(static_cast<uint64_t>(evicted->fingerprint));
+        }
+
+        NativeJankFingerprint &entry = entries_[index].fingerprint;
+        entry.fingerprint = static_cast<int64_t>(fingerprint);
+        entry.count = 1;
+        entry.repeats = 0;
+        entry.first_seen = timestamp;
+        entry.last_seen = timestamp;
+        index_.FindOrInsert(fingerprint, index);
+        PushFront(index);
+        *out = entry;
+        return true;
+    }
+
+    size_t JankDeduper::TakeSummaries(NativeJankFingerprint *out, size_t max_count)
+    {
+        size_t count = 0;
+        for (uint32_t index = head_; index != kNil && count < max_count; index = entries_[index].next)
+        {
+            NativeJankFingerprint &entry = entries_[index].fingerprint;
+            if (entry.repeats == 0)
+            {
+                continue;
+            }
+            out[count++] = entry;
+            entry.repeats = 0;
+        }
+        return count;
+    }
+
+    void JankDeduper::Unlink(uint32_t index)
+    {
+        Entry &entry = entries_[index];
+        if (entry.prev != kNil)
+        {
+            entries_[entry.prev].next = entry.next;
+        }
+        else
+        {
+            head_ = entry.next;
+        }
+        if (entry.next != kNil)
+        {
+            entries_[entry.next].prev = entry.prev;
+        }
+        else
+        {
+            tail_ = entry.prev;
+        }
+    }
+
+    void JankDeduper::PushFront(uint32_t index)
+    {
+        Entry &entry = entries_[index];
+        entry.prev = kNil;
+        entry.next = head_;
+        if (head_ != kNil)
+        {
+            entries_[head_].prev = index;
+        }
+        head_ = index;
+        if (tail_ == kNil)
+        {
+            tail_ = index;
+        }
+    }
+} // namespace glance
+
+extern "C" void *CreateJankDeduper(int32_t capacity, int32_t top_frames)
+{
+    if (capacity <= 0)
+    {
+        return nullptr;
+    }
+
+    return new glance::JankDeduper(static_cast<size_t>(capacity),
+                                   top_frames > 0 ? static_cast<size_t>(top_frames)
+                                                  : glance::JankDeduper::kDefaultTopFrames);
+}
+
+extern "C" void DestroyJankDeduper(void *deduper)
+{
+    delete static_cast<glance::JankDeduper *>(deduper);
+}
+
+extern "C" int32_t RecordJankReport(void *deduper,
+                                    int64_t isolate_instructions,
+                                    const NativeJankReportFrame *frames,
+                                    size_t frame_count,
+                                    int64_t timestamp,
+                                    NativeJankFingerprint *out,
+                                    NativeJankFingerprint *evicted)
+{
+    glance::JankDeduper *jank_deduper = static_cast<glance::JankDeduper *>(deduper);
+    uint64_t fingerprint = jank_deduper->Fingerprint(isolate_instructions, frames, frame_count);
+    return jank_deduper->Record(fingerprint, timestamp, out, evicted) ? 1 : 0;
+}
+
+extern "C" size_t TakeJankSummaries(void *deduper, NativeJankFingerprint *out, size_t max_count)
+{
+    return static_cast<glance::JankDeduper *>(deduper)->TakeSummaries(out, max_count);
+}
@@ -0,0 +1,140 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef JANK_DEDUP_H_
+#define JANK_DEDUP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "hash_map.h"
+#include "jank_report.h"
+
+/// A fingerprint of the jank reports seen by a `JankDeduper`.
+///
+/// |count| is the reports of the |fingerprint| since it entered the table, and
+/// |repeats| is the ones folded since it was last reported or summarized, see
+/// `TakeJankSummaries`. |first_seen| and |last_seen| are the timestamps of the
+/// reports.
+struct NativeJankFingerprint
+{
+    int64_t fingerprint;
+    int64_t count;
+    int64_t repeats;
+    int64_t first_seen;
+    int64_t last_seen;
+};
+
+namespace glance
+{
+    /// Folds the repeats of the same jank over a session, so a jank hit again and
+    /// again is reported once, and its repeats are summarized periodically
+    /// instead of being reported one by one, even if it alternates with others.
+    ///
+    /// The reports are keyed by `Fingerprint`. The table keeps at most |capacity|
+    /// fingerprints, the least recently seen one is evicted to make room, so it's
+    /// reported again as new if it comes back.
+    ///
+    /// Must be used from one thread at a time.
+    class JankDeduper
+    {
+    public:
+        /// The frames of a report that make up its fingerprint by default.
+        static constexpr size_t kDefaultTopFrames = 8;
+
+        JankDeduper(size_t capacity, size_t top_frames);
+
+        /// Fingerprints the report of the |frame_count| |frames| aggregated by
+        /// occurrence times, the same ones of the text of `GlanceStackTraceImpl`.
+        ///
+        /// The pcs are normalized to the offsets against |isolate_instructions|
+        /// (the frames before it are not in the text), so the fingerprint of the
+        /// app code is the same across the launches. Only the dominant frames
+        /// (occurring at least half as often as the heaviest one) are used, which
+        /// are the callers shared by all the samples of the jank, the innermost
+        /// pcs of a hot loop vary from one occurrence to another. The top
+        /// |top_frames| of them are hashed regardless of their order. Never 0.
+        uint64_t Fingerprint(int64_t isolate_instructions,
+                             const NativeJankReportFrame *frames,
+                             size_t frame_count);
+
+        /// Records a report of |fingerprint| at |timestamp|, and copies its entry
+        /// to |out|. Returns true if it's new, otherwise its |repeats| is counted.
+        ///
+        /// The entry evicted to make room for a new one is copied to |evicted|,
+        /// whose |fingerprint| is 0 if none, so its repeats can be summarized
+        /// before they're lost.
+        bool Record(uint64_t fingerprint,
+                    int64_t timestamp,
+                    NativeJankFingerprint *out,
+                    NativeJankFingerprint *evicted);
+
+        /// Copies at most |max_count| entries with repeats to |out|, the most
+        /// recently seen first, and resets their repeats. Returns the number of
+        /// entries copied, the rest are copied by the next call.
+        size_t TakeSummaries(NativeJankFingerprint *out, size_t max_count);
+
+        size_t size() const { return index_.size(); }
+
+    private:
+        static constexpr uint32_t kNil = UINT32_MAX;
+
+        struct Entry
+        {
+            NativeJankFingerprint fingerprint;
+            // The neighbors of the list of the entries, the most recently seen first.
+            uint32_t prev;
+            uint32_t next;
+        };
+
+        void Unlink(uint32_t index);
+
+        void PushFront(uint32_t index);
+
+        const size_t capacity_;
+
+        const size_t top_frames_;
+
+        std::vector<Entry> entries_;
+
+        // The index of the entry of a fingerprint.
+        HashMap<uint64_t, uint32_t, WordHash> index_;
+
+        uint32_t head_;
+
+        uint32_t tail_;
+
+        // The (occur_times, offset) of the frames of `Fingerprint`, reused.
+        std::vector<std::pair<int64_t, int64_t>> scratch_;
+    };
+} // namespace glance
+
+// Creates a `glance::JankDeduper` of at most |capacity| fingerprints of the top
+// |top_frames| frames. Returns nullptr if |capacity| is not positive.
+//
+// Returned deduper must be destroyed by `DestroyJankDeduper`.
+extern "C" void *CreateJankDeduper(int32_t capacity, int32_t top_frames);
+
+extern "C" void DestroyJankDeduper(void *deduper);
+
+// Fingerprints the report of the |frame_count| |frames| (see
+// `JankDeduper::Fingerprint`), and records it at |timestamp| (see
+// `JankDeduper::Record`).
+//
+// Returns 1 if the fingerprint is new, otherwise 0.
+extern "C" int32_t RecordJankReport(void *deduper,
+                                    int64_t isolate_instructions,
+                                    const NativeJankReportFrame *frames,
+                                    size_t frame_count,
+                                    int64_t timestamp,
+                                    NativeJankFingerprint *out,
+                                    NativeJankFingerprint *evicted);
+
+// Copies at most |max_count| fingerprints with repeats to |out|, see
+// `JankDeduper::TakeSummaries`.
+//
+// Returns the number of fingerprints copied.
+extern "C" size_t TakeJankSummaries(void *deduper, NativeJankFingerprint *out, size_t max_count);
+
+#endif // JANK_DEDUP_H_
@@ -0,0 +1,560 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "jank_report.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "module_map.h"
+
+namespace glance
+{
+    namespace
+    {
+        // See `kGlanceStackTraceHeaderLine` in `constants.dart`.
+        constexpr char kStackTraceHeaderLine[] =
+            "*** *** *** *** *** *** *** *** *** *** *** *** *** *** *** ***";
+
+        std::string ErrnoString(const char *what)
+        {
+            char buf[256];
+            snprintf(buf, sizeof(buf), "%s: %s", what, strerror(errno));
+            return buf;
+        }
+
+        bool WriteFully(int fd, const uint8_t *data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t written = write(fd, data, size);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                data += written;
+                size -= static_cast<size_t>(written);
+            }
+            return true;
+        }
+
+        uint64_t ZigZagEncode(int64_t value)
+        {
+            return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        }
+
+        int64_t ZigZagDecode(uint64_t value)
+        {
+            return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        }
+
+        class ByteReader
+        {
+        public:
+            ByteReader(const uint8_t *data, size_t size)
+                : data_(data), size_(size), position_(0)
+            {
+            }
+
+            bool AtEnd() const { return position_ >= size_; }
+
+            bool ReadByte(uint8_t *out)
+            {
+                if (position_ >= size_)
+                {
+                    return false;
+                }
+                *out = data_[position_++];
+                return true;
+            }
+
+            bool ReadVarint(uint64_t *out)
+            {
+                uint64_t value = 0;
+                for (int shift = 0; shift < 64; shift += 7)
+                {
+                    uint8_t byte;
+                    if (!ReadByte(&byte))
+                    {
+                        return false;
+                    }
+                    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    if ((byte & 0x80) == 0)
+                    {
+                        *out = value;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            bool ReadString(std::string *out)
+            {
+                uint64_t length;
+                if (!ReadVarint(&length) || length > size_ - position_)
+                {
+                    return false;
+                }
+                out->assign(reinterpret_cast<const char *>(data_ + position_), length);
+                position_ += length;
+                return true;
+            }
+
+            /// Splits the next |length| bytes off to |out|.
+            bool ReadBytes(size_t length, ByteReader *out)
+            {
+                if (length > size_ - position_)
+                {
+                    return false;
+                }
+                *out = ByteReader(data_ + position_, length);
+                position_ += length;
+                return true;
+            }
+
+        private:
+            const uint8_t *data_;
+            size_t size_;
+            size_t position_;
+        };
+
+        struct DecodedHeader
+        {
+            int64_t isolate_instructions = 0;
+            std::vector<std::string> lines;
+        };
+
+        // Decodes a report record, or a path report record if |has_path_depth|.
+        bool DecodeReport(ByteReader *reader, const DecodedHeader &header, bool has_path_depth, std::string *out)
+        {
+            uint64_t timestamp;
+            uint64_t frame_count;
+            if (!reader->ReadVarint(&timestamp) || !reader->ReadVarint(&frame_count))
+            {
+                return false;
+            }
+
+            if (header.lines.empty())
+            {
+                out->append(kStackTraceHeaderLine);
+                out->push_back('\n');
+            }
+            for (const std::string &line : header.lines)
+            {
+                out->append(line);
+                out->push_back('\n');
+            }
+
+            // Same as `GlanceStackTraceImpl.toString`.
+            char line[128];
+            for (uint64_t i = 0; i < frame_count; ++i)
+            {
+                uint64_t module_id;
+                uint64_t pc_offset;
+                uint64_t occur_times;
+                uint64_t path_depth = i;
+                if (!reader->ReadVarint(&module_id) ||
+                    !reader->ReadVarint(&pc_offset) ||
+                    !reader->ReadVarint(&occur_times) ||
+                    (has_path_depth && !reader->ReadVarint(&path_depth)))
+                {
+                    return false;
+                }
+
+                int64_t offset = ZigZagDecode(pc_offset);
+                if (offset < 0)
+                {
+                    continue;
+                }
+                uint64_t pc = static_cast<uint64_t>(header.isolate_instructions + offset);
+                int length = snprintf(line, sizeof(line),
+                                      "    #%02" PRIu64 " abs %016" PRIx64 " _kDartIsolateSnapshotInstructions",
+                                      path_depth, pc);
+                out->append(line, static_cast<size_t>(length));
+                if (header.isolate_instructions != 0)
+                {
+                    length = snprintf(line, sizeof(line), "+0x%" PRIx64, static_cast<uint64_t>(offset));
+                    out->append(line, static_cast<size_t>(length));
+                }
+                out->push_back('\n');
+            }
+            return true;
+        }
+    } // namespace
+
+    JankReportWriter *JankReportWriter::Open(const char *path, std::string *error)
+    {
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            *error = ErrnoString("failed to open the jank report file");
+            return nullptr;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            *error = ErrnoString("failed to stat the jank report file");
+            close(fd);
+            return nullptr;
+        }
+        if (st.st_size == 0)
+        {
+            uint8_t preamble[sizeof(jank_report::kMagic) + 1];
+            memcpy(preamble, jank_report::kMagic, sizeof(jank_report::kMagic));
+            preamble[sizeof(jank_report::kMagic)] = jank_report::kVersion;
+            if (!WriteFully(fd, preamble, sizeof(preamble)))
+            {
+                *error = ErrnoString("failed to write the jank report file");
+                close(fd);
+                return nullptr;
+            }
+        }
+
+        return new JankReportWriter(fd);
+    }
+
+    JankReportWriter::JankReportWriter(int fd)
+        : fd_(fd),
+          is_broken_(false),
+          has_header_(false),
+          isolate_instructions_(0)
+    {
+    }
+
+    JankReportWriter::~JankReportWriter()
+    {
+        close(fd_);
+    }
+
+    void JankReportWriter::PutVarint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            record_.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        record_.push_back(static_cast<uint8_t>(value));
+    }
+
+    void JankReportWriter::PutString(const char *value, size_t length)
+    {
+        PutVarint(length);
+        record_.insert(record_.end(), value, value + length);
+    }
+
+    void JankReportWriter::BeginRecord(jank_report::RecordType type)
+    {
+        buffer_.push_back(type);
+        record_.clear();
+    }
+
+    void JankReportWriter::EndRecord()
+    {
+        // The size goes before the body, so the body is encoded to |record_|
+        // first.
+        uint64_t size = record_.size();
+        while (size >= 0x80)
+        {
+            buffer_.push_back(static_cast<uint8_t>(size | 0x80));
+            size >>= 7;
+        }
+        buffer_.push_back(static_cast<uint8_t>(size));
+        buffer_.insert(buffer_.end(), record_.begin(), record_.end());
+    }
+
+    bool JankReportWriter::IsSameHeader(const char *build_id,
+                                        int64_t isolate_instructions,
+                                        const char *const *header_lines,
+                                        size_t header_line_count) const
+    {
+        if (!has_header_ ||
+            isolate_instructions != isolate_instructions_ ||
+            build_id_ != build_id ||
+            header_line_count != header_lines_.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < header_line_count; ++i)
+        {
+            if (header_lines_[i] != header_lines[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void JankReportWriter::EncodeHeader(const char *build_id,
+                                        int64_t isolate_instructions,
+                                        const char *const *header_lines,
+                                        size_t header_line_count)
+    {
+        has_header_ = true;
+        build_id_ = build_id;
+        isolate_instructions_ = isolate_instructions;
+        header_lines_.assign(header_lines, header_lines + header_line_count);
+        written_modules_.clear();
+
+        BeginRecord(jank_report::kHeaderRecord);
+        PutString(build_id_.data(), build_id_.size());
+        PutVarint(static_cast<uint64_t>(isolate_instructions_));
+        PutVarint(header_lines_.size());
+        for (const std::string &line : header_lines_)
+        {
+            PutString(line.data(), line.size());
+        }
+        EndRecord();
+    }
+
+    void JankReportWriter::EncodeModule(int32_t module_id)
+    {
+        if (module_id < 0 ||
+            std::find(written_modules_.begin(), written_modules_.end(), module_id) != written_modules_.end())
+        {
+            return;
+        }
+
+        NativeModuleInfo info;
+        if (!ModuleMap::Instance().GetModule(module_id, &info))
+        {
+            return;
+        }
+        written_modules_.push_back(module_id);
+
+        BeginRecord(jank_report::kModuleRecord);
+        PutVarint(static_cast<uint64_t>(module_id));
+        PutVarint(static_cast<uint64_t>(info.base_address));
+        PutString(info.path, info.path != nullptr ? strlen(info.path) : 0);
+        EndRecord();
+    }
+
+    bool JankReportWriter::Write(const char *build_id,
+                                 int64_t isolate_instructions,
+                                 const char *const *header_lines,
+                                 size_t header_line_count,
+                                 int64_t timestamp,
+                                 const NativeJankReportFrame *frames,
+                                 size_t frame_count,
+                                 std::string *error)
+    {
+        if (is_broken_)
+        {
+            *error = "the jank report file has a partial record that can't be removed";
+            return false;
+        }
+        if (build_id == nullptr)
+        {
+            build_id = "";
+        }
+
+        buffer_.clear();
+        if (!IsSameHeader(build_id, isolate_instructions, header_lines, header_line_count))
+        {
+            EncodeHeader(build_id, isolate_instructions, header_lines, header_line_count);
+        }
+        for (size_t i = 0; i < frame_count; ++i)
+        {
+            EncodeModule(frames[i].module_id);
+        }
+
+        // The frames of a calling context tree are numbered per call path.
+        bool has_path_depth = std::any_of(frames, frames + frame_count,
+                                          [](const NativeJankReportFrame &frame)
+                                          { return frame.path_depth >= 0; });
+        BeginRecord(has_path_depth ? jank_report::kPathReportRecord : jank_report::kReportRecord);
+        PutVarint(static_cast<uint64_t>(timestamp));
+        PutVarint(frame_count);
+        for (size_t i = 0; i < frame_count; ++i)
+        {
+            const NativeJankReportFrame &frame = frames[i];
+            PutVarint(static_cast<uint64_t>(static_cast<int64_t>(frame.module_id) + 1));
+            PutVarint(ZigZagEncode(frame.pc - isolate_instructions));
+            PutVarint(static_cast<uint64_t>(frame.occur_times));
+            if (has_path_depth)
+            {
+                // Same as `GlanceStackTraceImpl.toString`, a frame without a
+                // depth is numbered by its index.
+                PutVarint(static_cast<uint64_t>(frame.path_depth >= 0 ? frame.path_depth
+                                                                      : static_cast<int32_t>(i)));
+            }
+        }
+        EndRecord();
+
+        // The end of the file, the writes are appended there.
+        off_t end = lseek(fd_, 0, SEEK_END);
+        if (end < 0)
+        {
+            *error = ErrnoString("failed to seek the jank report file");
+            return false;
+        }
+        // One `write` per report, a crash leaves at most one truncated record.
+        if (!WriteFully(fd_, buffer_.data(), buffer_.size()))
+        {
+            *error = ErrnoString("failed to write the jank report file");
+            // A partial record would swallow the following records by its size,
+            // remove it so the file ends at a record boundary again.
+            if (ftruncate(fd_, end) != 0)
+            {
+                is_broken_ = true;
+            }
+            // The header and the modules of this report are removed with it,
+            // write them again with the next report.
+            has_header_ = false;
+            return false;
+        }
+        return true;
+    }
+
+    bool DecodeJankReports(const uint8_t *data, size_t size, std::string *out)
+    {
+        if (size < sizeof(jank_report::kMagic) + 1 ||
+            memcmp(data, jank_report::kMagic, sizeof(jank_report::kMagic)) != 0 ||
+            data[sizeof(jank_report::kMagic)] > jank_report::kVersion)
+        {
+            return false;
+        }
+
+        ByteReader reader(data + sizeof(jank_report::kMagic) + 1,
+                          size - sizeof(jank_report::kMagic) - 1);
+        DecodedHeader header;
+        bool is_first_report = true;
+        while (!reader.AtEnd())
+        {
+            uint8_t type;
+            uint64_t record_size;
+            ByteReader record(nullptr, 0);
+            if (!reader.ReadByte(&type) ||
+                !reader.ReadVarint(&record_size) ||
+                !reader.ReadBytes(static_cast<size_t>(record_size), &record))
+            {
+                // Truncated by a crash while appending.
+                break;
+            }
+
+            switch (type)
+            {
+            case jank_report::kHeaderRecord:
+            {
+                std::string build_id;
+                uint64_t isolate_instructions;
+                uint64_t line_count;
+                if (!record.ReadString(&build_id) ||
+                    !record.ReadVarint(&isolate_instructions) ||
+                    !record.ReadVarint(&line_count))
+                {
+                    return false;
+                }
+                header.isolate_instructions = static_cast<int64_t>(isolate_instructions);
+                header.lines.clear();
+                for (uint64_t i = 0; i < line_count; ++i)
+                {
+                    std::string line;
+                    if (!record.ReadString(&line))
+                    {
+                        return false;
+                    }
+                    header.lines.push_back(std::move(line));
+                }
+                break;
+            }
+            case jank_report::kReportRecord:
+            case jank_report::kPathReportRecord:
+            {
+                if (!is_first_report)
+                {
+                    out->push_back('\n');
+                }
+                is_first_report = false;
+                if (!DecodeReport(&record, header, type == jank_report::kPathReportRecord, out))
+                {
+                    return false;
+                }
+                break;
+            }
+            default:
+                // The modules are not part of the text, and the unknown records
+                // are skipped.
+                break;
+            }
+        }
+        return true;
+    }
+} // namespace glance
+
+extern "C" char *OpenJankReportWriter(const char *path, void **out)
+{
+    std::string error;
+    glance::JankReportWriter *writer = glance::JankReportWriter::Open(path, &error);
+    if (writer == nullptr)
+    {
+        return strdup(error.c_str());
+    }
+    *out = writer;
+    return nullptr;
+}
+
+extern "C" char *WriteJankReport(void *writer,
+                                 const char *build_id,
+                                 int64_t isolate_instructions,
+                                 const char *const *header_lines,
+                                 size_t header_line_count,
+                                 int64_t timestamp,
+                                 const NativeJankReportFrame *frames,
+                                 size_t frame_count)
+{
+    std::string error;
+    if (!static_cast<glance::JankReportWriter *>(writer)->Write(build_id,
+                                                                isolate_instructions,
+                                                                header_lines,
+                                                                header_line_count,
+                                                                timestamp,
+                                                                frames,
+                                                                frame_count,
+                                                                &error))
+    {
+        return strdup(error.c_str());
+    }
+    return nullptr;
+}
+
+extern "C" void CloseJankReportWriter(void *writer)
+{
+    delete static_cast<glance::JankReportWriter *>(writer);
+}
+
+extern "C" char *DecodeJankReportFile(const char *path, char **out)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return strdup(glance::ErrnoString("failed to open the jank report file").c_str());
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        data.insert(data.end(), chunk, chunk + read);
+    }
+    fclose(file);
+
+    std::string text;
+    if (!glance::DecodeJankReports(data.data(), data.size(), &text))
+    {
+        return strdup("not a jank report file");
+    }
+    *out = strdup(text.c_str());
+    return nullptr;
+}
@@ -0,0 +1,175 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef JANK_REPORT_H_
+#define JANK_REPORT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// A frame of a jank report, see `WriteJankReport`.
+///
+/// |module_id| is the id of `ModuleMap`, or -1 if the pc is not resolved.
+/// |path_depth| is the depth of the frame in its call path of a calling context
+/// tree, see `AggregatedNativeFrame.pathDepth`, or -1 if the frames are one stack.
+struct NativeJankReportFrame
+{
+    int64_t pc;
+    int64_t occur_times;
+    int32_t module_id;
+    int32_t path_depth;
+};
+
+namespace glance
+{
+    /// The compact binary format of the jank reports, which replaces the text of
+    /// `GlanceStackTraceImpl.toString` for uploading and storing the reports.
+    ///
+    /// All the integers are LEB128 varints, the signed ones are zigzag encoded.
+    /// The strings are the varint length followed by the bytes.
+    ///
+    /// ```
+    /// file   := "GLJR" version:u8 record*
+    /// record := type:u8 size:varint body[size]
+    /// header := build_id:string isolate_instructions:varint line_count:varint line:string*
+    /// module := module_id:varint base_address:varint path:string
+    /// report := timestamp:varint frame_count:varint frame*
+    /// frame  := module_id+1:varint pc-isolate_instructions:zigzag occur_times:varint
+    /// path_report := timestamp:varint frame_count:varint path_frame*
+    /// path_frame  := frame path_depth:varint
+    /// ```
+    ///
+    /// A header applies to the following records until the next header, and the
+    /// modules are only written once per header, the first time a report refers
+    /// to them. The size of a record lets a reader skip the unknown record types,
+    /// and drop a record truncated by a crash while it was being appended. The
+    /// reports of a calling context tree are path reports, whose frames are
+    /// numbered by their path depth, the other reports keep the plain frames.
+    namespace jank_report
+    {
+        constexpr char kMagic[4] = {'G', 'L', 'J', 'R'};
+
+        constexpr uint8_t kVersion = 1;
+
+        enum RecordType : uint8_t
+        {
+            kHeaderRecord = 1,
+            kModuleRecord = 2,
+            kReportRecord = 3,
+            kPathReportRecord = 4,
+        };
+    } // namespace jank_report
+
+    /// Appends the jank reports to a file in the format of `jank_report`.
+    ///
+    /// A report is encoded into a reused buffer and appended with a single
+    /// `write`, no intermediate strings are built. Must be used from one thread
+    /// at a time.
+    class JankReportWriter
+    {
+    public:
+        /// Opens |path| for appending, creates it if needed. Returns nullptr and
+        /// sets |error| on failure.
+        static JankReportWriter *Open(const char *path, std::string *error);
+
+        ~JankReportWriter();
+
+        /// Appends a report of the |frame_count| |frames|. Returns false and sets
+        /// |error| on failure, the partial record of a failed write is removed
+        /// so the following reports can still be read.
+        bool Write(const char *build_id,
+                   int64_t isolate_instructions,
+                   const char *const *header_lines,
+                   size_t header_line_count,
+                   int64_t timestamp,
+                   const NativeJankReportFrame *frames,
+                   size_t frame_count,
+                   std::string *error);
+
+    private:
+        explicit JankReportWriter(int fd);
+
+        bool IsSameHeader(const char *build_id,
+                          int64_t isolate_instructions,
+                          const char *const *header_lines,
+                          size_t header_line_count) const;
+
+        void EncodeHeader(const char *build_id,
+                          int64_t isolate_instructions,
+                          const char *const *header_lines,
+                          size_t header_line_count);
+
+        void EncodeModule(int32_t module_id);
+
+        // Starts a record of |type|, which is finished by `EndRecord`.
+        void BeginRecord(jank_report::RecordType type);
+
+        void EndRecord();
+
+        void PutVarint(uint64_t value);
+
+        void PutString(const char *value, size_t length);
+
+        int fd_;
+
+        // A failed write left a partial record that couldn't be truncated, the
+        // records appended after it would be misread.
+        bool is_broken_;
+
+        bool has_header_;
+
+        std::string build_id_;
+
+        int64_t isolate_instructions_;
+
+        std::vector<std::string> header_lines_;
+
+        // The modules written since the last header.
+        std::vector<int32_t> written_modules_;
+
+        std::vector<uint8_t> buffer_;
+
+        std::vector<uint8_t> record_;
+    };
+
+    /// Decodes the jank reports of |data| into the text of
+    /// `GlanceStackTraceImpl.toString`, which can be passed to `flutter symbolize`.
+    /// The reports are separated by an empty line. A truncated record at the end
+    /// is dropped. Returns false if |data| is not in the format.
+    bool DecodeJankReports(const uint8_t *data, size_t size, std::string *out);
+} // namespace glance
+
+// Opens |path| to append the jank reports, and returns the writer to |out|.
+//
+// On success returns nullptr otherwise returns a string containing the error.
+//
+// Returned string must be freed by the caller.
+extern "C" char *OpenJankReportWriter(const char *path, void **out);
+
+// Appends a jank report of the |frame_count| |frames|, see
+// `JankReportWriter::Write`.
+//
+// On success returns nullptr otherwise returns a string containing the error.
+//
+// Returned string must be freed by the caller.
+extern "C" char *WriteJankReport(void *writer,
+                                 const char *build_id,
+                                 int64_t isolate_instructions,
+                                 const char *const *header_lines,
+                                 size_t header_line_count,
+                                 int64_t timestamp,
+                                 const NativeJankReportFrame *frames,
+                                 size_t frame_count);
+
+extern "C" void CloseJankReportWriter(void *writer);
+
+// Decodes the jank reports file of |path| to text, see `DecodeJankReports`. The
+// text is returned to |out|, which must be freed by the caller.
+//
+// On success returns nullptr otherwise returns a string containing the error.
+//
+// Returned string must be freed by the caller.
+extern "C" char *DecodeJankReportFile(const char *path, char **out);
+
+#endif // JANK_REPORT_H_
@@ -0,0 +1,283 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "module_map.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <dlfcn.h> // NOLINT
+
+namespace glance
+{
+    ModuleMap &ModuleMap::Instance()
+    {
+        // Leaked on purpose, the interned strings must live as long as the process.
+        static ModuleMap *instance = new ModuleMap();
+        return *instance;
+    }
+
+    ModuleMap::ModuleMap()
+        : is_built_(false),
+          generation_(0),
+          pc_cache_(kPcCacheSize)
+    {
+        ClearPcCache();
+    }
+
+    void ModuleMap::SetPathFilters(const char *const *patterns, size_t count)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        path_filters_.clear();
+        for (size_t i = 0; i < count; ++i)
+        {
+            path_filters_.emplace_back(patterns[i], std::regex::ECMAScript | std::regex::optimize);
+        }
+
+        for (Module &module : modules_)
+        {
+            module.is_filtered_in = IsFilteredIn(module.path);
+        }
+        is_built_ = false;
+    }
+
+    bool ModuleMap::IsFilteredIn(const std::string &path) const
+    {
+        if (path_filters_.empty())
+        {
+            return true;
+        }
+
+        for (const std::regex &filter : path_filters_)
+        {
+            if (std::regex_match(path, filter))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ModuleMap::Refresh()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        RebuildIfNeeded();
+    }
+
+    void ModuleMap::RebuildIfNeeded()
+    {
+        uint64_t generation = LoadedModulesGeneration();
+        if (is_built_ && generation == generation_)
+        {
+            return;
+        }
+
+        generation_ = generation;
+        Rebuild();
+        is_built_ = true;
+    }
+
+    void ModuleMap::Rebuild()
+    {
+        std::vector<LoadedModule> loaded_modules;
+        EnumerateLoadedModules(&loaded_modules);
+
+        ranges_.clear();
+        for (const LoadedModule &loaded_module : loaded_modules)
+        {
+            // Reuse the id of a module that is already known, so the ids handed
+            // out before stay valid.
+            int32_t module_id = -1;
+            for (size_t i = 0; i < modules_.size(); ++i)
+            {
+                if (modules_[i].base_address == loaded_module.base_address &&
+                    modules_[i].path == loaded_module.path)
+                {
+                    module_id = static_cast<int32_t>(i);
+                    break;
+                }
+            }
+            if (module_id == -1)
+            {
+                module_id = static_cast<int32_t>(modules_.size());
+                modules_.push_back({loaded_module.path,
+                                    loaded_module.base_address,
+                                    loaded_module.start_address,
+                                    loaded_module.end_address,
+                                    loaded_module.build_id,
+                                    IsFilteredIn(loaded_module.path)});
+            }
+
+            // The address range check replaces matching the module path against
+            // the filters for every frame.
+            if (modules_[module_id].is_filtered_in)
+            {
+                ranges_.push_back({loaded_module.start_address, loaded_module.end_address, module_id});
+            }
+        }
+
+        std::sort(ranges_.begin(), ranges_.end(), [](const Range &a, const Range &b)
+                  { return a.start_address < b.start_address; });
+
+        // The pcs may belong to other modules now.
+        ClearPcCache();
+    }
+
+    int32_t ModuleMap::FindModule(uword pc) const
+    {
+        // Find the last range that starts at or before |pc|.
+        auto it = std::upper_bound(ranges_.begin(), ranges_.end(), pc, [](uword value, const Range &range)
+                                   { return value < range.start_address; });
+        if (it == ranges_.begin())
+        {
+            return -1;
+        }
+        --it;
+        return pc < it->end_address ? it->module_id : -1;
+    }
+
+    int32_t ModuleMap::InternSymbol(uword pc)
+    {
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void *>(pc), &info) == 0 || info.dli_sname == nullptr)
+        {
+            return -1;
+        }
+
+        uword symbol_address = reinterpret_cast<uword>(info.dli_saddr);
+        auto it = symbol_ids_by_address_.find(symbol_address);
+        if (it != symbol_ids_by_address_.end())
+        {
+            return it->second;
+        }
+
+        char *symbol_name = LookupSymbolName(&info);
+        int32_t symbol_id = static_cast<int32_t>(symbol_names_.size());
+        symbol_names_.emplace_back(symbol_name != nullptr ? symbol_name : "");
+        free(symbol_name);
+        symbol_ids_by_address_.emplace(symbol_address, symbol_id);
+        return symbol_id;
+    }
+
+    void ModuleMap::ClearPcCache()
+    {
+        for (PcCacheEntry &entry : pc_cache_)
+        {
+            entry.pc = 0;
+        }
+    }
+
+    void ModuleMap::Resolve(const int64_t *pcs, size_t count, NativeFrameInfo *out)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!is_built_)
+        {
+            RebuildIfNeeded();
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            uword pc = static_cast<uword>(pcs[i]);
+            if (pc == 0)
+            {
+                out[i] = {-1, -1};
+                continue;
+            }
+
+            // Fibonacci hashing, the low bits of the pcs are poorly distributed.
+            size_t index = static_cast<size_t>((pc * 11400714819323198485ull) >> 52) & (kPcCacheSize - 1);
+            PcCacheEntry &entry = pc_cache_[index];
+            if (entry.pc == pc)
+            {
+                out[i] = entry.info;
+                continue;
+            }
+
+            NativeFrameInfo info{FindModule(pc), -1};
+            if (info.module_id != -1)
+            {
+                info.symbol_id = InternSymbol(pc);
+            }
+
+            entry.pc = pc;
+            entry.info = info;
+            out[i] = info;
+        }
+    }
+
+    bool ModuleMap::GetModule(int32_t module_id, NativeModuleInfo *out)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (module_id < 0 || static_cast<size_t>(module_id) >= modules_.size())
+        {
+            return false;
+        }
+
+        const Module &module = modules_[module_id];
+        out->base_address = static_cast<int64_t>(module.base_address);
+        out->start_address = static_cast<int64_t>(module.start_address);
+        out->end_address = static_cast<int64_t>(module.end_address);
+        out->path = module.path.c_str();
+        return true;
+    }
+
+    bool ModuleMap::GetLoadedModule(int32_t module_id, LoadedModule *out)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (module_id < 0 || static_cast<size_t>(module_id) >= modules_.size())
+        {
+            return false;
+        }
+
+        const Module &module = modules_[module_id];
+        *out = {module.path, module.base_address, module.start_address, module.end_address, module.build_id};
+        return true;
+    }
+
+    void ModuleMap::GetFilteredInModules(std::vector<LoadedModule> *out)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        RebuildIfNeeded();
+
+        out->clear();
+        for (const Range &range : ranges_)
+        {
+            const Module &module = modules_[range.module_id];
+            out->push_back({module.path, module.base_address, range.start_address, range.end_address, module.build_id});
+        }
+    }
+
+    const char *ModuleMap::GetSymbolName(int32_t symbol_id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (symbol_id < 0 || static_cast<size_t>(symbol_id) >= symbol_names_.size())
+        {
+            return nullptr;
+        }
+
+        return symbol_names_[symbol_id].c_str();
+    }
+} // namespace glance
+
+extern "C" void SetModulePathFilters(const char *const *patterns, size_t count)
+{
+    glance::ModuleMap::Instance().SetPathFilters(patterns, count);
+}
+
+extern "C" void RefreshModuleMap()
+{
+    glance::ModuleMap::Instance().Refresh();
+}
+
+extern "C" void ResolveNativeFrames(const int64_t *pcs, size_t count, NativeFrameInfo *out)
+{
+    glance::ModuleMap::Instance().Resolve(pcs, count, out);
+}
+
+extern "C" int GetNativeModule(int32_t module_id, NativeModuleInfo *out)
+{
+    return glance::ModuleMap::Instance().GetModule(module_id, out) ? 1 : 0;
+}
+
+extern "C" const char *GetInternedSymbolName(int32_t symbol_id)
+{
+    return glance::ModuleMap::Instance().GetSymbolName(symbol_id);
+}
@@ -0,0 +1,176 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef MODULE_MAP_H_
+#define MODULE_MAP_H_
+
+#include <deque>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "collect_stack.h"
+
+/// The module and symbol a pc is resolved to, see `ResolveNativeFrames`.
+///
+/// |module_id| and |symbol_id| are -1 if the pc is not resolved.
+struct NativeFrameInfo
+{
+    int32_t module_id;
+    int32_t symbol_id;
+};
+
+/// A loaded module (shared library or image), see `GetNativeModule`.
+///
+/// |path| is owned by the module map and lives as long as the process.
+struct NativeModuleInfo
+{
+    int64_t base_address;
+    int64_t start_address;
+    int64_t end_address;
+    const char *path;
+};
+
+namespace glance
+{
+    /// A loaded module reported by the platform, see `ModuleMap::EnumerateLoadedModules`.
+    ///
+    /// |build_id| is the GNU build id or the `LC_UUID` in hex, or empty if the
+    /// module has none.
+    struct LoadedModule
+    {
+        std::string path;
+        uword base_address;
+        uword start_address;
+        uword end_address;
+        std::string build_id;
+    };
+
+    /// Caches the address ranges of the loaded modules sorted for binary search,
+    /// and interns the symbol names, so resolving a pc doesn't need `dladdr`,
+    /// demangling and allocating the symbol name every time.
+    ///
+    /// The address ranges are only rebuilt by `Refresh` when the platform reports
+    /// that the loaded modules are changed (see `LoadedModulesGeneration`), and
+    /// the module ids are stable across rebuilds.
+    class ModuleMap
+    {
+    public:
+        static ModuleMap &Instance();
+
+        /// Only the modules whose paths match one of the |patterns| (regular
+        /// expressions, e.g., `kAndroidDefaultModulePathFilters`) are resolved. All
+        /// modules are resolved if |count| is 0.
+        void SetPathFilters(const char *const *patterns, size_t count);
+
+        /// Rebuilds the address ranges if the loaded modules are changed. Checking
+        /// it walks the loaded modules, so it's called once per batch of
+        /// `Resolve` (e.g., per aggregation or export), not per stack.
+        void Refresh();
+
+        /// Resolves the |count| |pcs| to |out| against the address ranges of the
+        /// last `Refresh`, they're only built by the first call.
+        void Resolve(const int64_t *pcs, size_t count, NativeFrameInfo *out);
+
+        bool GetModule(int32_t module_id, NativeModuleInfo *out);
+
+        /// Same as `GetModule`, but also gets the build id.
+        bool GetLoadedModule(int32_t module_id, LoadedModule *out);
+
+        /// Refreshes the address ranges, and copies the loaded modules that are
+        /// filtered in to |out|, sorted by their start addresses.
+        void GetFilteredInModules(std::vector<LoadedModule> *out);
+
+        /// Returns the interned symbol name of |symbol_id|, or nullptr if not found.
+        const char *GetSymbolName(int32_t symbol_id);
+
+        /// Returns a value which changes whenever a module is loaded or unloaded.
+        ///
+        /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+        static uint64_t LoadedModulesGeneration();
+
+    private:
+        struct Module
+        {
+            std::string path;
+            uword base_address;
+            uword start_address;
+            uword end_address;
+            std::string build_id;
+            bool is_filtered_in;
+        };
+
+        struct Range
+        {
+            uword start_address;
+            uword end_address;
+            int32_t module_id;
+        };
+
+        struct PcCacheEntry
+        {
+            uword pc;
+            NativeFrameInfo info;
+        };
+
+        // Must be a power of 2.
+        static constexpr size_t kPcCacheSize = 4096;
+
+        ModuleMap();
+
+        /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+        static void EnumerateLoadedModules(std::vector<LoadedModule> *modules);
+
+        void RebuildIfNeeded();
+
+        void Rebuild();
+
+        bool IsFilteredIn(const std::string &path) const;
+
+        int32_t FindModule(uword pc) const;
+
+        int32_t InternSymbol(uword pc);
+
+        void ClearPcCache();
+
+        std::mutex mutex_;
+
+        bool is_built_;
+
+        uint64_t generation_;
+
+        std::vector<std::regex> path_filters_;
+
+        // A deque keeps the references to the paths stable while growing.
+        std::deque<Module> modules_;
+
+        std::vector<Range> ranges_;
+
+        std::unordered_map<uword, int32_t> symbol_ids_by_address_;
+
+        std::deque<std::string> symbol_names_;
+
+        std::vector<PcCacheEntry> pc_cache_;
+    };
+} // namespace glance
+
+// Sets the module path filters, see `ModuleMap::SetPathFilters`.
+extern "C" void SetModulePathFilters(const char *const *patterns, size_t count);
+
+// Refreshes the module map if the loaded modules are changed, see
+// `ModuleMap::Refresh`. Called once before resolving a batch of stacks.
+extern "C" void RefreshModuleMap();
+
+// Resolves the |count| |pcs| to the module ids and symbol ids in |out|.
+extern "C" void ResolveNativeFrames(const int64_t *pcs, size_t count, NativeFrameInfo *out);
+
+// Gets the module of |module_id| to |out|. Returns 0 if not found.
+extern "C" int GetNativeModule(int32_t module_id, NativeModuleInfo *out);
+
+// Returns the symbol name of |symbol_id|, or nullptr if not found.
+//
+// Returned string is owned by the module map and must not be freed.
+extern "C" const char *GetInternedSymbolName(int32_t symbol_id);
+
+#endif // MODULE_MAP_H_
@@ -0,0 +1,258 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "perf_event_sampler.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "collect_stack.h"
+#include "sampler_stats.h"
+
+#if defined(DART_HOST_OS_ANDROID) || defined(DART_HOST_OS_LINUX)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace glance
+{
+    std::atomic<bool> g_use_perf_events_(false);
+
+#if defined(DART_HOST_OS_ANDROID) || defined(DART_HOST_OS_LINUX)
+    namespace
+    {
+        // The data pages of the ring, a power of 2. A sample takes at most about
+        // 1KB (a callchain of `perf_event_max_stack` 127 frames), and the ring is
+        // drained on every tick, which sees a few samples at most.
+        constexpr size_t kPerfEventDataPages = 16;
+
+        // The layout of a `PERF_RECORD_SAMPLE` of the `sample_type` of `Open`,
+        // followed by the `nr` ips of the callchain.
+        struct PerfSampleRecord
+        {
+            perf_event_header header;
+            uint32_t pid;
+            uint32_t tid;
+            uint64_t time;
+            uint64_t nr;
+        };
+
+        struct PerfLostRecord
+        {
+            perf_event_header header;
+            uint64_t id;
+            uint64_t lost;
+        };
+
+        uint64_t ToSamplePeriod(int64_t sample_rate_in_micros)
+        {
+            return static_cast<uint64_t>(sample_rate_in_micros) * 1000;
+        }
+    } // namespace
+
+    PerfEventSampler *PerfEventSampler::Open(uint64_t os_thread_id, int64_t sample_rate_in_micros)
+    {
+        if (os_thread_id == 0 || sample_rate_in_micros <= 0)
+        {
+            return nullptr;
+        }
+
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        // Counts the CPU time of the thread only, unlike `PERF_COUNT_SW_CPU_CLOCK`
+        // which also counts the time of the other tasks on the CPU.
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+        attr.sample_period = ToSamplePeriod(sample_rate_in_micros);
+        attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+        // The user space frames only, which are allowed by `perf_event_paranoid`
+        // up to 2, the default of Linux.
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.exclude_callchain_kernel = 1;
+        // The same clock as `GetCurrentMonotonicMicros`, so the samples can be
+        // queried by the timestamps of the frames.
+        attr.use_clockid = 1;
+        attr.clockid = CLOCK_MONOTONIC;
+
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr,
+                                          static_cast<pid_t>(os_thread_id), -1, -1,
+                                          PERF_FLAG_FD_CLOEXEC));
+        if (fd == -1)
+        {
+            return nullptr;
+        }
+
+        size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t mapping_size = (1 + kPerfEventDataPages) * page_size;
+        void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        return new PerfEventSampler(fd, static_cast<uint8_t *>(mapping), mapping_size, page_size,
+                                    sample_rate_in_micros);
+    }
+
+    PerfEventSampler::PerfEventSampler(int fd, uint8_t *mapping, size_t mapping_size, size_t page_size,
+                                       int64_t sample_rate_in_micros)
+        : fd_(fd),
+          mapping_(mapping),
+          mapping_size_(mapping_size),
+          page_size_(page_size),
+          sample_rate_in_micros_(sample_rate_in_micros),
+          scratch_(),
+          sample_()
+    {
+    }
+
+    PerfEventSampler::~PerfEventSampler()
+    {
+        munmap(mapping_, mapping_size_);
+        close(fd_);
+    }
+
+    void PerfEventSampler::SetSampleRate(int64_t sample_rate_in_micros)
+    {
+        if (sample_rate_in_micros <= 0 || sample_rate_in_micros == sample_rate_in_micros_)
+        {
+            return;
+        }
+
+        uint64_t period = ToSamplePeriod(sample_rate_in_micros);
+        if (ioctl(fd_, PERF_EVENT_IOC_PERIOD, &period) == 0)
+        {
+            sample_rate_in_micros_ = sample_rate_in_micros;
+        }
+    }
+
+    const uint8_t *PerfEventSampler::ReadData(uint64_t offset, size_t size)
+    {
+        const uint8_t *data = mapping_ + page_size_;
+        size_t data_size = mapping_size_ - page_size_;
+        size_t begin = static_cast<size_t>(offset & (data_size - 1));
+        if (begin + size <= data_size)
+        {
+            return data + begin;
+        }
+
+        scratch_.resize(size);
+        size_t first = data_size - begin;
+        memcpy(scratch_.data(), data + begin, first);
+        memcpy(scratch_.data() + first, data, size - first);
+        return scratch_.data();
+    }
+
+    size_t PerfEventSampler::Drain(SampleRing *samples)
+    {
+        perf_event_mmap_page *metadata = reinterpret_cast<perf_event_mmap_page *>(mapping_);
+        uint64_t head = __atomic_load_n(&metadata->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = metadata->data_tail;
+
+        size_t count = 0;
+        while (tail < head)
+        {
+            perf_event_header header;
+            memcpy(&header, ReadData(tail, sizeof(header)), sizeof(header));
+            if (header.size < sizeof(header) || tail + header.size > head)
+            {
+                // Should not happen, drop everything rather than misparse the rest.
+                tail = head;
+                break;
+            }
+
+            const uint8_t *record = ReadData(tail, header.size);
+            if (header.type == PERF_RECORD_SAMPLE)
+            {
+                AddSample(record, header.size, samples);
+                ++count;
+            }
+            else if (header.type == PERF_RECORD_LOST && header.size >= sizeof(PerfLostRecord))
+            {
+                // The ring was full, e.g., the sampler thread was descheduled.
+                PerfLostRecord lost;
+                memcpy(&lost, record, sizeof(lost));
+                SamplerStats::Instance().RecordFailures(lost.lost);
+            }
+            tail += header.size;
+        }
+
+        __atomic_store_n(&metadata->data_tail, tail, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    void PerfEventSampler::AddSample(const uint8_t *record, size_t size, SampleRing *samples)
+    {
+        if (size < sizeof(PerfSampleRecord))
+        {
+            SamplerStats::Instance().RecordFailure();
+            return;
+        }
+
+        PerfSampleRecord sample;
+        memcpy(&sample, record, sizeof(sample));
+        size_t nr = std::min<uint64_t>(sample.nr, (size - sizeof(sample)) / sizeof(uint64_t));
+        const uint8_t *ips = record + sizeof(sample);
+
+        size_t depth = 0;
+        for (size_t i = 0; i < nr && depth < GLANCE_MAX_STACK_DEPTH - 1; ++i)
+        {
+            uint64_t ip;
+            memcpy(&ip, ips + i * sizeof(ip), sizeof(ip));
+            if (ip >= PERF_CONTEXT_MAX)
+            {
+                // The markers of the context, e.g., `PERF_CONTEXT_USER`.
+                continue;
+            }
+            sample_.pcs[depth++] = static_cast<int64_t>(ip);
+        }
+        // Terminated the same as the stacks walked by `StackWalker`.
+        sample_.pcs[depth] = 0;
+        sample_.depth = static_cast<int32_t>(depth);
+        // Only the CPU time of the thread is sampled.
+        sample_.kind = GLANCE_SAMPLE_KIND_CPU;
+        // Only sampled while running, the registers are not sampled.
+        sample_.syscall = GLANCE_NO_SYSCALL;
+        sample_.run_state = 'R';
+        sample_.voluntary_switches = 0;
+        sample_.involuntary_switches = 0;
+        // Taken by the kernel, the phase of the time of the sample is unknown.
+        SetFramePhaseOf(GLANCE_FRAME_PHASE_IDLE, &sample_);
+        sample_.timestamp = static_cast<int64_t>(sample.time / 1000);
+        samples->Write(sample_);
+
+        int64_t delivery_in_nanos = GetCurrentMonotonicNanos() - static_cast<int64_t>(sample.time);
+        // The target thread is never paused by us.
+        SamplerStats::Instance().RecordSuccess(sample_.pcs, GLANCE_MAX_STACK_DEPTH, delivery_in_nanos, 0);
+    }
+#else
+    PerfEventSampler *PerfEventSampler::Open(uint64_t os_thread_id, int64_t sample_rate_in_micros)
+    {
+        return nullptr;
+    }
+
+    PerfEventSampler::~PerfEventSampler()
+    {
+    }
+
+    void PerfEventSampler::SetSampleRate(int64_t sample_rate_in_micros)
+    {
+    }
+
+    size_t PerfEventSampler::Drain(SampleRing *samples)
+    {
+        return 0;
+    }
+#endif
+} // namespace glance
+
+extern "C" void SetNativeSamplerPerfEventsEnabled(int enabled)
+{
+    glance::g_use_perf_events_.store(enabled != 0);
+}
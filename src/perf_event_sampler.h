@@ -0,0 +1,80 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef PERF_EVENT_SAMPLER_H_
+#define PERF_EVENT_SAMPLER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "sample_ring.h"
+
+namespace glance
+{
+    /// Whether the `NativeSampler` samples with a `PerfEventSampler` instead of
+    /// the signals, see `SetNativeSamplerPerfEventsEnabled`.
+    extern std::atomic<bool> g_use_perf_events_;
+
+    /// Samples a thread with a `perf_event_open` task clock event: the kernel
+    /// interrupts the thread every |sample_rate_in_micros| of its CPU time, and
+    /// writes the user space callchain (following the frame pointers, the same
+    /// as `StackWalker`) to a ring mapped into memory, which is drained to the
+    /// `SampleRing` by the sampler thread. So the target thread never runs any
+    /// code of ours, and the sampler thread never waits for it.
+    ///
+    /// Unlike the signals, the thread is only sampled while it's running on a
+    /// CPU, i.e., the time it's blocked (e.g., on a lock or I/O) has no samples.
+    ///
+    /// Only supported on Android and Linux.
+    class PerfEventSampler
+    {
+    public:
+        /// Opens the event of the thread of |os_thread_id|. Returns nullptr if
+        /// it's not supported or denied, e.g., by `perf_event_paranoid` or the
+        /// seccomp policy of the app.
+        static PerfEventSampler *Open(uint64_t os_thread_id, int64_t sample_rate_in_micros);
+
+        ~PerfEventSampler();
+
+        /// Changes the sample period of the event, e.g., for a burst.
+        void SetSampleRate(int64_t sample_rate_in_micros);
+
+        /// Copies the samples written by the kernel since the last call to
+        /// |samples|. Returns the number of samples copied.
+        size_t Drain(SampleRing *samples);
+
+    private:
+        PerfEventSampler(int fd, uint8_t *mapping, size_t mapping_size, size_t page_size,
+                         int64_t sample_rate_in_micros);
+
+        /// Returns the |size| bytes at |offset| of the data ring, which are
+        /// copied to |scratch_| if they wrap around the end of the ring.
+        const uint8_t *ReadData(uint64_t offset, size_t size);
+
+        void AddSample(const uint8_t *record, size_t size, SampleRing *samples);
+
+        const int fd_;
+
+        // The metadata page followed by the data pages.
+        uint8_t *const mapping_;
+
+        const size_t mapping_size_;
+
+        const size_t page_size_;
+
+        int64_t sample_rate_in_micros_;
+
+        std::vector<uint8_t> scratch_;
+
+        NativeSample sample_;
+    };
+} // namespace glance
+
+// Sets whether the native sampler started by `StartNativeSampler` afterwards
+// samples the target thread with `perf_event_open` instead of the signals, see
+// `PerfEventSampler`. Falls back to the signals if `perf_event_open` is denied
+// or not supported. 0 disables it.
+extern "C" void SetNativeSamplerPerfEventsEnabled(int enabled);
+
+#endif // PERF_EVENT_SAMPLER_H_
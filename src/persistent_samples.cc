@@ -0,0 +1,247 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "persistent_samples.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace glance
+{
+    namespace
+    {
+        using persistent_samples::FileHeader;
+
+        std::string PersistentFileError(const char *what)
+        {
+            char buf[256];
+            snprintf(buf, sizeof(buf), "%s: %s", what, strerror(errno));
+            return buf;
+        }
+
+        // Copies |value| to |out| of |size| bytes, truncated if needed. Returns
+        // the number of bytes copied, not including the terminating '\0'.
+        size_t CopyTruncated(const std::string &value, char *out, size_t size)
+        {
+            size_t length = std::min(value.size(), size - 1);
+            memcpy(out, value.data(), length);
+            out[length] = '\0';
+            return length;
+        }
+    } // namespace
+
+    size_t PersistentSampleFile::SlotsOffset()
+    {
+        size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return (sizeof(FileHeader) + page_size - 1) / page_size * page_size;
+    }
+
+    PersistentSampleFile *PersistentSampleFile::Create(const char *path,
+                                                       size_t capacity,
+                                                       int64_t isolate_instructions,
+                                                       const std::vector<std::string> &header_lines,
+                                                       std::string *error)
+    {
+        // Drop the file of the previous run first, so the new one starts zero
+        // filled, and a reader of the old one is not affected.
+        if (unlink(path) != 0 && errno != ENOENT)
+        {
+            *error = PersistentFileError("failed to remove the persistent samples file");
+            return nullptr;
+        }
+
+        int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            *error = PersistentFileError("failed to create the persistent samples file");
+            return nullptr;
+        }
+
+        size_t mapping_size = SlotsOffset() + SampleRing::MemorySize(capacity);
+        if (ftruncate(fd, static_cast<off_t>(mapping_size)) != 0)
+        {
+            *error = PersistentFileError("failed to resize the persistent samples file");
+            close(fd);
+            return nullptr;
+        }
+
+        void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // The mapping keeps the file open.
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            *error = PersistentFileError("failed to map the persistent samples file");
+            return nullptr;
+        }
+
+        FileHeader *header = new (mapping) FileHeader;
+        header->version = persistent_samples::kVersion;
+        header->slot_size = static_cast<uint32_t>(SampleRing::SlotSize());
+        header->capacity = capacity;
+        header->isolate_instructions = isolate_instructions;
+
+        std::string header_text;
+        for (size_t i = 0; i < header_lines.size(); ++i)
+        {
+            if (i > 0)
+            {
+                header_text += '\n';
+            }
+            header_text += header_lines[i];
+        }
+        header->header_size = CopyTruncated(header_text, header->header, persistent_samples::kMaxHeaderSize);
+
+        // The pcs of the samples can only be told apart by the modules loaded in
+        // this process, which are gone on the next launch.
+        std::vector<LoadedModule> modules;
+        ModuleMap::Instance().GetFilteredInModules(&modules);
+        size_t module_count = std::min(modules.size(), persistent_samples::kMaxModules);
+        for (size_t i = 0; i < module_count; ++i)
+        {
+            persistent_samples::Module &module = header->modules[i];
+            module.base_address = static_cast<int64_t>(modules[i].base_address);
+            module.start_address = static_cast<int64_t>(modules[i].start_address);
+            module.end_address = static_cast<int64_t>(modules[i].end_address);
+            CopyTruncated(modules[i].path, module.path, persistent_samples::kMaxModulePathSize);
+        }
+        header->module_count = static_cast<uint32_t>(module_count);
+        header->state.store(persistent_samples::kRunning, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, persistent_samples::kMagic, sizeof(persistent_samples::kMagic));
+
+        return new PersistentSampleFile(mapping, mapping_size, capacity);
+    }
+
+    PersistentSampleFile::PersistentSampleFile(void *mapping, size_t mapping_size, size_t capacity)
+        : mapping_(mapping),
+          mapping_size_(mapping_size),
+          slots_(static_cast<uint8_t *>(mapping) + SlotsOffset()),
+          capacity_(capacity)
+    {
+    }
+
+    PersistentSampleFile::~PersistentSampleFile()
+    {
+        header()->state.store(persistent_samples::kCleanShutdown, std::memory_order_release);
+        munmap(mapping_, mapping_size_);
+    }
+
+    FileHeader *PersistentSampleFile::header() const
+    {
+        return static_cast<FileHeader *>(mapping_);
+    }
+
+    PersistedSamples *ReadPersistedSamples(const char *path,
+                                           int64_t window_in_micros,
+                                           std::string *error)
+    {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            *error = PersistentFileError("failed to open the persistent samples file");
+            return nullptr;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            *error = PersistentFileError("failed to stat the persistent samples file");
+            close(fd);
+            return nullptr;
+        }
+
+        size_t file_size = static_cast<size_t>(st.st_size);
+        if (file_size < PersistentSampleFile::SlotsOffset())
+        {
+            *error = "not a persistent samples file";
+            close(fd);
+            return nullptr;
+        }
+
+        void *mapping = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            *error = PersistentFileError("failed to map the persistent samples file");
+            return nullptr;
+        }
+
+        const FileHeader *header = static_cast<const FileHeader *>(mapping);
+        if (memcmp(header->magic, persistent_samples::kMagic, sizeof(persistent_samples::kMagic)) != 0 ||
+            header->version != persistent_samples::kVersion ||
+            header->slot_size != SampleRing::SlotSize() ||
+            header->capacity == 0 ||
+            header->capacity > (file_size - PersistentSampleFile::SlotsOffset()) / SampleRing::SlotSize() ||
+            SampleRing::MemorySize(header->capacity) > file_size - PersistentSampleFile::SlotsOffset() ||
+            header->module_count > persistent_samples::kMaxModules ||
+            header->header_size >= persistent_samples::kMaxHeaderSize)
+        {
+            *error = "not a persistent samples file";
+            munmap(mapping, file_size);
+            return nullptr;
+        }
+
+        PersistedSamples *samples = new PersistedSamples();
+        samples->isolate_instructions = header->isolate_instructions;
+        samples->clean_shutdown =
+            header->state.load(std::memory_order_relaxed) == persistent_samples::kCleanShutdown ? 1 : 0;
+        samples->header_text.assign(header->header, header->header_size);
+
+        samples->module_paths.reserve(header->module_count);
+        for (uint32_t i = 0; i < header->module_count; ++i)
+        {
+            const persistent_samples::Module &module = header->modules[i];
+            samples->module_paths.emplace_back(module.path, strnlen(module.path, persistent_samples::kMaxModulePathSize));
+        }
+        // Refer to the paths once all of them are added, growing the vector may
+        // move them.
+        for (uint32_t i = 0; i < header->module_count; ++i)
+        {
+            const persistent_samples::Module &module = header->modules[i];
+            samples->module_infos.push_back({module.base_address,
+                                             module.start_address,
+                                             module.end_address,
+                                             samples->module_paths[i].c_str()});
+        }
+
+        SampleRing::RecoverSamples(static_cast<const uint8_t *>(mapping) + PersistentSampleFile::SlotsOffset(),
+                                   header->capacity,
+                                   window_in_micros,
+                                   &samples->sample_list);
+        munmap(mapping, file_size);
+
+        samples->module_count = static_cast<int32_t>(samples->module_infos.size());
+        samples->modules = samples->module_infos.data();
+        samples->header = samples->header_text.c_str();
+        samples->sample_count = samples->sample_list.size();
+        samples->samples = samples->sample_list.data();
+        return samples;
+    }
+} // namespace glance
+
+extern "C" char *LoadPersistedSamples(const char *path,
+                                      int64_t window_in_micros,
+                                      NativePersistedSamples **out)
+{
+    std::string error;
+    glance::PersistedSamples *samples = glance::ReadPersistedSamples(path, window_in_micros, &error);
+    if (samples == nullptr)
+    {
+        return strdup(error.c_str());
+    }
+    *out = samples;
+    return nullptr;
+}
+
+extern "C" void FreePersistedSamples(NativePersistedSamples *samples)
+{
+    delete static_cast<glance::PersistedSamples *>(samples);
+}
@@ -0,0 +1,162 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef PERSISTENT_SAMPLES_H_
+#define PERSISTENT_SAMPLES_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "module_map.h"
+#include "sample_ring.h"
+
+/// The samples persisted by a previous run, see `LoadPersistedSamples`.
+///
+/// |header| is the header lines of the Dart stack trace of the run joined with
+/// '\n' (see `DartStackTraceInfo`), |modules| are the modules filtered in when
+/// the run started sorted by |start_address|, and |samples| are in order of
+/// oldest to newest. |clean_shutdown| is 1 if the run stopped the sampler.
+struct NativePersistedSamples
+{
+    int64_t isolate_instructions;
+    int32_t clean_shutdown;
+    int32_t module_count;
+    const NativeModuleInfo *modules;
+    const char *header;
+    size_t sample_count;
+    const NativeSample *samples;
+};
+
+namespace glance
+{
+    /// The layout of the file mapped by `PersistentSampleFile`.
+    ///
+    /// ```
+    /// file := header slot[capacity] node[*]
+    /// ```
+    ///
+    /// The header is written once when the file is created, the slots and the
+    /// nodes are the memory of a `SampleRing`. The file is only read back by the same build of
+    /// the library, so the structs are stored as is.
+    namespace persistent_samples
+    {
+        constexpr char kMagic[8] = {'G', 'L', 'S', 'A', 'M', 'P', 'L', 'E'};
+
+        constexpr uint32_t kVersion = 4;
+
+        constexpr size_t kMaxHeaderSize = 2048;
+
+        constexpr size_t kMaxModules = 256;
+
+        constexpr size_t kMaxModulePathSize = 128;
+
+        enum State : uint32_t
+        {
+            kRunning = 1,
+            kCleanShutdown = 2,
+        };
+
+        struct Module
+        {
+            int64_t base_address;
+            int64_t start_address;
+            int64_t end_address;
+            char path[kMaxModulePathSize];
+        };
+
+        struct FileHeader
+        {
+            // Written last, a file without the magic is not completely created.
+            char magic[sizeof(kMagic)];
+            uint32_t version;
+            uint32_t slot_size;
+            uint64_t capacity;
+            std::atomic<uint32_t> state;
+            uint32_t module_count;
+            int64_t isolate_instructions;
+            uint64_t header_size;
+            char header[kMaxHeaderSize];
+            Module modules[kMaxModules];
+        };
+    } // namespace persistent_samples
+
+    /// A file mapped into memory that holds the slots of the `SampleRing` of the
+    /// native sampler, so the latest samples survive a crash or the process being
+    /// killed (e.g., by an ANR), and can be recovered on the next launch.
+    ///
+    /// Writing a sample is still plain stores to the mapped memory, the kernel
+    /// writes the dirty pages back to the file even if the process dies, no
+    /// syscall is made per sample. Only a power loss can lose the samples.
+    class PersistentSampleFile
+    {
+    public:
+        /// Creates the file of |path| for |capacity| samples, replacing the file
+        /// of the previous run. The |header_lines| and the modules filtered in by
+        /// `ModuleMap` are stored for symbolizing the samples after the process
+        /// is gone. Returns nullptr and sets |error| on failure.
+        static PersistentSampleFile *Create(const char *path,
+                                            size_t capacity,
+                                            int64_t isolate_instructions,
+                                            const std::vector<std::string> &header_lines,
+                                            std::string *error);
+
+        /// Marks the run as cleanly shut down, and unmaps the file.
+        ~PersistentSampleFile();
+
+        /// The zero filled memory of the ring, see `SampleRing(size_t, void *)`.
+        void *slots() const { return slots_; }
+
+        size_t capacity() const { return capacity_; }
+
+        /// The offset of the slots in the file, aligned to the page size.
+        static size_t SlotsOffset();
+
+    private:
+        PersistentSampleFile(void *mapping, size_t mapping_size, size_t capacity);
+
+        persistent_samples::FileHeader *header() const;
+
+        void *mapping_;
+
+        size_t mapping_size_;
+
+        void *slots_;
+
+        size_t capacity_;
+    };
+
+    /// The samples of a previous run, which owns the memory referred by the
+    /// `NativePersistedSamples`.
+    struct PersistedSamples : NativePersistedSamples
+    {
+        std::string header_text;
+        std::vector<std::string> module_paths;
+        std::vector<NativeModuleInfo> module_infos;
+        std::vector<NativeSample> sample_list;
+    };
+
+    /// Reads the file of |path| written by a `PersistentSampleFile` of a previous
+    /// run. Only the samples of |window_in_micros| before the newest sample are
+    /// kept, see `SampleRing::RecoverSamples`. Returns nullptr and sets |error|
+    /// if the file is missing or not valid.
+    PersistedSamples *ReadPersistedSamples(const char *path,
+                                           int64_t window_in_micros,
+                                           std::string *error);
+} // namespace glance
+
+// Loads the samples persisted by the native sampler of a previous run to |out|,
+// which must be freed by `FreePersistedSamples`. Must be called before the
+// native sampler of this run replaces the file, see `SetNativeSamplerPersistentFile`.
+//
+// On success returns nullptr otherwise returns a string containing the error.
+//
+// Returned string must be freed by the caller.
+extern "C" char *LoadPersistedSamples(const char *path,
+                                      int64_t window_in_micros,
+                                      NativePersistedSamples **out);
+
+extern "C" void FreePersistedSamples(NativePersistedSamples *samples);
+
+#endif // PERSISTENT_SAMPLES_H_
@@ -0,0 +1,451 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "profile_export.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <time.h>
+#include <unordered_map>
+#include <zlib.h>
+
+#include "module_map.h"
+
+namespace glance
+{
+    namespace
+    {
+        // The field numbers of `profile.proto`.
+        enum ProfileField : uint32_t
+        {
+            kProfileSampleType = 1,
+            kProfileSample = 2,
+            kProfileMapping = 3,
+            kProfileLocation = 4,
+            kProfileFunction = 5,
+            kProfileStringTable = 6,
+            kProfileTimeNanos = 9,
+            kProfileDurationNanos = 10,
+            kProfilePeriodType = 11,
+            kProfilePeriod = 12,
+        };
+
+        enum ProtoWireType : uint32_t
+        {
+            kWireVarint = 0,
+            kWireLengthDelimited = 2,
+        };
+
+        void ProtoPutVarint(std::string *out, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out->push_back(static_cast<char>(value));
+        }
+
+        void ProtoPutVarintField(std::string *out, uint32_t field, uint64_t value)
+        {
+            // The default values are omitted.
+            if (value == 0)
+            {
+                return;
+            }
+            ProtoPutVarint(out, (field << 3) | kWireVarint);
+            ProtoPutVarint(out, value);
+        }
+
+        void ProtoPutBytesField(std::string *out, uint32_t field, const std::string &value)
+        {
+            ProtoPutVarint(out, (field << 3) | kWireLengthDelimited);
+            ProtoPutVarint(out, value.size());
+            out->append(value);
+        }
+
+        void ProtoPutPackedField(std::string *out, uint32_t field, const std::vector<uint64_t> &values)
+        {
+            std::string packed;
+            for (uint64_t value : values)
+            {
+                ProtoPutVarint(&packed, value);
+            }
+            ProtoPutBytesField(out, field, packed);
+        }
+
+        bool IsSnapshotSymbol(const char *name)
+        {
+            // `dladdr` drops the leading underscore on Apple platforms.
+            return strncmp(name, "_kDart", 6) == 0 || strncmp(name, "kDart", 5) == 0;
+        }
+
+        std::string HexString(uword value)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "0x%" PRIxPTR, value);
+            return buf;
+        }
+
+        /// Names the frames of the samples, and caches the modules of them.
+        class FrameNamer
+        {
+        public:
+            /// The loaded modules are checked once per export.
+            FrameNamer()
+            {
+                ModuleMap::Instance().Refresh();
+            }
+
+            /// Resolves the pcs of |sample| to |out|.
+            void Resolve(const NativeSample &sample, NativeFrameInfo *out)
+            {
+                ModuleMap::Instance().Resolve(sample.pcs, static_cast<size_t>(sample.depth), out);
+            }
+
+            const LoadedModule *GetModule(int32_t module_id)
+            {
+                if (module_id < 0)
+                {
+                    return nullptr;
+                }
+                auto it = modules_.find(module_id);
+                if (it == modules_.end())
+                {
+                    LoadedModule module;
+                    if (!ModuleMap::Instance().GetLoadedModule(module_id, &module))
+                    {
+                        return nullptr;
+                    }
+                    it = modules_.emplace(module_id, std::move(module)).first;
+                }
+                return &it->second;
+            }
+
+            /// Returns the symbol name of |info|, or nullptr if it doesn't tell the
+            /// frames apart.
+            const char *GetFunctionName(const NativeFrameInfo &info)
+            {
+                const char *name = ModuleMap::Instance().GetSymbolName(info.symbol_id);
+                if (name == nullptr || name[0] == '\0' || IsSnapshotSymbol(name))
+                {
+                    return nullptr;
+                }
+                return name;
+            }
+
+            std::string GetFrameName(uword pc, const NativeFrameInfo &info)
+            {
+                const char *function_name = GetFunctionName(info);
+                if (function_name != nullptr)
+                {
+                    return function_name;
+                }
+
+                const LoadedModule *module = GetModule(info.module_id);
+                if (module == nullptr || module->path.empty())
+                {
+                    return HexString(pc);
+                }
+                size_t slash = module->path.find_last_of('/');
+                std::string file_name = slash == std::string::npos ? module->path : module->path.substr(slash + 1);
+                return file_name + "+" + HexString(pc - module->base_address);
+            }
+
+        private:
+            std::unordered_map<int32_t, LoadedModule> modules_;
+        };
+
+        /// Builds the messages of `profile.proto`, the ids of the mappings, the
+        /// locations and the functions start from 1.
+        class PprofBuilder
+        {
+        public:
+            PprofBuilder() { InternString(""); }
+
+            int64_t InternString(const std::string &value)
+            {
+                auto it = string_ids_.find(value);
+                if (it != string_ids_.end())
+                {
+                    return it->second;
+                }
+                int64_t id = static_cast<int64_t>(strings_.size());
+                strings_.push_back(value);
+                string_ids_.emplace(value, id);
+                return id;
+            }
+
+            uint64_t GetLocationId(uword pc, const NativeFrameInfo &info)
+            {
+                auto it = location_ids_.find(pc);
+                if (it != location_ids_.end())
+                {
+                    return it->second;
+                }
+
+                uint64_t id = location_ids_.size() + 1;
+                location_ids_.emplace(pc, id);
+
+                std::string location;
+                ProtoPutVarintField(&location, 1, id);
+                ProtoPutVarintField(&location, 2, GetMappingId(info.module_id));
+                ProtoPutVarintField(&location, 3, pc);
+                uint64_t function_id = GetFunctionId(info);
+                if (function_id != 0)
+                {
+                    std::string line;
+                    ProtoPutVarintField(&line, 1, function_id);
+                    ProtoPutBytesField(&location, 4, line);
+                }
+                ProtoPutBytesField(&locations_, kProfileLocation, location);
+                return id;
+            }
+
+            void AddSample(const std::vector<uint64_t> &location_ids, const std::vector<uint64_t> &values)
+            {
+                std::string sample;
+                ProtoPutPackedField(&sample, 1, location_ids);
+                ProtoPutPackedField(&sample, 2, values);
+                ProtoPutBytesField(&samples_, kProfileSample, sample);
+            }
+
+            std::string ValueType(const char *type, const char *unit)
+            {
+                std::string value_type;
+                ProtoPutVarintField(&value_type, 1, InternString(type));
+                ProtoPutVarintField(&value_type, 2, InternString(unit));
+                return value_type;
+            }
+
+            /// Appends the samples, the mappings, the locations, the functions and
+            /// the string table to |out|.
+            void Finish(std::string *out)
+            {
+                out->append(samples_);
+                out->append(mappings_);
+                out->append(locations_);
+                out->append(functions_);
+                for (const std::string &value : strings_)
+                {
+                    ProtoPutBytesField(out, kProfileStringTable, value);
+                }
+            }
+
+            FrameNamer &namer() { return namer_; }
+
+        private:
+            uint64_t GetMappingId(int32_t module_id)
+            {
+                const LoadedModule *module = namer_.GetModule(module_id);
+                if (module == nullptr)
+                {
+                    return 0;
+                }
+                auto it = mapping_ids_.find(module_id);
+                if (it != mapping_ids_.end())
+                {
+                    return it->second;
+                }
+
+                uint64_t id = mapping_ids_.size() + 1;
+                mapping_ids_.emplace(module_id, id);
+
+                std::string mapping;
+                ProtoPutVarintField(&mapping, 1, id);
+                ProtoPutVarintField(&mapping, 2, module->start_address);
+                ProtoPutVarintField(&mapping, 3, module->end_address);
+                // The address of the code relative to the load base, which is the
+                // file offset of it in the usual layouts of the modules.
+                ProtoPutVarintField(&mapping, 4, module->start_address - module->base_address);
+                ProtoPutVarintField(&mapping, 5, InternString(module->path));
+                ProtoPutVarintField(&mapping, 6, InternString(module->build_id));
+                ProtoPutBytesField(&mappings_, kProfileMapping, mapping);
+                return id;
+            }
+
+            uint64_t GetFunctionId(const NativeFrameInfo &info)
+            {
+                const char *name = namer_.GetFunctionName(info);
+                if (name == nullptr)
+                {
+                    return 0;
+                }
+                auto it = function_ids_.find(info.symbol_id);
+                if (it != function_ids_.end())
+                {
+                    return it->second;
+                }
+
+                uint64_t id = function_ids_.size() + 1;
+                function_ids_.emplace(info.symbol_id, id);
+
+                const LoadedModule *module = namer_.GetModule(info.module_id);
+                std::string function;
+                ProtoPutVarintField(&function, 1, id);
+                ProtoPutVarintField(&function, 2, InternString(name));
+                ProtoPutVarintField(&function, 3, InternString(name));
+                ProtoPutVarintField(&function, 4, InternString(module != nullptr ? module->path : ""));
+                ProtoPutBytesField(&functions_, kProfileFunction, function);
+                return id;
+            }
+
+            FrameNamer namer_;
+
+            std::vector<std::string> strings_;
+
+            std::unordered_map<std::string, int64_t> string_ids_;
+
+            std::unordered_map<int32_t, uint64_t> mapping_ids_;
+
+            std::unordered_map<uword, uint64_t> location_ids_;
+
+            std::unordered_map<int32_t, uint64_t> function_ids_;
+
+            std::string samples_;
+
+            std::string mappings_;
+
+            std::string locations_;
+
+            std::string functions_;
+        };
+
+        bool Gzip(const std::string &data, std::string *out, std::string *error)
+        {
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            // 16 more window bits for the gzip header and trailer.
+            if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                *error = "failed to initialize the compression";
+                return false;
+            }
+
+            out->resize(deflateBound(&stream, static_cast<uLong>(data.size())));
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+            stream.avail_in = static_cast<uInt>(data.size());
+            stream.next_out = reinterpret_cast<Bytef *>(&(*out)[0]);
+            stream.avail_out = static_cast<uInt>(out->size());
+            int result = deflate(&stream, Z_FINISH);
+            out->resize(stream.total_out);
+            deflateEnd(&stream);
+            if (result != Z_STREAM_END)
+            {
+                *error = "failed to compress the profile";
+                return false;
+            }
+            return true;
+        }
+
+        int64_t GetCurrentRealtimeNanos()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        }
+    } // namespace
+
+    bool EncodePprofProfile(const std::vector<NativeSample> &samples,
+                            int64_t sample_period_in_micros,
+                            std::string *out,
+                            std::string *error)
+    {
+        PprofBuilder builder;
+        std::string profile;
+        ProtoPutBytesField(&profile, kProfileSampleType, builder.ValueType("samples", "count"));
+        ProtoPutBytesField(&profile, kProfileSampleType, builder.ValueType("wall", "microseconds"));
+
+        NativeFrameInfo infos[GLANCE_MAX_STACK_DEPTH];
+        std::vector<uint64_t> location_ids;
+        std::vector<uint64_t> values(2);
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            const NativeSample &sample = samples[i];
+            size_t depth = static_cast<size_t>(sample.depth);
+            builder.namer().Resolve(sample, infos);
+            location_ids.clear();
+            // The leaf frame first, the same as the pcs.
+            for (size_t j = 0; j < depth; ++j)
+            {
+                location_ids.push_back(builder.GetLocationId(static_cast<uword>(sample.pcs[j]), infos[j]));
+            }
+
+            int64_t wall = sample_period_in_micros;
+            if (i + 1 < samples.size())
+            {
+                int64_t interval = samples[i + 1].timestamp - sample.timestamp;
+                wall = sample_period_in_micros > 0 ? std::min(interval, sample_period_in_micros) : interval;
+            }
+            values[0] = 1;
+            values[1] = static_cast<uint64_t>(std::max<int64_t>(wall, 0));
+            builder.AddSample(location_ids, values);
+        }
+        builder.Finish(&profile);
+
+        if (!samples.empty())
+        {
+            // The timestamps are monotonic, convert the first one to the wall clock.
+            int64_t first = samples.front().timestamp;
+            int64_t last = samples.back().timestamp;
+            int64_t realtime_offset_in_nanos = GetCurrentRealtimeNanos() - GetCurrentMonotonicNanos();
+            ProtoPutVarintField(&profile, kProfileTimeNanos, static_cast<uint64_t>(first * 1000 + realtime_offset_in_nanos));
+            ProtoPutVarintField(&profile, kProfileDurationNanos,
+                                static_cast<uint64_t>((last - first + std::max<int64_t>(sample_period_in_micros, 0)) * 1000));
+        }
+        ProtoPutBytesField(&profile, kProfilePeriodType, builder.ValueType("wall", "microseconds"));
+        ProtoPutVarintField(&profile, kProfilePeriod, static_cast<uint64_t>(std::max<int64_t>(sample_period_in_micros, 0)));
+
+        return Gzip(profile, out, error);
+    }
+
+    void EncodeCollapsedStacks(const std::vector<NativeSample> &samples, std::string *out)
+    {
+        FrameNamer namer;
+        std::unordered_map<uword, std::string> frame_names;
+        std::map<std::string, int64_t> stacks;
+        NativeFrameInfo infos[GLANCE_MAX_STACK_DEPTH];
+        std::string stack;
+        for (const NativeSample &sample : samples)
+        {
+            size_t depth = static_cast<size_t>(sample.depth);
+            if (depth == 0)
+            {
+                continue;
+            }
+            namer.Resolve(sample, infos);
+
+            stack.clear();
+            // The outermost frame first.
+            for (size_t i = depth; i > 0; --i)
+            {
+                uword pc = static_cast<uword>(sample.pcs[i - 1]);
+                auto it = frame_names.find(pc);
+                if (it == frame_names.end())
+                {
+                    std::string name = namer.GetFrameName(pc, infos[i - 1]);
+                    // ';' separates the frames.
+                    std::replace(name.begin(), name.end(), ';', ':');
+                    it = frame_names.emplace(pc, std::move(name)).first;
+                }
+                if (!stack.empty())
+                {
+                    stack += ';';
+                }
+                stack += it->second;
+            }
+            stacks[stack]++;
+        }
+
+        out->clear();
+        for (const auto &entry : stacks)
+        {
+            out->append(entry.first);
+            out->push_back(' ');
+            out->append(std::to_string(entry.second));
+            out->push_back('\n');
+        }
+    }
+} // namespace glance
@@ -0,0 +1,53 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef PROFILE_EXPORT_H_
+#define PROFILE_EXPORT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sample_ring.h"
+
+namespace glance
+{
+    /// Exports the samples to the formats of the standard profile tooling, which
+    /// keep the caller/callee structure lost by aggregating the frames.
+    ///
+    /// The pcs are resolved by `ModuleMap`. A frame is named by its symbol if
+    /// it's resolved, otherwise (including the Dart AOT frames, which all resolve
+    /// to the `_kDart*SnapshotInstructions` symbols) by the file name of its
+    /// module and the offset from the module base, e.g., `libapp.so+0x1a2b3c`,
+    /// which can be symbolized offline.
+    namespace profile_export
+    {
+        enum Format : int32_t
+        {
+            // The gzip'd `profile.proto` of pprof, see
+            // https://github.com/google/pprof/blob/main/proto/profile.proto.
+            kPprof = 0,
+            // The collapsed stacks of `stackcollapse.pl`, one line per unique stack
+            // from the outermost frame to the innermost one, followed by the
+            // number of samples, e.g., `main;foo;bar 42`.
+            kCollapsed = 1,
+        };
+    } // namespace profile_export
+
+    /// Encodes the |samples| in order of oldest to newest into a gzip'd pprof
+    /// profile to |out|. Each sample has 2 values, `samples/count` and
+    /// `wall/microseconds`, the latter is the time to the next sample capped at
+    /// |sample_period_in_micros|, so the bursts of the adaptive rate are not
+    /// overweighted. The mappings carry the paths and the build ids of the
+    /// modules. Returns false and sets |error| if the compression fails.
+    bool EncodePprofProfile(const std::vector<NativeSample> &samples,
+                            int64_t sample_period_in_micros,
+                            std::string *out,
+                            std::string *error);
+
+    /// Encodes the |samples| into the collapsed stacks to |out|, the lines are
+    /// sorted by the stacks.
+    void EncodeCollapsedStacks(const std::vector<NativeSample> &samples, std::string *out);
+} // namespace glance
+
+#endif // PROFILE_EXPORT_H_
@@ -0,0 +1,285 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "sample_ring.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+namespace glance
+{
+    namespace
+    {
+        uint16_t SaturateSwitches(int32_t switches)
+        {
+            return static_cast<uint16_t>(std::min<int32_t>(std::max<int32_t>(switches, 0), UINT16_MAX));
+        }
+    } // namespace
+
+    SampleRing::SampleRing(size_t capacity)
+        : SampleRing(capacity, nullptr)
+    {
+    }
+
+    SampleRing::SampleRing(size_t capacity, void *memory)
+        : capacity_(capacity),
+          owned_memory_(memory == nullptr ? new uint8_t[MemorySize(capacity)]() : nullptr),
+          slots_(static_cast<Slot *>(memory != nullptr ? memory : owned_memory_.get())),
+          stacks_(NodeCapacityFor(capacity), slots_ + capacity),
+          write_position_(0),
+          oldest_position_(0)
+    {
+        // Zero filled memory is a ring of unwritten slots, just start the lifetime
+        // of the slots without touching it.
+        for (size_t i = 0; i < capacity_; ++i)
+        {
+            new (&slots_[i]) Slot;
+        }
+    }
+
+    size_t SampleRing::SlotSize()
+    {
+        return sizeof(Slot);
+    }
+
+    size_t SampleRing::NodeCapacityFor(size_t capacity)
+    {
+        // At least the deepest stack always fits once the older samples are
+        // evicted.
+        return std::max<size_t>(capacity * kStackNodesPerSample, GLANCE_MAX_STACK_DEPTH);
+    }
+
+    size_t SampleRing::MemorySize(size_t capacity)
+    {
+        return capacity * sizeof(Slot) + StackTable::MemorySize(NodeCapacityFor(capacity));
+    }
+
+    void SampleRing::RecoverSamples(const void *memory,
+                                    size_t capacity,
+                                    int64_t window_in_micros,
+                                    std::vector<NativeSample> *out)
+    {
+        const Slot *slots = static_cast<const Slot *>(memory);
+        const void *nodes = slots + capacity;
+
+        // The writer is gone, so the sequences are stable. Order the written
+        // slots by their positions, which also drops a slot whose sequence
+        // doesn't match its index. The nodes of a written slot are not released
+        // before its sequence is made odd, so they are intact.
+        std::vector<std::pair<uint64_t, size_t>> positions;
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            uint64_t sequence = slots[i].sequence.load(std::memory_order_relaxed);
+            if (sequence == 0 || sequence % 2 != 0)
+            {
+                continue;
+            }
+            uint64_t position = sequence / 2 - 1;
+            if (position % capacity == i)
+            {
+                positions.emplace_back(position, i);
+            }
+        }
+        std::sort(positions.begin(), positions.end());
+
+        size_t first = 0;
+        if (window_in_micros > 0 && !positions.empty())
+        {
+            int64_t newest_timestamp = slots[positions.back().second].timestamp;
+            while (first < positions.size() &&
+                   slots[positions[first].second].timestamp < newest_timestamp - window_in_micros)
+            {
+                ++first;
+            }
+        }
+
+        size_t node_capacity = NodeCapacityFor(capacity);
+        out->clear();
+        out->resize(positions.size() - first);
+        for (size_t i = first; i < positions.size(); ++i)
+        {
+            const Slot &slot = slots[positions[i].second];
+            NativeSample &sample = (*out)[i - first];
+            sample.timestamp = slot.timestamp;
+            sample.kind = slot.kind;
+            sample.syscall = slot.syscall;
+            sample.run_state = slot.run_state;
+            sample.voluntary_switches = slot.voluntary_switches;
+            sample.involuntary_switches = slot.involuntary_switches;
+            sample.frame_phase = slot.frame_phase;
+            sample.frame_number = static_cast<int32_t>(slot.frame_number);
+            sample.depth = static_cast<int32_t>(StackTable::ExpandFrom(
+                nodes, node_capacity, slot.stack, std::min<size_t>(slot.depth, GLANCE_MAX_STACK_DEPTH), sample.pcs));
+            if (sample.depth < GLANCE_MAX_STACK_DEPTH)
+            {
+                sample.pcs[sample.depth] = 0;
+            }
+        }
+    }
+
+    size_t SampleRing::CapacityFor(int64_t sample_rate_in_micros,
+                                   int64_t window_in_micros,
+                                   size_t memory_budget_in_bytes)
+    {
+        size_t capacity = SIZE_MAX;
+        if (sample_rate_in_micros > 0 && window_in_micros > 0)
+        {
+            // One more sample to cover both ends of the window.
+            capacity = static_cast<size_t>(window_in_micros / sample_rate_in_micros) + 1;
+        }
+
+        if (memory_budget_in_bytes > 0)
+        {
+            capacity = std::min(capacity, memory_budget_in_bytes / (sizeof(Slot) + StackTable::MemorySize(kStackNodesPerSample)));
+        }
+
+        if (capacity == SIZE_MAX)
+        {
+            // Neither the window nor the memory budget is given.
+            return 0;
+        }
+
+        return std::max<size_t>(capacity, 1);
+    }
+
+    void SampleRing::Write(const NativeSample &sample)
+    {
+        uint64_t position = write_position_.load(std::memory_order_relaxed);
+        Slot &slot = slots_[position % capacity_];
+
+        slot.sequence.store(2 * position + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        if (oldest_position_ + capacity_ <= position)
+        {
+            // The sample being overwritten, unless it's already evicted.
+            stacks_.Release(slot.stack);
+            oldest_position_ = position - capacity_ + 1;
+        }
+
+        size_t depth = std::min<size_t>(static_cast<size_t>(sample.depth), GLANCE_MAX_STACK_DEPTH);
+        uint32_t stack = StackTable::kEmptyStack;
+        while (!stacks_.Intern(sample.pcs, depth, &stack))
+        {
+            // The live stacks take all the nodes, drop the oldest samples until the
+            // new one fits, which always happens before reaching it.
+            Evict(oldest_position_++);
+        }
+        slot.timestamp = sample.timestamp;
+        slot.stack = stack;
+        slot.depth = static_cast<uint16_t>(depth);
+        slot.kind = static_cast<uint16_t>(sample.kind);
+        slot.syscall = static_cast<int16_t>(sample.syscall);
+        slot.run_state = static_cast<uint8_t>(sample.run_state);
+        slot.voluntary_switches = SaturateSwitches(sample.voluntary_switches);
+        slot.involuntary_switches = SaturateSwitches(sample.involuntary_switches);
+        slot.frame_phase = static_cast<uint8_t>(sample.frame_phase);
+        slot.frame_number = static_cast<uint32_t>(sample.frame_number);
+        slot.sequence.store(2 * (position + 1), std::memory_order_release);
+
+        write_position_.store(position + 1, std::memory_order_release);
+    }
+
+    void SampleRing::Evict(uint64_t position)
+    {
+        Slot &slot = slots_[position % capacity_];
+        // Leave the sequence odd, the readers treat it as overwritten.
+        slot.sequence.store(2 * position + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        stacks_.Release(slot.stack);
+        slot.stack = StackTable::kEmptyStack;
+    }
+
+    size_t SampleRing::ReadRange(int64_t start, int64_t end, NativeSample *out, size_t max_count) const
+    {
+        uint64_t write_position = write_position_.load(std::memory_order_acquire);
+        uint64_t oldest_position = write_position > capacity_ ? write_position - capacity_ : 0;
+
+        // The timestamps are monotonic, walk from the newest sample backwards and
+        // stop at the first sample older than |start|.
+        size_t count = 0;
+        for (uint64_t position = write_position; position > oldest_position && count < max_count; --position)
+        {
+            if (!ReadAt(position - 1, &out[count]))
+            {
+                // Overwritten by the producer, so are all the older ones.
+                break;
+            }
+
+            int64_t timestamp = out[count].timestamp;
+            if (timestamp < start)
+            {
+                break;
+            }
+            if (timestamp > end)
+            {
+                continue;
+            }
+
+            ++count;
+        }
+
+        std::reverse(out, out + count);
+        return count;
+    }
+
+    bool SampleRing::ReadAt(uint64_t position, NativeSample *out) const
+    {
+        const Slot &slot = slots_[position % capacity_];
+        const uint64_t expected_sequence = 2 * (position + 1);
+
+        if (slot.sequence.load(std::memory_order_acquire) != expected_sequence)
+        {
+            return false;
+        }
+        out->timestamp = slot.timestamp;
+        out->kind = slot.kind;
+        out->syscall = slot.syscall;
+        out->run_state = slot.run_state;
+        out->voluntary_switches = slot.voluntary_switches;
+        out->involuntary_switches = slot.involuntary_switches;
+        out->frame_phase = slot.frame_phase;
+        out->frame_number = static_cast<int32_t>(slot.frame_number);
+        out->depth = static_cast<int32_t>(stacks_.Expand(slot.stack, std::min<size_t>(slot.depth, GLANCE_MAX_STACK_DEPTH), out->pcs));
+        if (out->depth < GLANCE_MAX_STACK_DEPTH)
+        {
+            out->pcs[out->depth] = 0;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.sequence.load(std::memory_order_relaxed) == expected_sequence;
+    }
+
+    bool SampleRing::ReadTimestampAt(uint64_t position, int64_t *timestamp) const
+    {
+        const Slot &slot = slots_[position % capacity_];
+        const uint64_t expected_sequence = 2 * (position + 1);
+
+        if (slot.sequence.load(std::memory_order_acquire) != expected_sequence)
+        {
+            return false;
+        }
+        *timestamp = slot.timestamp;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.sequence.load(std::memory_order_relaxed) == expected_sequence;
+    }
+
+    uint64_t SampleRing::LowerBound(int64_t timestamp) const
+    {
+        uint64_t high = write_position();
+        uint64_t low = high > capacity_ ? high - capacity_ : 0;
+        while (low < high)
+        {
+            uint64_t middle = low + (high - low) / 2;
+            int64_t middle_timestamp = 0;
+            // An overwritten sample is older than any readable one.
+            if (!ReadTimestampAt(middle, &middle_timestamp) || middle_timestamp < timestamp)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        return low;
+    }
+} // namespace glance
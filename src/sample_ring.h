@@ -0,0 +1,216 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef SAMPLE_RING_H_
+#define SAMPLE_RING_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "collect_stack.h"
+#include "stack_table.h"
+
+// The maximum number of frames of a single sample, keep it in sync with the
+// `kNativeSampleMaxStackDepth` in `collect_stack.dart`.
+#define GLANCE_MAX_STACK_DEPTH 100
+
+// The kinds of `NativeSample::kind`, keep them in sync with the `NativeStack`
+// in `collect_stack.dart`.
+//
+// A wall tick is taken on the wall clock of the sampler, whether the thread is
+// running or blocked.
+#define GLANCE_SAMPLE_KIND_WALL 0
+// A CPU tick is taken on the CPU time of the thread, i.e., only while it's
+// running on a CPU, see `StartCpuTimeSampling` and `PerfEventSampler`.
+#define GLANCE_SAMPLE_KIND_CPU 1
+
+// The `NativeSample::syscall` of a thread that was not in a syscall, or whose
+// syscall is not known, see `g_last_target_syscall_`.
+#define GLANCE_NO_SYSCALL -1
+
+// The phases of `NativeSample::frame_phase`, set by the binding with
+// `SetFramePhase`, keep them in sync with the `FramePhase` in
+// `collect_stack.dart`. Only the phases the native code refers to are here.
+//
+// Between the frames and the callbacks, or not marked.
+#define GLANCE_FRAME_PHASE_IDLE 0
+// Building the widgets of a frame.
+#define GLANCE_FRAME_PHASE_BUILD 2
+// Laying out the render objects of a frame.
+#define GLANCE_FRAME_PHASE_LAYOUT 3
+
+/// A single stack sample of the target thread.
+///
+/// |pcs| is terminated with 0 if the |depth| is less than `GLANCE_MAX_STACK_DEPTH`.
+struct NativeSample
+{
+    int64_t timestamp;
+    int32_t depth;
+    // One of the `GLANCE_SAMPLE_KIND_*`.
+    int32_t kind;
+    // The number of the syscall the thread was in, see `GetSyscallName`.
+    int32_t syscall;
+    // The state letter of `/proc/<pid>/task/<tid>/stat` (e.g., 'R' running, 'S'
+    // sleeping, 'D' waiting for I/O), or 0 if it's not read, see
+    // `SchedStateReader`.
+    int32_t run_state;
+    // The context switches of the thread since the previous sample that has
+    // them, see `SchedStateReader`.
+    int32_t voluntary_switches;
+    int32_t involuntary_switches;
+    // One of the `GLANCE_FRAME_PHASE_*` and the number of the frame of the UI
+    // thread when the thread was stopped, see `g_frame_phase_`.
+    int32_t frame_phase;
+    int32_t frame_number;
+    int64_t pcs[GLANCE_MAX_STACK_DEPTH];
+};
+
+namespace glance
+{
+    /// Sets the `frame_phase` and the `frame_number` of |sample| from a |word|
+    /// of `g_frame_phase_`.
+    ///
+    /// Async-signal-safe.
+    inline void SetFramePhaseOf(uint64_t word, NativeSample *sample)
+    {
+        sample->frame_phase = static_cast<int32_t>(word & kFramePhaseMask);
+        sample->frame_number = static_cast<int32_t>(word >> kFramePhaseBits);
+    }
+} // namespace glance
+
+namespace glance
+{
+    /// A fixed-size ring of `NativeSample`s with a single producer (the sampler
+    /// thread) and a single consumer (the thread querying the samples).
+    ///
+    /// The producer always overwrites the oldest sample and never waits for the
+    /// consumer. Each slot is guarded by a sequence number (seqlock), so the consumer
+    /// can detect a slot that is overwritten while it is being copied and drop it,
+    /// instead of taking a lock on the producer's hot path.
+    ///
+    /// A slot only holds the timestamp and the id of the stack in a `StackTable`,
+    /// the samples of the same thread mostly share their outermost frames, so the
+    /// ring takes a fraction of the memory of storing the full `NativeSample`s.
+    /// The table has `kStackNodesPerSample` nodes per slot. If a stack doesn't fit
+    /// in the free nodes, the oldest samples are dropped early to free theirs, so
+    /// the ring covers a shorter window instead of losing the newest samples.
+    ///
+    /// All the memory is allocated up front, writing a sample allocates nothing.
+    /// The slots and the nodes can also live in the memory given by the caller,
+    /// e.g., a mapped file that outlives the process (see `PersistentSampleFile`).
+    class SampleRing
+    {
+    public:
+        /// The number of the nodes of the `StackTable` per slot.
+        static constexpr size_t kStackNodesPerSample = 8;
+
+        explicit SampleRing(size_t capacity);
+
+        /// Uses the `MemorySize(capacity)` bytes of |memory| for the slots and the
+        /// nodes, which must be zero filled and outlive the ring.
+        SampleRing(size_t capacity, void *memory);
+
+        ~SampleRing() = default;
+
+        /// Returns the number of samples that covers |window_in_micros| at the
+        /// |sample_rate_in_micros| but fits in |memory_budget_in_bytes|. A value of
+        /// 0 means no limit of that dimension, at least 1 is returned.
+        static size_t CapacityFor(int64_t sample_rate_in_micros,
+                                  int64_t window_in_micros,
+                                  size_t memory_budget_in_bytes);
+
+        /// The size of a slot.
+        static size_t SlotSize();
+
+        /// The size of the memory of the slots and the nodes of a ring of
+        /// |capacity| samples.
+        static size_t MemorySize(size_t capacity);
+
+        /// Copies the samples completely written to the `MemorySize(capacity)`
+        /// bytes of |memory| by a ring of another process to |out| in order of oldest to
+        /// newest, skipping the ones older than |window_in_micros| before the
+        /// newest sample (0 means no limit). A sample torn by the writer exiting
+        /// in the middle of it is dropped.
+        static void RecoverSamples(const void *memory,
+                                   size_t capacity,
+                                   int64_t window_in_micros,
+                                   std::vector<NativeSample> *out);
+
+        size_t capacity() const { return capacity_; }
+
+        /// Appends the |sample|, overwriting the oldest one if the ring is full.
+        /// Must only be called from the producer thread.
+        void Write(const NativeSample &sample);
+
+        /// Copies the samples whose timestamps are within [|start|, |end|] to |out|
+        /// in order of oldest to newest. If there are more than |max_count| samples,
+        /// the newest |max_count| samples are copied.
+        ///
+        /// Returns the number of samples copied.
+        size_t ReadRange(int64_t start, int64_t end, NativeSample *out, size_t max_count) const;
+
+        /// The position of the next sample to write, which increases by 1 for every
+        /// sample written. The sample of position `p` is readable by `ReadAt` until
+        /// position `p + capacity()` is written.
+        uint64_t write_position() const { return write_position_.load(std::memory_order_acquire); }
+
+        /// Copies the sample of |position| to |out|. Returns false if the sample
+        /// is not written yet or is already overwritten.
+        bool ReadAt(uint64_t position, NativeSample *out) const;
+
+        /// Returns the position of the oldest readable sample whose timestamp is not
+        /// less than |timestamp|, or `write_position()` if there's no such sample.
+        uint64_t LowerBound(int64_t timestamp) const;
+
+        /// The stacks of the samples, see `StackTable`.
+        const StackTable &stacks() const { return stacks_; }
+
+    private:
+        bool ReadTimestampAt(uint64_t position, int64_t *timestamp) const;
+
+        /// Drops the sample of |position| before it's overwritten, and frees its
+        /// stack. Must only be called from the producer thread.
+        void Evict(uint64_t position);
+
+        static size_t NodeCapacityFor(size_t capacity);
+
+        struct Slot
+        {
+            // 2 * (position + 1) once the sample of the position is written, odd
+            // while it's being written or after it's evicted.
+            std::atomic<uint64_t> sequence;
+            int64_t timestamp;
+            // The id in |stacks_|.
+            uint32_t stack;
+            // The upper half of |depth| of the older files is 0, which reads
+            // back as a wall tick.
+            uint16_t depth;
+            uint16_t kind;
+            int16_t syscall;
+            uint8_t run_state;
+            uint8_t frame_phase;
+            // Saturated, a sample never sees that many.
+            uint16_t voluntary_switches;
+            uint16_t involuntary_switches;
+            // Wraps around, the frames of a window never do.
+            uint32_t frame_number;
+        };
+
+        const size_t capacity_;
+
+        // Null if the memory is given by the caller.
+        std::unique_ptr<uint8_t[]> owned_memory_;
+
+        Slot *slots_;
+
+        StackTable stacks_;
+
+        std::atomic<uint64_t> write_position_;
+
+        // The oldest position whose slot may still hold a stack, only used by the
+        // producer.
+        uint64_t oldest_position_;
+    };
+} // namespace glance
+
+#endif // SAMPLE_RING_H_
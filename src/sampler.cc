@@ -0,0 +1,592 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "sampler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "profile_export.h"
+#include "thread_registry.h"
+
+namespace glance
+{
+    namespace
+    {
+        std::mutex g_native_sampler_mutex;
+
+        NativeSampler *g_native_sampler = nullptr;
+
+        // See `SetNativeSamplerPersistentFile`, guarded by `g_native_sampler_mutex`.
+        std::string g_persistent_file_path;
+
+        int64_t g_persistent_isolate_instructions = 0;
+
+        std::vector<std::string> g_persistent_header_lines;
+
+        // The adaptive rate is shared with the UI thread without locking, see
+        // `SetNativeSamplerBurst`.
+        std::atomic<int64_t> g_burst_rate_in_micros(0);
+
+        std::atomic<int64_t> g_burst_duration_in_micros(0);
+
+        std::atomic<int64_t> g_frame_budget_in_micros(0);
+
+        std::atomic<int64_t> g_burst_until_micros(0);
+
+        // The beginning of the frame in progress, or 0 if no frame is in progress.
+        std::atomic<int64_t> g_frame_begin_micros(0);
+
+        // See `SetNativeSamplerCpuTimeSampleRate`.
+        std::atomic<int64_t> g_cpu_time_rate_in_micros(0);
+
+        // Caps the copies of a CPU tick, e.g., of a timer far faster than the
+        // scheduler tick of the kernel.
+        constexpr size_t kMaxTicksPerCpuTimeSample = 16;
+
+        void StartBurst(int64_t now)
+        {
+            g_burst_until_micros.store(now + g_burst_duration_in_micros.load(std::memory_order_relaxed),
+                                       std::memory_order_relaxed);
+        }
+    } // namespace
+
+    void SetCurrentThreadName(const char *name)
+    {
+#if defined(DART_HOST_OS_MACOS)
+        pthread_setname_np(name);
+#else
+        pthread_setname_np(pthread_self(), name);
+#endif
+    }
+
+    void SleepUntil(int64_t deadline_micros)
+    {
+#if defined(DART_HOST_OS_MACOS)
+        // There is no `clock_nanosleep` on Apple platforms, sleep for the
+        // remaining time instead.
+        int64_t remaining = deadline_micros - GetCurrentMonotonicMicros();
+        if (remaining <= 0)
+        {
+            return;
+        }
+        struct timespec ts;
+        ts.tv_sec = remaining / 1000000;
+        ts.tv_nsec = (remaining % 1000000) * 1000;
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        {
+        }
+#else
+        struct timespec ts;
+        ts.tv_sec = deadline_micros / 1000000;
+        ts.tv_nsec = (deadline_micros % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        {
+        }
+#endif
+    }
+
+    NativeSampler::NativeSampler(int64_t sample_rate_in_micros, size_t capacity)
+        : sample_rate_in_micros_(sample_rate_in_micros),
+          samples_(capacity),
+          aggregator_(sample_rate_in_micros),
+          perf_event_thread_id_(0),
+          uses_perf_events_(false),
+          cpu_time_rate_in_micros_(0),
+          cpu_time_thread_id_(0),
+          running_(false),
+          thread_()
+    {
+    }
+
+    NativeSampler::NativeSampler(int64_t sample_rate_in_micros, PersistentSampleFile *persistent_file)
+        : sample_rate_in_micros_(sample_rate_in_micros),
+          persistent_file_(persistent_file),
+          samples_(persistent_file->capacity(), persistent_file->slots()),
+          aggregator_(sample_rate_in_micros),
+          perf_event_thread_id_(0),
+          uses_perf_events_(false),
+          cpu_time_rate_in_micros_(0),
+          cpu_time_thread_id_(0),
+          running_(false),
+          thread_()
+    {
+    }
+
+    NativeSampler::~NativeSampler()
+    {
+        Stop();
+    }
+
+    bool NativeSampler::Start()
+    {
+        if (running_.load())
+        {
+            return true;
+        }
+
+        if (g_use_perf_events_.load())
+        {
+            // Falls back to the signals if it can't be opened, e.g., denied by
+            // `perf_event_paranoid`.
+            OpenPerfEventSamplerIfNeeded();
+        }
+        if (perf_event_sampler_ == nullptr)
+        {
+            SetUpSignalSampling();
+        }
+
+        running_.store(true);
+        if (pthread_create(&thread_, nullptr, &NativeSampler::ThreadMain, this) != 0)
+        {
+            running_.store(false);
+            return false;
+        }
+
+        return true;
+    }
+
+    void NativeSampler::Stop()
+    {
+        if (!running_.exchange(false))
+        {
+            return;
+        }
+
+        pthread_join(thread_, nullptr);
+    }
+
+    void *NativeSampler::ThreadMain(void *arg)
+    {
+        SetCurrentThreadName("glance.sampler");
+        reinterpret_cast<NativeSampler *>(arg)->Run();
+        return nullptr;
+    }
+
+    bool NativeSampler::OpenPerfEventSamplerIfNeeded()
+    {
+        uint64_t os_thread_id = 0;
+        ThreadRegistry::Instance().WithDefaultTarget([&os_thread_id](const TargetThread &thread)
+                                                     { os_thread_id = thread.os_thread_id; });
+        // Keeps the event if the target thread is unregistered for now.
+        if (perf_event_sampler_ != nullptr && (os_thread_id == perf_event_thread_id_ || os_thread_id == 0))
+        {
+            return true;
+        }
+
+        perf_event_sampler_.reset(PerfEventSampler::Open(os_thread_id, sample_rate_in_micros_));
+        perf_event_thread_id_ = os_thread_id;
+        uses_perf_events_.store(perf_event_sampler_ != nullptr, std::memory_order_relaxed);
+        return perf_event_sampler_ != nullptr;
+    }
+
+    void NativeSampler::SetUpSignalSampling()
+    {
+        cpu_time_rate_in_micros_.store(g_cpu_time_rate_in_micros.load(), std::memory_order_relaxed);
+        if (g_read_sched_state_.load())
+        {
+            sched_state_reader_.reset(new SchedStateReader());
+        }
+    }
+
+    void NativeSampler::StartCpuTimeSamplingIfNeeded()
+    {
+        ThreadRegistry::Instance().WithDefaultTarget(
+            [this](const TargetThread &thread)
+            {
+                // Started while the thread is pinned, so it can't exit meanwhile.
+                if (thread.os_thread_id != cpu_time_thread_id_)
+                {
+                    // Not retried if it fails, e.g., the timers are denied.
+                    cpu_time_thread_id_ = thread.os_thread_id;
+                    StartCpuTimeSampling(thread, cpu_time_rate_in_micros_.load(std::memory_order_relaxed));
+                }
+            });
+    }
+
+    void NativeSampler::TakeCpuTimeSamples(NativeSample *sample, int64_t *newest_timestamp)
+    {
+        size_t ticks;
+        while ((ticks = TakeCpuTimeSample(sample)) != 0)
+        {
+            // A tick taken right before the last wall tick may be taken after it,
+            // keep the timestamps of the ring in order.
+            sample->timestamp = std::max(sample->timestamp, *newest_timestamp);
+            *newest_timestamp = sample->timestamp;
+            // The missed ticks were most likely in the same code, so a CPU tick
+            // always stands for the same CPU time.
+            for (size_t i = 0; i < std::min(ticks, kMaxTicksPerCpuTimeSample); ++i)
+            {
+                samples_.Write(*sample);
+            }
+        }
+    }
+
+    void NativeSampler::ReadSchedState(NativeSample *sample)
+    {
+        sample->run_state = 0;
+        sample->voluntary_switches = 0;
+        sample->involuntary_switches = 0;
+        if (sched_state_reader_ == nullptr)
+        {
+            return;
+        }
+
+        ThreadRegistry::Instance().WithDefaultTarget(
+            [this, sample](const TargetThread &thread)
+            { sched_state_reader_->Read(thread, sample->timestamp, sample); });
+    }
+
+    int64_t NativeSampler::NextInterval(int64_t now, int64_t interval)
+    {
+        int64_t burst_rate = g_burst_rate_in_micros.load(std::memory_order_relaxed);
+        if (burst_rate <= 0 || burst_rate >= sample_rate_in_micros_)
+        {
+            return sample_rate_in_micros_;
+        }
+
+        // The UI thread can't tell that a frame is running late while it's busy
+        // running the frame, so check it here.
+        int64_t frame_begin = g_frame_begin_micros.load(std::memory_order_relaxed);
+        if (frame_begin != 0 &&
+            now - frame_begin > g_frame_budget_in_micros.load(std::memory_order_relaxed))
+        {
+            StartBurst(now);
+        }
+
+        if (now < g_burst_until_micros.load(std::memory_order_relaxed))
+        {
+            return burst_rate;
+        }
+
+        // Decay back to the base rate.
+        return std::min(std::max(interval, burst_rate) * 2, sample_rate_in_micros_);
+    }
+
+    void NativeSampler::Run()
+    {
+        NativeSample sample;
+        int64_t newest_timestamp = 0;
+        int64_t interval = sample_rate_in_micros_;
+        int64_t deadline = GetCurrentMonotonicMicros() + interval;
+        if (samples_cpu_time())
+        {
+            StartCpuTimeSamplingIfNeeded();
+        }
+        while (running_.load(std::memory_order_relaxed))
+        {
+            SleepUntil(deadline);
+            if (!running_.load(std::memory_order_relaxed))
+            {
+                break;
+            }
+
+            if (perf_event_sampler_ != nullptr)
+            {
+                // The samples are taken by the kernel, only copy them here.
+                perf_event_sampler_->Drain(&samples_);
+                // Follows the target thread, or falls back to the signals if the
+                // event of the new one can't be opened.
+                if (!OpenPerfEventSamplerIfNeeded())
+                {
+                    SetUpSignalSampling();
+                }
+            }
+            else
+            {
+                if (samples_cpu_time())
+                {
+                    TakeCpuTimeSamples(&sample, &newest_timestamp);
+                    // Follows the target thread.
+                    StartCpuTimeSamplingIfNeeded();
+                }
+
+                sample.timestamp = GetCurrentMonotonicMicros();
+                sample.kind = GLANCE_SAMPLE_KIND_WALL;
+                // Read before the thread is stopped, which wakes it up.
+                ReadSchedState(&sample);
+                char *error = CollectStackTraceOfTargetThread(sample.pcs, GLANCE_MAX_STACK_DEPTH);
+                if (error == nullptr)
+                {
+                    sample.syscall = g_last_target_syscall_;
+                    SetFramePhaseOf(g_last_target_frame_phase_, &sample);
+                    size_t depth = 0;
+                    while (depth < GLANCE_MAX_STACK_DEPTH && sample.pcs[depth] != 0)
+                    {
+                        ++depth;
+                    }
+                    sample.depth = static_cast<int32_t>(depth);
+                    samples_.Write(sample);
+                    newest_timestamp = sample.timestamp;
+                }
+                else
+                {
+                    // Something went wrong, but just discard this sample.
+                    free(error);
+                }
+            }
+
+            int64_t now = GetCurrentMonotonicMicros();
+            interval = NextInterval(now, interval);
+            if (perf_event_sampler_ != nullptr)
+            {
+                perf_event_sampler_->SetSampleRate(interval);
+            }
+            deadline += interval;
+            if (deadline < now)
+            {
+                // We fell behind, skip the missed ticks instead of sampling in a burst.
+                deadline = now + interval;
+            }
+        }
+
+        if (samples_cpu_time())
+        {
+            StopCpuTimeSampling();
+        }
+    }
+} // namespace glance
+
+extern "C" char *StartNativeSampler(int64_t sample_rate_in_micros,
+                                    int64_t window_in_micros,
+                                    size_t memory_budget_in_bytes)
+{
+    // A burst may last as long as the frames keep running late, so the ring
+    // covers the window at the burst rate.
+    int64_t wall_rate_in_micros = sample_rate_in_micros;
+    int64_t burst_rate_in_micros = glance::g_burst_rate_in_micros.load();
+    if (burst_rate_in_micros > 0 && burst_rate_in_micros < wall_rate_in_micros)
+    {
+        wall_rate_in_micros = burst_rate_in_micros;
+    }
+    // The CPU ticks take the slots of the ring too, at most one per CPU rate.
+    int64_t cpu_rate_in_micros = glance::g_cpu_time_rate_in_micros.load();
+    int64_t ring_rate_in_micros = cpu_rate_in_micros > 0 && wall_rate_in_micros > 0
+                                      ? wall_rate_in_micros * cpu_rate_in_micros /
+                                            (wall_rate_in_micros + cpu_rate_in_micros)
+                                      : wall_rate_in_micros;
+    size_t capacity = glance::SampleRing::CapacityFor(
+        std::max<int64_t>(ring_rate_in_micros, 1), window_in_micros, memory_budget_in_bytes);
+    if (sample_rate_in_micros <= 0 || capacity == 0)
+    {
+        return strdup("invalid sample rate, window or memory budget");
+    }
+
+    if (!glance::ThreadRegistry::Instance().HasDefaultTarget())
+    {
+        return strdup("target thread is not set, call SetCurrentThreadAsTarget first");
+    }
+
+    std::lock_guard<std::mutex> lock(glance::g_native_sampler_mutex);
+    if (glance::g_native_sampler != nullptr)
+    {
+        return strdup("native sampler is already started");
+    }
+
+    glance::NativeSampler *sampler = nullptr;
+    if (glance::g_persistent_file_path.empty())
+    {
+        sampler = new glance::NativeSampler(sample_rate_in_micros, capacity);
+    }
+    else
+    {
+        std::string error;
+        glance::PersistentSampleFile *persistent_file = glance::PersistentSampleFile::Create(
+            glance::g_persistent_file_path.c_str(),
+            capacity,
+            glance::g_persistent_isolate_instructions,
+            glance::g_persistent_header_lines,
+            &error);
+        if (persistent_file == nullptr)
+        {
+            return strdup(error.c_str());
+        }
+        sampler = new glance::NativeSampler(sample_rate_in_micros, persistent_file);
+    }
+    if (!sampler->Start())
+    {
+        delete sampler;
+        return strdup("failed to create the sampler thread");
+    }
+
+    glance::g_native_sampler = sampler;
+    return nullptr; // Success.
+}
+
+extern "C" void SetNativeSamplerPersistentFile(const char *path,
+                                               int64_t isolate_instructions,
+                                               const char *const *header_lines,
+                                               size_t header_line_count)
+{
+    std::lock_guard<std::mutex> lock(glance::g_native_sampler_mutex);
+    glance::g_persistent_file_path = path != nullptr ? path : "";
+    glance::g_persistent_isolate_instructions = isolate_instructions;
+    glance::g_persistent_header_lines.assign(header_lines, header_lines + header_line_count);
+}
+
+extern "C" void SetNativeSamplerBurst(int64_t burst_rate_in_micros,
+                                      int64_t burst_duration_in_micros,
+                                      int64_t frame_budget_in_micros)
+{
+    glance::g_burst_duration_in_micros.store(burst_duration_in_micros);
+    glance::g_frame_budget_in_micros.store(frame_budget_in_micros);
+    glance::g_burst_rate_in_micros.store(burst_rate_in_micros);
+}
+
+extern "C" void SetNativeSamplerCpuTimeSampleRate(int64_t cpu_rate_in_micros)
+{
+    glance::g_cpu_time_rate_in_micros.store(std::max<int64_t>(cpu_rate_in_micros, 0));
+}
+
+extern "C" void RequestNativeSamplerBurst()
+{
+    glance::StartBurst(glance::GetCurrentMonotonicMicros());
+}
+
+extern "C" void MarkFrameBegin()
+{
+    glance::g_frame_begin_micros.store(glance::GetCurrentMonotonicMicros(), std::memory_order_relaxed);
+}
+
+extern "C" void MarkFrameEnd()
+{
+    glance::g_frame_begin_micros.store(0, std::memory_order_relaxed);
+}
+
+extern "C" void StopNativeSampler()
+{
+    std::lock_guard<std::mutex> lock(glance::g_native_sampler_mutex);
+    if (glance::g_native_sampler == nullptr)
+    {
+        return;
+    }
+
+    delete glance::g_native_sampler;
+    glance::g_native_sampler = nullptr;
+}
+
+extern "C" int32_t GetNativeSamplerBackend()
+{
+    std::lock_guard<std::mutex> lock(glance::g_native_sampler_mutex);
+    if (glance::g_native_sampler == nullptr)
+    {
+        return 0;
+    }
+
+    return glance::g_native_sampler->uses_perf_events() ? 2 : 1;
+}
+
+extern "C" size_t GetNativeSamplerCapacity()
+{
+    std::lock_guard<std::mutex> lock(glance::g_native_sampler_mutex);
+    if (glance::g_native_sampler == nullptr)
+    {
+        return 0;
+    }
+
+    return glance::g_native_sampler->samples().capacity();
+}
+
+extern "C" size_t ReadNativeSamples(int64_t start, int64_t end, NativeSample *out, size_t max_count)
+{
+    // Only guards the sampler against `StopNativeSampler`, the sampler thread
+    // never takes this lock.
+    std::lock_guard<std::mutex> lock(glance::g_native_sampler_mutex);
+    if (glance::g_native_sampler == nullptr)
+    {
+        return 0;
+    }
+
+    return glance::g_native_sampler->samples().ReadRange(start, end, out, max_count);
+}
+
+extern "C" size_t AggregateNativeSamples(int64_t start,
+                                         int64_t end,
+                                         int64_t occur_times_threshold,
+                                         NativeAggregatedFrame *out,
+                                         size_t max_count)
+{
+    std::lock_guard<std::mutex> lock(glance::g_native_sampler_mutex);
+    if (glance::g_native_sampler == nullptr)
+    {
+        return 0;
+    }
+
+    // The sampler may fall back to the signals mid-run, which starts the CPU
+    // ticks, but the reports stay of the wall ticks.
+    glance::SampleAggregator &aggregator = glance::g_native_sampler->aggregator();
+    aggregator.set_wall_samples_only(glance::g_native_sampler->samples_cpu_time());
+    return aggregator.Aggregate(
+        glance::g_native_sampler->samples(), start, end, occur_times_threshold, out, max_count);
+}
+
+extern "C" char *ExportNativeSamplerProfile(int64_t start,
+                                            int64_t end,
+                                            int32_t format,
+                                            uint8_t **out,
+                                            size_t *out_size)
+{
+    std::vector<NativeSample> samples;
+    int64_t sample_rate_in_micros = 0;
+    {
+        std::lock_guard<std::mutex> lock(glance::g_native_sampler_mutex);
+        if (glance::g_native_sampler == nullptr)
+        {
+            return strdup("native sampler is not started");
+        }
+
+        // Only the samples in range are copied under the lock, the ring can be
+        // far larger than the range.
+        const glance::SampleRing &ring = glance::g_native_sampler->samples();
+        uint64_t begin = ring.LowerBound(start);
+        uint64_t last = end < INT64_MAX ? ring.LowerBound(end + 1) : ring.write_position();
+        samples.reserve(last > begin ? last - begin : 0);
+        // The profile is of the wall ticks, the same as the reports.
+        const bool is_wall_only = glance::g_native_sampler->samples_cpu_time();
+        NativeSample sample;
+        for (uint64_t position = begin; position < last; ++position)
+        {
+            // A sample overwritten since the bounds are found is out of the ring.
+            if (ring.ReadAt(position, &sample) && (!is_wall_only || sample.kind == GLANCE_SAMPLE_KIND_WALL))
+            {
+                samples.push_back(sample);
+            }
+        }
+        sample_rate_in_micros = glance::g_native_sampler->sample_rate_in_micros();
+    }
+
+    // Encode without the lock, which would block stopping the sampler.
+    std::string profile;
+    switch (format)
+    {
+    case glance::profile_export::kPprof:
+    {
+        std::string error;
+        if (!glance::EncodePprofProfile(samples, sample_rate_in_micros, &profile, &error))
+        {
+            return strdup(error.c_str());
+        }
+        break;
+    }
+    case glance::profile_export::kCollapsed:
+        glance::EncodeCollapsedStacks(samples, &profile);
+        break;
+    default:
+        return strdup("unknown profile format");
+    }
+
+    // Never a null pointer even if the profile is empty.
+    *out = static_cast<uint8_t *>(malloc(profile.size() + 1));
+    if (*out == nullptr)
+    {
+        return strdup("out of memory");
+    }
+    memcpy(*out, profile.data(), profile.size());
+    *out_size = profile.size();
+    return nullptr;
+}
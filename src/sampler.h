@@ -0,0 +1,243 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <atomic>
+#include <memory>
+#include <pthread.h>
+
+#include "aggregator.h"
+#include "collect_stack.h"
+#include "persistent_samples.h"
+#include "perf_event_sampler.h"
+#include "sample_ring.h"
+#include "sched_state.h"
+
+namespace glance
+{
+    /// Samples the target thread set by `SetCurrentThreadAsTarget` on a dedicated
+    /// native thread, so the sampling cadence doesn't depend on the Dart event loop.
+    ///
+    /// The sampler thread sleeps until an absolute deadline, so the time spent on
+    /// collecting the stack trace doesn't accumulate as drift. If a tick is missed
+    /// (e.g., the sampler thread is descheduled), it's dropped instead of being
+    /// replayed in a burst.
+    ///
+    /// If the adaptive rate is enabled (see `SetNativeSamplerBurst`), the sampler
+    /// switches to the burst rate when a burst is requested or a frame runs past
+    /// its budget, and decays back to the base rate by doubling the interval on
+    /// every tick once the burst is over.
+    ///
+    /// If a |persistent_file| is given, the samples are kept in it instead of the
+    /// heap, and the sampler owns it.
+    class NativeSampler
+    {
+    public:
+        NativeSampler(int64_t sample_rate_in_micros, size_t capacity);
+
+        NativeSampler(int64_t sample_rate_in_micros, PersistentSampleFile *persistent_file);
+
+        ~NativeSampler();
+
+        /// Starts the sampler thread. Returns false if the thread can't be created.
+        ///
+        /// If `g_use_perf_events_` is set, the target thread is sampled by a
+        /// `PerfEventSampler` if it can be opened, otherwise by the signals.
+        ///
+        /// With the signals, the target thread is also sampled on its CPU time if
+        /// enabled by `SetNativeSamplerCpuTimeSampleRate`, and the samples are
+        /// annotated with its scheduling state if enabled by
+        /// `SetNativeSamplerSchedStateEnabled`.
+        bool Start();
+
+        /// Stops and joins the sampler thread.
+        void Stop();
+
+        int64_t sample_rate_in_micros() const { return sample_rate_in_micros_; }
+
+        bool uses_perf_events() const { return uses_perf_events_.load(std::memory_order_relaxed); }
+
+        /// Whether the CPU ticks are taken along with the wall ticks, see
+        /// `StartCpuTimeSampling`.
+        bool samples_cpu_time() const { return cpu_time_rate_in_micros_.load(std::memory_order_relaxed) != 0; }
+
+        const SampleRing &samples() const { return samples_; }
+
+        /// Must only be used by the thread querying the samples.
+        SampleAggregator &aggregator() { return aggregator_; }
+
+    private:
+        static void *ThreadMain(void *arg);
+
+        void Run();
+
+        /// Opens the `PerfEventSampler` of the current target thread, if it's not
+        /// opened for it yet. Returns false if it can't be opened.
+        bool OpenPerfEventSamplerIfNeeded();
+
+        /// Sets up the CPU ticks and the scheduling state of the signals, done by
+        /// `Start` and again whenever it falls back from the `PerfEventSampler`.
+        void SetUpSignalSampling();
+
+        /// Starts the CPU timer of the current target thread, if it's not started
+        /// for it yet.
+        void StartCpuTimeSamplingIfNeeded();
+
+        /// Writes the CPU ticks taken since the last call to |samples_|, not
+        /// older than |*newest_timestamp|, which is updated.
+        void TakeCpuTimeSamples(NativeSample *sample, int64_t *newest_timestamp);
+
+        /// Annotates the |sample| of the current target thread about to be taken
+        /// with its scheduling state, see `SchedStateReader`.
+        void ReadSchedState(NativeSample *sample);
+
+        /// Returns the interval to the next tick at |now|, given the |interval| to
+        /// the current tick.
+        int64_t NextInterval(int64_t now, int64_t interval);
+
+        const int64_t sample_rate_in_micros_;
+
+        // Must outlive the |samples_| living in it.
+        std::unique_ptr<PersistentSampleFile> persistent_file_;
+
+        SampleRing samples_;
+
+        SampleAggregator aggregator_;
+
+        // Only used by the sampler thread once it's started.
+        std::unique_ptr<PerfEventSampler> perf_event_sampler_;
+
+        // The `TargetThread::os_thread_id` of |perf_event_sampler_|.
+        uint64_t perf_event_thread_id_;
+
+        std::atomic<bool> uses_perf_events_;
+
+        // Null if the samples are not annotated with the scheduling state, only
+        // used by the sampler thread once it's started.
+        std::unique_ptr<SchedStateReader> sched_state_reader_;
+
+        // The CPU time between the CPU ticks, or 0 if not sampled. Only set by
+        // `SetUpSignalSampling`.
+        std::atomic<int64_t> cpu_time_rate_in_micros_;
+
+        // The `TargetThread::os_thread_id` of the CPU timer, only used by the
+        // sampler thread.
+        uint64_t cpu_time_thread_id_;
+
+        std::atomic<bool> running_;
+
+        pthread_t thread_;
+    };
+
+    /// Sleeps until the monotonic time reaches |deadline_micros|, see
+    /// `GetCurrentMonotonicMicros`.
+    void SleepUntil(int64_t deadline_micros);
+
+    /// Names the calling thread |name|, which is shown in the debuggers and the
+    /// traces.
+    void SetCurrentThreadName(const char *name);
+} // namespace glance
+
+// Starts sampling the target thread every |sample_rate_in_micros| on a native
+// thread, keeping the samples of the latest |window_in_micros| that fit in
+// |memory_budget_in_bytes| (see `SampleRing::CapacityFor`).
+//
+// On success returns nullptr otherwise returns a string containing the error.
+//
+// Returned string must be freed by the caller.
+extern "C" char *StartNativeSampler(int64_t sample_rate_in_micros,
+                                    int64_t window_in_micros,
+                                    size_t memory_budget_in_bytes);
+
+// Keeps the samples of the native sampler started afterwards in a file mapped
+// into memory at |path|, so they can be loaded by `LoadPersistedSamples` on the
+// next launch if the process dies without calling `StopNativeSampler`. The
+// |isolate_instructions| and the |header_lines| of the Dart stack trace are
+// stored with the samples, see `PersistentSampleFile`. A null |path| keeps the
+// samples in the heap, which is the default.
+extern "C" void SetNativeSamplerPersistentFile(const char *path,
+                                               int64_t isolate_instructions,
+                                               const char *const *header_lines,
+                                               size_t header_line_count);
+
+// Enables the adaptive sample rate of the native sampler: it samples every
+// |burst_rate_in_micros| for |burst_duration_in_micros| after a burst is
+// requested by `RequestNativeSamplerBurst`, or after a frame marked by
+// `MarkFrameBegin` runs longer than |frame_budget_in_micros|. 0
+// |burst_rate_in_micros| disables it.
+//
+// Can be called before or after `StartNativeSampler`, but the samples only
+// cover the window at the burst rate if it's set before, which sizes the ring
+// for it.
+extern "C" void SetNativeSamplerBurst(int64_t burst_rate_in_micros,
+                                      int64_t burst_duration_in_micros,
+                                      int64_t frame_budget_in_micros);
+
+// Also samples the target thread every |cpu_rate_in_micros| of its CPU time by
+// the native sampler started by `StartNativeSampler` afterwards, so the samples
+// of the time the thread is running on a CPU can be told from the ones of the
+// time it's blocked, see `StartCpuTimeSampling`. The CPU ticks are read by
+// `ReadNativeSamples` with `GLANCE_SAMPLE_KIND_CPU`, but not aggregated by
+// `AggregateNativeSamples` nor exported by `ExportNativeSamplerProfile`. Not
+// used with `perf_event_open`, whose samples are all CPU ticks. 0 disables it.
+extern "C" void SetNativeSamplerCpuTimeSampleRate(int64_t cpu_rate_in_micros);
+
+// Requests a burst of the high rate sampling, see `SetNativeSamplerBurst`.
+//
+// Only stores an atomic, cheap enough to be called on the UI thread per frame.
+extern "C" void RequestNativeSamplerBurst();
+
+// Marks the beginning of a frame on the UI thread, the native sampler starts a
+// burst once the frame runs past its budget, see `SetNativeSamplerBurst`.
+//
+// Only stores an atomic, cheap enough to be called on the UI thread per frame.
+extern "C" void MarkFrameBegin();
+
+// Marks the end of the frame marked by `MarkFrameBegin`.
+extern "C" void MarkFrameEnd();
+
+// Stops the native sampler started by `StartNativeSampler`, the collected
+// samples are dropped. The persistent file is marked as cleanly shut down, see
+// `SetNativeSamplerPersistentFile`.
+extern "C" void StopNativeSampler();
+
+// Returns 1 if the native sampler samples with the signals, 2 if with
+// `perf_event_open` (see `SetNativeSamplerPerfEventsEnabled`), or 0 if the
+// native sampler is not started.
+extern "C" int32_t GetNativeSamplerBackend();
+
+// Returns the maximum number of samples the native sampler keeps, or 0 if the
+// native sampler is not started.
+extern "C" size_t GetNativeSamplerCapacity();
+
+// Copies the samples of the native sampler whose timestamps are within
+// [|start|, |end|] to |out| in order of oldest to newest, at most |max_count|
+// of the newest samples are copied. Returns the number of samples copied.
+extern "C" size_t ReadNativeSamples(int64_t start, int64_t end, NativeSample *out, size_t max_count);
+
+// Aggregates the samples of the native sampler within [|start|, |end|] by
+// occurrence times, see `SampleAggregator`. At most |max_count| frames that
+// occur more than |occur_times_threshold| are copied to |out|.
+//
+// Returns the number of frames copied.
+extern "C" size_t AggregateNativeSamples(int64_t start,
+                                         int64_t end,
+                                         int64_t occur_times_threshold,
+                                         NativeAggregatedFrame *out,
+                                         size_t max_count);
+
+// Exports the samples of the native sampler within [|start|, |end|] as a
+// profile of |format| (see `profile_export::Format`) to |out| of |out_size|
+// bytes, which must be freed by the caller.
+//
+// On success returns nullptr otherwise returns a string containing the error.
+//
+// Returned string must be freed by the caller.
+extern "C" char *ExportNativeSamplerProfile(int64_t start,
+                                            int64_t end,
+                                            int32_t format,
+                                            uint8_t **out,
+                                            size_t *out_size);
+
+#endif // SAMPLER_H_
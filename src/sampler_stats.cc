@@ -0,0 +1,123 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "sampler_stats.h"
+
+namespace glance
+{
+    Histogram::Histogram()
+        : count_(0),
+          sum_(0),
+          max_(0)
+    {
+        for (std::atomic<int64_t> &bucket : buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    size_t Histogram::BucketOf(int64_t value)
+    {
+        if (value <= 0)
+        {
+            return 0;
+        }
+        size_t bucket = 64 - __builtin_clzll(static_cast<unsigned long long>(value));
+        return bucket < GLANCE_HISTOGRAM_BUCKET_COUNT ? bucket : GLANCE_HISTOGRAM_BUCKET_COUNT - 1;
+    }
+
+    void Histogram::Record(int64_t value)
+    {
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        buckets_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+
+        int64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max &&
+               !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void Histogram::CopyTo(NativeHistogram *out) const
+    {
+        // Not a consistent snapshot, the fields may be off by the samples recorded
+        // while copying, which is fine for the stats.
+        out->count = count_.load(std::memory_order_relaxed);
+        out->sum = sum_.load(std::memory_order_relaxed);
+        out->max = max_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < GLANCE_HISTOGRAM_BUCKET_COUNT; ++i)
+        {
+            out->buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    SamplerStats &SamplerStats::Instance()
+    {
+        // Intentionally leaked, the stats are updated until the process exits.
+        static SamplerStats *instance = new SamplerStats();
+        return *instance;
+    }
+
+    SamplerStats::SamplerStats()
+        : succeeded_(0),
+          timed_out_(0),
+          failed_(0),
+          frames_truncated_(0)
+    {
+    }
+
+    void SamplerStats::RecordTimeout()
+    {
+        timed_out_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void SamplerStats::RecordFailure()
+    {
+        RecordFailures(1);
+    }
+
+    void SamplerStats::RecordFailures(uint64_t count)
+    {
+        failed_.fetch_add(static_cast<int64_t>(count), std::memory_order_relaxed);
+    }
+
+    void SamplerStats::RecordSuccess(const int64_t *buf,
+                                     size_t buf_size,
+                                     int64_t signal_delivery_in_nanos,
+                                     int64_t target_pause_in_nanos)
+    {
+        size_t depth = 0;
+        while (depth < buf_size && buf[depth] != 0)
+        {
+            ++depth;
+        }
+
+        succeeded_.fetch_add(1, std::memory_order_relaxed);
+        // `StackWalker::Walk` keeps the last slot for the terminating 0, so a full
+        // buffer means the walk is stopped by the buffer.
+        if (buf_size > 1 && depth >= buf_size - 1)
+        {
+            frames_truncated_.fetch_add(1, std::memory_order_relaxed);
+        }
+        signal_delivery_in_nanos_.Record(signal_delivery_in_nanos);
+        target_pause_in_nanos_.Record(target_pause_in_nanos);
+        walk_depth_.Record(static_cast<int64_t>(depth));
+    }
+
+    void SamplerStats::CopyTo(NativeSamplerStats *out) const
+    {
+        out->samples_succeeded = succeeded_.load(std::memory_order_relaxed);
+        out->samples_timed_out = timed_out_.load(std::memory_order_relaxed);
+        out->samples_failed = failed_.load(std::memory_order_relaxed);
+        out->samples_attempted = out->samples_succeeded + out->samples_timed_out + out->samples_failed;
+        out->frames_truncated = frames_truncated_.load(std::memory_order_relaxed);
+        signal_delivery_in_nanos_.CopyTo(&out->signal_delivery_in_nanos);
+        target_pause_in_nanos_.CopyTo(&out->target_pause_in_nanos);
+        walk_depth_.CopyTo(&out->walk_depth);
+    }
+} // namespace glance
+
+extern "C" void GetSamplerStats(NativeSamplerStats *out)
+{
+    glance::SamplerStats::Instance().CopyTo(out);
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef SAMPLER_STATS_H_
+#define SAMPLER_STATS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// The number of buckets of a `NativeHistogram`, keep it in sync with the
+// `kNativeHistogramBucketCount` in `collect_stack.dart`.
+#define GLANCE_HISTOGRAM_BUCKET_COUNT 32
+
+/// A histogram with log2 buckets, bucket 0 counts the values <= 0, and bucket
+/// i counts the values in [2^(i-1), 2^i), the last bucket also counts all the
+/// larger values.
+struct NativeHistogram
+{
+    int64_t count;
+    int64_t sum;
+    int64_t max;
+    int64_t buckets[GLANCE_HISTOGRAM_BUCKET_COUNT];
+};
+
+/// The counters of stack trace collection since the process started, see
+/// `GetSamplerStats`.
+struct NativeSamplerStats
+{
+    int64_t samples_attempted;
+    int64_t samples_succeeded;
+    int64_t samples_timed_out;
+    // Failed for the reasons other than timing out, e.g., failed to send the signal.
+    int64_t samples_failed;
+    // The samples with more frames than the buffer can hold, the outermost
+    // frames are dropped.
+    int64_t frames_truncated;
+    // From sending the signal to the signal handler starting on Android, or the
+    // time of suspending the thread on iOS.
+    NativeHistogram signal_delivery_in_nanos;
+    // See `g_last_target_pause_in_nanos_`.
+    NativeHistogram target_pause_in_nanos;
+    NativeHistogram walk_depth;
+};
+
+namespace glance
+{
+    /// The lock-free counterpart of `NativeHistogram`.
+    class Histogram
+    {
+    public:
+        Histogram();
+
+        void Record(int64_t value);
+
+        void CopyTo(NativeHistogram *out) const;
+
+        static size_t BucketOf(int64_t value);
+
+    private:
+        std::atomic<int64_t> count_;
+        std::atomic<int64_t> sum_;
+        std::atomic<int64_t> max_;
+        std::atomic<int64_t> buckets_[GLANCE_HISTOGRAM_BUCKET_COUNT];
+    };
+
+    /// The self-overhead of sampling, updated by the collecting threads after
+    /// each `CollectStackTrace` call. Never touched by the signal handler, which
+    /// only leaves its timestamps in the request.
+    class SamplerStats
+    {
+    public:
+        static SamplerStats &Instance();
+
+        void RecordTimeout();
+
+        void RecordFailure();
+
+        /// Records |count| failures at once, e.g., the samples lost by the kernel.
+        void RecordFailures(uint64_t count);
+
+        /// Records a sample collected into |buf| of |buf_size|.
+        void RecordSuccess(const int64_t *buf,
+                           size_t buf_size,
+                           int64_t signal_delivery_in_nanos,
+                           int64_t target_pause_in_nanos);
+
+        int64_t timed_out() const { return timed_out_.load(std::memory_order_relaxed); }
+
+        void CopyTo(NativeSamplerStats *out) const;
+
+    private:
+        SamplerStats();
+
+        std::atomic<int64_t> succeeded_;
+        std::atomic<int64_t> timed_out_;
+        std::atomic<int64_t> failed_;
+        std::atomic<int64_t> frames_truncated_;
+        Histogram signal_delivery_in_nanos_;
+        Histogram target_pause_in_nanos_;
+        Histogram walk_depth_;
+    };
+} // namespace glance
+
+// Copies the counters of stack trace collection to |out|, the counters are
+// never reset, so the overhead of a period is the difference of two calls.
+extern "C" void GetSamplerStats(NativeSamplerStats *out);
+
+#endif // SAMPLER_STATS_H_
@@ -0,0 +1,442 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "sched_state.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(DART_HOST_OS_ANDROID) || defined(DART_HOST_OS_LINUX)
+#include <fcntl.h>
+#elif defined(DART_HOST_OS_MACOS)
+#include <mach/mach.h>
+#endif
+
+namespace glance
+{
+    std::atomic<bool> g_read_sched_state_(false);
+
+    namespace
+    {
+        struct SyscallName
+        {
+            int32_t number;
+            const char *name;
+        };
+
+        // The syscalls a thread mostly blocks in, the ones not defined by the
+        // platform are left out.
+        constexpr SyscallName kSyscallNames[] = {
+#ifdef SYS_read
+            {SYS_read, "read"},
+#endif
+#ifdef SYS_write
+            {SYS_write, "write"},
+#endif
+#ifdef SYS_readv
+            {SYS_readv, "readv"},
+#endif
+#ifdef SYS_writev
+            {SYS_writev, "writev"},
+#endif
+#ifdef SYS_pread64
+            {SYS_pread64, "pread64"},
+#endif
+#ifdef SYS_pwrite64
+            {SYS_pwrite64, "pwrite64"},
+#endif
+#ifdef SYS_pread
+            {SYS_pread, "pread"},
+#endif
+#ifdef SYS_pwrite
+            {SYS_pwrite, "pwrite"},
+#endif
+#ifdef SYS_open
+            {SYS_open, "open"},
+#endif
+#ifdef SYS_openat
+            {SYS_openat, "openat"},
+#endif
+#ifdef SYS_close
+            {SYS_close, "close"},
+#endif
+#ifdef SYS_fsync
+            {SYS_fsync, "fsync"},
+#endif
+#ifdef SYS_fdatasync
+            {SYS_fdatasync, "fdatasync"},
+#endif
+#ifdef SYS_ftruncate
+            {SYS_ftruncate, "ftruncate"},
+#endif
+#ifdef SYS_fallocate
+            {SYS_fallocate, "fallocate"},
+#endif
+#ifdef SYS_renameat
+            {SYS_renameat, "renameat"},
+#endif
+#ifdef SYS_unlinkat
+            {SYS_unlinkat, "unlinkat"},
+#endif
+#ifdef SYS_getdents64
+            {SYS_getdents64, "getdents64"},
+#endif
+#ifdef SYS_newfstatat
+            {SYS_newfstatat, "newfstatat"},
+#endif
+#ifdef SYS_statx
+            {SYS_statx, "statx"},
+#endif
+#ifdef SYS_flock
+            {SYS_flock, "flock"},
+#endif
+#ifdef SYS_fcntl
+            {SYS_fcntl, "fcntl"},
+#endif
+#ifdef SYS_ioctl
+            // E.g., the binder transactions on Android.
+            {SYS_ioctl, "ioctl"},
+#endif
+#ifdef SYS_futex
+            {SYS_futex, "futex"},
+#endif
+#ifdef SYS_poll
+            {SYS_poll, "poll"},
+#endif
+#ifdef SYS_ppoll
+            {SYS_ppoll, "ppoll"},
+#endif
+#ifdef SYS_select
+            {SYS_select, "select"},
+#endif
+#ifdef SYS_pselect6
+            {SYS_pselect6, "pselect6"},
+#endif
+#ifdef SYS_epoll_wait
+            {SYS_epoll_wait, "epoll_wait"},
+#endif
+#ifdef SYS_epoll_pwait
+            {SYS_epoll_pwait, "epoll_pwait"},
+#endif
+#ifdef SYS_nanosleep
+            {SYS_nanosleep, "nanosleep"},
+#endif
+#ifdef SYS_clock_nanosleep
+            {SYS_clock_nanosleep, "clock_nanosleep"},
+#endif
+#ifdef SYS_restart_syscall
+            // A sleep or a wait with a timeout resumed after a signal, e.g., of
+            // the sampler.
+            {SYS_restart_syscall, "restart_syscall"},
+#endif
+#ifdef SYS_sched_yield
+            {SYS_sched_yield, "sched_yield"},
+#endif
+#ifdef SYS_wait4
+            {SYS_wait4, "wait4"},
+#endif
+#ifdef SYS_waitid
+            {SYS_waitid, "waitid"},
+#endif
+#ifdef SYS_rt_sigtimedwait
+            {SYS_rt_sigtimedwait, "rt_sigtimedwait"},
+#endif
+#ifdef SYS_mmap
+            {SYS_mmap, "mmap"},
+#endif
+#ifdef SYS_munmap
+            {SYS_munmap, "munmap"},
+#endif
+#ifdef SYS_mprotect
+            {SYS_mprotect, "mprotect"},
+#endif
+#ifdef SYS_madvise
+            {SYS_madvise, "madvise"},
+#endif
+#ifdef SYS_msync
+            {SYS_msync, "msync"},
+#endif
+#ifdef SYS_membarrier
+            {SYS_membarrier, "membarrier"},
+#endif
+#ifdef SYS_connect
+            {SYS_connect, "connect"},
+#endif
+#ifdef SYS_accept
+            {SYS_accept, "accept"},
+#endif
+#ifdef SYS_accept4
+            {SYS_accept4, "accept4"},
+#endif
+#ifdef SYS_recvfrom
+            {SYS_recvfrom, "recvfrom"},
+#endif
+#ifdef SYS_sendto
+            {SYS_sendto, "sendto"},
+#endif
+#ifdef SYS_recvmsg
+            {SYS_recvmsg, "recvmsg"},
+#endif
+#ifdef SYS_sendmsg
+            {SYS_sendmsg, "sendmsg"},
+#endif
+#ifdef SYS_kevent
+            {SYS_kevent, "kevent"},
+#endif
+#ifdef SYS_kevent64
+            {SYS_kevent64, "kevent64"},
+#endif
+#ifdef SYS_kevent_qos
+            {SYS_kevent_qos, "kevent_qos"},
+#endif
+#ifdef SYS_kevent_id
+            {SYS_kevent_id, "kevent_id"},
+#endif
+#ifdef SYS_psynch_mutexwait
+            {SYS_psynch_mutexwait, "psynch_mutexwait"},
+#endif
+#ifdef SYS_psynch_cvwait
+            {SYS_psynch_cvwait, "psynch_cvwait"},
+#endif
+#ifdef SYS_psynch_rw_rdlock
+            {SYS_psynch_rw_rdlock, "psynch_rw_rdlock"},
+#endif
+#ifdef SYS_psynch_rw_wrlock
+            {SYS_psynch_rw_wrlock, "psynch_rw_wrlock"},
+#endif
+#ifdef SYS_ulock_wait
+            {SYS_ulock_wait, "ulock_wait"},
+#endif
+#ifdef SYS_ulock_wait2
+            {SYS_ulock_wait2, "ulock_wait2"},
+#endif
+#ifdef SYS___semwait_signal
+            {SYS___semwait_signal, "semwait_signal"},
+#endif
+#ifdef SYS_workq_kernreturn
+            {SYS_workq_kernreturn, "workq_kernreturn"},
+#endif
+#if defined(DART_HOST_OS_MACOS)
+            // The Mach traps, see `osfmk/mach/syscall_sw.h` of XNU.
+            {-31, "mach_msg_trap"},
+            {-32, "mach_msg_overwrite_trap"},
+            {-36, "semaphore_wait_trap"},
+            {-38, "semaphore_timedwait_trap"},
+            {-47, "mach_msg2_trap"},
+            {-59, "swtch_pri"},
+            {-61, "thread_switch"},
+            {-90, "mach_wait_until"},
+#endif
+        };
+    } // namespace
+
+#if defined(DART_HOST_OS_ANDROID) || defined(DART_HOST_OS_LINUX)
+    namespace
+    {
+        int OpenTaskFile(uint64_t os_thread_id, const char *name)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "/proc/self/task/%llu/%s",
+                     static_cast<unsigned long long>(os_thread_id), name);
+            return open(path, O_RDONLY | O_CLOEXEC);
+        }
+
+        // Returns the value of the line of |key| (e.g., "\nvoluntary_ctxt_switches:")
+        // in |status|, or -1 if not found.
+        int64_t FindStatusValue(const char *status, const char *key)
+        {
+            const char *line = strstr(status, key);
+            if (line == nullptr)
+            {
+                return -1;
+            }
+            return strtoll(line + strlen(key), nullptr, 10);
+        }
+    } // namespace
+
+    SchedStateReader::SchedStateReader()
+        : os_thread_id_(0),
+          stat_fd_(-1),
+          status_fd_(-1),
+          voluntary_switches_(-1),
+          involuntary_switches_(-1),
+          switches_read_micros_(0)
+    {
+    }
+
+    SchedStateReader::~SchedStateReader()
+    {
+        Close();
+    }
+
+    void SchedStateReader::Close()
+    {
+        if (stat_fd_ != -1)
+        {
+            close(stat_fd_);
+            stat_fd_ = -1;
+        }
+        if (status_fd_ != -1)
+        {
+            close(status_fd_);
+            status_fd_ = -1;
+        }
+        voluntary_switches_ = -1;
+        involuntary_switches_ = -1;
+    }
+
+    bool SchedStateReader::OpenIfNeeded(uint64_t os_thread_id)
+    {
+        if (os_thread_id == os_thread_id_ && stat_fd_ != -1)
+        {
+            return true;
+        }
+
+        // Not retried for the same thread if it fails, e.g., denied.
+        if (os_thread_id == os_thread_id_)
+        {
+            return false;
+        }
+
+        Close();
+        os_thread_id_ = os_thread_id;
+        stat_fd_ = OpenTaskFile(os_thread_id, "stat");
+        status_fd_ = OpenTaskFile(os_thread_id, "status");
+        return stat_fd_ != -1;
+    }
+
+    bool SchedStateReader::ReadSwitches(NativeSample *sample)
+    {
+        if (status_fd_ == -1)
+        {
+            return false;
+        }
+
+        char status[4096];
+        ssize_t size = pread(status_fd_, status, sizeof(status) - 1, 0);
+        if (size <= 0)
+        {
+            return false;
+        }
+        status[size] = '\0';
+
+        // The leading newline tells "voluntary" from "nonvoluntary".
+        int64_t voluntary = FindStatusValue(status, "\nvoluntary_ctxt_switches:");
+        int64_t involuntary = FindStatusValue(status, "\nnonvoluntary_ctxt_switches:");
+        if (voluntary < 0 || involuntary < 0)
+        {
+            return false;
+        }
+
+        if (voluntary_switches_ >= 0)
+        {
+            sample->voluntary_switches = static_cast<int32_t>(voluntary - voluntary_switches_);
+            sample->involuntary_switches = static_cast<int32_t>(involuntary - involuntary_switches_);
+        }
+        voluntary_switches_ = voluntary;
+        involuntary_switches_ = involuntary;
+        return true;
+    }
+
+    void SchedStateReader::Read(const TargetThread &thread, int64_t now, NativeSample *sample)
+    {
+        sample->run_state = 0;
+        sample->voluntary_switches = 0;
+        sample->involuntary_switches = 0;
+        if (!OpenIfNeeded(thread.os_thread_id))
+        {
+            return;
+        }
+
+        // "<pid> (<comm>) <state> ...", the state follows the last ')' since the
+        // comm may contain one. The comm is at most 16 bytes.
+        char stat[64];
+        ssize_t size = pread(stat_fd_, stat, sizeof(stat) - 1, 0);
+        if (size > 0)
+        {
+            stat[size] = '\0';
+            const char *comm_end = strrchr(stat, ')');
+            if (comm_end != nullptr && comm_end[1] == ' ' && comm_end[2] != '\0')
+            {
+                sample->run_state = comm_end[2];
+            }
+        }
+
+        if (now - switches_read_micros_ >= kSwitchesReadIntervalInMicros)
+        {
+            switches_read_micros_ = now;
+            ReadSwitches(sample);
+        }
+    }
+#elif defined(DART_HOST_OS_MACOS)
+    SchedStateReader::SchedStateReader()
+        : os_thread_id_(0),
+          stat_fd_(-1),
+          status_fd_(-1),
+          voluntary_switches_(-1),
+          involuntary_switches_(-1),
+          switches_read_micros_(0)
+    {
+    }
+
+    SchedStateReader::~SchedStateReader()
+    {
+    }
+
+    void SchedStateReader::Read(const TargetThread &thread, int64_t now, NativeSample *sample)
+    {
+        sample->run_state = 0;
+        sample->voluntary_switches = 0;
+        sample->involuntary_switches = 0;
+
+        thread_basic_info_data_t info;
+        mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+        if (thread_info(pthread_mach_thread_np(thread.thread), THREAD_BASIC_INFO,
+                        reinterpret_cast<thread_info_t>(&info), &count) != KERN_SUCCESS)
+        {
+            return;
+        }
+
+        // The same letters as the `stat` of Linux.
+        switch (info.run_state)
+        {
+        case TH_STATE_RUNNING:
+            sample->run_state = 'R';
+            break;
+        case TH_STATE_STOPPED:
+            sample->run_state = 'T';
+            break;
+        case TH_STATE_WAITING:
+            sample->run_state = 'S';
+            break;
+        case TH_STATE_UNINTERRUPTIBLE:
+            sample->run_state = 'D';
+            break;
+        case TH_STATE_HALTED:
+            sample->run_state = 'X';
+            break;
+        default:
+            break;
+        }
+    }
+#endif
+} // namespace glance
+
+extern "C" void SetNativeSamplerSchedStateEnabled(int enabled)
+{
+    glance::g_read_sched_state_.store(enabled != 0);
+}
+
+extern "C" const char *GetSyscallName(int32_t number)
+{
+    for (const glance::SyscallName &syscall_name : glance::kSyscallNames)
+    {
+        if (syscall_name.number == number)
+        {
+            return syscall_name.name;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef SCHED_STATE_H_
+#define SCHED_STATE_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "collect_stack.h"
+#include "sample_ring.h"
+
+namespace glance
+{
+    /// Whether the `NativeSampler` annotates the samples with the run state and
+    /// the context switches of the target thread, see
+    /// `SetNativeSamplerSchedStateEnabled`.
+    extern std::atomic<bool> g_read_sched_state_;
+
+    /// Reads the scheduling state of the target thread for the samples on the
+    /// sampler thread, so the signal handler only reads the registers (see
+    /// `g_last_target_syscall_`).
+    ///
+    /// The run state is read for every sample right before the thread is
+    /// stopped, from `/proc/self/task/<tid>/stat` on Android and Linux, or
+    /// `thread_info` on iOS. The context switches are read from `status`, which
+    /// costs about 3 times as much as `stat`, in batches of
+    /// `kSwitchesReadIntervalInMicros`: the switches since the previous read are
+    /// added to the sample of the read, so the samples of a time range still sum
+    /// up to its switches. There are no context switches on iOS.
+    ///
+    /// The files are kept open while the target thread is the same.
+    class SchedStateReader
+    {
+    public:
+        static constexpr int64_t kSwitchesReadIntervalInMicros = 8000;
+
+        SchedStateReader();
+
+        ~SchedStateReader();
+
+        /// Sets the `run_state`, `voluntary_switches` and `involuntary_switches`
+        /// of the |sample| of |thread| taken at |now|, which are 0 if not read.
+        void Read(const TargetThread &thread, int64_t now, NativeSample *sample);
+
+    private:
+        /// Opens the files of the thread of |os_thread_id| if they're not opened
+        /// for it yet. Returns false if the run state can't be read.
+        bool OpenIfNeeded(uint64_t os_thread_id);
+
+        void Close();
+
+        /// Reads the context switches of the thread since the previous read to
+        /// |sample|. Returns false if they can't be read.
+        bool ReadSwitches(NativeSample *sample);
+
+        uint64_t os_thread_id_;
+
+        int stat_fd_;
+
+        int status_fd_;
+
+        // The totals of the previous read, or -1 if not read yet.
+        int64_t voluntary_switches_;
+
+        int64_t involuntary_switches_;
+
+        int64_t switches_read_micros_;
+    };
+} // namespace glance
+
+// Sets whether the native sampler started by `StartNativeSampler` afterwards
+// annotates the samples with the run state and the context switches of the
+// target thread, see `SchedStateReader`, and the syscall it's in, see
+// `g_last_target_syscall_`. 0 disables it.
+extern "C" void SetNativeSamplerSchedStateEnabled(int enabled);
+
+// Returns the name of the syscall of |number| of the platform (see
+// `NativeSample::syscall`), e.g., "futex", or nullptr if it's not one of the
+// syscalls that mostly block. The string lives as long as the process.
+extern "C" const char *GetSyscallName(int32_t number);
+
+#endif // SCHED_STATE_H_
@@ -0,0 +1,178 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "stack_table.h"
+
+#include <new>
+
+#include "hash_map.h"
+
+namespace glance
+{
+    StackTable::StackTable(size_t node_capacity, void *memory)
+        : node_capacity_(node_capacity),
+          nodes_(static_cast<Node *>(memory))
+    {
+        // Keep the load factor of the index under 1/2 so the probe sequences
+        // stay short.
+        size_t bucket_count = 2;
+        while (bucket_count < node_capacity_ * 2)
+        {
+            bucket_count <<= 1;
+        }
+        buckets_.assign(bucket_count, kEmptyStack);
+
+        // Zero filled memory is a table of free nodes, just start the lifetime of
+        // the nodes without touching it. The lowest ids are taken first.
+        free_nodes_.reserve(node_capacity_);
+        for (size_t i = 0; i < node_capacity_; ++i)
+        {
+            new (&nodes_[i]) Node;
+            free_nodes_.push_back(static_cast<uint32_t>(node_capacity_ - i));
+        }
+    }
+
+    size_t StackTable::MemorySize(size_t node_capacity)
+    {
+        return node_capacity * sizeof(Node);
+    }
+
+    bool StackTable::Intern(const int64_t *pcs, size_t depth, uint32_t *stack)
+    {
+        uint32_t node = kEmptyStack;
+        for (size_t i = depth; i > 0; --i)
+        {
+            uint64_t pc = static_cast<uint64_t>(pcs[i - 1]);
+            uint32_t child = FindChild(node, pc);
+            if (child == kEmptyStack)
+            {
+                if (free_nodes_.empty())
+                {
+                    // Drop the references taken by the outer frames.
+                    Release(node);
+                    return false;
+                }
+
+                child = free_nodes_.back();
+                free_nodes_.pop_back();
+                Node &child_node = NodeOf(child);
+                child_node.pc.store(pc, std::memory_order_relaxed);
+                child_node.parent.store(node, std::memory_order_relaxed);
+                child_node.ref_count = 0;
+                InsertChild(child);
+            }
+
+            NodeOf(child).ref_count++;
+            node = child;
+        }
+
+        *stack = node;
+        return true;
+    }
+
+    void StackTable::Release(uint32_t stack)
+    {
+        // A node is referred by every stack passing through it, so the count of
+        // a node is never less than the counts of its children.
+        for (uint32_t id = stack; id != kEmptyStack;)
+        {
+            Node &node = NodeOf(id);
+            uint32_t parent = node.parent.load(std::memory_order_relaxed);
+            if (--node.ref_count == 0)
+            {
+                EraseChild(id);
+                free_nodes_.push_back(id);
+            }
+            id = parent;
+        }
+    }
+
+    size_t StackTable::Expand(uint32_t stack, size_t max_depth, int64_t *out) const
+    {
+        return ExpandFrom(nodes_, node_capacity_, stack, max_depth, out);
+    }
+
+    size_t StackTable::ExpandFrom(const void *memory,
+                                  size_t node_capacity,
+                                  uint32_t stack,
+                                  size_t max_depth,
+                                  int64_t *out)
+    {
+        const Node *nodes = static_cast<const Node *>(memory);
+
+        // The nodes may be reused by the writer while they are walked, which is
+        // detected by the caller afterwards. Bound the walk so a garbage parent
+        // can't send it out of the table or around in a cycle.
+        size_t depth = 0;
+        for (uint32_t id = stack; id != kEmptyStack && id <= node_capacity && depth < max_depth; ++depth)
+        {
+            const Node &node = nodes[id - 1];
+            out[depth] = static_cast<int64_t>(node.pc.load(std::memory_order_relaxed));
+            id = node.parent.load(std::memory_order_relaxed);
+        }
+        return depth;
+    }
+
+    size_t StackTable::BucketOf(uint32_t parent, uint64_t pc) const
+    {
+        return static_cast<size_t>(HashWord(pc ^ HashWord(parent))) & (buckets_.size() - 1);
+    }
+
+    uint32_t StackTable::FindChild(uint32_t parent, uint64_t pc) const
+    {
+        size_t mask = buckets_.size() - 1;
+        for (size_t i = BucketOf(parent, pc);; i = (i + 1) & mask)
+        {
+            uint32_t id = buckets_[i];
+            if (id == kEmptyStack)
+            {
+                return kEmptyStack;
+            }
+            const Node &node = NodeOf(id);
+            if (node.pc.load(std::memory_order_relaxed) == pc &&
+                node.parent.load(std::memory_order_relaxed) == parent)
+            {
+                return id;
+            }
+        }
+    }
+
+    void StackTable::InsertChild(uint32_t id)
+    {
+        const Node &node = NodeOf(id);
+        size_t mask = buckets_.size() - 1;
+        size_t i = BucketOf(node.parent.load(std::memory_order_relaxed), node.pc.load(std::memory_order_relaxed));
+        while (buckets_[i] != kEmptyStack)
+        {
+            i = (i + 1) & mask;
+        }
+        buckets_[i] = id;
+    }
+
+    void StackTable::EraseChild(uint32_t id)
+    {
+        const Node &node = NodeOf(id);
+        size_t mask = buckets_.size() - 1;
+        size_t i = BucketOf(node.parent.load(std::memory_order_relaxed), node.pc.load(std::memory_order_relaxed));
+        while (buckets_[i] != id)
+        {
+            i = (i + 1) & mask;
+        }
+
+        // Shift the following entries of the probe sequence back into the hole,
+        // the same as `HashMap::Erase`.
+        buckets_[i] = kEmptyStack;
+        for (size_t j = (i + 1) & mask; buckets_[j] != kEmptyStack; j = (j + 1) & mask)
+        {
+            const Node &moved = NodeOf(buckets_[j]);
+            size_t home = BucketOf(moved.parent.load(std::memory_order_relaxed), moved.pc.load(std::memory_order_relaxed));
+            bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+            if (stays)
+            {
+                continue;
+            }
+            buckets_[i] = buckets_[j];
+            buckets_[j] = kEmptyStack;
+            i = j;
+        }
+    }
+} // namespace glance
@@ -0,0 +1,103 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef STACK_TABLE_H_
+#define STACK_TABLE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace glance
+{
+    /// A hash-consed prefix trie of the stacks of the samples: a node is a frame
+    /// and its parent is the caller frame, so the stacks sharing the same
+    /// outermost frames (e.g., the run loop of the UI thread) share the nodes, and
+    /// a stack is identified by the id of its innermost node. Equal stacks that
+    /// are live at the same time have equal ids.
+    ///
+    /// The nodes are reference counted by the live stacks passing through them,
+    /// and reused once no stack refers to them. All the memory is allocated up
+    /// front, interning a stack allocates nothing.
+    ///
+    /// Only the writer thread may `Intern` and `Release` the stacks. The nodes are
+    /// only changed once they are released, so a reader can `Expand` a stack
+    /// concurrently as long as it checks afterwards that the stack was not
+    /// released in the meantime, e.g., by the sequence number of the `SampleRing`
+    /// slot holding it.
+    class StackTable
+    {
+    public:
+        /// The id of the empty stack.
+        static constexpr uint32_t kEmptyStack = 0;
+
+        /// Uses the |node_capacity| nodes of `MemorySize(node_capacity)` bytes in
+        /// |memory|, which must be zero filled and outlive the table.
+        StackTable(size_t node_capacity, void *memory);
+
+        ~StackTable() = default;
+
+        static size_t MemorySize(size_t node_capacity);
+
+        size_t node_capacity() const { return node_capacity_; }
+
+        /// The number of the nodes referred by the live stacks.
+        size_t live_node_count() const { return node_capacity_ - free_nodes_.size(); }
+
+        /// Interns the stack of the |depth| |pcs| in order of innermost to
+        /// outermost, and returns its id to |stack|. Returns false if there are not
+        /// enough free nodes, nothing is interned in that case.
+        bool Intern(const int64_t *pcs, size_t depth, uint32_t *stack);
+
+        /// Drops a reference of the |stack| returned by `Intern`.
+        void Release(uint32_t stack);
+
+        /// Copies at most |max_depth| pcs of |stack| to |out| in order of innermost
+        /// to outermost. Returns the number of pcs copied.
+        size_t Expand(uint32_t stack, size_t max_depth, int64_t *out) const;
+
+        /// `Expand` over the |node_capacity| nodes in |memory| of a table of
+        /// another process.
+        static size_t ExpandFrom(const void *memory,
+                                 size_t node_capacity,
+                                 uint32_t stack,
+                                 size_t max_depth,
+                                 int64_t *out);
+
+    private:
+        struct Node
+        {
+            std::atomic<uint64_t> pc;
+            // The id of the caller node, or `kEmptyStack` for the outermost frame.
+            std::atomic<uint32_t> parent;
+            // Only used by the writer.
+            uint32_t ref_count;
+        };
+
+        // The ids start from 1, `kEmptyStack` is not a node.
+        Node &NodeOf(uint32_t id) const { return nodes_[id - 1]; }
+
+        size_t BucketOf(uint32_t parent, uint64_t pc) const;
+
+        /// Returns the id of the child of |parent| with |pc|, or `kEmptyStack` if
+        /// not found.
+        uint32_t FindChild(uint32_t parent, uint64_t pc) const;
+
+        void InsertChild(uint32_t id);
+
+        void EraseChild(uint32_t id);
+
+        const size_t node_capacity_;
+
+        Node *nodes_;
+
+        // The index of the nodes by their parents and pcs, with open addressing
+        // and linear probing. It only stores the node ids and reads the keys from
+        // the nodes, which takes an eighth of the memory of a `HashMap` of the keys.
+        std::vector<uint32_t> buckets_;
+
+        std::vector<uint32_t> free_nodes_;
+    };
+} // namespace glance
+
+#endif // STACK_TABLE_H_
@@ -0,0 +1,247 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "thread_registry.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+
+namespace glance
+{
+    ThreadRegistry &ThreadRegistry::Instance()
+    {
+        // Intentionally leaked, the registry is used until the process exits.
+        static ThreadRegistry *instance = new ThreadRegistry();
+        return *instance;
+    }
+
+    ThreadRegistry::ThreadRegistry()
+        : default_index_(-1),
+          next_id_(0)
+    {
+        for (Entry &entry : entries_)
+        {
+            entry.state.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    bool ThreadRegistry::Pin(Entry &entry)
+    {
+        uint32_t state = entry.state.fetch_add(1, std::memory_order_acquire);
+        if ((state & kRegisteredBit) == 0)
+        {
+            entry.state.fetch_sub(1, std::memory_order_release);
+            return false;
+        }
+        return true;
+    }
+
+    void ThreadRegistry::Unpin(Entry &entry)
+    {
+        entry.state.fetch_sub(1, std::memory_order_release);
+    }
+
+    int32_t ThreadRegistry::RegisterCurrentThread(const char *name)
+    {
+        pthread_t self = pthread_self();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry *free_entry = nullptr;
+        for (Entry &entry : entries_)
+        {
+            uint32_t state = entry.state.load(std::memory_order_relaxed);
+            if ((state & kRegisteredBit) != 0 && pthread_equal(entry.thread.thread, self))
+            {
+                entry.name = name != nullptr ? name : "";
+                return entry.thread.id;
+            }
+            // A free entry may be pinned for a moment by a concurrent sampling,
+            // which fails to pin it anyway.
+            if (free_entry == nullptr && state == 0)
+            {
+                free_entry = &entry;
+            }
+        }
+
+        if (free_entry == nullptr)
+        {
+            return -1;
+        }
+
+        uword stack_lower = 0;
+        uword stack_upper = 0;
+        if (!GetCurrentThreadStackBounds(&stack_lower, &stack_upper))
+        {
+            return -1;
+        }
+
+        int32_t id = next_id_++;
+        free_entry->thread = {id, self, GetCurrentOsThreadId(), stack_lower, stack_upper};
+        free_entry->name = name != nullptr ? name : "";
+        free_entry->state.fetch_or(kRegisteredBit, std::memory_order_release);
+        return id;
+    }
+
+    void ThreadRegistry::UnregisterCurrentThread()
+    {
+        pthread_t self = pthread_self();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < kMaxThreads; ++i)
+        {
+            Entry &entry = entries_[i];
+            if ((entry.state.load(std::memory_order_relaxed) & kRegisteredBit) == 0 ||
+                !pthread_equal(entry.thread.thread, self))
+            {
+                continue;
+            }
+
+            int32_t index = static_cast<int32_t>(i);
+            default_index_.compare_exchange_strong(index, -1);
+            entry.state.fetch_and(~kRegisteredBit, std::memory_order_acq_rel);
+            // Wait for the samplings in progress, which are bounded by the timeout.
+            while (entry.state.load(std::memory_order_acquire) != 0)
+            {
+                sched_yield();
+            }
+            return;
+        }
+    }
+
+    void ThreadRegistry::SetDefaultTarget(int32_t thread_id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < kMaxThreads; ++i)
+        {
+            Entry &entry = entries_[i];
+            if ((entry.state.load(std::memory_order_relaxed) & kRegisteredBit) != 0 &&
+                entry.thread.id == thread_id)
+            {
+                default_index_.store(static_cast<int32_t>(i), std::memory_order_release);
+                return;
+            }
+        }
+        default_index_.store(-1, std::memory_order_release);
+    }
+
+    bool ThreadRegistry::HasDefaultTarget()
+    {
+        return default_index_.load(std::memory_order_acquire) != -1;
+    }
+
+    bool ThreadRegistry::GetName(int32_t thread_id, char *out, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const Entry &entry : entries_)
+        {
+            if ((entry.state.load(std::memory_order_relaxed) & kRegisteredBit) == 0 ||
+                entry.thread.id != thread_id)
+            {
+                continue;
+            }
+
+            if (size > 0)
+            {
+                size_t length = std::min(entry.name.size(), size - 1);
+                memcpy(out, entry.name.data(), length);
+                out[length] = '\0';
+            }
+            return true;
+        }
+        return false;
+    }
+} // namespace glance
+
+extern "C" void SetCurrentThreadAsTarget()
+{
+    glance::ThreadRegistry &registry = glance::ThreadRegistry::Instance();
+    registry.SetDefaultTarget(registry.RegisterCurrentThread("ui"));
+}
+
+// Collect stack trace of the target thread previously set by
+// SetCurrentThreadAsTarget into the given |buf| buffer.
+//
+// Stack trace is collected as a sequence of PC (program counter values) for
+// each frame and is terminated with 0 value.
+//
+// On success returns nullptr otherwise returns a string containing the error.
+//
+// Returned string must be freed by the caller.
+extern "C" char *CollectStackTraceOfTargetThread(int64_t *buf, size_t buf_size)
+{
+    char *error = nullptr;
+    bool found = glance::ThreadRegistry::Instance().WithDefaultTarget(
+        [&](const glance::TargetThread &thread)
+        {
+            error = glance::CollectStackTrace(thread, buf, buf_size);
+        });
+    if (!found)
+    {
+        return strdup("target thread is not set, call SetCurrentThreadAsTarget first");
+    }
+
+    return error;
+}
+
+extern "C" int32_t RegisterTargetThread(const char *name)
+{
+    return glance::ThreadRegistry::Instance().RegisterCurrentThread(name);
+}
+
+extern "C" void UnregisterTargetThread()
+{
+    glance::ThreadRegistry::Instance().UnregisterCurrentThread();
+}
+
+extern "C" int GetTargetThreadName(int32_t thread_id, char *out, size_t size)
+{
+    return glance::ThreadRegistry::Instance().GetName(thread_id, out, size) ? 1 : 0;
+}
+
+extern "C" size_t CollectStackTracesOfAllThreads(NativeThreadSample *out, size_t max_count)
+{
+    size_t count = 0;
+    glance::ThreadRegistry::Instance().ForEach(
+        [&](const glance::TargetThread &thread)
+        {
+            if (count >= max_count)
+            {
+                return;
+            }
+
+            NativeThreadSample &thread_sample = out[count++];
+            NativeSample &sample = thread_sample.sample;
+            thread_sample.thread_id = thread.id;
+            sample.timestamp = glance::GetCurrentMonotonicMicros();
+            sample.kind = GLANCE_SAMPLE_KIND_WALL;
+            sample.syscall = GLANCE_NO_SYSCALL;
+            sample.run_state = 0;
+            sample.voluntary_switches = 0;
+            sample.involuntary_switches = 0;
+            glance::SetFramePhaseOf(GLANCE_FRAME_PHASE_IDLE, &sample);
+            char *error = glance::CollectStackTrace(thread, sample.pcs, GLANCE_MAX_STACK_DEPTH);
+            if (error != nullptr)
+            {
+                // Still report the thread, so the samples can be matched to the
+                // threads by the caller.
+                free(error);
+                thread_sample.error = 1;
+                sample.depth = 0;
+                sample.pcs[0] = 0;
+                return;
+            }
+
+            size_t depth = 0;
+            while (depth < GLANCE_MAX_STACK_DEPTH && sample.pcs[depth] != 0)
+            {
+                ++depth;
+            }
+            thread_sample.error = 0;
+            sample.depth = static_cast<int32_t>(depth);
+            sample.syscall = glance::g_last_target_syscall_;
+            // The phase of the UI thread, the other threads are seen in it.
+            glance::SetFramePhaseOf(glance::g_last_target_frame_phase_, &sample);
+        });
+    return count;
+}
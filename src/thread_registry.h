@@ -0,0 +1,145 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef THREAD_REGISTRY_H_
+#define THREAD_REGISTRY_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "collect_stack.h"
+#include "sample_ring.h"
+
+/// A sample of a registered thread, see `CollectStackTracesOfAllThreads`.
+///
+/// |error| is 0 if the stack trace is collected, otherwise the |sample| is empty.
+struct NativeThreadSample
+{
+    int32_t thread_id;
+    int32_t error;
+    NativeSample sample;
+};
+
+namespace glance
+{
+    /// The threads to be sampled, e.g., the UI thread, the raster thread, the
+    /// platform thread and the threads of the background isolates.
+    ///
+    /// A thread registers itself, so its stack bounds can be looked up on the
+    /// thread itself, and must unregister itself before it exits.
+    ///
+    /// The threads are kept in a fixed array. Sampling a thread doesn't take the
+    /// lock, it pins the entry with a reference count instead, and unregistering
+    /// waits for the entry to be unpinned, so a thread can't exit in the middle
+    /// of being sampled. The lock only serializes registering and unregistering.
+    class ThreadRegistry
+    {
+    public:
+        /// The maximum number of the registered threads, keep it in sync with the
+        /// `_maxTargetThreads` in `collect_stack.dart`.
+        static constexpr size_t kMaxThreads = 32;
+
+        static ThreadRegistry &Instance();
+
+        /// Registers the calling thread with |name|. Returns the id of the thread,
+        /// or -1 if there are too many threads or the stack bounds of the thread
+        /// can't be found. Registering a thread again only updates its name.
+        int32_t RegisterCurrentThread(const char *name);
+
+        /// Unregisters the calling thread, does nothing if it's not registered.
+        void UnregisterCurrentThread();
+
+        /// Sets the thread of |thread_id| as the one sampled by
+        /// `CollectStackTraceOfTargetThread`.
+        void SetDefaultTarget(int32_t thread_id);
+
+        bool HasDefaultTarget();
+
+        /// Copies the name of |thread_id| to |out|, truncated to |size|. Returns
+        /// false if not found.
+        bool GetName(int32_t thread_id, char *out, size_t size);
+
+        /// Calls |callback| with the default target thread. Returns false if there
+        /// is no default target thread.
+        template <typename Callback>
+        bool WithDefaultTarget(Callback callback)
+        {
+            int32_t index = default_index_.load(std::memory_order_acquire);
+            if (index == -1 || !Pin(entries_[index]))
+            {
+                return false;
+            }
+            if (default_index_.load(std::memory_order_acquire) != index)
+            {
+                // Unregistered and the entry is reused by another thread.
+                Unpin(entries_[index]);
+                return false;
+            }
+
+            callback(entries_[index].thread);
+            Unpin(entries_[index]);
+            return true;
+        }
+
+        /// Calls |callback| with each registered thread.
+        template <typename Callback>
+        void ForEach(Callback callback)
+        {
+            for (Entry &entry : entries_)
+            {
+                if (Pin(entry))
+                {
+                    callback(entry.thread);
+                    Unpin(entry);
+                }
+            }
+        }
+
+    private:
+        // The bit of `Entry::state` set while the thread is registered, the lower
+        // bits are the number of pins.
+        static constexpr uint32_t kRegisteredBit = 1u << 31;
+
+        struct Entry
+        {
+            std::atomic<uint32_t> state;
+            TargetThread thread;
+            std::string name;
+        };
+
+        ThreadRegistry();
+
+        static bool Pin(Entry &entry);
+
+        static void Unpin(Entry &entry);
+
+        std::mutex mutex_;
+
+        Entry entries_[kMaxThreads];
+
+        std::atomic<int32_t> default_index_;
+
+        int32_t next_id_;
+    };
+} // namespace glance
+
+// Registers the current thread with |name| to be sampled, see
+// `ThreadRegistry::RegisterCurrentThread`.
+//
+// Returns the id of the thread, or -1 on failure.
+extern "C" int32_t RegisterTargetThread(const char *name);
+
+// Unregisters the current thread, must be called before the thread exits.
+extern "C" void UnregisterTargetThread();
+
+// Copies the name of |thread_id| to |out| (at most |size| bytes including the
+// terminating 0). Returns 0 if not found.
+extern "C" int GetTargetThreadName(int32_t thread_id, char *out, size_t size);
+
+// Collects the stack traces of all the registered threads in one pass, one
+// sample per thread is copied to |out|, at most |max_count| samples.
+//
+// Returns the number of samples copied.
+extern "C" size_t CollectStackTracesOfAllThreads(NativeThreadSample *out, size_t max_count);
+
+#endif // THREAD_REGISTRY_H_
@@ -0,0 +1,33 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+// Decodes a jank report file written by `JankReportWriter` to the text of
+// `GlanceStackTraceImpl.toString`, which can be passed to `flutter symbolize`.
+//
+// Usage: glance_decode <jank report file>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "jank_report.h"
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <jank report file>\n", argv[0]);
+        return 2;
+    }
+
+    char *text = nullptr;
+    char *error = DecodeJankReportFile(argv[1], &text);
+    if (error != nullptr)
+    {
+        fprintf(stderr, "%s\n", error);
+        free(error);
+        return 1;
+    }
+
+    fputs(text, stdout);
+    free(text);
+    return 0;
+}
@@ -0,0 +1,643 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+// The native tests of the protocols and the data structures that the
+// regression run can't drive into their corner cases, run by `ctest` on a plain
+// Linux host:
+//
+// - `dump_requests`: the slots of the requests of `CollectStackTrace`, a
+//   request given up on a timeout and served by a late signal handler, its slot
+//   reused while the signal is still pending, and all the slots in use.
+// - `stack_table`: the hash-consed stacks of `StackTable`, the equal stacks
+//   interned to one id, the nodes dropped with their last reference and reused.
+// - `sample_ring`: the stacks of the samples of `SampleRing` released when
+//   they're overwritten, and the samples recovered from a mapped file.
+// - `aggregator`: the samples of a burst weighted by their intervals by
+//   `SampleAggregator`, as the window moves.
+// - `jank_report`: a short write of `JankReportWriter` removed from the file, the
+//   reports before and after it still decoded, and the frames of a calling
+//   context tree decoded with the numbers of `GlanceStackTraceImpl.toString`.
+//
+// Exits with 1 if a check fails.
+//
+// Usage: glance_native_test <suite>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "aggregator.h"
+#include "collect_stack.h"
+#include "jank_report.h"
+#include "module_map.h"
+#include "sample_ring.h"
+#include "sampler_stats.h"
+#include "stack_table.h"
+
+namespace glance
+{
+    namespace
+    {
+        bool g_failed = false;
+
+        void Check(bool condition, const char *message)
+        {
+            if (!condition)
+            {
+                fprintf(stderr, "FAILED: %s\n", message);
+                g_failed = true;
+            }
+        }
+
+        constexpr int kDumpSignal = SIGPWR;
+
+        constexpr size_t kMaxDumpRequests = 8;
+
+        constexpr int64_t kShortTimeoutInMicros = 20000;
+
+        constexpr int64_t kLongTimeoutInMicros = 2000000;
+
+        constexpr size_t kBufferSize = 64;
+
+        void SleepForMillis(int64_t millis)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+        }
+
+        /// A thread to be sampled, which blocks the signal of `CollectStackTrace`
+        /// on demand, so the requests stay pending until it's unblocked.
+        class BlockingTarget
+        {
+        public:
+            BlockingTarget()
+                : blocked_(false), applied_(false), stopped_(false), ready_(false)
+            {
+                thread_ = std::thread([this]()
+                                      { Run(); });
+                while (!ready_.load())
+                {
+                    SleepForMillis(1);
+                }
+            }
+
+            ~BlockingTarget()
+            {
+                stopped_.store(true);
+                thread_.join();
+            }
+
+            const TargetThread &target() const { return target_; }
+
+            /// Blocks or unblocks the signal on the thread, and waits for it.
+            /// Unblocking delivers the pending signal right away.
+            void SetBlocked(bool blocked)
+            {
+                blocked_.store(blocked);
+                while (applied_.load() != blocked)
+                {
+                    SleepForMillis(1);
+                }
+            }
+
+        private:
+            void Run()
+            {
+                target_.id = 0;
+                target_.thread = pthread_self();
+                target_.os_thread_id = GetCurrentOsThreadId();
+                GetCurrentThreadStackBounds(&target_.stack_lower, &target_.stack_upper);
+                ready_.store(true);
+
+                sigset_t set;
+                sigemptyset(&set);
+                sigaddset(&set, kDumpSignal);
+                while (!stopped_.load())
+                {
+                    bool blocked = blocked_.load();
+                    if (blocked != applied_.load())
+                    {
+                        pthread_sigmask(blocked ? SIG_BLOCK : SIG_UNBLOCK, &set, nullptr);
+                        applied_.store(blocked);
+                    }
+                    SleepForMillis(1);
+                }
+            }
+
+            TargetThread target_;
+
+            std::atomic<bool> blocked_;
+
+            std::atomic<bool> applied_;
+
+            std::atomic<bool> stopped_;
+
+            std::atomic<bool> ready_;
+
+            std::thread thread_;
+        };
+
+        /// Collects the stack of |target|. Returns true if it's collected with
+        /// at least one frame.
+        bool Collect(const TargetThread &target, char **error)
+        {
+            int64_t pcs[kBufferSize] = {};
+            *error = CollectStackTrace(target, pcs, kBufferSize);
+            return *error == nullptr && pcs[0] != 0;
+        }
+
+        void TestDumpRequests()
+        {
+            int64_t default_timeout_in_micros = g_collect_stack_timeout_in_micros_.load();
+            BlockingTarget target;
+            char *error = nullptr;
+
+            // Served on time.
+            g_collect_stack_timeout_in_micros_.store(kLongTimeoutInMicros);
+            Check(Collect(target.target(), &error), "the stack of the target is not collected");
+            free(error);
+
+            // Given up on the timeout, then the late signal handler must not take
+            // the request, and the slot must be free again.
+            NativeSamplerStats before;
+            GetSamplerStats(&before);
+            g_collect_stack_timeout_in_micros_.store(kShortTimeoutInMicros);
+            target.SetBlocked(true);
+            Check(!Collect(target.target(), &error) && error != nullptr,
+                  "the request is not given up while the signal is blocked");
+            free(error);
+            NativeSamplerStats after;
+            GetSamplerStats(&after);
+            Check(after.samples_timed_out == before.samples_timed_out + 1, "the timeout is not counted");
+            target.SetBlocked(false);
+            g_collect_stack_timeout_in_micros_.store(kLongTimeoutInMicros);
+            Check(Collect(target.target(), &error), "the slot is not reused after a late signal handler");
+            free(error);
+
+            // Given up, and the slot reused by the next request while the signal of
+            // the first one is still pending. The second signal is merged into the
+            // pending one, whose handler carries the stale generation, so the new
+            // request must be found by scanning the slots.
+            g_collect_stack_timeout_in_micros_.store(kShortTimeoutInMicros);
+            target.SetBlocked(true);
+            Check(!Collect(target.target(), &error), "the request is not given up while the signal is blocked");
+            free(error);
+            g_collect_stack_timeout_in_micros_.store(kLongTimeoutInMicros);
+            bool reused_collected = false;
+            std::thread reused([&target, &reused_collected]()
+                               {
+                                   char *reused_error = nullptr;
+                                   reused_collected = Collect(target.target(), &reused_error);
+                                   free(reused_error); });
+            SleepForMillis(50);
+            target.SetBlocked(false);
+            reused.join();
+            Check(reused_collected, "the request reusing a slot is not served by the stale signal");
+
+            // All the slots in use, then one more request must fail right away, and
+            // a single signal must serve all of them.
+            target.SetBlocked(true);
+            std::vector<std::thread> collectors;
+            std::atomic<size_t> collected(0);
+            for (size_t i = 0; i < kMaxDumpRequests; ++i)
+            {
+                collectors.emplace_back([&target, &collected]()
+                                        {
+                                            char *collector_error = nullptr;
+                                            if (Collect(target.target(), &collector_error))
+                                            {
+                                                collected.fetch_add(1);
+                                            }
+                                            free(collector_error); });
+            }
+            SleepForMillis(100);
+            Check(!Collect(target.target(), &error) && error != nullptr &&
+                      strstr(error, "too many concurrent") != nullptr,
+                  "a request is claimed while all the slots are in use");
+            free(error);
+            target.SetBlocked(false);
+            for (std::thread &collector : collectors)
+            {
+                collector.join();
+            }
+            Check(collected.load() == kMaxDumpRequests, "the pending requests are not all served");
+
+            g_collect_stack_timeout_in_micros_.store(default_timeout_in_micros);
+        }
+
+        void TestStackTable()
+        {
+            constexpr size_t kNodeCapacity = 8;
+            std::vector<uint8_t> memory(StackTable::MemorySize(kNodeCapacity));
+            StackTable table(kNodeCapacity, memory.data());
+
+            // Innermost first, sharing the 2 outermost frames.
+            const int64_t a[] = {0x30, 0x20, 0x10};
+            const int64_t b[] = {0x40, 0x20, 0x10};
+            uint32_t a_id = StackTable::kEmptyStack;
+            uint32_t a_again_id = StackTable::kEmptyStack;
+            uint32_t b_id = StackTable::kEmptyStack;
+            Check(table.Intern(a, 3, &a_id) && a_id != StackTable::kEmptyStack, "a stack is not interned");
+            Check(table.Intern(a, 3, &a_again_id) && a_again_id == a_id, "the equal stacks have different ids");
+            Check(table.live_node_count() == 3, "the equal stacks don't share their nodes");
+            Check(table.Intern(b, 3, &b_id) && b_id != a_id, "the different stacks have the same id");
+            Check(table.live_node_count() == 4, "the stacks don't share their outermost frames");
+
+            int64_t out[GLANCE_MAX_STACK_DEPTH];
+            Check(table.Expand(b_id, GLANCE_MAX_STACK_DEPTH, out) == 3 && out[0] == 0x40 && out[1] == 0x20 &&
+                      out[2] == 0x10,
+                  "the stack is not expanded innermost first");
+            Check(table.Expand(a_id, 2, out) == 2 && out[0] == 0x30 && out[1] == 0x20,
+                  "the stack is not cut at the max depth");
+
+            // Dropped with the last reference only.
+            table.Release(a_id);
+            Check(table.live_node_count() == 4, "the nodes are dropped while still referred");
+            Check(table.Expand(a_id, GLANCE_MAX_STACK_DEPTH, out) == 3 && out[0] == 0x30,
+                  "a stack still referred is changed");
+            table.Release(a_again_id);
+            Check(table.live_node_count() == 3, "the innermost node is not dropped with its last reference");
+            table.Release(b_id);
+            Check(table.live_node_count() == 0, "the shared nodes are not dropped with their last reference");
+
+            // The freed nodes are reused, and a stack that doesn't fit interns nothing.
+            const int64_t deep[] = {8, 7, 6, 5, 4, 3, 2, 1};
+            uint32_t deep_id = StackTable::kEmptyStack;
+            Check(table.Intern(deep, kNodeCapacity, &deep_id), "the freed nodes are not reused");
+            Check(table.live_node_count() == kNodeCapacity, "the nodes are not all used");
+            uint32_t full_id = StackTable::kEmptyStack;
+            Check(!table.Intern(a, 3, &full_id), "a stack is interned without free nodes");
+            Check(table.live_node_count() == kNodeCapacity, "a stack that doesn't fit takes nodes");
+            Check(table.Expand(deep_id, GLANCE_MAX_STACK_DEPTH, out) == kNodeCapacity && out[0] == 8 && out[7] == 1,
+                  "the stack of the reused nodes is not expanded");
+            Check(StackTable::ExpandFrom(memory.data(), kNodeCapacity, deep_id, GLANCE_MAX_STACK_DEPTH, out) ==
+                          kNodeCapacity &&
+                      out[0] == 8,
+                  "the stack is not expanded from the memory of the table");
+            table.Release(deep_id);
+            Check(table.live_node_count() == 0, "the reused nodes are not dropped");
+        }
+
+        NativeSample MakeSample(int64_t timestamp, int64_t leaf_pc)
+        {
+            NativeSample sample;
+            memset(&sample, 0, sizeof(sample));
+            sample.timestamp = timestamp;
+            sample.depth = 3;
+            sample.kind = GLANCE_SAMPLE_KIND_WALL;
+            sample.syscall = GLANCE_NO_SYSCALL;
+            sample.pcs[0] = leaf_pc;
+            sample.pcs[1] = 0x20;
+            sample.pcs[2] = 0x10;
+            return sample;
+        }
+
+        void TestSampleRing()
+        {
+            constexpr size_t kCapacity = 4;
+            constexpr int64_t kWrites = 10;
+            {
+                SampleRing ring(kCapacity);
+                // The same stack again and again takes its nodes once.
+                for (int64_t i = 0; i < kWrites; ++i)
+                {
+                    ring.Write(MakeSample(i, 0x30));
+                }
+                Check(ring.stacks().live_node_count() == 3, "the equal stacks of the samples are not shared");
+            }
+            {
+                SampleRing ring(kCapacity);
+                // A new leaf per sample, the overwritten ones must release theirs.
+                for (int64_t i = 0; i < kWrites; ++i)
+                {
+                    ring.Write(MakeSample(i, 0x100 + i));
+                }
+                Check(ring.stacks().live_node_count() == 2 + kCapacity,
+                      "the stacks of the overwritten samples are not released");
+                NativeSample sample;
+                Check(!ring.ReadAt(0, &sample), "an overwritten sample is read");
+                Check(ring.ReadAt(kWrites - 1, &sample) && sample.timestamp == kWrites - 1 &&
+                          sample.pcs[0] == 0x100 + kWrites - 1 && sample.pcs[2] == 0x10,
+                      "the newest sample is not read back");
+            }
+
+            // Recovered from a file mapped by a ring that is gone.
+            char path[] = "/tmp/glance_native_test_XXXXXX";
+            int fd = mkstemp(path);
+            Check(fd != -1, "failed to create the file of the ring");
+            if (fd == -1)
+            {
+                return;
+            }
+            unlink(path);
+            size_t size = SampleRing::MemorySize(kCapacity);
+            Check(ftruncate(fd, static_cast<off_t>(size)) == 0, "failed to size the file of the ring");
+            void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            Check(memory != MAP_FAILED, "failed to map the file of the ring");
+            if (memory == MAP_FAILED)
+            {
+                close(fd);
+                return;
+            }
+            {
+                SampleRing ring(kCapacity, memory);
+                for (int64_t i = 0; i < kWrites; ++i)
+                {
+                    ring.Write(MakeSample(i * 1000, 0x100 + i));
+                }
+            }
+            munmap(memory, size);
+
+            const void *recovered_memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            Check(recovered_memory != MAP_FAILED, "failed to map the file of the ring again");
+            if (recovered_memory == MAP_FAILED)
+            {
+                return;
+            }
+            std::vector<NativeSample> recovered;
+            SampleRing::RecoverSamples(recovered_memory, kCapacity, 0, &recovered);
+            Check(recovered.size() == kCapacity, "the samples of the ring are not all recovered");
+            bool is_intact = recovered.size() == kCapacity;
+            for (size_t i = 0; i < recovered.size() && is_intact; ++i)
+            {
+                int64_t index = kWrites - static_cast<int64_t>(kCapacity) + static_cast<int64_t>(i);
+                is_intact = recovered[i].timestamp == index * 1000 && recovered[i].depth == 3 &&
+                            recovered[i].pcs[0] == 0x100 + index && recovered[i].pcs[1] == 0x20 &&
+                            recovered[i].pcs[2] == 0x10;
+            }
+            Check(is_intact, "the recovered samples are not the newest ones oldest first");
+            SampleRing::RecoverSamples(recovered_memory, kCapacity, 1000, &recovered);
+            Check(recovered.size() == 2 && recovered[0].timestamp == (kWrites - 2) * 1000,
+                  "the recovered samples are not cut to the window");
+            munmap(const_cast<void *>(recovered_memory), size);
+        }
+
+        // The occurrence times of |pc| in the |count| frames of |frames|, or -1.
+        int64_t OccurTimesOf(const NativeAggregatedFrame *frames, size_t count, int64_t pc)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (frames[i].pc == pc)
+                {
+                    return frames[i].occur_times;
+                }
+            }
+            return -1;
+        }
+
+        void TestAggregator()
+        {
+            // The pcs of this binary, so they resolve to a module.
+            const char *const patterns[] = {"(.*)"};
+            SetModulePathFilters(patterns, 1);
+            const int64_t root = reinterpret_cast<int64_t>(&TestStackTable);
+            const int64_t slow = reinterpret_cast<int64_t>(&TestSampleRing);
+            const int64_t burst = reinterpret_cast<int64_t>(&TestDumpRequests);
+
+            constexpr int64_t kSampleRate = 10000;
+            constexpr int64_t kBurstRate = 1000;
+            SampleRing ring(64);
+            NativeSample sample;
+            memset(&sample, 0, sizeof(sample));
+            sample.depth = 2;
+            sample.kind = GLANCE_SAMPLE_KIND_WALL;
+            sample.syscall = GLANCE_NO_SYSCALL;
+            sample.pcs[1] = root;
+            // 2 samples of the base rate, then a burst of the same time.
+            int64_t timestamp = 0;
+            for (int i = 0; i < 2; ++i)
+            {
+                timestamp += kSampleRate;
+                sample.timestamp = timestamp;
+                sample.pcs[0] = slow;
+                ring.Write(sample);
+            }
+            int64_t burst_begin = timestamp + kBurstRate;
+            for (int64_t i = 0; i < kSampleRate / kBurstRate; ++i)
+            {
+                timestamp += kBurstRate;
+                sample.timestamp = timestamp;
+                sample.pcs[0] = burst;
+                ring.Write(sample);
+            }
+
+            SampleAggregator aggregator(kSampleRate);
+            NativeAggregatedFrame frames[8];
+            size_t count = aggregator.Aggregate(ring, 0, INT64_MAX, 0, frames, 8);
+            Check(OccurTimesOf(frames, count, slow) == 2, "the samples of the base rate are not counted as one each");
+            Check(OccurTimesOf(frames, count, burst) == 1,
+                  "the samples of a burst are not weighted by their intervals");
+            Check(OccurTimesOf(frames, count, root) == 3, "the weights are not summed up across the leaves");
+
+            // The samples leaving the window are removed by their weights.
+            count = aggregator.Aggregate(ring, burst_begin, INT64_MAX, 0, frames, 8);
+            Check(OccurTimesOf(frames, count, slow) == -1, "the samples leaving the window are still counted");
+            Check(OccurTimesOf(frames, count, burst) == 1 && OccurTimesOf(frames, count, root) == 1,
+                  "the samples in the window are not weighted the same after it moves");
+
+            // Counted over, the first sample still follows the one before the window.
+            count = aggregator.Aggregate(ring, burst_begin, INT64_MAX, 1, frames, 8);
+            Check(count == 0, "the first sample of the window is weighted as a sample of the base rate");
+            count = aggregator.Aggregate(ring, 0, INT64_MAX, 1, frames, 8);
+            Check(OccurTimesOf(frames, count, slow) == 2 && OccurTimesOf(frames, count, burst) == -1,
+                  "the threshold is not of the samples of the base rate");
+        }
+
+        // The number of occurrences of |part| in |text|.
+        size_t CountOf(const std::string &text, const char *part)
+        {
+            size_t count = 0;
+            for (size_t position = text.find(part); position != std::string::npos;
+                 position = text.find(part, position + 1))
+            {
+                ++count;
+            }
+            return count;
+        }
+
+        off_t FileSizeOf(const char *path)
+        {
+            struct stat st;
+            return stat(path, &st) == 0 ? st.st_size : -1;
+        }
+
+        // Writes the report of the |frame_count| |frames| to a new file, and
+        // decodes it to |text|.
+        bool WriteAndDecodeJankReport(const NativeJankReportFrame *frames, size_t frame_count, std::string *text)
+        {
+            char path[] = "/tmp/glance_native_test_XXXXXX";
+            int fd = mkstemp(path);
+            if (fd == -1)
+            {
+                return false;
+            }
+            close(fd);
+
+            std::string error;
+            JankReportWriter *writer = JankReportWriter::Open(path, &error);
+            const char *const header[] = {"header"};
+            bool is_written = writer != nullptr &&
+                              writer->Write("build", 0x1000, header, 1, 1, frames, frame_count, &error);
+            delete writer;
+            char *decoded = nullptr;
+            char *decode_error = is_written ? DecodeJankReportFile(path, &decoded) : nullptr;
+            unlink(path);
+            if (!is_written || decode_error != nullptr)
+            {
+                free(decode_error);
+                return false;
+            }
+            text->assign(decoded);
+            free(decoded);
+            return true;
+        }
+
+        void TestJankReportPaths()
+        {
+            // Two call paths of a calling context tree, each from the innermost
+            // frame, the frame before the isolate instructions is not printed.
+            const NativeJankReportFrame frames[] = {
+                {0x1020, 2, -1, 0},
+                {0x1010, 3, -1, 1},
+                {0x1030, 1, -1, 0},
+                {0x0800, 1, -1, 1},
+                {0x1010, 1, -1, 2},
+            };
+            std::string text;
+            Check(WriteAndDecodeJankReport(frames, 5, &text), "failed to write and decode the paths");
+            Check(text == "header\n"
+                          "    #00 abs 0000000000001020 _kDartIsolateSnapshotInstructions+0x20\n"
+                          "    #01 abs 0000000000001010 _kDartIsolateSnapshotInstructions+0x10\n"
+                          "    #00 abs 0000000000001030 _kDartIsolateSnapshotInstructions+0x30\n"
+                          "    #02 abs 0000000000001010 _kDartIsolateSnapshotInstructions+0x10\n",
+                  "the frames of the paths are not numbered by their path depths");
+
+            // The frames of one stack keep their indexes.
+            const NativeJankReportFrame stack[] = {
+                {0x1020, 2, -1, -1},
+                {0x0800, 1, -1, -1},
+                {0x1010, 1, -1, -1},
+            };
+            Check(WriteAndDecodeJankReport(stack, 3, &text), "failed to write and decode the stack");
+            Check(text == "header\n"
+                          "    #00 abs 0000000000001020 _kDartIsolateSnapshotInstructions+0x20\n"
+                          "    #02 abs 0000000000001010 _kDartIsolateSnapshotInstructions+0x10\n",
+                  "the frames of the stack are not numbered by their indexes");
+        }
+
+        void TestJankReport()
+        {
+            char path[] = "/tmp/glance_native_test_XXXXXX";
+            int fd = mkstemp(path);
+            Check(fd != -1, "failed to create the jank report file");
+            if (fd == -1)
+            {
+                return;
+            }
+            close(fd);
+
+            std::string error;
+            JankReportWriter *writer = JankReportWriter::Open(path, &error);
+            Check(writer != nullptr, "failed to open the jank report file");
+            if (writer == nullptr)
+            {
+                unlink(path);
+                return;
+            }
+            const char *const first_header[] = {"first"};
+            const char *const second_header[] = {"second"};
+            std::vector<NativeJankReportFrame> frames(64);
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                frames[i].pc = 0x1000 + static_cast<int64_t>(i) * 0x10;
+                frames[i].occur_times = 1;
+                frames[i].module_id = -1;
+                frames[i].path_depth = -1;
+            }
+            Check(writer->Write("build", 0x1000, first_header, 1, 1, frames.data(), frames.size(), &error),
+                  "failed to write the first report");
+
+            // Cut the next write short by the file size limit, the excess fails
+            // with `EFBIG` instead of raising `SIGXFSZ`.
+            off_t size = FileSizeOf(path);
+            struct rlimit limit;
+            getrlimit(RLIMIT_FSIZE, &limit);
+            struct rlimit short_limit = limit;
+            short_limit.rlim_cur = static_cast<rlim_t>(size) + 16;
+            signal(SIGXFSZ, SIG_IGN);
+            Check(setrlimit(RLIMIT_FSIZE, &short_limit) == 0, "failed to limit the file size");
+            Check(!writer->Write("build", 0x1000, second_header, 1, 2, frames.data(), frames.size(), &error),
+                  "the short write is not reported");
+            setrlimit(RLIMIT_FSIZE, &limit);
+            signal(SIGXFSZ, SIG_DFL);
+            Check(FileSizeOf(path) == size, "the partial record of the short write is left in the file");
+
+            Check(writer->Write("build", 0x1000, second_header, 1, 3, frames.data(), frames.size(), &error),
+                  "failed to write the report after the short write");
+            delete writer;
+
+            char *text = nullptr;
+            char *decode_error = DecodeJankReportFile(path, &text);
+            unlink(path);
+            Check(decode_error == nullptr, "failed to decode the reports around the short write");
+            if (decode_error != nullptr)
+            {
+                free(decode_error);
+                return;
+            }
+            std::string decoded(text);
+            free(text);
+            Check(CountOf(decoded, "    #00 ") == 2, "the reports around the short write are not all decoded");
+            Check(decoded.find("first\n") == 0 && CountOf(decoded, "second\n") == 1,
+                  "the header of the short write is not written again with the next report");
+        }
+    } // namespace
+} // namespace glance
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: glance_native_test <suite>\n");
+        return 1;
+    }
+
+    if (strcmp(argv[1], "dump_requests") == 0)
+    {
+        glance::TestDumpRequests();
+    }
+    else if (strcmp(argv[1], "stack_table") == 0)
+    {
+        glance::TestStackTable();
+    }
+    else if (strcmp(argv[1], "sample_ring") == 0)
+    {
+        glance::TestSampleRing();
+    }
+    else if (strcmp(argv[1], "aggregator") == 0)
+    {
+        glance::TestAggregator();
+    }
+    else if (strcmp(argv[1], "jank_report") == 0)
+    {
+        glance::TestJankReport();
+        glance::TestJankReportPaths();
+    }
+    else
+    {
+        fprintf(stderr, "Unknown suite: %s\n", argv[1]);
+        return 1;
+    }
+    return glance::g_failed ? 1 : 0;
+}
@@ -0,0 +1,675 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+// A headless regression run of the native sampler on a synthetic jank workload,
+// so the attribution and the overhead of sampling can be gated on a plain Linux
+// host (e.g., a CI container) instead of on devices:
+//
+// - A "UI" thread renders frames of a fixed amount of work, and every
+//   `kJankInterval`th frame calls `RegressionHotFunction`, which runs for about
+//   `kJankMillis`.
+// - The workload runs once without the sampler and once with it, the slowdown
+//   of the second run is the overhead seen by the UI thread.
+// - Most of the samples within the janky frames must have their innermost frame
+//   in `RegressionHotFunction`.
+// - The frames mark their phases with `SetFramePhase` like the binding does,
+//   and the samples in `RegressionHotFunction` must be of its phase and of its
+//   frame (unless `--perf-events`, whose samples have no phase).
+// - The janky frames are aggregated and recorded by a `JankDeduper` like the
+//   reports of the Dart side. As they're all the same jank, the repeats must be
+//   folded into the fingerprint of the first one. Only checked when the janky
+//   frames block (`--cpu-time` and `--sched-state`), the stacks of
+//   `RegressionHotFunction` are its innermost pcs only, none of which occur
+//   often enough to be reported.
+//
+// Prints a `name value` line per metric, also to the `--output` file if given,
+// and exits with 1 if a check fails.
+//
+// With `--perf-events`, the samples are taken by `perf_event_open` instead of
+// the signals, see `PerfEventSampler`, and the run fails if it's not available.
+//
+// With `--cpu-time`, the target thread is also sampled on its CPU time (see
+// `SetNativeSamplerCpuTimeSampleRate`), and the janky frames block for another
+// `kJankMillis` after `RegressionHotFunction`. Then the attribution is of the
+// CPU ticks, and the wall ticks must see the blocking.
+//
+// With `--sched-state`, the samples are annotated with the scheduling state of
+// the target thread (see `SetNativeSamplerSchedStateEnabled`), and the janky
+// frames block the same as `--cpu-time`. Then most of the samples of the
+// blocking must be sleeping in `read`, most of the ones in
+// `RegressionHotFunction` must be running, and the attribution is of the
+// running samples.
+//
+// With `--watchdog`, the frames are also marked as the tasks of the UI thread
+// (see `MarkUiTaskBegin`) and watched by the watchdog with a timeout shorter
+// than `RegressionHotFunction`. Then most of the janky frames must be reported
+// by the callback while they're still running, with the stack in
+// `RegressionHotFunction`, and nothing else must be reported, including the UI
+// thread idling after the frames.
+//
+// Usage: glance_regression [--min-attribution <ratio>] [--max-pause-micros <micros>]
+//                          [--max-slowdown-percent <percent>] [--output <file>]
+//                          [--perf-events] [--cpu-time] [--sched-state] [--watchdog]
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <mutex>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "aggregator.h"
+#include "collect_stack.h"
+#include "jank_dedup.h"
+#include "sampler.h"
+#include "sampler_stats.h"
+#include "sched_state.h"
+#include "thread_registry.h"
+#include "watchdog.h"
+
+#define REGRESSION_NOINLINE __attribute__((noinline))
+
+namespace glance
+{
+    // Not in the anonymous namespace, so it's exported and `dladdr` finds it,
+    // see `ENABLE_EXPORTS` of `glance_regression`.
+    REGRESSION_NOINLINE uint64_t RegressionHotFunction(uint64_t work)
+    {
+        uint64_t x = work | 1;
+        for (uint64_t i = 0; i < work; ++i)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+        }
+        return x;
+    }
+
+    REGRESSION_NOINLINE uint64_t RegressionLightFrame(uint64_t work)
+    {
+        uint64_t x = work | 1;
+        for (uint64_t i = 0; i < work; ++i)
+        {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        return x;
+    }
+
+    namespace
+    {
+        constexpr int kFrameCount = 120;
+
+        constexpr int kJankInterval = 10;
+
+        constexpr int64_t kLightFrameMillis = 2;
+
+        constexpr int64_t kJankMillis = 50;
+
+        constexpr int64_t kSampleRateInMicros = 1000;
+
+        constexpr double kDefaultMinAttribution = 0.8;
+
+        constexpr int64_t kDefaultMaxPauseInMicros = 2000;
+
+        // The janky frames of `--cpu-time` spend half of the time blocked, which
+        // only the wall ticks see.
+        constexpr double kMaxWallAttributionOfBlockingJank = 0.75;
+
+        // The samples of `--sched-state` in the state of their part of the
+        // janky frames, the rest are taken right at the switches.
+        constexpr double kMinSchedStateRatio = 0.8;
+
+        // The phase is copied while the thread is stopped, so it's exact.
+        constexpr double kMinFramePhaseRatio = 0.95;
+
+        // The `jankThreshold` of 16ms over `kSampleRateInMicros`, the frames of
+        // the reports of the Dart side occur more than it.
+        constexpr int64_t kDedupOccurTimesThreshold = 16;
+
+        // The frames of the reports of the Dart side, see `kMaxStackTraces`.
+        constexpr size_t kDedupMaxFrames = 99;
+
+        // The janky frames reported as new fingerprints at most, as the janky
+        // frames are all the same, only the first one should be.
+        constexpr double kMaxDedupNewRatio = 0.25;
+
+        // Shorter than `kJankMillis`, and far longer than the light frames.
+        constexpr int64_t kWatchdogTimeoutInMicros = 25000;
+
+        // The janky frames reported by the watchdog while they're running, and the
+        // reports with the stack in `RegressionHotFunction`.
+        constexpr double kMinWatchdogRatio = 0.8;
+
+        // The reports of `--watchdog`, passed to `OnWatchdogReport` on the
+        // watchdog thread.
+        std::mutex g_watchdog_reports_mutex;
+
+        std::vector<NativeWatchdogReport> g_watchdog_reports;
+
+        void OnWatchdogReport(const NativeWatchdogReport *report)
+        {
+            std::lock_guard<std::mutex> lock(g_watchdog_reports_mutex);
+            g_watchdog_reports.push_back(*report);
+        }
+
+        // Keeps the results of the work from being optimized out.
+        std::atomic<uint64_t> g_sink{0};
+
+        struct Jank
+        {
+            int64_t begin;
+            int64_t end;
+            int32_t frame;
+        };
+
+        struct Workload
+        {
+            uint64_t hot_work_per_milli = 0;
+            uint64_t light_work_per_milli = 0;
+            // Whether to start the native sampler once the UI thread is the target.
+            bool sampled = false;
+            // Whether the janky frames also block for `kJankMillis`, see `BlockFor`.
+            bool blocks = false;
+            // Whether the frames are watched by the watchdog along with the sampler.
+            bool watched = false;
+            // The end of the frames, the UI thread idles afterwards while watched.
+            int64_t frames_end = 0;
+            char *sampler_error = nullptr;
+            int32_t backend = 0;
+            int64_t elapsed_in_micros = 0;
+            // The [begin, end] and the number of the janky frames.
+            std::vector<Jank> janks;
+        };
+
+        // How many iterations of |function| take a millisecond, the minimum of a
+        // few rounds so a preempted round doesn't skew it.
+        uint64_t Calibrate(uint64_t (*function)(uint64_t))
+        {
+            constexpr uint64_t kWork = 1 << 20;
+            int64_t best = INT64_MAX;
+            for (int i = 0; i < 5; ++i)
+            {
+                int64_t start = GetCurrentMonotonicMicros();
+                g_sink.fetch_add(function(kWork), std::memory_order_relaxed);
+                best = std::min(best, GetCurrentMonotonicMicros() - start);
+            }
+            return kWork * 1000 / static_cast<uint64_t>(std::max<int64_t>(best, 1));
+        }
+
+        // Blocks in a `read` of a timer, which is restarted after the signals of
+        // the sampler (unlike a sleep), so it stays the syscall of the samples.
+        void BlockFor(int64_t millis)
+        {
+            int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+            if (fd == -1)
+            {
+                SleepUntil(GetCurrentMonotonicMicros() + millis * 1000);
+                return;
+            }
+
+            struct itimerspec spec;
+            memset(&spec, 0, sizeof(spec));
+            spec.it_value.tv_sec = millis / 1000;
+            spec.it_value.tv_nsec = (millis % 1000) * 1000000;
+            timerfd_settime(fd, 0, &spec, nullptr);
+            uint64_t expirations;
+            while (read(fd, &expirations, sizeof(expirations)) == -1 && errno == EINTR)
+            {
+            }
+            close(fd);
+        }
+
+        REGRESSION_NOINLINE void RunFrames(Workload *workload)
+        {
+            SetCurrentThreadAsTarget();
+            if (workload->sampled)
+            {
+                workload->sampler_error = StartNativeSampler(kSampleRateInMicros, 60 * 1000 * 1000, 16 * 1024 * 1024);
+                if (workload->sampler_error != nullptr)
+                {
+                    UnregisterTargetThread();
+                    return;
+                }
+                workload->backend = GetNativeSamplerBackend();
+                if (workload->watched)
+                {
+                    workload->sampler_error = StartWatchdog(kWatchdogTimeoutInMicros);
+                    if (workload->sampler_error != nullptr)
+                    {
+                        UnregisterTargetThread();
+                        return;
+                    }
+                }
+            }
+            workload->janks.clear();
+            int64_t start = GetCurrentMonotonicMicros();
+            for (int frame = 0; frame < kFrameCount; ++frame)
+            {
+                int64_t begin = GetCurrentMonotonicMicros();
+                MarkUiTaskBegin();
+                MarkFrameBegin();
+                SetFramePhase(GLANCE_FRAME_PHASE_BUILD, frame);
+                uint64_t result = RegressionLightFrame(workload->light_work_per_milli * kLightFrameMillis);
+                bool is_jank = frame % kJankInterval == kJankInterval - 1;
+                if (is_jank)
+                {
+                    SetFramePhase(GLANCE_FRAME_PHASE_LAYOUT, frame);
+                    result ^= RegressionHotFunction(workload->hot_work_per_milli * kJankMillis);
+                    if (workload->blocks)
+                    {
+                        BlockFor(kJankMillis);
+                    }
+                }
+                SetFramePhase(GLANCE_FRAME_PHASE_IDLE, frame);
+                MarkFrameEnd();
+                MarkUiTaskEnd();
+                g_sink.fetch_add(result, std::memory_order_relaxed);
+                if (is_jank)
+                {
+                    workload->janks.push_back({begin, GetCurrentMonotonicMicros(), frame});
+                }
+            }
+            workload->elapsed_in_micros = GetCurrentMonotonicMicros() - start;
+            workload->frames_end = GetCurrentMonotonicMicros();
+            if (workload->watched && workload->sampled)
+            {
+                // Waiting for the next task is not a freeze.
+                SleepUntil(workload->frames_end + 4 * kWatchdogTimeoutInMicros);
+            }
+            // The next workload thread may get the same `pthread_t`.
+            UnregisterTargetThread();
+        }
+
+        // Runs the frames on a new thread, which is the target of the sampler.
+        void RunWorkload(Workload *workload)
+        {
+            std::thread thread([workload]()
+                               { RunFrames(workload); });
+            thread.join();
+        }
+
+        bool IsInHotFunction(int64_t pc)
+        {
+            Dl_info info;
+            return dladdr(reinterpret_cast<void *>(pc), &info) != 0 &&
+                   info.dli_saddr == reinterpret_cast<void *>(&RegressionHotFunction);
+        }
+
+        class Report
+        {
+        public:
+            explicit Report(FILE *output) : output_(output), failed_(false) {}
+
+            void Metric(const char *name, double value)
+            {
+                printf("%s %.3f\n", name, value);
+                if (output_ != nullptr)
+                {
+                    fprintf(output_, "%s %.3f\n", name, value);
+                }
+            }
+
+            void Check(bool passed, const char *description)
+            {
+                if (!passed)
+                {
+                    fprintf(stderr, "FAILED: %s\n", description);
+                    failed_ = true;
+                }
+            }
+
+            bool failed() const { return failed_; }
+
+        private:
+            FILE *output_;
+            bool failed_;
+        };
+    } // namespace
+} // namespace glance
+
+int main(int argc, char **argv)
+{
+    double min_attribution = glance::kDefaultMinAttribution;
+    int64_t max_pause_in_micros = glance::kDefaultMaxPauseInMicros;
+    // Wall time is noisy on the shared hosts, so the slowdown is only gated if
+    // asked for.
+    double max_slowdown_percent = -1;
+    const char *output_path = nullptr;
+    bool use_perf_events = false;
+    bool use_cpu_time = false;
+    bool use_sched_state = false;
+    bool use_watchdog = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *option = argv[i];
+        if (strcmp(option, "--perf-events") == 0)
+        {
+            use_perf_events = true;
+            continue;
+        }
+        if (strcmp(option, "--cpu-time") == 0)
+        {
+            use_cpu_time = true;
+            continue;
+        }
+        if (strcmp(option, "--sched-state") == 0)
+        {
+            use_sched_state = true;
+            continue;
+        }
+        if (strcmp(option, "--watchdog") == 0)
+        {
+            use_watchdog = true;
+            continue;
+        }
+
+        if (i + 1 == argc)
+        {
+            fprintf(stderr, "Usage: %s [--min-attribution <ratio>] [--max-pause-micros <micros>] "
+                            "[--max-slowdown-percent <percent>] [--output <file>] [--perf-events] [--cpu-time] "
+                            "[--sched-state] [--watchdog]\n",
+                    argv[0]);
+            return 2;
+        }
+        const char *value = argv[++i];
+        if (strcmp(option, "--min-attribution") == 0)
+        {
+            min_attribution = atof(value);
+        }
+        else if (strcmp(option, "--max-pause-micros") == 0)
+        {
+            max_pause_in_micros = strtoll(value, nullptr, 10);
+        }
+        else if (strcmp(option, "--max-slowdown-percent") == 0)
+        {
+            max_slowdown_percent = atof(value);
+        }
+        else if (strcmp(option, "--output") == 0)
+        {
+            output_path = value;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", option);
+            return 2;
+        }
+    }
+
+    FILE *output = nullptr;
+    if (output_path != nullptr)
+    {
+        output = fopen(output_path, "w");
+        if (output == nullptr)
+        {
+            fprintf(stderr, "Failed to open %s: %s\n", output_path, strerror(errno));
+            return 2;
+        }
+    }
+    glance::Report report(output);
+
+    glance::Workload workload;
+    workload.blocks = use_cpu_time || use_sched_state;
+    workload.hot_work_per_milli = glance::Calibrate(&glance::RegressionHotFunction);
+    workload.light_work_per_milli = glance::Calibrate(&glance::RegressionLightFrame);
+
+    glance::RunWorkload(&workload);
+    int64_t baseline_in_micros = workload.elapsed_in_micros;
+
+    NativeSamplerStats stats_before;
+    GetSamplerStats(&stats_before);
+    SetNativeSamplerPerfEventsEnabled(use_perf_events ? 1 : 0);
+    SetNativeSamplerCpuTimeSampleRate(use_cpu_time ? glance::kSampleRateInMicros : 0);
+    SetNativeSamplerSchedStateEnabled(use_sched_state ? 1 : 0);
+    SetWatchdogCallback(use_watchdog ? &glance::OnWatchdogReport : nullptr);
+    workload.sampled = true;
+    workload.watched = use_watchdog;
+    glance::RunWorkload(&workload);
+    if (workload.sampler_error != nullptr)
+    {
+        fprintf(stderr, "Failed to start the native sampler or the watchdog: %s\n", workload.sampler_error);
+        free(workload.sampler_error);
+        return 1;
+    }
+    int32_t backend = workload.backend;
+    // The samples of `PerfEventSampler` are only drained on the next tick.
+    glance::SleepUntil(glance::GetCurrentMonotonicMicros() + 10 * glance::kSampleRateInMicros);
+    int64_t sampled_in_micros = workload.elapsed_in_micros;
+
+    // The samples of the kind the attribution is of (the running ones of the
+    // `--sched-state` run), and the wall ticks of the `--cpu-time` run.
+    size_t jank_samples = 0;
+    size_t attributed_samples = 0;
+    size_t wall_samples = 0;
+    size_t wall_attributed_samples = 0;
+    // The wall ticks of `--sched-state` in and out of `RegressionHotFunction`.
+    size_t hot_samples = 0;
+    size_t hot_running_samples = 0;
+    size_t blocked_samples = 0;
+    size_t blocked_in_read_samples = 0;
+    int64_t voluntary_switches = 0;
+    // The samples in `RegressionHotFunction`, and the ones of its phase and frame.
+    size_t phase_samples = 0;
+    size_t phase_matched_samples = 0;
+    std::vector<NativeSample> samples(glance::kJankMillis * 4);
+    for (const auto &jank : workload.janks)
+    {
+        size_t count = ReadNativeSamples(jank.begin, jank.end, samples.data(), samples.size());
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (samples[i].depth == 0)
+            {
+                continue;
+            }
+            bool is_attributed = glance::IsInHotFunction(samples[i].pcs[0]);
+            if (is_attributed)
+            {
+                ++phase_samples;
+                phase_matched_samples += samples[i].frame_phase == GLANCE_FRAME_PHASE_LAYOUT &&
+                                                 samples[i].frame_number == jank.frame
+                                             ? 1
+                                             : 0;
+            }
+            if (use_sched_state && samples[i].kind == GLANCE_SAMPLE_KIND_WALL)
+            {
+                voluntary_switches += samples[i].voluntary_switches;
+                if (is_attributed)
+                {
+                    ++hot_samples;
+                    hot_running_samples += samples[i].run_state == 'R' ? 1 : 0;
+                }
+                else
+                {
+                    ++blocked_samples;
+                    blocked_in_read_samples +=
+                        samples[i].run_state == 'S' && samples[i].syscall == SYS_read ? 1 : 0;
+                }
+            }
+            if (use_cpu_time && samples[i].kind == GLANCE_SAMPLE_KIND_WALL)
+            {
+                ++wall_samples;
+                wall_attributed_samples += is_attributed ? 1 : 0;
+                continue;
+            }
+            if (use_sched_state && samples[i].run_state != 'R')
+            {
+                continue;
+            }
+            ++jank_samples;
+            attributed_samples += is_attributed ? 1 : 0;
+        }
+    }
+
+    // The janky frames recorded as new fingerprints, and the repeats summarized.
+    size_t dedup_reports = 0;
+    size_t dedup_new_reports = 0;
+    int64_t dedup_repeats = 0;
+    {
+        glance::JankDeduper deduper(workload.janks.size(), glance::JankDeduper::kDefaultTopFrames);
+        std::vector<NativeAggregatedFrame> aggregated(glance::kDedupMaxFrames);
+        std::vector<NativeJankReportFrame> frames;
+        NativeJankFingerprint entry;
+        NativeJankFingerprint evicted;
+        for (const auto &jank : workload.janks)
+        {
+            size_t count = AggregateNativeSamples(jank.begin, jank.end, glance::kDedupOccurTimesThreshold,
+                                                  aggregated.data(), aggregated.size());
+            if (count == 0)
+            {
+                continue;
+            }
+            frames.clear();
+            for (size_t i = 0; i < count; ++i)
+            {
+                frames.push_back({aggregated[i].pc, aggregated[i].occur_times, aggregated[i].module_id, -1});
+            }
+            ++dedup_reports;
+            // No Dart snapshot, the offsets are of the pcs.
+            dedup_new_reports += RecordJankReport(&deduper, 0, frames.data(), frames.size(), jank.end, &entry, &evicted);
+        }
+
+        std::vector<NativeJankFingerprint> summaries(workload.janks.size());
+        size_t summary_count = TakeJankSummaries(&deduper, summaries.data(), summaries.size());
+        for (size_t i = 0; i < summary_count; ++i)
+        {
+            dedup_repeats += summaries[i].repeats;
+        }
+    }
+    StopNativeSampler();
+
+    // The janky frames reported while running, the reports with the stack in
+    // `RegressionHotFunction`, and the reports of anything else.
+    size_t watchdog_janks = 0;
+    size_t watchdog_attributed_reports = 0;
+    size_t watchdog_false_reports = 0;
+    bool watchdog_report_taken = false;
+    if (use_watchdog)
+    {
+        NativeWatchdogReport taken;
+        watchdog_report_taken = TakeWatchdogReport(&taken) != 0;
+        StopWatchdog();
+        SetWatchdogCallback(nullptr);
+
+        std::lock_guard<std::mutex> lock(glance::g_watchdog_reports_mutex);
+        for (const auto &jank : workload.janks)
+        {
+            watchdog_janks += std::any_of(glance::g_watchdog_reports.begin(), glance::g_watchdog_reports.end(),
+                                          [&jank](const NativeWatchdogReport &report)
+                                          {
+                                              return report.sample.timestamp >= jank.begin &&
+                                                     report.sample.timestamp <= jank.end;
+                                          })
+                                  ? 1
+                                  : 0;
+        }
+        for (const auto &report : glance::g_watchdog_reports)
+        {
+            bool in_jank = std::any_of(workload.janks.begin(), workload.janks.end(),
+                                       [&report](const glance::Jank &jank)
+                                       {
+                                           return report.sample.timestamp >= jank.begin &&
+                                                  report.sample.timestamp <= jank.end;
+                                       });
+            watchdog_false_reports += in_jank ? 0 : 1;
+            watchdog_attributed_reports +=
+                in_jank && report.error == 0 && report.sample.depth > 0 &&
+                        glance::IsInHotFunction(report.sample.pcs[0])
+                    ? 1
+                    : 0;
+        }
+    }
+
+    NativeSamplerStats stats;
+    GetSamplerStats(&stats);
+    int64_t succeeded = stats.samples_succeeded - stats_before.samples_succeeded;
+    int64_t attempted = stats.samples_attempted - stats_before.samples_attempted;
+    int64_t pause_count = stats.target_pause_in_nanos.count - stats_before.target_pause_in_nanos.count;
+    int64_t pause_sum = stats.target_pause_in_nanos.sum - stats_before.target_pause_in_nanos.sum;
+    double mean_pause_in_micros = pause_count > 0 ? pause_sum / 1000.0 / pause_count : 0;
+    double attribution = jank_samples > 0 ? static_cast<double>(attributed_samples) / jank_samples : 0;
+    double wall_attribution = wall_samples > 0 ? static_cast<double>(wall_attributed_samples) / wall_samples : 0;
+    double hot_running_ratio = hot_samples > 0 ? static_cast<double>(hot_running_samples) / hot_samples : 0;
+    double blocked_in_read_ratio =
+        blocked_samples > 0 ? static_cast<double>(blocked_in_read_samples) / blocked_samples : 0;
+    double phase_ratio = phase_samples > 0 ? static_cast<double>(phase_matched_samples) / phase_samples : 0;
+    size_t watchdog_reports = glance::g_watchdog_reports.size();
+    double watchdog_jank_ratio =
+        !workload.janks.empty() ? static_cast<double>(watchdog_janks) / workload.janks.size() : 0;
+    double watchdog_attribution =
+        watchdog_reports > 0 ? static_cast<double>(watchdog_attributed_reports) / watchdog_reports : 0;
+    double dedup_new_ratio =
+        dedup_reports > 0 ? static_cast<double>(dedup_new_reports) / dedup_reports : 0;
+    double slowdown_percent = baseline_in_micros > 0
+                                  ? (sampled_in_micros - baseline_in_micros) * 100.0 / baseline_in_micros
+                                  : 0;
+
+    report.Metric("perf_events", backend == 2 ? 1 : 0);
+    report.Metric("baseline_ms", baseline_in_micros / 1000.0);
+    report.Metric("sampled_ms", sampled_in_micros / 1000.0);
+    report.Metric("slowdown_percent", slowdown_percent);
+    report.Metric("samples_attempted", static_cast<double>(attempted));
+    report.Metric("samples_succeeded", static_cast<double>(succeeded));
+    report.Metric("mean_target_pause_us", mean_pause_in_micros);
+    report.Metric("max_target_pause_us", stats.target_pause_in_nanos.max / 1000.0);
+    report.Metric("jank_samples", static_cast<double>(jank_samples));
+    report.Metric("hot_function_attribution", attribution);
+    report.Metric("hot_function_phase_ratio", phase_ratio);
+    report.Metric("dedup_reports", static_cast<double>(dedup_reports));
+    report.Metric("dedup_new_ratio", dedup_new_ratio);
+    report.Metric("dedup_repeats", static_cast<double>(dedup_repeats));
+    if (use_cpu_time)
+    {
+        report.Metric("wall_jank_samples", static_cast<double>(wall_samples));
+        report.Metric("wall_hot_function_attribution", wall_attribution);
+    }
+    if (use_sched_state)
+    {
+        report.Metric("hot_function_running_ratio", hot_running_ratio);
+        report.Metric("blocked_in_read_ratio", blocked_in_read_ratio);
+        report.Metric("jank_voluntary_switches", static_cast<double>(voluntary_switches));
+    }
+    if (use_watchdog)
+    {
+        report.Metric("watchdog_reports", static_cast<double>(watchdog_reports));
+        report.Metric("watchdog_jank_ratio", watchdog_jank_ratio);
+        report.Metric("watchdog_hot_function_attribution", watchdog_attribution);
+        report.Metric("watchdog_false_reports", static_cast<double>(watchdog_false_reports));
+    }
+
+    report.Check(!use_perf_events || backend == 2, "perf_event_open is not available");
+    report.Check(jank_samples > 0, "no samples within the janky frames");
+    report.Check(attribution >= min_attribution, "the janky frames are not attributed to RegressionHotFunction");
+    report.Check(backend == 2 || phase_ratio >= glance::kMinFramePhaseRatio,
+                 "the samples in RegressionHotFunction are not of its frame phase");
+    report.Check(!workload.blocks || (dedup_reports > 0 && dedup_new_ratio <= glance::kMaxDedupNewRatio),
+                 "the repeats of the same jank are not folded by the deduper");
+    report.Check(dedup_new_reports + dedup_repeats == dedup_reports,
+                 "the repeats are not all summarized by the deduper");
+    report.Check(mean_pause_in_micros <= max_pause_in_micros, "the target thread is paused for too long");
+    report.Check(!use_cpu_time || (wall_samples > 0 && wall_attribution <= glance::kMaxWallAttributionOfBlockingJank),
+                 "the wall ticks don't see the blocking of the janky frames");
+    report.Check(!use_sched_state || hot_running_ratio >= glance::kMinSchedStateRatio,
+                 "the samples in RegressionHotFunction are not running");
+    report.Check(!use_sched_state || blocked_in_read_ratio >= glance::kMinSchedStateRatio,
+                 "the samples of the blocking are not sleeping in read");
+    report.Check(!use_sched_state || voluntary_switches > 0, "no context switches of the blocking");
+    report.Check(!use_watchdog || watchdog_jank_ratio >= glance::kMinWatchdogRatio,
+                 "the janky frames are not reported by the watchdog while running");
+    report.Check(!use_watchdog || watchdog_attribution >= glance::kMinWatchdogRatio,
+                 "the watchdog reports are not attributed to RegressionHotFunction");
+    report.Check(!use_watchdog || watchdog_false_reports == 0, "the watchdog reports a frame that is not frozen");
+    report.Check(!use_watchdog || watchdog_report_taken, "the watchdog reports are not kept for TakeWatchdogReport");
+    report.Check(max_slowdown_percent < 0 || slowdown_percent <= max_slowdown_percent,
+                 "the workload is slowed down too much by the sampler");
+    if (output != nullptr)
+    {
+        fclose(output);
+    }
+    return report.failed() ? 1 : 0;
+}
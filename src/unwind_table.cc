@@ -0,0 +1,870 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "unwind_table.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "module_map.h"
+
+namespace glance
+{
+    std::atomic<bool> g_use_unwind_tables_(false);
+
+    namespace
+    {
+        // The pointer encodings of `.eh_frame`, see the LSB "Exception Frames".
+        enum PointerEncoding : uint8_t
+        {
+            kPeAbsptr = 0x00,
+            kPeUleb128 = 0x01,
+            kPeUdata2 = 0x02,
+            kPeUdata4 = 0x03,
+            kPeUdata8 = 0x04,
+            kPeSleb128 = 0x09,
+            kPeSdata2 = 0x0a,
+            kPeSdata4 = 0x0b,
+            kPeSdata8 = 0x0c,
+            kPePcrel = 0x10,
+            kPeDatarel = 0x30,
+            kPeIndirect = 0x80,
+            kPeOmit = 0xff,
+        };
+
+        // The DWARF register numbers of the stack pointer and the frame pointer.
+#if defined(HOST_ARCH_X64)
+        constexpr uint64_t kCfiStackPointer = 7;
+        constexpr uint64_t kCfiFramePointer = 6;
+        constexpr bool kCfiIsSupported = true;
+#elif defined(HOST_ARCH_ARM64)
+        constexpr uint64_t kCfiStackPointer = 31;
+        constexpr uint64_t kCfiFramePointer = 29;
+        constexpr bool kCfiIsSupported = true;
+#else
+        // The 32-bit ARM libraries unwind with `.ARM.exidx` instead.
+        constexpr uint64_t kCfiStackPointer = ~0ull;
+        constexpr uint64_t kCfiFramePointer = ~0ull;
+        constexpr bool kCfiIsSupported = false;
+#endif
+
+        // Reads the CFI in the loaded image, any malformed read fails the reader
+        // instead of reading past |end|.
+        struct CfiReader
+        {
+            const uint8_t *position;
+            const uint8_t *end;
+            bool ok;
+
+            bool Has(size_t size)
+            {
+                if (!ok || static_cast<size_t>(end - position) < size)
+                {
+                    ok = false;
+                    return false;
+                }
+                return true;
+            }
+
+            template <typename T>
+            T Read()
+            {
+                T value = 0;
+                if (Has(sizeof(T)))
+                {
+                    memcpy(&value, position, sizeof(T));
+                    position += sizeof(T);
+                }
+                return value;
+            }
+
+            uint64_t ReadUleb128()
+            {
+                uint64_t value = 0;
+                for (uint32_t shift = 0; Has(1); shift += 7)
+                {
+                    uint8_t byte = *position++;
+                    if (shift < 64)
+                    {
+                        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    }
+                    if ((byte & 0x80) == 0)
+                    {
+                        break;
+                    }
+                }
+                return value;
+            }
+
+            int64_t ReadSleb128()
+            {
+                uint64_t value = 0;
+                uint32_t shift = 0;
+                uint8_t byte = 0;
+                while (Has(1))
+                {
+                    byte = *position++;
+                    if (shift < 64)
+                    {
+                        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    }
+                    shift += 7;
+                    if ((byte & 0x80) == 0)
+                    {
+                        break;
+                    }
+                }
+                if (shift < 64 && (byte & 0x40) != 0)
+                {
+                    value |= ~0ull << shift;
+                }
+                return static_cast<int64_t>(value);
+            }
+
+            // Reads a pointer of |encoding|, |data_base| is the base of
+            // `kPeDatarel`. The indirect pointers are not dereferenced, they
+            // are only skipped.
+            uword ReadPointer(uint8_t encoding, uword data_base)
+            {
+                if (encoding == kPeOmit)
+                {
+                    return 0;
+                }
+
+                uword field = reinterpret_cast<uword>(position);
+                uword value = 0;
+                switch (encoding & 0x0f)
+                {
+                case kPeAbsptr:
+                    value = Read<uword>();
+                    break;
+                case kPeUleb128:
+                    value = static_cast<uword>(ReadUleb128());
+                    break;
+                case kPeUdata2:
+                    value = Read<uint16_t>();
+                    break;
+                case kPeUdata4:
+                    value = Read<uint32_t>();
+                    break;
+                case kPeUdata8:
+                    value = static_cast<uword>(Read<uint64_t>());
+                    break;
+                case kPeSleb128:
+                    value = static_cast<uword>(ReadSleb128());
+                    break;
+                case kPeSdata2:
+                    value = static_cast<uword>(static_cast<intptr_t>(Read<int16_t>()));
+                    break;
+                case kPeSdata4:
+                    value = static_cast<uword>(static_cast<intptr_t>(Read<int32_t>()));
+                    break;
+                case kPeSdata8:
+                    value = static_cast<uword>(Read<int64_t>());
+                    break;
+                default:
+                    ok = false;
+                    return 0;
+                }
+
+                switch (encoding & 0x70)
+                {
+                case 0:
+                    break;
+                case kPePcrel:
+                    value += field;
+                    break;
+                case kPeDatarel:
+                    value += data_base;
+                    break;
+                default:
+                    // `textrel` and `funcrel` are not used by `.eh_frame`.
+                    ok = false;
+                    return 0;
+                }
+                return value;
+            }
+        };
+
+        // The rule of a register of the caller.
+        struct CfiRule
+        {
+            enum Kind : uint8_t
+            {
+                kSameValue,
+                kOffset,
+                kUnsupported,
+            };
+
+            Kind kind;
+            int64_t offset;
+        };
+
+        struct CfiState
+        {
+            uint64_t cfa_register;
+            int64_t cfa_offset;
+            bool is_cfa_supported;
+            CfiRule ra;
+            CfiRule fp;
+        };
+
+        struct Cie
+        {
+            uint64_t code_alignment;
+            int64_t data_alignment;
+            uint64_t ra_register;
+            uint8_t fde_encoding;
+            bool has_augmentation_data;
+            const uint8_t *instructions;
+            const uint8_t *end;
+        };
+
+        // Parses the CIE at |address|. Returns false if it's not supported.
+        bool ParseCie(const uint8_t *address, Cie *cie)
+        {
+            CfiReader reader{address, address + 12, true};
+            uint64_t length = reader.Read<uint32_t>();
+            bool is_64_bit = length == 0xffffffff;
+            if (is_64_bit)
+            {
+                length = reader.Read<uint64_t>();
+            }
+            if (!reader.ok || length == 0)
+            {
+                return false;
+            }
+            reader.end = reader.position + length;
+
+            uint64_t id = is_64_bit ? reader.Read<uint64_t>() : reader.Read<uint32_t>();
+            uint8_t version = reader.Read<uint8_t>();
+            if (!reader.ok || id != 0 || (version != 1 && version != 3))
+            {
+                return false;
+            }
+
+            const char *augmentation = reinterpret_cast<const char *>(reader.position);
+            size_t augmentation_size = strnlen(augmentation, reader.end - reader.position);
+            if (!reader.Has(augmentation_size + 1))
+            {
+                return false;
+            }
+            reader.position += augmentation_size + 1;
+
+            cie->code_alignment = reader.ReadUleb128();
+            cie->data_alignment = reader.ReadSleb128();
+            cie->ra_register = version == 1 ? reader.Read<uint8_t>() : reader.ReadUleb128();
+            cie->fde_encoding = kPeAbsptr;
+            cie->has_augmentation_data = augmentation_size > 0 && augmentation[0] == 'z';
+
+            if (cie->has_augmentation_data)
+            {
+                uint64_t data_size = reader.ReadUleb128();
+                if (!reader.Has(data_size))
+                {
+                    return false;
+                }
+                CfiReader data{reader.position, reader.position + data_size, true};
+                for (size_t i = 1; i < augmentation_size; ++i)
+                {
+                    switch (augmentation[i])
+                    {
+                    case 'L':
+                        data.Read<uint8_t>();
+                        break;
+                    case 'P':
+                        data.ReadPointer(data.Read<uint8_t>(), 0);
+                        break;
+                    case 'R':
+                        cie->fde_encoding = data.Read<uint8_t>();
+                        break;
+                    case 'S':
+                    case 'B':
+                    case 'G':
+                        break;
+                    default:
+                        return false;
+                    }
+                }
+                if (!data.ok)
+                {
+                    return false;
+                }
+                reader.position += data_size;
+            }
+            else if (augmentation_size > 0)
+            {
+                // The sizes of the other augmentations are unknown.
+                return false;
+            }
+
+            cie->instructions = reader.position;
+            cie->end = reader.end;
+            return reader.ok;
+        }
+
+        // Interprets the CFI instructions and calls |emit| with each location
+        // and the state from it.
+        class CfiInterpreter
+        {
+        public:
+            CfiInterpreter(const Cie &cie, const CfiState &initial)
+                : cie_(cie), initial_(initial), state_(initial), stack_size_(0)
+            {
+            }
+
+            const CfiState &state() const { return state_; }
+
+            // Runs the instructions in [|begin|, |end|) starting at |*location|.
+            // The |emit| is called with the location and the state before the
+            // location advances. Returns false if the instructions are malformed.
+            template <typename Emit>
+            bool Run(const uint8_t *begin, const uint8_t *end, uword *location, Emit emit)
+            {
+                CfiReader reader{begin, end, true};
+                while (reader.ok && reader.position < end)
+                {
+                    uint8_t opcode = reader.Read<uint8_t>();
+                    uint8_t operand = opcode & 0x3f;
+                    switch (opcode & 0xc0)
+                    {
+                    case 0x40: // DW_CFA_advance_loc
+                        Advance(location, operand * cie_.code_alignment, emit);
+                        continue;
+                    case 0x80: // DW_CFA_offset
+                        SetOffset(operand, static_cast<int64_t>(reader.ReadUleb128()) * cie_.data_alignment);
+                        continue;
+                    case 0xc0: // DW_CFA_restore
+                        Restore(operand);
+                        continue;
+                    default:
+                        break;
+                    }
+
+                    switch (opcode)
+                    {
+                    case 0x00: // DW_CFA_nop
+                        break;
+                    case 0x01: // DW_CFA_set_loc
+                    {
+                        uword target = reader.ReadPointer(cie_.fde_encoding, 0);
+                        if (target < *location)
+                        {
+                            return false;
+                        }
+                        Advance(location, target - *location, emit);
+                        break;
+                    }
+                    case 0x02: // DW_CFA_advance_loc1
+                        Advance(location, reader.Read<uint8_t>() * cie_.code_alignment, emit);
+                        break;
+                    case 0x03: // DW_CFA_advance_loc2
+                        Advance(location, reader.Read<uint16_t>() * cie_.code_alignment, emit);
+                        break;
+                    case 0x04: // DW_CFA_advance_loc4
+                        Advance(location, reader.Read<uint32_t>() * cie_.code_alignment, emit);
+                        break;
+                    case 0x05: // DW_CFA_offset_extended
+                    {
+                        uint64_t reg = reader.ReadUleb128();
+                        SetOffset(reg, static_cast<int64_t>(reader.ReadUleb128()) * cie_.data_alignment);
+                        break;
+                    }
+                    case 0x06: // DW_CFA_restore_extended
+                        Restore(reader.ReadUleb128());
+                        break;
+                    case 0x07: // DW_CFA_undefined
+                    case 0x09: // DW_CFA_register
+                    {
+                        uint64_t reg = reader.ReadUleb128();
+                        if (opcode == 0x09)
+                        {
+                            reader.ReadUleb128();
+                        }
+                        SetRule(reg, {CfiRule::kUnsupported, 0});
+                        break;
+                    }
+                    case 0x08: // DW_CFA_same_value
+                        SetRule(reader.ReadUleb128(), {CfiRule::kSameValue, 0});
+                        break;
+                    case 0x0a: // DW_CFA_remember_state
+                        // The whole row is remembered, including the CFA.
+                        if (stack_size_ == kMaxRememberedStates)
+                        {
+                            return false;
+                        }
+                        stack_[stack_size_++] = state_;
+                        break;
+                    case 0x0b: // DW_CFA_restore_state
+                    {
+                        if (stack_size_ == 0)
+                        {
+                            return false;
+                        }
+                        state_ = stack_[--stack_size_];
+                        break;
+                    }
+                    case 0x0c: // DW_CFA_def_cfa
+                        state_.cfa_register = reader.ReadUleb128();
+                        state_.cfa_offset = static_cast<int64_t>(reader.ReadUleb128());
+                        state_.is_cfa_supported = true;
+                        break;
+                    case 0x0d: // DW_CFA_def_cfa_register
+                        state_.cfa_register = reader.ReadUleb128();
+                        break;
+                    case 0x0e: // DW_CFA_def_cfa_offset
+                        state_.cfa_offset = static_cast<int64_t>(reader.ReadUleb128());
+                        break;
+                    case 0x0f: // DW_CFA_def_cfa_expression
+                        reader.position += std::min<uint64_t>(reader.ReadUleb128(), end - reader.position);
+                        state_.is_cfa_supported = false;
+                        break;
+                    case 0x10: // DW_CFA_expression
+                    case 0x16: // DW_CFA_val_expression
+                    {
+                        uint64_t reg = reader.ReadUleb128();
+                        reader.position += std::min<uint64_t>(reader.ReadUleb128(), end - reader.position);
+                        SetRule(reg, {CfiRule::kUnsupported, 0});
+                        break;
+                    }
+                    case 0x11: // DW_CFA_offset_extended_sf
+                    {
+                        uint64_t reg = reader.ReadUleb128();
+                        SetOffset(reg, reader.ReadSleb128() * cie_.data_alignment);
+                        break;
+                    }
+                    case 0x12: // DW_CFA_def_cfa_sf
+                        state_.cfa_register = reader.ReadUleb128();
+                        state_.cfa_offset = reader.ReadSleb128() * cie_.data_alignment;
+                        state_.is_cfa_supported = true;
+                        break;
+                    case 0x13: // DW_CFA_def_cfa_offset_sf
+                        state_.cfa_offset = reader.ReadSleb128() * cie_.data_alignment;
+                        break;
+                    case 0x14: // DW_CFA_val_offset
+                    case 0x15: // DW_CFA_val_offset_sf
+                    {
+                        uint64_t reg = reader.ReadUleb128();
+                        if (opcode == 0x14)
+                        {
+                            reader.ReadUleb128();
+                        }
+                        else
+                        {
+                            reader.ReadSleb128();
+                        }
+                        SetRule(reg, {CfiRule::kUnsupported, 0});
+                        break;
+                    }
+                    case 0x2d: // DW_CFA_AARCH64_negate_ra_state
+                        // The signed return addresses are stripped by the walker.
+                        break;
+                    case 0x2e: // DW_CFA_GNU_args_size
+                        reader.ReadUleb128();
+                        break;
+                    case 0x2f: // DW_CFA_GNU_negative_offset_extended
+                    {
+                        uint64_t reg = reader.ReadUleb128();
+                        SetOffset(reg, -static_cast<int64_t>(reader.ReadUleb128()) * cie_.data_alignment);
+                        break;
+                    }
+                    default:
+                        return false;
+                    }
+                }
+                return reader.ok;
+            }
+
+        private:
+            static constexpr size_t kMaxRememberedStates = 8;
+
+            template <typename Emit>
+            void Advance(uword *location, uint64_t delta, Emit &emit)
+            {
+                if (delta == 0)
+                {
+                    return;
+                }
+                emit(*location, state_);
+                *location += delta;
+            }
+
+            void SetRule(uint64_t reg, CfiRule rule)
+            {
+                if (reg == cie_.ra_register)
+                {
+                    state_.ra = rule;
+                }
+                else if (reg == kCfiFramePointer)
+                {
+                    state_.fp = rule;
+                }
+            }
+
+            void SetOffset(uint64_t reg, int64_t offset)
+            {
+                SetRule(reg, {CfiRule::kOffset, offset});
+            }
+
+            void Restore(uint64_t reg)
+            {
+                if (reg == cie_.ra_register)
+                {
+                    state_.ra = initial_.ra;
+                }
+                else if (reg == kCfiFramePointer)
+                {
+                    state_.fp = initial_.fp;
+                }
+            }
+
+            const Cie &cie_;
+            const CfiState &initial_;
+            CfiState state_;
+            CfiState stack_[kMaxRememberedStates];
+            size_t stack_size_;
+        };
+
+        bool FitsInt16(int64_t value)
+        {
+            return value > INT16_MIN && value <= INT16_MAX;
+        }
+
+        UnwindRow ToUnwindRow(uint32_t pc_offset, const CfiState &state)
+        {
+            UnwindRow row{pc_offset, UnwindRow::kNone, 0, 0};
+
+            UnwindRow::CfaRegister cfa_register;
+            if (!state.is_cfa_supported)
+            {
+                return row;
+            }
+            else if (state.cfa_register == kCfiStackPointer)
+            {
+                cfa_register = UnwindRow::kStackPointer;
+            }
+            else if (state.cfa_register == kCfiFramePointer)
+            {
+                cfa_register = UnwindRow::kFramePointer;
+            }
+            else
+            {
+                return row;
+            }
+            if (state.cfa_offset < 0 || state.cfa_offset >= (1 << 29))
+            {
+                return row;
+            }
+
+            int16_t ra_offset;
+            if (state.ra.kind == CfiRule::kOffset && FitsInt16(state.ra.offset))
+            {
+                ra_offset = static_cast<int16_t>(state.ra.offset);
+            }
+#if defined(HOST_ARCH_ARM64)
+            else if (state.ra.kind == CfiRule::kSameValue)
+            {
+                // Not saved yet, e.g., in a leaf function or the prologue.
+                ra_offset = UnwindRow::kInRegister;
+            }
+#endif
+            else
+            {
+                return row;
+            }
+
+            int16_t fp_offset;
+            if (state.fp.kind == CfiRule::kOffset && FitsInt16(state.fp.offset))
+            {
+                fp_offset = static_cast<int16_t>(state.fp.offset);
+            }
+            else if (state.fp.kind == CfiRule::kSameValue)
+            {
+                fp_offset = UnwindRow::kInRegister;
+            }
+            else
+            {
+                return row;
+            }
+
+            row.cfa = static_cast<int32_t>(state.cfa_offset << 2) | cfa_register;
+            row.ra_offset = ra_offset;
+            row.fp_offset = fp_offset;
+            return row;
+        }
+
+        bool IsSameRule(const UnwindRow &a, const UnwindRow &b)
+        {
+            return a.cfa == b.cfa && a.ra_offset == b.ra_offset && a.fp_offset == b.fp_offset;
+        }
+
+        // Appends |row| keeping the rows sorted by the pcs, a row at the same pc
+        // as the last one replaces it, and a row of the same rule as the last one
+        // is merged into it.
+        void AppendUnwindRow(const UnwindRow &row, std::vector<UnwindRow> *rows)
+        {
+            if (!rows->empty())
+            {
+                UnwindRow &last = rows->back();
+                if (row.pc_offset < last.pc_offset)
+                {
+                    // Overlaps the previous function.
+                    return;
+                }
+                if (row.pc_offset == last.pc_offset)
+                {
+                    last = row;
+                    if (rows->size() >= 2 && IsSameRule((*rows)[rows->size() - 2], last))
+                    {
+                        rows->pop_back();
+                    }
+                    return;
+                }
+                if (IsSameRule(last, row))
+                {
+                    return;
+                }
+            }
+            else if (row.cfa_register() == UnwindRow::kNone)
+            {
+                return;
+            }
+            rows->push_back(row);
+        }
+    } // namespace
+
+    bool BuildUnwindRows(const uint8_t *eh_frame_hdr, uword base_address, std::vector<UnwindRow> *rows)
+    {
+        if (!kCfiIsSupported)
+        {
+            return false;
+        }
+
+        // The header is followed by the binary search table of the FDEs sorted
+        // by their start pcs, which is what is used to find the FDEs.
+        uword hdr_address = reinterpret_cast<uword>(eh_frame_hdr);
+        CfiReader reader{eh_frame_hdr, eh_frame_hdr + 4 + 2 * sizeof(uint64_t), true};
+        uint8_t version = reader.Read<uint8_t>();
+        uint8_t eh_frame_ptr_encoding = reader.Read<uint8_t>();
+        uint8_t fde_count_encoding = reader.Read<uint8_t>();
+        uint8_t table_encoding = reader.Read<uint8_t>();
+        if (!reader.ok || version != 1 || table_encoding != (kPeDatarel | kPeSdata4))
+        {
+            return false;
+        }
+        reader.ReadPointer(eh_frame_ptr_encoding, hdr_address);
+        uword fde_count = reader.ReadPointer(fde_count_encoding, hdr_address);
+        if (!reader.ok)
+        {
+            return false;
+        }
+
+        const int32_t *table = reinterpret_cast<const int32_t *>(reader.position);
+        std::unordered_map<const uint8_t *, Cie> cies;
+        std::unordered_map<const uint8_t *, CfiState> initial_states;
+        for (uword i = 0; i < fde_count; ++i)
+        {
+            int32_t fde_relative;
+            memcpy(&fde_relative, &table[i * 2 + 1], sizeof(fde_relative));
+            const uint8_t *fde = eh_frame_hdr + fde_relative;
+
+            CfiReader fde_reader{fde, fde + 12, true};
+            uint64_t length = fde_reader.Read<uint32_t>();
+            bool is_64_bit = length == 0xffffffff;
+            if (is_64_bit)
+            {
+                length = fde_reader.Read<uint64_t>();
+            }
+            if (!fde_reader.ok || length == 0)
+            {
+                continue;
+            }
+            fde_reader.end = fde_reader.position + length;
+
+            const uint8_t *cie_pointer_field = fde_reader.position;
+            uint64_t cie_pointer = is_64_bit ? fde_reader.Read<uint64_t>() : fde_reader.Read<uint32_t>();
+            const uint8_t *cie_address = cie_pointer_field - cie_pointer;
+
+            auto it = cies.find(cie_address);
+            if (it == cies.end())
+            {
+                Cie cie;
+                if (!ParseCie(cie_address, &cie))
+                {
+                    // Remember the failure, with no instructions.
+                    cie.instructions = nullptr;
+                }
+                it = cies.emplace(cie_address, cie).first;
+            }
+            const Cie &cie = it->second;
+            if (cie.instructions == nullptr)
+            {
+                continue;
+            }
+
+            uword pc_begin = fde_reader.ReadPointer(cie.fde_encoding, hdr_address);
+            uword pc_range = fde_reader.ReadPointer(cie.fde_encoding & 0x0f, hdr_address);
+            if (cie.has_augmentation_data)
+            {
+                uint64_t data_size = fde_reader.ReadUleb128();
+                if (fde_reader.Has(data_size))
+                {
+                    fde_reader.position += data_size;
+                }
+            }
+            if (!fde_reader.ok || pc_begin < base_address || pc_begin + pc_range - base_address > UINT32_MAX)
+            {
+                continue;
+            }
+
+            auto state_it = initial_states.find(cie_address);
+            if (state_it == initial_states.end())
+            {
+                CfiState initial{0, 0, false, {CfiRule::kSameValue, 0}, {CfiRule::kSameValue, 0}};
+                CfiInterpreter cie_interpreter(cie, initial);
+                uword location = 0;
+                if (!cie_interpreter.Run(cie.instructions, cie.end, &location, [](uword, const CfiState &) {}))
+                {
+                    continue;
+                }
+                state_it = initial_states.emplace(cie_address, cie_interpreter.state()).first;
+            }
+
+            uword pc_end = pc_begin + pc_range;
+            auto emit = [&](uword location, const CfiState &state)
+            {
+                if (location < pc_end)
+                {
+                    AppendUnwindRow(ToUnwindRow(static_cast<uint32_t>(location - base_address), state), rows);
+                }
+            };
+            CfiInterpreter interpreter(cie, state_it->second);
+            uword location = pc_begin;
+            if (!interpreter.Run(fde_reader.position, fde_reader.end, &location, emit))
+            {
+                // Drop the rows after the malformed instruction.
+                AppendUnwindRow({static_cast<uint32_t>(location - base_address), UnwindRow::kNone, 0, 0}, rows);
+                continue;
+            }
+            emit(location, interpreter.state());
+            AppendUnwindRow({static_cast<uint32_t>(pc_end - base_address), UnwindRow::kNone, 0, 0}, rows);
+        }
+
+        rows->shrink_to_fit();
+        return true;
+    }
+
+    UnwindTables &UnwindTables::Instance()
+    {
+        static UnwindTables instance;
+        return instance;
+    }
+
+    UnwindTables::UnwindTables()
+        : is_built_(false),
+          generation_(0),
+          current_(nullptr)
+    {
+    }
+
+    void UnwindTables::UpdateIfNeeded()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t generation = ModuleMap::LoadedModulesGeneration();
+        if (is_built_ && generation == generation_)
+        {
+            return;
+        }
+        is_built_ = true;
+        generation_ = generation;
+
+        std::vector<Section> sections;
+        EnumerateSections(&sections);
+
+        std::unique_ptr<Snapshot> snapshot(new Snapshot());
+        for (const Section &section : sections)
+        {
+            std::unique_ptr<Table> &table = tables_[section.start_address];
+            if (table == nullptr || table->base_address != section.base_address ||
+                table->end_address != section.end_address)
+            {
+                // A new module, or another one loaded at the same address, the
+                // old table is leaked on purpose, see |tables_|.
+                std::unique_ptr<Table> built(new Table{section.base_address,
+                                                       section.start_address,
+                                                       section.end_address,
+                                                       {}});
+                if (!BuildUnwindRows(section.eh_frame_hdr, section.base_address, &built->rows))
+                {
+                    built->rows.clear();
+                }
+                table.release();
+                table = std::move(built);
+            }
+            if (!table->rows.empty())
+            {
+                snapshot->tables.push_back(table.get());
+            }
+        }
+        std::sort(snapshot->tables.begin(), snapshot->tables.end(),
+                  [](const Table *a, const Table *b)
+                  { return a->start_address < b->start_address; });
+
+        current_.store(snapshot.get(), std::memory_order_release);
+        snapshots_.push_back(std::move(snapshot));
+    }
+
+    bool UnwindTables::Find(uword pc, UnwindRow *out) const
+    {
+        const Snapshot *snapshot = current_.load(std::memory_order_acquire);
+        if (snapshot == nullptr)
+        {
+            return false;
+        }
+
+        const std::vector<const Table *> &tables = snapshot->tables;
+        auto table_it = std::upper_bound(tables.begin(), tables.end(), pc,
+                                         [](uword pc, const Table *table)
+                                         { return pc < table->start_address; });
+        if (table_it == tables.begin())
+        {
+            return false;
+        }
+        const Table &table = **(table_it - 1);
+        if (pc >= table.end_address || pc < table.base_address)
+        {
+            return false;
+        }
+
+        uword pc_offset = pc - table.base_address;
+        auto row_it = std::upper_bound(table.rows.begin(), table.rows.end(), pc_offset,
+                                       [](uword pc_offset, const UnwindRow &row)
+                                       { return pc_offset < row.pc_offset; });
+        if (row_it == table.rows.begin() || (row_it - 1)->cfa_register() == UnwindRow::kNone)
+        {
+            return false;
+        }
+        *out = *(row_it - 1);
+        return true;
+    }
+
+    size_t UnwindTables::MemorySize()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t size = 0;
+        for (const auto &entry : tables_)
+        {
+            size += entry.second->rows.capacity() * sizeof(UnwindRow);
+        }
+        return size;
+    }
+} // namespace glance
+
+extern "C" void SetUnwindTablesEnabled(int enabled)
+{
+    if (enabled != 0)
+    {
+        // Built before the walkers can look them up.
+        glance::UnwindTables::Instance().UpdateIfNeeded();
+    }
+    glance::g_use_unwind_tables_.store(enabled != 0, std::memory_order_release);
+}
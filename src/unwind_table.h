@@ -0,0 +1,139 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef UNWIND_TABLE_H_
+#define UNWIND_TABLE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "collect_stack.h"
+
+namespace glance
+{
+    /// Whether `StackWalker` falls back to the `UnwindTables` for the frames
+    /// without frame pointers, see `SetUnwindTablesEnabled`.
+    extern std::atomic<bool> g_use_unwind_tables_;
+
+    /// How to find the caller of the frames of a range of pcs, which is the DWARF
+    /// CFI of `.eh_frame` evaluated ahead of time, so stepping a frame is a lookup
+    /// and a few loads instead of interpreting the CFI on every sample.
+    ///
+    /// Only the rules the compilers emit for the ordinary functions are kept:
+    /// the CFA (the stack pointer of the caller) is an offset from the stack
+    /// pointer or the frame pointer, and the return address and the frame pointer
+    /// of the caller are saved at offsets from the CFA, or still in the registers.
+    /// The pcs with any other rule have no row, the walk stops there.
+    struct UnwindRow
+    {
+        enum CfaRegister : uint32_t
+        {
+            // The pcs have no supported unwind info.
+            kNone = 0,
+            kStackPointer = 1,
+            kFramePointer = 2,
+        };
+
+        // |ra_offset| of the return address in the link register, or |fp_offset|
+        // of the frame pointer of the caller still in the frame pointer.
+        static constexpr int16_t kInRegister = INT16_MIN;
+
+        // The offset from the module base of the first pc of the row, the row
+        // covers the pcs up to the next row.
+        uint32_t pc_offset;
+        // The CFA offset shifted left by 2, with the `CfaRegister` in the low
+        // bits, which keeps a row in 12 bytes.
+        int32_t cfa;
+        int16_t ra_offset;
+        int16_t fp_offset;
+
+        CfaRegister cfa_register() const { return static_cast<CfaRegister>(cfa & 3); }
+
+        int32_t cfa_offset() const { return cfa >> 2; }
+    };
+
+    /// Evaluates the CFI of the module loaded at |base_address|, whose
+    /// `.eh_frame_hdr` is at |eh_frame_hdr|, into |rows| sorted by the pcs.
+    /// Returns false if the section or the architecture is not supported.
+    bool BuildUnwindRows(const uint8_t *eh_frame_hdr, uword base_address, std::vector<UnwindRow> *rows);
+
+    /// The `UnwindRow`s of the loaded modules, which are built once per module
+    /// when it's loaded, and looked up by `StackWalker` for the pcs of the frames
+    /// that don't keep the frame pointer chain (e.g., `libflutter.so` and `libc`
+    /// built with `-fomit-frame-pointer`).
+    ///
+    /// A table takes about 12 bytes per unwind rule change, i.e., a few per
+    /// function, so it's only built if enabled, see `SetUnwindTablesEnabled`.
+    class UnwindTables
+    {
+    public:
+        /// A loaded module with the `.eh_frame_hdr` section, see `EnumerateSections`.
+        struct Section
+        {
+            uword base_address;
+            uword start_address;
+            uword end_address;
+            const uint8_t *eh_frame_hdr;
+        };
+
+        static UnwindTables &Instance();
+
+        /// Builds the tables of the modules loaded since the last call.
+        void UpdateIfNeeded();
+
+        /// Finds the row covering |pc| to |out|. Returns false if there is no
+        /// table of the module or the pc has no supported unwind info.
+        ///
+        /// Async-signal-safe.
+        bool Find(uword pc, UnwindRow *out) const;
+
+        /// The memory taken by the tables in bytes.
+        size_t MemorySize();
+
+    private:
+        struct Table
+        {
+            uword base_address;
+            uword start_address;
+            uword end_address;
+            std::vector<UnwindRow> rows;
+        };
+
+        // The tables of the modules sorted by the start addresses.
+        struct Snapshot
+        {
+            std::vector<const Table *> tables;
+        };
+
+        UnwindTables();
+
+        /// Platform specific, see `collect_stack_android.cc` and `collect_stack_ios.cc`.
+        static void EnumerateSections(std::vector<Section> *sections);
+
+        std::mutex mutex_;
+
+        bool is_built_;
+
+        uint64_t generation_;
+
+        // The tables by the start addresses of the modules. A table is never
+        // freed, a walker may still be reading it when the module is unloaded.
+        std::unordered_map<uword, std::unique_ptr<Table>> tables_;
+
+        // The same as |tables_|, all the published snapshots are kept.
+        std::vector<std::unique_ptr<Snapshot>> snapshots_;
+
+        std::atomic<const Snapshot *> current_;
+    };
+} // namespace glance
+
+// Enables falling back to the unwind tables built from `.eh_frame` when walking
+// the frames without frame pointers, the tables of the loaded modules are built
+// before it returns. 0 disables it, the tables are kept.
+extern "C" void SetUnwindTablesEnabled(int enabled);
+
+#endif // UNWIND_TABLE_H_
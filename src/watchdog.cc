@@ -0,0 +1,262 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#include "watchdog.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "sampler.h"
+#include "thread_registry.h"
+
+namespace glance
+{
+    std::atomic<uint64_t> g_ui_heartbeat_(0);
+
+    namespace
+    {
+        std::mutex g_watchdog_mutex;
+
+        Watchdog *g_watchdog = nullptr;
+
+        std::atomic<WatchdogCallback> g_watchdog_callback(nullptr);
+
+        // Moves the heartbeat forward to the next odd (|busy|) or even value, so a
+        // missed mark doesn't flip the meaning of the following ones.
+        void BumpUiHeartbeat(bool busy)
+        {
+            // Only the UI thread writes it.
+            uint64_t heartbeat = g_ui_heartbeat_.load(std::memory_order_relaxed) + 2;
+            g_ui_heartbeat_.store(busy ? heartbeat | 1 : heartbeat & ~uint64_t{1},
+                                  std::memory_order_relaxed);
+        }
+    } // namespace
+
+    Watchdog::Watchdog(int64_t timeout_in_micros)
+        : timeout_in_micros_(timeout_in_micros),
+          poll_interval_in_micros_(std::max<int64_t>(
+              std::min(timeout_in_micros / 4, kMaxPollIntervalInMicros), 1)),
+          last_heartbeat_(0),
+          last_progress_micros_(0),
+          next_report_in_micros_(timeout_in_micros),
+          report_index_(0),
+          report_(),
+          pending_begin_(0),
+          pending_count_(0),
+          running_(false),
+          thread_()
+    {
+    }
+
+    Watchdog::~Watchdog()
+    {
+        Stop();
+    }
+
+    bool Watchdog::Start()
+    {
+        if (running_.load())
+        {
+            return true;
+        }
+
+        last_heartbeat_ = g_ui_heartbeat_.load(std::memory_order_relaxed);
+        last_progress_micros_ = GetCurrentMonotonicMicros();
+        running_.store(true);
+        if (pthread_create(&thread_, nullptr, &Watchdog::ThreadMain, this) != 0)
+        {
+            running_.store(false);
+            return false;
+        }
+
+        return true;
+    }
+
+    void Watchdog::Stop()
+    {
+        if (!running_.exchange(false))
+        {
+            return;
+        }
+
+        pthread_join(thread_, nullptr);
+    }
+
+    bool Watchdog::TakeReport(NativeWatchdogReport *out)
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        if (pending_count_ == 0)
+        {
+            return false;
+        }
+
+        *out = pending_reports_[pending_begin_];
+        pending_begin_ = (pending_begin_ + 1) % kMaxPendingReports;
+        --pending_count_;
+        return true;
+    }
+
+    void *Watchdog::ThreadMain(void *arg)
+    {
+        SetCurrentThreadName("glance.watchdog");
+        reinterpret_cast<Watchdog *>(arg)->Run();
+        return nullptr;
+    }
+
+    void Watchdog::Run()
+    {
+        int64_t deadline = GetCurrentMonotonicMicros() + poll_interval_in_micros_;
+        while (running_.load(std::memory_order_relaxed))
+        {
+            SleepUntil(deadline);
+            if (!running_.load(std::memory_order_relaxed))
+            {
+                break;
+            }
+
+            int64_t now = GetCurrentMonotonicMicros();
+            Check(now);
+            deadline += poll_interval_in_micros_;
+            if (deadline < now)
+            {
+                deadline = now + poll_interval_in_micros_;
+            }
+        }
+    }
+
+    void Watchdog::Check(int64_t now)
+    {
+        uint64_t heartbeat = g_ui_heartbeat_.load(std::memory_order_relaxed);
+        if (heartbeat != last_heartbeat_)
+        {
+            // The progress is seen up to a poll interval late, which only delays
+            // the report by as much.
+            last_heartbeat_ = heartbeat;
+            last_progress_micros_ = now;
+            next_report_in_micros_ = timeout_in_micros_;
+            report_index_ = 0;
+            return;
+        }
+
+        int64_t frozen_in_micros = now - last_progress_micros_;
+        if ((heartbeat & 1) == 0 || frozen_in_micros < next_report_in_micros_)
+        {
+            return;
+        }
+
+        Report(heartbeat, frozen_in_micros);
+        // Backs off, a hard freeze is reported a few times rather than on every
+        // poll.
+        next_report_in_micros_ *= 2;
+        ++report_index_;
+    }
+
+    void Watchdog::Report(uint64_t heartbeat, int64_t frozen_in_micros)
+    {
+        report_.freeze_id = static_cast<int64_t>(heartbeat >> 1);
+        report_.frozen_in_micros = frozen_in_micros;
+        report_.report_index = report_index_;
+
+        NativeSample &sample = report_.sample;
+        sample.timestamp = GetCurrentMonotonicMicros();
+        sample.kind = GLANCE_SAMPLE_KIND_WALL;
+        sample.syscall = GLANCE_NO_SYSCALL;
+        sample.run_state = 0;
+        sample.voluntary_switches = 0;
+        sample.involuntary_switches = 0;
+        SetFramePhaseOf(GLANCE_FRAME_PHASE_IDLE, &sample);
+        char *error = CollectStackTraceOfTargetThread(sample.pcs, GLANCE_MAX_STACK_DEPTH);
+        if (error == nullptr)
+        {
+            size_t depth = 0;
+            while (depth < GLANCE_MAX_STACK_DEPTH && sample.pcs[depth] != 0)
+            {
+                ++depth;
+            }
+            report_.error = 0;
+            sample.depth = static_cast<int32_t>(depth);
+            sample.syscall = g_last_target_syscall_;
+            SetFramePhaseOf(g_last_target_frame_phase_, &sample);
+        }
+        else
+        {
+            // Still reported, the freeze is worth knowing without the stack.
+            free(error);
+            report_.error = 1;
+            sample.depth = 0;
+            sample.pcs[0] = 0;
+        }
+
+        WatchdogCallback callback = g_watchdog_callback.load();
+        if (callback != nullptr)
+        {
+            callback(&report_);
+        }
+
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        if (pending_count_ == kMaxPendingReports)
+        {
+            pending_begin_ = (pending_begin_ + 1) % kMaxPendingReports;
+            --pending_count_;
+        }
+        pending_reports_[(pending_begin_ + pending_count_) % kMaxPendingReports] = report_;
+        ++pending_count_;
+    }
+} // namespace glance
+
+extern "C" char *StartWatchdog(int64_t timeout_in_micros)
+{
+    if (timeout_in_micros <= 0)
+    {
+        return strdup("invalid timeout");
+    }
+
+    if (!glance::ThreadRegistry::Instance().HasDefaultTarget())
+    {
+        return strdup("target thread is not set, call SetCurrentThreadAsTarget first");
+    }
+
+    std::lock_guard<std::mutex> lock(glance::g_watchdog_mutex);
+    if (glance::g_watchdog != nullptr)
+    {
+        return strdup("watchdog is already started");
+    }
+
+    glance::Watchdog *watchdog = new glance::Watchdog(timeout_in_micros);
+    if (!watchdog->Start())
+    {
+        delete watchdog;
+        return strdup("failed to create the watchdog thread");
+    }
+
+    glance::g_watchdog = watchdog;
+    return nullptr; // Success.
+}
+
+extern "C" void StopWatchdog()
+{
+    std::lock_guard<std::mutex> lock(glance::g_watchdog_mutex);
+    delete glance::g_watchdog;
+    glance::g_watchdog = nullptr;
+}
+
+extern "C" void SetWatchdogCallback(WatchdogCallback callback)
+{
+    glance::g_watchdog_callback.store(callback);
+}
+
+extern "C" int32_t TakeWatchdogReport(NativeWatchdogReport *out)
+{
+    std::lock_guard<std::mutex> lock(glance::g_watchdog_mutex);
+    return glance::g_watchdog != nullptr && glance::g_watchdog->TakeReport(out) ? 1 : 0;
+}
+
+extern "C" void MarkUiTaskBegin()
+{
+    glance::BumpUiHeartbeat(true);
+}
+
+extern "C" void MarkUiTaskEnd()
+{
+    glance::BumpUiHeartbeat(false);
+}
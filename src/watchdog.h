@@ -0,0 +1,152 @@
+// Copyright (c) 2024 Littlegnal. Licensed under the MIT License. See the LICENSE file for details.
+
+#ifndef WATCHDOG_H_
+#define WATCHDOG_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <pthread.h>
+
+#include "collect_stack.h"
+#include "sample_ring.h"
+
+/// A report of the UI thread stuck in a task, see `StartWatchdog`.
+///
+/// The reports of a freeze are taken once it has lasted the timeout, then twice
+/// the timeout, 4 times and so on until the task returns. They have the same
+/// |freeze_id| and are numbered by |report_index| from 0. |frozen_in_micros| is
+/// how long the task has been running when the |sample| is taken.
+///
+/// |error| is 0 if the stack trace is collected, otherwise the |sample| is empty.
+struct NativeWatchdogReport
+{
+    int64_t freeze_id;
+    int64_t frozen_in_micros;
+    int32_t error;
+    int32_t report_index;
+    NativeSample sample;
+};
+
+/// Called on the watchdog thread with each report, see `SetWatchdogCallback`.
+/// The |report| is only valid during the call.
+typedef void (*WatchdogCallback)(const NativeWatchdogReport *report);
+
+namespace glance
+{
+    /// The heartbeat of the UI thread, moved forward by `MarkUiTaskBegin` and
+    /// `MarkUiTaskEnd`, so it's odd while the UI thread is in a task, and
+    /// changes with every task. It's a single word, so the UI thread updates it
+    /// with a plain store.
+    extern std::atomic<uint64_t> g_ui_heartbeat_;
+
+    /// Watches `g_ui_heartbeat_` on a dedicated native thread, so a UI thread
+    /// stuck in a task is reported while it's still stuck, without anything
+    /// running on the UI thread or its isolate.
+    ///
+    /// The heartbeat is checked every quarter of the timeout (at most every
+    /// `kMaxPollIntervalInMicros`). The UI thread is frozen once the heartbeat
+    /// is odd and hasn't changed for the timeout, then the stack of the default
+    /// target thread is collected the same way as the samples of the
+    /// `NativeSampler`, and the report is passed to the `WatchdogCallback` and
+    /// kept for `TakeReport`. The UI thread waiting for its next task (an even
+    /// heartbeat) is never frozen.
+    class Watchdog
+    {
+    public:
+        static constexpr int64_t kMaxPollIntervalInMicros = 50000;
+
+        /// The reports kept for `TakeReport`, the oldest one is dropped once
+        /// it's full.
+        static constexpr size_t kMaxPendingReports = 8;
+
+        explicit Watchdog(int64_t timeout_in_micros);
+
+        ~Watchdog();
+
+        /// Starts the watchdog thread. Returns false if the thread can't be created.
+        bool Start();
+
+        /// Stops and joins the watchdog thread.
+        void Stop();
+
+        /// Moves the oldest report not taken yet to |out|. Returns false if there
+        /// is none.
+        bool TakeReport(NativeWatchdogReport *out);
+
+    private:
+        static void *ThreadMain(void *arg);
+
+        void Run();
+
+        /// Checks the heartbeat at |now|, and reports the freeze if it's due.
+        void Check(int64_t now);
+
+        void Report(uint64_t heartbeat, int64_t frozen_in_micros);
+
+        const int64_t timeout_in_micros_;
+
+        const int64_t poll_interval_in_micros_;
+
+        // Only used by the watchdog thread once it's started.
+        uint64_t last_heartbeat_;
+
+        int64_t last_progress_micros_;
+
+        // How long the freeze lasts when it's reported next.
+        int64_t next_report_in_micros_;
+
+        int32_t report_index_;
+
+        NativeWatchdogReport report_;
+
+        // Guards the |pending_reports_|.
+        std::mutex pending_mutex_;
+
+        NativeWatchdogReport pending_reports_[kMaxPendingReports];
+
+        size_t pending_begin_;
+
+        size_t pending_count_;
+
+        std::atomic<bool> running_;
+
+        pthread_t thread_;
+    };
+} // namespace glance
+
+// Starts watching the UI thread (the default target thread) on a native thread,
+// which reports a task that runs longer than |timeout_in_micros| while it's
+// still running, see `glance::Watchdog`. The tasks are marked by
+// `MarkUiTaskBegin` and `MarkUiTaskEnd`.
+//
+// On success returns nullptr otherwise returns a string containing the error.
+//
+// Returned string must be freed by the caller.
+extern "C" char *StartWatchdog(int64_t timeout_in_micros);
+
+// Stops the watchdog started by `StartWatchdog`, the reports not taken yet are
+// dropped.
+extern "C" void StopWatchdog();
+
+// Sets the |callback| called on the watchdog thread with each report, e.g., to
+// hand the report to a crash reporter of the app. nullptr removes it.
+//
+// Can be called before or after `StartWatchdog`.
+extern "C" void SetWatchdogCallback(WatchdogCallback callback);
+
+// Moves the oldest report of the watchdog not taken yet to |out|. Returns 1 if
+// a report is moved, otherwise 0.
+extern "C" int32_t TakeWatchdogReport(NativeWatchdogReport *out);
+
+// Marks the beginning of a task on the UI thread (e.g., a frame, or a handler
+// of an event), the watchdog reports it once it runs past the timeout. The
+// tasks must not be nested.
+//
+// Only stores an atomic, cheap enough to be called on the UI thread per task.
+extern "C" void MarkUiTaskBegin();
+
+// Marks the end of the task marked by `MarkUiTaskBegin`.
+extern "C" void MarkUiTaskEnd();
+
+#endif // WATCHDOG_H_
@@ -0,0 +1,104 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:glance/src/calling_context_tree.dart';
+import 'package:glance/src/collect_stack.dart';
+
+final _module = NativeModule(
+  id: 0,
+  path: 'libapp.so',
+  baseAddress: 0x1000,
+  symbolName: '',
+);
+
+/// A stack of the [pcs] in order of innermost to outermost, the `0` pcs have no
+/// module.
+NativeStack _stack(List<int> pcs) {
+  return NativeStack(
+    frames: [
+      for (final pc in pcs)
+        NativeFrame(pc: pc, timestamp: 0, module: pc == 0 ? null : _module),
+    ],
+    modules: [_module],
+  );
+}
+
+List<int> _pcs(List<CallingContextNode> path) {
+  return [for (final node in path) node.frame!.pc];
+}
+
+void main() {
+  group('CallingContextTree', () {
+    test('add counts the self and total counts', () {
+      final tree = CallingContextTree()
+        ..add(_stack([0x3, 0x2, 0x1]))
+        ..add(_stack([0x3, 0x2, 0x1]))
+        ..add(_stack([0x2, 0x1]))
+        ..add(_stack([0x4, 0x1]));
+      expect(tree.sampleCount, 4);
+
+      final main = tree.root.children.single;
+      expect(main.frame!.pc, 0x1);
+      expect(main.totalCount, 4);
+      expect(main.selfCount, 0);
+
+      final children = main.children.toList();
+      expect(children.length, 2);
+      expect(children[0].frame!.pc, 0x2);
+      expect(children[0].totalCount, 3);
+      expect(children[0].selfCount, 1);
+      expect(children[1].frame!.pc, 0x4);
+      expect(children[1].totalCount, 1);
+      expect(children[1].selfCount, 1);
+
+      final leaf = children[0].children.single;
+      expect(leaf.frame!.pc, 0x3);
+      expect(leaf.totalCount, 2);
+      expect(leaf.selfCount, 2);
+      expect(_pcs(leaf.path), [0x3, 0x2, 0x1]);
+    });
+
+    test('add keeps the different call paths of a function apart', () {
+      final tree = CallingContextTree()
+        ..add(_stack([0x9, 0x2, 0x1]))
+        ..add(_stack([0x9, 0x3, 0x1]));
+
+      final nodes = tree.heaviestNodes(10);
+      expect(nodes.length, 2);
+      expect(nodes.map((node) => _pcs(node.path)), [
+        [0x9, 0x2, 0x1],
+        [0x9, 0x3, 0x1],
+      ]);
+      expect(nodes.every((node) => node.selfCount == 1), isTrue);
+    });
+
+    test('add counts the frames without a module to their caller', () {
+      final tree = CallingContextTree()
+        ..add(_stack([0, 0, 0x2, 0x1]))
+        ..add(_stack([0, 0]));
+      // The stack without any kept frame is dropped.
+      expect(tree.sampleCount, 1);
+
+      final node = tree.heaviestNodes(10).single;
+      expect(_pcs(node.path), [0x2, 0x1]);
+      expect(node.selfCount, 1);
+    });
+
+    test('heaviestNodes returns the heaviest self counts first', () {
+      final tree = CallingContextTree();
+      for (int i = 0; i < 3; ++i) {
+        tree.add(_stack([0x2, 0x1]));
+      }
+      for (int i = 0; i < 5; ++i) {
+        tree.add(_stack([0x4, 0x3, 0x1]));
+      }
+      tree.add(_stack([0x1]));
+
+      final nodes = tree.heaviestNodes(10);
+      expect(nodes.map((node) => node.selfCount), [5, 3, 1]);
+      expect(_pcs(nodes[0].path), [0x4, 0x3, 0x1]);
+      expect(_pcs(nodes[1].path), [0x2, 0x1]);
+      expect(_pcs(nodes[2].path), [0x1]);
+
+      expect(tree.heaviestNodes(2).length, 2);
+    });
+  });
+}
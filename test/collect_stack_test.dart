@@ -3,6 +3,7 @@ import 'package:ffi/ffi.dart';
 
 import 'package:flutter_test/flutter_test.dart';
 import 'package:glance/src/collect_stack.dart';
+import 'package:glance/src/constants.dart';
 
 class FakeCollectStackNativeBindings implements CollectStackNativeBindings {
   FakeCollectStackNativeBindings(this.arena);
@@ -13,6 +14,50 @@ class FakeCollectStackNativeBindings implements CollectStackNativeBindings {
   bool isDladdr = false;
   bool isLookupSymbolName = false;
   bool isSetCurrentThreadAsTarget = false;
+  bool isStartNativeSampler = false;
+  bool isStopNativeSampler = false;
+  bool isResolveNativeFrames = false;
+  int refreshModuleMapCount = 0;
+  List<String> modulePathFilters = [];
+  int? collectStackTimeoutInMicros;
+  int? stackCopySizeInBytes;
+  int? unwindTablesEnabled;
+  int? nativeSamplerPerfEventsEnabled;
+  int? nativeSamplerCpuTimeSampleRate;
+  int? nativeSamplerSchedStateEnabled;
+  List<int>? nativeSamplerBurst;
+  int frameBeginCount = 0;
+  int frameEndCount = 0;
+  List<int>? framePhase;
+  int? watchdogTimeoutInMicros;
+  bool isStopWatchdog = false;
+  int watchdogReportCount = 1;
+  int uiTaskBeginCount = 0;
+  int uiTaskEndCount = 0;
+  int burstRequestCount = 0;
+  String? registeredThreadName;
+  bool isUnregisterTargetThread = false;
+  bool isJankReportWriterOpened = false;
+  ({
+    String buildId,
+    int isolateInstructions,
+    List<String> headerLines,
+    int timestamp,
+    List<({int pc, int occurTimes, int moduleId, int pathDepth})> frames,
+  })?
+  writtenJankReport;
+  List<int>? jankDeduperArgs;
+  bool isJankDeduperDestroyed = false;
+
+  /// The (count, repeats, firstSeen, lastSeen) of the fingerprints, the least
+  /// recently seen first. The fingerprint of a report is the sum of its pcs.
+  final jankFingerprints =
+      <int, ({int count, int repeats, int firstSeen, int lastSeen})>{};
+  ({String? path, int isolateInstructions, List<String> headerLines})?
+  persistentFile;
+  bool isPersistedSamplesFreed = false;
+  bool isDartImageLoaded = true;
+  List<int>? exportedProfileArgs;
 
   @override
   // ignore: non_constant_identifier_names
@@ -22,6 +67,7 @@ class FakeCollectStackNativeBindings implements CollectStackNativeBindings {
   ) {
     isCollectStackTraceOfTargetThread = true;
     buf[0] = 123;
+    buf[1] = 0;
     return ffi.nullptr; // success
   }
 
@@ -45,11 +91,601 @@ class FakeCollectStackNativeBindings implements CollectStackNativeBindings {
     return "hello".toNativeUtf8();
   }
 
+  @override
+  // ignore: non_constant_identifier_names
+  int GetDartImageInfo(ffi.Pointer<NativeDartImageInfoStruct> out) {
+    if (!isDartImageLoaded) {
+      return 0;
+    }
+    out.ref.isolateDsoBase = 0x1000;
+    out.ref.vmDsoBase = 0x1000;
+    out.ref.isolateInstructions = 0x2000;
+    out.ref.vmInstructions = 0x1800;
+    out.ref.buildId = 'abc'.toNativeUtf8(allocator: arena);
+    out.ref.path = 'libapp.so'.toNativeUtf8(allocator: arena);
+    return 1;
+  }
+
   @override
   // ignore: non_constant_identifier_names
   void SetCurrentThreadAsTarget() {
     isSetCurrentThreadAsTarget = true;
   }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int RegisterTargetThread(ffi.Pointer<Utf8> name) {
+    registeredThreadName = name.toDartString();
+    return 1;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void UnregisterTargetThread() {
+    isUnregisterTargetThread = true;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int GetTargetThreadName(int threadId, ffi.Pointer<Utf8> out, int size) {
+    final name = threadId == 0 ? 'ui' : 'raster';
+    final units = out.cast<ffi.Uint8>();
+    for (int i = 0; i < name.length; ++i) {
+      units[i] = name.codeUnitAt(i);
+    }
+    units[name.length] = 0;
+    return 1;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int CollectStackTracesOfAllThreads(
+    ffi.Pointer<NativeThreadSampleStruct> out,
+    int maxCount,
+  ) {
+    out[0].threadId = 0;
+    out[0].error = 0;
+    out[0].sample.timestamp = 100;
+    out[0].sample.depth = 1;
+    out[0].sample.syscall = 98;
+    out[0].sample.framePhase = FramePhase.build.index;
+    out[0].sample.frameNumber = 7;
+    out[0].sample.pcs[0] = 123;
+    out[0].sample.pcs[1] = 0;
+    out[1].threadId = 1;
+    out[1].error = 1;
+    out[1].sample.timestamp = 200;
+    out[1].sample.depth = 0;
+    out[1].sample.pcs[0] = 0;
+    return 2;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> StartNativeSampler(
+    int sampleRateInMicros,
+    int windowInMicros,
+    int memoryBudgetInBytes,
+  ) {
+    isStartNativeSampler = true;
+    return ffi.nullptr; // success
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void StopNativeSampler() {
+    isStopNativeSampler = true;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int GetNativeSamplerCapacity() {
+    return 10;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int ReadNativeSamples(
+    int start,
+    int end,
+    ffi.Pointer<NativeSampleStruct> out,
+    int maxCount,
+  ) {
+    out[0].timestamp = 100;
+    out[0].depth = 1;
+    out[0].kind = 0;
+    out[0].syscall = 63;
+    out[0].runState = 'S'.codeUnitAt(0);
+    out[0].voluntarySwitches = 2;
+    out[0].involuntarySwitches = 1;
+    out[0].framePhase = FramePhase.layout.index;
+    out[0].frameNumber = 3;
+    out[0].pcs[0] = 123;
+    out[0].pcs[1] = 0;
+    out[1].timestamp = 200;
+    out[1].depth = 1;
+    out[1].kind = kNativeSampleKindCpu;
+    out[1].syscall = kNoSyscall;
+    out[1].runState = 'R'.codeUnitAt(0);
+    out[1].voluntarySwitches = 0;
+    out[1].involuntarySwitches = 0;
+    out[1].framePhase = FramePhase.idle.index;
+    out[1].frameNumber = 3;
+    out[1].pcs[0] = 456;
+    out[1].pcs[1] = 0;
+    return 2;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int AggregateNativeSamples(
+    int start,
+    int end,
+    int occurTimesThreshold,
+    ffi.Pointer<NativeAggregatedFrameStruct> out,
+    int maxCount,
+  ) {
+    out[0].pc = 456;
+    out[0].timestamp = 200;
+    out[0].occurTimes = 3;
+    out[0].moduleId = 0;
+    out[0].symbolId = 0;
+    out[1].pc = 789;
+    out[1].timestamp = 200;
+    out[1].occurTimes = 2;
+    out[1].moduleId = -1;
+    out[1].symbolId = -1;
+    return 2;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetStackCopySize(int sizeInBytes) {
+    stackCopySizeInBytes = sizeInBytes;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetUnwindTablesEnabled(int enabled) {
+    unwindTablesEnabled = enabled;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerPerfEventsEnabled(int enabled) {
+    nativeSamplerPerfEventsEnabled = enabled;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerCpuTimeSampleRate(int cpuRateInMicros) {
+    nativeSamplerCpuTimeSampleRate = cpuRateInMicros;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerSchedStateEnabled(int enabled) {
+    nativeSamplerSchedStateEnabled = enabled;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> GetSyscallName(int number) {
+    return number == 63 ? 'read'.toNativeUtf8(allocator: arena) : ffi.nullptr;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetCollectStackTimeout(int timeoutInMicros) {
+    collectStackTimeoutInMicros = timeoutInMicros;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> OpenJankReportWriter(
+    ffi.Pointer<Utf8> path,
+    ffi.Pointer<ffi.Pointer<ffi.Void>> out,
+  ) {
+    isJankReportWriterOpened = true;
+    out.value = ffi.Pointer<ffi.Void>.fromAddress(1);
+    return ffi.nullptr;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> WriteJankReport(
+    ffi.Pointer<ffi.Void> writer,
+    ffi.Pointer<Utf8> buildId,
+    int isolateInstructions,
+    ffi.Pointer<ffi.Pointer<Utf8>> headerLines,
+    int headerLineCount,
+    int timestamp,
+    ffi.Pointer<NativeJankReportFrameStruct> frames,
+    int frameCount,
+  ) {
+    writtenJankReport = (
+      buildId: buildId.toDartString(),
+      isolateInstructions: isolateInstructions,
+      headerLines: [
+        for (int i = 0; i < headerLineCount; ++i) headerLines[i].toDartString(),
+      ],
+      timestamp: timestamp,
+      frames: [
+        for (int i = 0; i < frameCount; ++i)
+          (
+            pc: frames[i].pc,
+            occurTimes: frames[i].occurTimes,
+            moduleId: frames[i].moduleId,
+            pathDepth: frames[i].pathDepth,
+          ),
+      ],
+    );
+    return ffi.nullptr;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void CloseJankReportWriter(ffi.Pointer<ffi.Void> writer) {
+    isJankReportWriterOpened = false;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<ffi.Void> CreateJankDeduper(int capacity, int topFrames) {
+    jankDeduperArgs = [capacity, topFrames];
+    return ffi.Pointer<ffi.Void>.fromAddress(1);
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void DestroyJankDeduper(ffi.Pointer<ffi.Void> deduper) {
+    isJankDeduperDestroyed = true;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int RecordJankReport(
+    ffi.Pointer<ffi.Void> deduper,
+    int isolateInstructions,
+    ffi.Pointer<NativeJankReportFrameStruct> frames,
+    int frameCount,
+    int timestamp,
+    ffi.Pointer<NativeJankFingerprintStruct> out,
+    ffi.Pointer<NativeJankFingerprintStruct> evicted,
+  ) {
+    int fingerprint = 0;
+    for (int i = 0; i < frameCount; ++i) {
+      fingerprint += frames[i].pc - isolateInstructions;
+    }
+
+    evicted.ref.fingerprint = 0;
+    final previous = jankFingerprints.remove(fingerprint);
+    if (previous == null && jankFingerprints.length == jankDeduperArgs![0]) {
+      final evictedFingerprint = jankFingerprints.keys.first;
+      final entry = jankFingerprints.remove(evictedFingerprint)!;
+      evicted.ref
+        ..fingerprint = evictedFingerprint
+        ..count = entry.count
+        ..repeats = entry.repeats
+        ..firstSeen = entry.firstSeen
+        ..lastSeen = entry.lastSeen;
+    }
+    final entry = previous != null
+        ? (
+            count: previous.count + 1,
+            repeats: previous.repeats + 1,
+            firstSeen: previous.firstSeen,
+            lastSeen: timestamp,
+          )
+        : (count: 1, repeats: 0, firstSeen: timestamp, lastSeen: timestamp);
+    jankFingerprints[fingerprint] = entry;
+    out.ref
+      ..fingerprint = fingerprint
+      ..count = entry.count
+      ..repeats = entry.repeats
+      ..firstSeen = entry.firstSeen
+      ..lastSeen = entry.lastSeen;
+    return previous == null ? 1 : 0;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int TakeJankSummaries(
+    ffi.Pointer<ffi.Void> deduper,
+    ffi.Pointer<NativeJankFingerprintStruct> out,
+    int maxCount,
+  ) {
+    int count = 0;
+    for (final fingerprint in jankFingerprints.keys.toList().reversed) {
+      final entry = jankFingerprints[fingerprint]!;
+      if (entry.repeats == 0) {
+        continue;
+      }
+      if (count == maxCount) {
+        break;
+      }
+      out[count++]
+        ..fingerprint = fingerprint
+        ..count = entry.count
+        ..repeats = entry.repeats
+        ..firstSeen = entry.firstSeen
+        ..lastSeen = entry.lastSeen;
+      jankFingerprints[fingerprint] = (
+        count: entry.count,
+        repeats: 0,
+        firstSeen: entry.firstSeen,
+        lastSeen: entry.lastSeen,
+      );
+    }
+    return count;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> DecodeJankReportFile(
+    ffi.Pointer<Utf8> path,
+    ffi.Pointer<ffi.Pointer<Utf8>> out,
+  ) {
+    out.value = 'decoded ${path.toDartString()}'.toNativeUtf8();
+    return ffi.nullptr;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void GetSamplerStats(ffi.Pointer<NativeSamplerStatsStruct> out) {
+    out.ref.samplesAttempted = 10;
+    out.ref.samplesSucceeded = 7;
+    out.ref.samplesTimedOut = 2;
+    out.ref.samplesFailed = 1;
+    out.ref.framesTruncated = 3;
+    for (final histogram in [
+      out.ref.signalDeliveryInNanos,
+      out.ref.targetPauseInNanos,
+      out.ref.walkDepth,
+    ]) {
+      histogram.count = 7;
+      histogram.sum = 70;
+      histogram.max = 12;
+      for (int i = 0; i < kNativeHistogramBucketCount; ++i) {
+        histogram.buckets[i] = 0;
+      }
+      histogram.buckets[3] = 2;
+      histogram.buckets[4] = 5;
+    }
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerBurst(
+    int burstRateInMicros,
+    int burstDurationInMicros,
+    int frameBudgetInMicros,
+  ) {
+    nativeSamplerBurst = [
+      burstRateInMicros,
+      burstDurationInMicros,
+      frameBudgetInMicros,
+    ];
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetNativeSamplerPersistentFile(
+    ffi.Pointer<Utf8> path,
+    int isolateInstructions,
+    ffi.Pointer<ffi.Pointer<Utf8>> headerLines,
+    int headerLineCount,
+  ) {
+    persistentFile = (
+      path: path == ffi.nullptr ? null : path.toDartString(),
+      isolateInstructions: isolateInstructions,
+      headerLines: List<String>.generate(
+        headerLineCount,
+        (i) => headerLines[i].toDartString(),
+      ),
+    );
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> LoadPersistedSamples(
+    ffi.Pointer<Utf8> path,
+    int windowInMicros,
+    ffi.Pointer<ffi.Pointer<NativePersistedSamplesStruct>> out,
+  ) {
+    if (path.toDartString() != 'samples.bin') {
+      return 'failed to open the persistent samples file'.toNativeUtf8();
+    }
+
+    final samples = arena<NativePersistedSamplesStruct>();
+    samples.ref.isolateInstructions = 0x1000;
+    samples.ref.cleanShutdown = 0;
+    // Sorted by the start addresses.
+    samples.ref.moduleCount = 2;
+    samples.ref.modules = arena<NativeModuleInfoStruct>(2);
+    samples.ref.modules[0]
+      ..baseAddress = 0x1000
+      ..startAddress = 0x1000
+      ..endAddress = 0x2000
+      ..path = 'libflutter.so'.toNativeUtf8(allocator: arena);
+    samples.ref.modules[1]
+      ..baseAddress = 0x3000
+      ..startAddress = 0x3000
+      ..endAddress = 0x4000
+      ..path = 'libapp.so'.toNativeUtf8(allocator: arena);
+    samples.ref.header = "*** ***\nbuild_id: 'abc'".toNativeUtf8(
+      allocator: arena,
+    );
+    samples.ref.sampleCount = 2;
+    samples.ref.samples = arena<NativeSampleStruct>(2);
+    samples.ref.samples[0]
+      ..timestamp = 100
+      ..depth = 3
+      ..syscall = 202
+      ..runState = 'S'.codeUnitAt(0)
+      ..voluntarySwitches = 4
+      ..framePhase = FramePhase.paint.index
+      ..frameNumber = 12;
+    samples.ref.samples[0].pcs[0] = 0x3100;
+    samples.ref.samples[0].pcs[1] = 0x2100;
+    samples.ref.samples[0].pcs[2] = 0x1100;
+    samples.ref.samples[1]
+      ..timestamp = 200
+      ..depth = 1;
+    samples.ref.samples[1].pcs[0] = 0x3200;
+    out.value = samples;
+    return ffi.nullptr;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void FreePersistedSamples(ffi.Pointer<NativePersistedSamplesStruct> samples) {
+    isPersistedSamplesFreed = true;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> ExportNativeSamplerProfile(
+    int startTimestamp,
+    int endTimestamp,
+    int format,
+    ffi.Pointer<ffi.Pointer<ffi.Uint8>> out,
+    ffi.Pointer<ffi.Size> outSize,
+  ) {
+    exportedProfileArgs = [startTimestamp, endTimestamp, format];
+    if (!isStartNativeSampler) {
+      return 'native sampler is not started'.toNativeUtf8();
+    }
+
+    // Allocated by `malloc`, which is freed by the caller.
+    const profile = 'main;foo;bar 2\n';
+    out.value = malloc<ffi.Uint8>(profile.length);
+    out.value.asTypedList(profile.length).setAll(0, profile.codeUnits);
+    outSize.value = profile.length;
+    return ffi.nullptr;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void RequestNativeSamplerBurst() {
+    burstRequestCount++;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void MarkFrameBegin() {
+    frameBeginCount++;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void MarkFrameEnd() {
+    frameEndCount++;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetFramePhase(int phase, int frameNumber) {
+    framePhase = [phase, frameNumber];
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> StartWatchdog(int timeoutInMicros) {
+    watchdogTimeoutInMicros = timeoutInMicros;
+    if (timeoutInMicros <= 0) {
+      return 'invalid timeout'.toNativeUtf8();
+    }
+    return ffi.nullptr; // success
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void StopWatchdog() {
+    isStopWatchdog = true;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int TakeWatchdogReport(ffi.Pointer<NativeWatchdogReportStruct> out) {
+    if (watchdogReportCount == 0) {
+      return 0;
+    }
+    final index = 2 - watchdogReportCount--;
+    out.ref.freezeId = 5;
+    out.ref.frozenInMicros = 100000 << index;
+    out.ref.error = index;
+    out.ref.reportIndex = index;
+    out.ref.sample.timestamp = 300;
+    out.ref.sample.depth = 1;
+    out.ref.sample.syscall = kNoSyscall;
+    out.ref.sample.framePhase = FramePhase.layout.index;
+    out.ref.sample.frameNumber = 9;
+    out.ref.sample.pcs[0] = 123;
+    out.ref.sample.pcs[1] = 0;
+    return 1;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void MarkUiTaskBegin() {
+    uiTaskBeginCount++;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void MarkUiTaskEnd() {
+    uiTaskEndCount++;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void SetModulePathFilters(
+    ffi.Pointer<ffi.Pointer<Utf8>> patterns,
+    int count,
+  ) {
+    modulePathFilters = List<String>.generate(
+      count,
+      (i) => patterns[i].toDartString(),
+    );
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void RefreshModuleMap() {
+    refreshModuleMapCount++;
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  void ResolveNativeFrames(
+    ffi.Pointer<ffi.Int64> pcs,
+    int count,
+    ffi.Pointer<NativeFrameInfoStruct> out,
+  ) {
+    isResolveNativeFrames = true;
+    for (int i = 0; i < count; ++i) {
+      out[i].moduleId = 0;
+      out[i].symbolId = 0;
+    }
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  int GetNativeModule(int moduleId, ffi.Pointer<NativeModuleInfoStruct> out) {
+    out.ref.baseAddress = 123;
+    out.ref.startAddress = 0;
+    out.ref.endAddress = 1000;
+    out.ref.path = "libapp.so".toNativeUtf8(allocator: arena);
+    return 1; // found
+  }
+
+  @override
+  // ignore: non_constant_identifier_names
+  ffi.Pointer<Utf8> GetInternedSymbolName(int symbolId) {
+    // Owned by the native side, so it's not freed by the user
+    return "hello".toNativeUtf8(allocator: arena);
+  }
 }
 
 void main() {
@@ -74,8 +710,8 @@ void main() {
 
         final nativeStack = stackCapturer.captureStackOfTargetThread();
         expect(nativeBindings.isCollectStackTraceOfTargetThread, isTrue);
-        expect(nativeBindings.isDladdr, isTrue);
-        expect(nativeBindings.isLookupSymbolName, isTrue);
+        expect(nativeBindings.isResolveNativeFrames, isTrue);
+        expect(nativeBindings.refreshModuleMapCount, 1);
 
         final frame = nativeStack.frames[0];
         final module = nativeStack.modules[0];
@@ -83,11 +719,668 @@ void main() {
         expect(frame.module, module);
         expect(frame.module, module);
 
-        expect(module.id, 0); // The first `id` is 0
+        expect(module.id, 0); // The id of the native module map
         expect(module.path, 'libapp.so');
         expect(module.baseAddress, 123);
         expect(module.symbolName, 'hello');
       });
     });
+
+    test('registerCurrentThread and unregisterCurrentThread', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        expect(stackCapturer.registerCurrentThread('raster'), 1);
+        expect(nativeBindings.registeredThreadName, 'raster');
+
+        stackCapturer.unregisterCurrentThread();
+        expect(nativeBindings.isUnregisterTargetThread, isTrue);
+      });
+    });
+
+    test('captureStacksOfAllThreads', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        final stacks = stackCapturer.captureStacksOfAllThreads();
+        expect(stacks.length, 2);
+        expect(stacks[0].threadId, 0);
+        expect(stacks[0].threadName, 'ui');
+        expect(stacks[0].stack.frames.length, 1);
+        expect(stacks[0].stack.frames[0].pc, 123);
+        expect(stacks[0].stack.frames[0].timestamp, 100);
+        expect(stacks[0].stack.syscall, 98);
+        expect(stacks[0].stack.framePhase, FramePhase.build);
+        expect(stacks[0].stack.frameNumber, 7);
+        // The stack of the failed thread is empty
+        expect(stacks[1].threadId, 1);
+        expect(stacks[1].threadName, 'raster');
+        expect(stacks[1].stack.frames, isEmpty);
+
+        stackCapturer.dispose();
+      });
+    });
+
+    test('setStackCopySize', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setStackCopySize(16 * 1024);
+        expect(nativeBindings.stackCopySizeInBytes, 16 * 1024);
+      });
+    });
+
+    test('setUnwindTablesEnabled', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setUnwindTablesEnabled(true);
+        expect(nativeBindings.unwindTablesEnabled, 1);
+        stackCapturer.setUnwindTablesEnabled(false);
+        expect(nativeBindings.unwindTablesEnabled, 0);
+      });
+    });
+
+    test('setNativeSamplerPerfEventsEnabled', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setNativeSamplerPerfEventsEnabled(true);
+        expect(nativeBindings.nativeSamplerPerfEventsEnabled, 1);
+        stackCapturer.setNativeSamplerPerfEventsEnabled(false);
+        expect(nativeBindings.nativeSamplerPerfEventsEnabled, 0);
+      });
+    });
+
+    test('setNativeSamplerCpuTimeSampleRate', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setNativeSamplerCpuTimeSampleRate(1000);
+        expect(nativeBindings.nativeSamplerCpuTimeSampleRate, 1000);
+        stackCapturer.setNativeSamplerCpuTimeSampleRate(0);
+        expect(nativeBindings.nativeSamplerCpuTimeSampleRate, 0);
+      });
+    });
+
+    test('setNativeSamplerSchedStateEnabled', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setNativeSamplerSchedStateEnabled(true);
+        expect(nativeBindings.nativeSamplerSchedStateEnabled, 1);
+        stackCapturer.setNativeSamplerSchedStateEnabled(false);
+        expect(nativeBindings.nativeSamplerSchedStateEnabled, 0);
+      });
+    });
+
+    test('getSyscallName', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        expect(stackCapturer.getSyscallName(63), 'read');
+        expect(stackCapturer.getSyscallName(1234), isNull);
+        expect(stackCapturer.getSyscallName(kNoSyscall), isNull);
+      });
+    });
+
+    test('getSamplerStats', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        final stats = stackCapturer.getSamplerStats();
+        expect(stats.samplesAttempted, 10);
+        expect(stats.samplesSucceeded, 7);
+        expect(stats.samplesTimedOut, 2);
+        expect(stats.samplesFailed, 1);
+        expect(stats.framesTruncated, 3);
+        expect(stats.targetPauseInNanoseconds.count, 7);
+        expect(stats.targetPauseInNanoseconds.sum, 70);
+        expect(stats.targetPauseInNanoseconds.max, 12);
+        expect(
+          stats.walkDepth.buckets.length,
+          kNativeHistogramBucketCount,
+        );
+        expect(stats.walkDepth.buckets[3], 2);
+        expect(stats.walkDepth.buckets[4], 5);
+      });
+    });
+
+    test('setNativeSamplerBurst', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setNativeSamplerBurst(1000, 500000, 16000);
+        expect(nativeBindings.nativeSamplerBurst, [1000, 500000, 16000]);
+
+        stackCapturer.requestNativeSamplerBurst();
+        stackCapturer.markFrameBegin();
+        stackCapturer.markFrameEnd();
+        expect(nativeBindings.burstRequestCount, 1);
+        expect(nativeBindings.frameBeginCount, 1);
+        expect(nativeBindings.frameEndCount, 1);
+      });
+    });
+
+    test('setFramePhase', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setFramePhase(FramePhase.layout, 42);
+        expect(nativeBindings.framePhase, [FramePhase.layout.index, 42]);
+      });
+    });
+
+    test('startWatchdog', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        expect(stackCapturer.startWatchdog(200000), isTrue);
+        expect(nativeBindings.watchdogTimeoutInMicros, 200000);
+        expect(stackCapturer.startWatchdog(0), isFalse);
+
+        stackCapturer.markUiTaskBegin();
+        stackCapturer.markUiTaskEnd();
+        expect(nativeBindings.uiTaskBeginCount, 1);
+        expect(nativeBindings.uiTaskEndCount, 1);
+
+        stackCapturer.stopWatchdog();
+        expect(nativeBindings.isStopWatchdog, isTrue);
+      });
+    });
+
+    test('takeWatchdogReports', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        nativeBindings.watchdogReportCount = 2;
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        final reports = stackCapturer.takeWatchdogReports();
+        expect(reports.length, 2);
+        expect(reports[0].freezeId, 5);
+        expect(reports[0].frozenInMicros, 100000);
+        expect(reports[0].reportIndex, 0);
+        expect(reports[0].stack.frames.length, 1);
+        expect(reports[0].stack.frames[0].pc, 123);
+        expect(reports[0].stack.frames[0].timestamp, 300);
+        expect(reports[0].stack.framePhase, FramePhase.layout);
+        expect(reports[0].stack.frameNumber, 9);
+        // The stack of the failed report is empty
+        expect(reports[1].frozenInMicros, 200000);
+        expect(reports[1].reportIndex, 1);
+        expect(reports[1].stack.frames, isEmpty);
+
+        expect(stackCapturer.takeWatchdogReports(), isEmpty);
+
+        stackCapturer.dispose();
+      });
+    });
+
+    test('FramePhase.fromIndex', () {
+      expect(FramePhase.fromIndex(FramePhase.paint.index), FramePhase.paint);
+      // Unknown phases, e.g., of a newer native library.
+      expect(FramePhase.fromIndex(-1), FramePhase.idle);
+      expect(FramePhase.fromIndex(FramePhase.values.length), FramePhase.idle);
+    });
+
+    test('setNativeSamplerPersistentFile', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setNativeSamplerPersistentFile('samples.bin', 0x1000, [
+          '*** ***',
+          "build_id: 'abc'",
+        ]);
+        expect(nativeBindings.persistentFile?.path, 'samples.bin');
+        expect(nativeBindings.persistentFile?.isolateInstructions, 0x1000);
+        expect(nativeBindings.persistentFile?.headerLines, [
+          '*** ***',
+          "build_id: 'abc'",
+        ]);
+
+        stackCapturer.setNativeSamplerPersistentFile(null, 0, []);
+        expect(nativeBindings.persistentFile?.path, isNull);
+        expect(nativeBindings.persistentFile?.headerLines, isEmpty);
+      });
+    });
+
+    test('loadPersistedSamples', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        final persisted = stackCapturer.loadPersistedSamples(
+          'samples.bin',
+          5000000,
+        )!;
+        expect(nativeBindings.isPersistedSamplesFreed, isTrue);
+        expect(persisted.cleanShutdown, isFalse);
+        expect(persisted.isolateInstructions, 0x1000);
+        expect(persisted.headerLines, ['*** ***', "build_id: 'abc'"]);
+        expect(persisted.stacks.length, 2);
+
+        // The pcs are resolved against the modules of the previous run.
+        final frames = persisted.stacks[0].frames;
+        expect(frames.length, 3);
+        expect(frames[0].pc, 0x3100);
+        expect(frames[0].timestamp, 100);
+        expect(frames[0].module?.path, 'libapp.so');
+        expect(frames[0].module?.baseAddress, 0x3000);
+        expect(frames[1].module, isNull);
+        expect(frames[2].module?.path, 'libflutter.so');
+        expect(persisted.stacks[0].modules.length, 2);
+        expect(persisted.stacks[0].syscall, 202);
+        expect(persisted.stacks[0].runState, 'S'.codeUnitAt(0));
+        expect(persisted.stacks[0].voluntaryContextSwitches, 4);
+        expect(persisted.stacks[0].framePhase, FramePhase.paint);
+        expect(persisted.stacks[0].frameNumber, 12);
+        expect(persisted.stacks[1].framePhase, FramePhase.idle);
+        expect(persisted.stacks[1].frames.single.pc, 0x3200);
+        expect(persisted.stacks[1].frames.single.timestamp, 200);
+      });
+    });
+
+    test('loadPersistedSamples returns null if failed', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        expect(stackCapturer.loadPersistedSamples('missing.bin', 0), isNull);
+        expect(nativeBindings.isPersistedSamplesFreed, isFalse);
+      });
+    });
+
+    test('exportNativeSamplerProfile', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        expect(stackCapturer.startNativeSampler(1000, 10000, 0), isTrue);
+        final profile = stackCapturer.exportNativeSamplerProfile(
+          ProfileFormat.collapsed,
+          [100, 200],
+        )!;
+        expect(nativeBindings.exportedProfileArgs, [100, 200, 1]);
+        expect(String.fromCharCodes(profile), 'main;foo;bar 2\n');
+
+        stackCapturer.dispose();
+      });
+    });
+
+    test('exportNativeSamplerProfile returns null if failed', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        expect(
+          stackCapturer.exportNativeSamplerProfile(ProfileFormat.pprof, [
+            0,
+            1000,
+          ]),
+          isNull,
+        );
+        expect(nativeBindings.exportedProfileArgs, [0, 1000, 0]);
+      });
+    });
+
+    test('setCollectStackTimeout', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setCollectStackTimeout(1000);
+        expect(nativeBindings.collectStackTimeoutInMicros, 1000);
+      });
+    });
+
+    test('setModulePathFilters', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        stackCapturer.setModulePathFilters(kAndroidDefaultModulePathFilters);
+        expect(
+          nativeBindings.modulePathFilters,
+          equals(kAndroidDefaultModulePathFilters),
+        );
+
+        stackCapturer.setModulePathFilters([]);
+        expect(nativeBindings.modulePathFilters, isEmpty);
+      });
+    });
+
+    test('startNativeSampler and stopNativeSampler', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        expect(stackCapturer.startNativeSampler(1000, 10000, 0), isTrue);
+        expect(nativeBindings.isStartNativeSampler, isTrue);
+
+        stackCapturer.stopNativeSampler();
+        expect(nativeBindings.isStopNativeSampler, isTrue);
+      });
+    });
+
+    test('readNativeSamples', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        expect(stackCapturer.startNativeSampler(1000, 10000, 0), isTrue);
+        final nativeStacks = stackCapturer.readNativeSamples([0, 1000]);
+        expect(nativeStacks.length, 2);
+        // Once for the batch, not per stack.
+        expect(nativeBindings.refreshModuleMapCount, 1);
+        // The order is reversed
+        expect(nativeStacks[0].frames[0].pc, 456);
+        expect(nativeStacks[0].frames[0].timestamp, 200);
+        expect(nativeStacks[1].frames[0].pc, 123);
+        expect(nativeStacks[1].frames[0].timestamp, 100);
+        expect(nativeStacks[0].isCpuTick, isTrue);
+        expect(nativeStacks[1].isCpuTick, isFalse);
+        expect(nativeStacks[0].syscall, kNoSyscall);
+        expect(nativeStacks[0].runState, 'R'.codeUnitAt(0));
+        expect(nativeStacks[1].syscall, 63);
+        expect(nativeStacks[1].runState, 'S'.codeUnitAt(0));
+        expect(nativeStacks[1].voluntaryContextSwitches, 2);
+        expect(nativeStacks[1].involuntaryContextSwitches, 1);
+        expect(nativeStacks[0].framePhase, FramePhase.idle);
+        expect(nativeStacks[1].framePhase, FramePhase.layout);
+        expect(nativeStacks[1].frameNumber, 3);
+
+        stackCapturer.dispose();
+      });
+    });
+
+    test('aggregateNativeSamples', () {
+      using((arena) {
+        nativeBindings = FakeCollectStackNativeBindings(arena);
+        stackCapturer = StackCapturer(nativeBindings: nativeBindings);
+
+        final frames = stackCapturer.aggregateNativeSamples([0, 1000], 1, 10);
+        expect(frames.length, 2);
+        expect(frames[0].frame.pc, 456);
+        expect(frames[0].frame.timestamp, 200);
+        expect(frames[0].frame.module!.path, 'libapp.so');
+        expect(frames[0].frame.module!.baseAddress, 123);
+        expect(frames[0].frame.module!.symbolName, 'hello');
+        expect(frames[0].occurTimes, 3);
+        expect(frames[1].frame.pc, 789);
+        expect(frames[1].frame.module, isNull);
+        expect(frames[1].occurTimes, 2);
+
+        stackCapturer.dispose();
+      });
+    });
+  });
+
+  group('DartImageInfo', () {
+    test('load', () {
+      using((arena) {
+        final nativeBindings = FakeCollectStackNativeBindings(arena);
+        final info = DartImageInfo.load(nativeBindings: nativeBindings)!;
+        expect(info.buildId, 'abc');
+        expect(info.isolateDsoBase, 0x1000);
+        expect(info.vmDsoBase, 0x1000);
+        expect(info.isolateInstructions, 0x2000);
+        expect(info.vmInstructions, 0x1800);
+      });
+    });
+
+    test('load returns null if the image is not loaded', () {
+      using((arena) {
+        final nativeBindings = FakeCollectStackNativeBindings(arena)
+          ..isDartImageLoaded = false;
+        expect(DartImageInfo.load(nativeBindings: nativeBindings), isNull);
+      });
+    });
+  });
+
+  group('JankReportWriter', () {
+    test('write', () {
+      using((arena) {
+        final nativeBindings = FakeCollectStackNativeBindings(arena);
+        final writer = JankReportWriter(
+          'report.bin',
+          nativeBindings: nativeBindings,
+        );
+        final module = NativeModule(
+          id: 1,
+          path: 'libapp.so',
+          baseAddress: 0x1000,
+          symbolName: '',
+        );
+
+        final isWritten = writer.write(
+          buildId: 'abc',
+          isolateInstructions: 0x2000,
+          headerLines: ['line1', 'line2'],
+          timestamp: 10,
+          frames: [
+            (
+              frame: NativeFrame(pc: 0x2010, timestamp: 1, module: module),
+              occurTimes: 3,
+              pathDepth: null,
+            ),
+            (
+              frame: NativeFrame(pc: 0x10, timestamp: 1),
+              occurTimes: 1,
+              pathDepth: null,
+            ),
+          ],
+        );
+        expect(isWritten, isTrue);
+        expect(nativeBindings.isJankReportWriterOpened, isTrue);
+
+        final report = nativeBindings.writtenJankReport!;
+        expect(report.buildId, 'abc');
+        expect(report.isolateInstructions, 0x2000);
+        expect(report.headerLines, ['line1', 'line2']);
+        expect(report.timestamp, 10);
+        expect(report.frames, [
+          (pc: 0x2010, occurTimes: 3, moduleId: 1, pathDepth: -1),
+          (pc: 0x10, occurTimes: 1, moduleId: -1, pathDepth: -1),
+        ]);
+
+        writer.close();
+        expect(nativeBindings.isJankReportWriterOpened, isFalse);
+      });
+    });
+
+    test('write the path depths of a calling context tree', () {
+      using((arena) {
+        final nativeBindings = FakeCollectStackNativeBindings(arena);
+        final writer = JankReportWriter(
+          'report.bin',
+          nativeBindings: nativeBindings,
+        );
+
+        final isWritten = writer.write(
+          buildId: 'abc',
+          isolateInstructions: 0x2000,
+          headerLines: const [],
+          timestamp: 10,
+          frames: [
+            (
+              frame: NativeFrame(pc: 0x2020, timestamp: 1),
+              occurTimes: 2,
+              pathDepth: 0,
+            ),
+            (
+              frame: NativeFrame(pc: 0x2010, timestamp: 1),
+              occurTimes: 3,
+              pathDepth: 1,
+            ),
+            (
+              frame: NativeFrame(pc: 0x2030, timestamp: 1),
+              occurTimes: 1,
+              pathDepth: 0,
+            ),
+          ],
+        );
+        expect(isWritten, isTrue);
+        expect(nativeBindings.writtenJankReport!.frames, [
+          (pc: 0x2020, occurTimes: 2, moduleId: -1, pathDepth: 0),
+          (pc: 0x2010, occurTimes: 3, moduleId: -1, pathDepth: 1),
+          (pc: 0x2030, occurTimes: 1, moduleId: -1, pathDepth: 0),
+        ]);
+      });
+    });
+
+    test('decodeFile', () {
+      using((arena) {
+        final nativeBindings = FakeCollectStackNativeBindings(arena);
+        expect(
+          JankReportWriter.decodeFile(
+            'report.bin',
+            nativeBindings: nativeBindings,
+          ),
+          'decoded report.bin',
+        );
+      });
+    });
+  });
+  group('JankDeduper', () {
+    ({NativeFrame frame, int occurTimes}) frame(int pc) =>
+        (frame: NativeFrame(pc: pc, timestamp: 1), occurTimes: 1);
+
+    test('record new and repeated reports', () {
+      using((arena) {
+        final nativeBindings = FakeCollectStackNativeBindings(arena);
+        final deduper = JankDeduper(nativeBindings: nativeBindings);
+
+        final first = deduper.record(
+          isolateInstructions: 0x1000,
+          frames: [frame(0x1010), frame(0x1020)],
+          timestamp: 10,
+        )!;
+        expect(nativeBindings.jankDeduperArgs, [
+          kMaxJankFingerprints,
+          kJankFingerprintTopFrames,
+        ]);
+        expect(first.isNew, isTrue);
+        expect(first.fingerprint, (
+          fingerprint: 0x30,
+          count: 1,
+          repeats: 0,
+          firstSeen: 10,
+          lastSeen: 10,
+        ));
+        expect(first.evicted, isNull);
+
+        final repeat = deduper.record(
+          isolateInstructions: 0x1000,
+          frames: [frame(0x1010), frame(0x1020)],
+          timestamp: 20,
+        )!;
+        expect(repeat.isNew, isFalse);
+        expect(repeat.fingerprint, (
+          fingerprint: 0x30,
+          count: 2,
+          repeats: 1,
+          firstSeen: 10,
+          lastSeen: 20,
+        ));
+
+        deduper.dispose();
+        expect(nativeBindings.isJankDeduperDestroyed, isTrue);
+      });
+    });
+
+    test('record evicts the least recently seen', () {
+      using((arena) {
+        final nativeBindings = FakeCollectStackNativeBindings(arena);
+        final deduper = JankDeduper(
+          capacity: 2,
+          nativeBindings: nativeBindings,
+        );
+
+        deduper.record(
+
+          isolateInstructions: 0,
+
+          frames: [frame(1)],
+
+          timestamp: 1,
+
+        );
+        deduper.record(
+          isolateInstructions: 0,
+          frames: [frame(2)],
+          timestamp: 2,
+        );
+        deduper.record(
+          isolateInstructions: 0,
+          frames: [frame(1)],
+          timestamp: 3,
+        );
+        final recorded = deduper.record(
+          isolateInstructions: 0,
+          frames: [frame(3)],
+          timestamp: 4,
+        )!;
+        expect(recorded.isNew, isTrue);
+        expect(recorded.evicted, (
+          fingerprint: 2,
+          count: 1,
+          repeats: 0,
+          firstSeen: 2,
+          lastSeen: 2,
+        ));
+      });
+    });
+
+    test('takeSummaries', () {
+      using((arena) {
+        final nativeBindings = FakeCollectStackNativeBindings(arena);
+        final deduper = JankDeduper(nativeBindings: nativeBindings);
+        expect(deduper.takeSummaries(), isEmpty);
+
+        // More than a batch of the summaries.
+        for (int pc = 1; pc <= 20; ++pc) {
+          deduper.record(
+            isolateInstructions: 0,
+            frames: [frame(pc)],
+            timestamp: pc,
+          );
+          deduper.record(
+            isolateInstructions: 0,
+            frames: [frame(pc)],
+            timestamp: pc + 100,
+          );
+        }
+        deduper.record(
+          isolateInstructions: 0,
+          frames: [frame(21)],
+          timestamp: 1,
+        );
+
+        final summaries = deduper.takeSummaries();
+        expect(summaries.length, 20);
+        expect(summaries.first, (
+          fingerprint: 20,
+          count: 2,
+          repeats: 1,
+          firstSeen: 20,
+          lastSeen: 120,
+        ));
+        expect(summaries.last.fingerprint, 1);
+        expect(deduper.takeSummaries(), isEmpty);
+      });
+    });
   });
 }
@@ -1,5 +1,6 @@
 import 'dart:async';
 import 'dart:developer';
+import 'dart:typed_data';
 
 import 'package:fake_async/fake_async.dart';
 import 'package:flutter/services.dart';
@@ -19,6 +20,98 @@ class FakeSampler implements Sampler {
 
   bool isClose = false;
 
+  int frameBeginCount = 0;
+
+  int frameEndCount = 0;
+
+  int burstRequestCount = 0;
+
+  RecoveredSamples? recoveredSamples;
+
+  CpuTimeSplit? cpuTimeSplit;
+
+  ThreadStateSummary? threadStateSummary;
+
+  Map<FramePhase, int>? framePhases;
+
+  final setFramePhases = <(FramePhase, int)>[];
+
+  int uiTaskBeginCount = 0;
+
+  int uiTaskEndCount = 0;
+
+  ({ProfileFormat format, List<int>? timestampRange})? exportedProfile;
+
+  SamplerStats samplerStats = const SamplerStats(
+    samplesAttempted: 0,
+    samplesSucceeded: 0,
+    samplesTimedOut: 0,
+    samplesFailed: 0,
+    framesTruncated: 0,
+    signalDeliveryInNanoseconds: SamplerHistogram(
+      count: 0,
+      sum: 0,
+      max: 0,
+      buckets: [],
+    ),
+    targetPauseInNanoseconds: SamplerHistogram(
+      count: 0,
+      sum: 0,
+      max: 0,
+      buckets: [],
+    ),
+    walkDepth: SamplerHistogram(count: 0, sum: 0, max: 0, buckets: []),
+  );
+
+  @override
+  SamplerStats getSamplerStats() => samplerStats;
+
+  @override
+  Future<Uint8List?> exportProfile(
+    ProfileFormat format, {
+    List<int>? timestampRange,
+  }) async {
+    exportedProfile = (format: format, timestampRange: timestampRange);
+    return Uint8List.fromList([1, 2, 3]);
+  }
+
+  @override
+  void markFrameBegin() {
+    frameBeginCount++;
+  }
+
+  @override
+  void markFrameEnd() {
+    frameEndCount++;
+  }
+
+  @override
+  void setFramePhase(FramePhase phase, int frameNumber) {
+    setFramePhases.add((phase, frameNumber));
+  }
+
+  @override
+  void markUiTaskBegin() {
+    uiTaskBeginCount++;
+  }
+
+  @override
+  void markUiTaskEnd() {
+    uiTaskEndCount++;
+  }
+
+  @override
+  void requestSampleBurst() {
+    burstRequestCount++;
+  }
+
+  @override
+  RecoveredSamples? takeRecoveredSamples() {
+    final samples = recoveredSamples;
+    recoveredSamples = null;
+    return samples;
+  }
+
   @override
   void close() {
     isClose = true;
@@ -30,6 +123,25 @@ class FakeSampler implements Sampler {
   ) async {
     return frames;
   }
+
+  @override
+  Future<CpuTimeSplit?> getCpuTimeSplit(List<int> timestampRange) async {
+    return cpuTimeSplit;
+  }
+
+  @override
+  Future<ThreadStateSummary?> getThreadStateSummary(
+    List<int> timestampRange,
+  ) async {
+    return threadStateSummary;
+  }
+
+  @override
+  Future<Map<FramePhase, int>?> getFramePhases(
+    List<int> timestampRange,
+  ) async {
+    return framePhases;
+  }
 }
 
 class TestJankDetectedReporter extends JankDetectedReporter {
@@ -41,6 +153,70 @@ class TestJankDetectedReporter extends JankDetectedReporter {
   }
 }
 
+/// Fingerprints a report by the pc of its first frame, and never evicts.
+class FakeJankDeduper implements JankDeduper {
+  @override
+  int get capacity => kMaxJankFingerprints;
+
+  @override
+  int get topFrames => kJankFingerprintTopFrames;
+
+  final fingerprints = <int, JankFingerprint>{};
+
+  bool isDisposed = false;
+
+  @override
+  ({bool isNew, JankFingerprint fingerprint, JankFingerprint? evicted})?
+  record({
+    required int isolateInstructions,
+    required List<({NativeFrame frame, int occurTimes})> frames,
+    required int timestamp,
+  }) {
+    final fingerprint = frames.first.frame.pc;
+    final previous = fingerprints[fingerprint];
+    final entry = previous != null
+        ? (
+            fingerprint: fingerprint,
+            count: previous.count + 1,
+            repeats: previous.repeats + 1,
+            firstSeen: previous.firstSeen,
+            lastSeen: timestamp,
+          )
+        : (
+            fingerprint: fingerprint,
+            count: 1,
+            repeats: 0,
+            firstSeen: timestamp,
+            lastSeen: timestamp,
+          );
+    fingerprints[fingerprint] = entry;
+    return (isNew: previous == null, fingerprint: entry, evicted: null);
+  }
+
+  @override
+  List<JankFingerprint> takeSummaries() {
+    final summaries = [
+      for (final entry in fingerprints.values)
+        if (entry.repeats > 0) entry,
+    ];
+    for (final summary in summaries) {
+      fingerprints[summary.fingerprint] = (
+        fingerprint: summary.fingerprint,
+        count: summary.count,
+        repeats: 0,
+        firstSeen: summary.firstSeen,
+        lastSeen: summary.lastSeen,
+      );
+    }
+    return summaries;
+  }
+
+  @override
+  void dispose() {
+    isDisposed = true;
+  }
+}
+
 void main() {
   final glanceWidgetBinding = GlanceWidgetBinding.ensureInitialized();
 
@@ -116,6 +292,102 @@ void main() {
       expect(onCheckJankCalled, isTrue);
     });
 
+    test('do not change the tree of the pipeline owners to mark the phases', () {
+      int countPipelineOwners() {
+        int count = 0;
+        glanceWidgetBinding.rootPipelineOwner.visitChildren((_) => ++count);
+        return count;
+      }
+
+      final pipelineOwners = countPipelineOwners();
+      glanceWidgetBinding.onFramePhase = (phase, frameNumber) {};
+      glanceWidgetBinding.handleBeginFrame(const Duration());
+      glanceWidgetBinding.handleDrawFrame();
+      glanceWidgetBinding.onFramePhase = null;
+      expect(countPipelineOwners(), pipelineOwners);
+    });
+
+    test('mark the phases of a frame', () {
+      final phases = <(FramePhase, int)>[];
+      glanceWidgetBinding.onFramePhase = (phase, frameNumber) {
+        phases.add((phase, frameNumber));
+      };
+
+      glanceWidgetBinding.handleBeginFrame(const Duration());
+      glanceWidgetBinding.handleDrawFrame();
+      glanceWidgetBinding.onFramePhase = null;
+
+      final frameNumber = phases.first.$2;
+      expect(phases, [
+        (FramePhase.animate, frameNumber),
+        (FramePhase.build, frameNumber),
+        (FramePhase.layout, frameNumber),
+        (FramePhase.paint, frameNumber),
+        (FramePhase.postFrame, frameNumber),
+        (FramePhase.idle, frameNumber),
+      ]);
+
+      phases.clear();
+      glanceWidgetBinding.onFramePhase = (phase, frameNumber) {
+        phases.add((phase, frameNumber));
+      };
+      glanceWidgetBinding.handleBeginFrame(const Duration());
+      glanceWidgetBinding.handleDrawFrame();
+      glanceWidgetBinding.onFramePhase = null;
+      expect(phases.first, (FramePhase.animate, frameNumber + 1));
+    });
+
+    test('mark the phase of traceFunctionCall and restore it after', () {
+      final phases = <FramePhase>[];
+      glanceWidgetBinding.onFramePhase = (phase, frameNumber) {
+        phases.add(phase);
+      };
+
+      glanceWidgetBinding.traceFunctionCall(() {});
+      glanceWidgetBinding.handlePointerEvent(const PointerAddedEvent());
+      glanceWidgetBinding.onFramePhase = null;
+
+      expect(phases, [
+        FramePhase.platformEvent,
+        FramePhase.idle,
+        FramePhase.input,
+        FramePhase.idle,
+      ]);
+    });
+
+    test('mark a frame as a task', () {
+      final tasks = <String>[];
+      glanceWidgetBinding.onTaskBegin = () => tasks.add('begin');
+      glanceWidgetBinding.onTaskEnd = () => tasks.add('end');
+
+      glanceWidgetBinding.handleBeginFrame(const Duration());
+      expect(tasks, ['begin']);
+      // A handler within the frame is a part of it.
+      glanceWidgetBinding.traceFunctionCall(() {});
+      expect(tasks, ['begin']);
+      glanceWidgetBinding.handleDrawFrame();
+      glanceWidgetBinding.onTaskBegin = null;
+      glanceWidgetBinding.onTaskEnd = null;
+
+      expect(tasks, ['begin', 'end']);
+    });
+
+    test('mark traceFunctionCall as a task even if it throws', () {
+      final tasks = <String>[];
+      glanceWidgetBinding.onTaskBegin = () => tasks.add('begin');
+      glanceWidgetBinding.onTaskEnd = () => tasks.add('end');
+
+      glanceWidgetBinding.handlePointerEvent(const PointerAddedEvent());
+      expect(
+        () => glanceWidgetBinding.traceFunctionCall(() => throw StateError('')),
+        throwsStateError,
+      );
+      glanceWidgetBinding.onTaskBegin = null;
+      glanceWidgetBinding.onTaskEnd = null;
+
+      expect(tasks, ['begin', 'end', 'begin', 'end']);
+    });
+
     test('called onCheckJank after calling handleMetricsChanged', () {
       bool onCheckJankCalled = false;
       glanceWidgetBinding.onCheckJank = (int start, int end) {
@@ -355,6 +627,414 @@ void main() {
     },
   );
 
+  test('Mark the frames on the sampler if adaptiveSampleRate is true', () async {
+    await glance.start(
+      config: const GlanceConfiguration(adaptiveSampleRate: true),
+    );
+
+    glanceWidgetBinding.handleBeginFrame(const Duration());
+    glanceWidgetBinding.handleDrawFrame();
+    expect(sampler.frameBeginCount, 1);
+    expect(sampler.frameEndCount, 1);
+
+    await glance.end();
+    expect(glanceWidgetBinding.onFrameBegin, isNull);
+    expect(glanceWidgetBinding.onFrameEnd, isNull);
+  });
+
+  test('Mark the frame phases on the sampler if markFramePhases is true', () async {
+    final reportCompleter = Completer<JankReport>();
+    await glance.start(
+      config: GlanceConfiguration(
+        jankThreshold: 1,
+        markFramePhases: true,
+        reporters: [
+          TestJankDetectedReporter((info) {
+            if (!reportCompleter.isCompleted) {
+              reportCompleter.complete(info);
+            }
+          }),
+        ],
+      ),
+    );
+
+    glanceWidgetBinding.handleBeginFrame(const Duration());
+    glanceWidgetBinding.handleDrawFrame();
+    expect(
+      sampler.setFramePhases.map((e) => e.$1),
+      containsAllInOrder([
+        FramePhase.animate,
+        FramePhase.build,
+        FramePhase.layout,
+        FramePhase.idle,
+      ]),
+    );
+
+    const framePhases = {FramePhase.build: 1, FramePhase.layout: 4};
+    sampler.frames = [
+      AggregatedNativeFrame(NativeFrame(pc: 0x2050, timestamp: Timeline.now)),
+    ];
+    sampler.framePhases = framePhases;
+    final now = Timeline.now - 2000;
+    glanceWidgetBinding.onCheckJank!(now - 3000, now);
+
+    final report = await reportCompleter.future;
+    expect(report.framePhases, framePhases);
+
+    await glance.end();
+    expect(glanceWidgetBinding.onFramePhase, isNull);
+  });
+
+  test('Mark the tasks on the sampler if the watchdog is enabled', () async {
+    await glance.start(
+      config: GlanceConfiguration(
+        watchdogTimeoutInMilliseconds: 2000,
+        onUiThreadFrozen: (_) {},
+      ),
+    );
+
+    glanceWidgetBinding.handleBeginFrame(const Duration());
+    glanceWidgetBinding.handleDrawFrame();
+    glanceWidgetBinding.handlePointerEvent(const PointerAddedEvent());
+    expect(sampler.uiTaskBeginCount, 2);
+    expect(sampler.uiTaskEndCount, 2);
+
+    await glance.end();
+    expect(glanceWidgetBinding.onTaskBegin, isNull);
+    expect(glanceWidgetBinding.onTaskEnd, isNull);
+  });
+
+  test('Do not mark the tasks without onUiThreadFrozen', () async {
+    await glance.start(
+      config: const GlanceConfiguration(watchdogTimeoutInMilliseconds: 2000),
+    );
+
+    glanceWidgetBinding.handlePointerEvent(const PointerAddedEvent());
+    expect(sampler.uiTaskBeginCount, 0);
+
+    await glance.end();
+  });
+
+  test('watchdogReportCallback reports the freeze', () {
+    final frame = AggregatedNativeFrame(
+      NativeFrame(pc: 0x1100, timestamp: 0),
+      occurTimes: 3,
+    );
+    const info = DartStackTraceInfo(0x1000, ['build_id: \'abc\'']);
+    final reports = <JankReport>[];
+
+    GlanceImpl.watchdogReportCallback(info, reports.add)(
+      WatchdogReport(
+        freezeId: 1,
+        frozenInMicroseconds: 4000000,
+        reportIndex: 1,
+        frames: [frame],
+      ),
+    );
+
+    expect(reports, [
+      JankReport(
+        stackTrace: GlanceStackTraceImpl([frame], info),
+        frozenDuration: const Duration(seconds: 4),
+      ),
+    ]);
+  });
+
+  test('Report the recovered samples on start', () async {
+    final frame = AggregatedNativeFrame(
+      NativeFrame(
+        pc: 0x1100,
+        timestamp: 0,
+        module: NativeModule(
+          id: 0,
+          path: 'libapp.so',
+          baseAddress: 0x1000,
+          symbolName: '',
+        ),
+      ),
+      occurTimes: 5,
+    );
+    sampler.recoveredSamples = RecoveredSamples(
+      frames: [frame],
+      isolateInstructions: 0x1000,
+      headerLines: const ['build_id: \'abc\''],
+    );
+
+    final reports = <JankReport>[];
+    await glance.start(
+      config: GlanceConfiguration(
+        reporters: [TestJankDetectedReporter(reports.add)],
+        persistentSamplesPath: 'samples.bin',
+      ),
+    );
+
+    expect(reports.length, 1);
+    expect(reports[0].isRecovered, isTrue);
+    expect(
+      reports[0].stackTrace,
+      GlanceStackTraceImpl(
+        [frame],
+        const DartStackTraceInfo(0x1000, ['build_id: \'abc\'']),
+      ),
+    );
+    expect(sampler.recoveredSamples, isNull);
+
+    await glance.end();
+  });
+
+  test('Use the DartImageInfo read natively on start', () async {
+    glance = GlanceImpl.forTesting(
+      sampler,
+      loadDartImageInfo: () => const DartImageInfo(
+        buildId: 'abc',
+        isolateDsoBase: 0x1000,
+        vmDsoBase: 0x1000,
+        isolateInstructions: 0x2000,
+        vmInstructions: 0x1800,
+      ),
+    );
+
+    final reportCompleter = Completer<JankReport>();
+    await glance.start(
+      config: GlanceConfiguration(
+        jankThreshold: 1,
+        reporters: [
+          TestJankDetectedReporter((info) {
+            if (!reportCompleter.isCompleted) {
+              reportCompleter.complete(info);
+            }
+          }),
+        ],
+      ),
+    );
+
+    sampler.frames = [
+      AggregatedNativeFrame(NativeFrame(pc: 0x2010, timestamp: Timeline.now)),
+    ];
+    final now = Timeline.now - 2000;
+    glanceWidgetBinding.onCheckJank!(now - 3000, now);
+
+    final report = await reportCompleter.future;
+    final stackTrace = report.stackTrace as GlanceStackTraceImpl;
+    expect(stackTrace.dartStackTraceInfo.isolateInstructions, 0x2000);
+    expect(stackTrace.dartStackTraceInfo.dartStackTraceHeaderLines, [
+      kGlanceStackTraceHeaderLine,
+      'build_id: \'abc\'',
+      'isolate_dso_base: 1000, vm_dso_base: 1000',
+      'isolate_instructions: 2000, vm_instructions: 1800',
+    ]);
+
+    await glance.end();
+  });
+
+  test('Report the CPU time split if sampleCpuTime is true', () async {
+    final reportCompleter = Completer<JankReport>();
+    await glance.start(
+      config: GlanceConfiguration(
+        jankThreshold: 1,
+        sampleCpuTime: true,
+        reporters: [
+          TestJankDetectedReporter((info) {
+            if (!reportCompleter.isCompleted) {
+              reportCompleter.complete(info);
+            }
+          }),
+        ],
+      ),
+    );
+
+    final onCpu = [
+      AggregatedNativeFrame(
+        NativeFrame(pc: 0x2010, timestamp: Timeline.now),
+        occurTimes: 3,
+      ),
+    ];
+    final offCpu = [
+      AggregatedNativeFrame(
+        NativeFrame(pc: 0x2020, timestamp: Timeline.now),
+        occurTimes: 5,
+      ),
+    ];
+    sampler.frames = [
+      AggregatedNativeFrame(NativeFrame(pc: 0x2030, timestamp: Timeline.now)),
+    ];
+    sampler.cpuTimeSplit = CpuTimeSplit(onCpu: onCpu, offCpu: offCpu);
+    final now = Timeline.now - 2000;
+    glanceWidgetBinding.onCheckJank!(now - 3000, now);
+
+    final report = await reportCompleter.future;
+    expect(
+      report.onCpuStackTrace,
+      GlanceStackTraceImpl(onCpu, const DartStackTraceInfo(0, [])),
+    );
+    expect(
+      report.offCpuStackTrace,
+      GlanceStackTraceImpl(offCpu, const DartStackTraceInfo(0, [])),
+    );
+
+    await glance.end();
+  });
+
+  test('Report the thread state if sampleThreadState is true', () async {
+    final reportCompleter = Completer<JankReport>();
+    await glance.start(
+      config: GlanceConfiguration(
+        jankThreshold: 1,
+        sampleThreadState: true,
+        reporters: [
+          TestJankDetectedReporter((info) {
+            if (!reportCompleter.isCompleted) {
+              reportCompleter.complete(info);
+            }
+          }),
+        ],
+      ),
+    );
+
+    const threadState = ThreadStateSummary(
+      runStates: {'running': 2, 'sleeping': 3},
+      syscalls: {'futex': 3},
+      voluntaryContextSwitches: 4,
+      involuntaryContextSwitches: 1,
+    );
+    sampler.frames = [
+      AggregatedNativeFrame(NativeFrame(pc: 0x2040, timestamp: Timeline.now)),
+    ];
+    sampler.threadStateSummary = threadState;
+    final now = Timeline.now - 2000;
+    glanceWidgetBinding.onCheckJank!(now - 3000, now);
+
+    final report = await reportCompleter.future;
+    expect(report.threadState, threadState);
+    expect(report.onCpuStackTrace, isNull);
+
+    await glance.end();
+  });
+
+  test('Fold the repeated janks if dedupJankReports is true', () async {
+    final jankDeduper = FakeJankDeduper();
+    glance = GlanceImpl.forTesting(
+      sampler,
+      createJankDeduper: () => jankDeduper,
+    );
+    final reports = <JankReport>[];
+    await glance.start(
+      config: GlanceConfiguration(
+        jankThreshold: 1,
+        dedupJankReports: true,
+        reporters: [TestJankDetectedReporter(reports.add)],
+      ),
+    );
+
+    final a = [
+      AggregatedNativeFrame(NativeFrame(pc: 0x2010, timestamp: Timeline.now)),
+    ];
+    final b = [
+      AggregatedNativeFrame(NativeFrame(pc: 0x2020, timestamp: Timeline.now)),
+    ];
+    // The repeats of `a` alternate with `b`.
+    for (final frames in [a, b, a, a]) {
+      sampler.frames = frames;
+      final now = Timeline.now - 2000;
+      glanceWidgetBinding.onCheckJank!(now - 3000, now);
+      await Future.delayed(Duration.zero);
+    }
+
+    expect(reports, [
+      JankReport(
+        stackTrace: GlanceStackTraceImpl(a, const DartStackTraceInfo(0, [])),
+        fingerprint: 0x2010,
+      ),
+      JankReport(
+        stackTrace: GlanceStackTraceImpl(b, const DartStackTraceInfo(0, [])),
+        fingerprint: 0x2020,
+      ),
+    ]);
+
+    // The repeats are summarized on end.
+    await glance.end();
+    expect(reports.length, 3);
+    final summary = reports.last;
+    final fingerprint = jankDeduper.fingerprints[0x2010]!;
+    expect(
+      summary,
+      JankReport(
+        stackTrace: GlanceStackTraceImpl(a, const DartStackTraceInfo(0, [])),
+        fingerprint: 0x2010,
+        occurrences: 2,
+        isSummary: true,
+        firstSeen: DateTime.fromMicrosecondsSinceEpoch(fingerprint.firstSeen),
+        lastSeen: DateTime.fromMicrosecondsSinceEpoch(fingerprint.lastSeen),
+      ),
+    );
+    expect(summary.firstSeen!.isAfter(summary.lastSeen!), isFalse);
+    expect(jankDeduper.isDisposed, isTrue);
+  });
+
+  test('Report the summaries of the repeated janks periodically', () async {
+    final jankDeduper = FakeJankDeduper();
+    glance = GlanceImpl.forTesting(
+      sampler,
+      createJankDeduper: () => jankDeduper,
+    );
+    final summaryCompleter = Completer<JankReport>();
+    await glance.start(
+      config: GlanceConfiguration(
+        jankThreshold: 1,
+        dedupJankReports: true,
+        jankSummaryIntervalInMilliseconds: 10,
+        reporters: [
+          TestJankDetectedReporter((info) {
+            if (info.isSummary && !summaryCompleter.isCompleted) {
+              summaryCompleter.complete(info);
+            }
+          }),
+        ],
+      ),
+    );
+
+    sampler.frames = [
+      AggregatedNativeFrame(NativeFrame(pc: 0x2010, timestamp: Timeline.now)),
+    ];
+    // Reported within the same event loop turn, before the timer.
+    for (int i = 0; i < 3; ++i) {
+      final now = Timeline.now - 2000;
+      glanceWidgetBinding.onCheckJank!(now - 3000, now);
+    }
+
+    final summary = await summaryCompleter.future;
+    expect(summary.fingerprint, 0x2010);
+    expect(summary.occurrences, 2);
+    expect(jankDeduper.fingerprints[0x2010]!.repeats, 0);
+
+    await glance.end();
+  });
+
+  test('getSamplerStats returns the stats of the Sampler', () {
+    expect(glance.getSamplerStats(), same(sampler.samplerStats));
+  });
+
+  test('GlanceNoOpImpl.getSamplerStats returns null', () {
+    expect(GlanceNoOpImpl().getSamplerStats(), isNull);
+  });
+
+  test('exportProfile exports the profile of the Sampler', () async {
+    expect(await glance.exportProfile(), [1, 2, 3]);
+    expect(sampler.exportedProfile!.format, ProfileFormat.pprof);
+    expect(sampler.exportedProfile!.timestampRange, isNull);
+
+    await glance.exportProfile(
+      format: ProfileFormat.collapsed,
+      timestampRange: [100, 200],
+    );
+    expect(sampler.exportedProfile!.format, ProfileFormat.collapsed);
+    expect(sampler.exportedProfile!.timestampRange, [100, 200]);
+  });
+
+  test('GlanceNoOpImpl.exportProfile returns null', () async {
+    expect(await GlanceNoOpImpl().exportProfile(), isNull);
+  });
+
   test('Call Sampler.close after calling end', () async {
     glance.start();
     await glance.end();
@@ -498,6 +1178,39 @@ isolate_instructions: 100, vm_instructions: 1016bc000
       },
     );
 
+    test(
+      'GlanceStackTraceImpl.toString numbers the call paths separately',
+      () {
+        final module = NativeModule(
+          id: 1,
+          path: 'libapp.so',
+          baseAddress: 540641718272,
+          symbolName: 'hello',
+        );
+        AggregatedNativeFrame frame(int pc, int pathDepth) =>
+            AggregatedNativeFrame(
+              NativeFrame(pc: pc, timestamp: Timeline.now, module: module),
+              pathDepth: pathDepth,
+            );
+        final stackTrace = GlanceStackTraceImpl([
+          frame(110, 0),
+          frame(120, 1),
+          frame(130, 0),
+          frame(120, 1),
+        ], const DartStackTraceInfo(0, []));
+
+        const expectedStackTrace = '''
+*** *** *** *** *** *** *** *** *** *** *** *** *** *** *** ***
+    #00 abs 000000000000006e _kDartIsolateSnapshotInstructions
+    #01 abs 0000000000000078 _kDartIsolateSnapshotInstructions
+    #00 abs 0000000000000082 _kDartIsolateSnapshotInstructions
+    #01 abs 0000000000000078 _kDartIsolateSnapshotInstructions
+''';
+
+        expect(stackTrace.toString(), expectedStackTrace);
+      },
+    );
+
     test('Able to parseDartStackTraceInfo', () async {
       final fakeDartStackTrace =
           '''
@@ -532,6 +1245,7 @@ isolate_instructions: 100, vm_instructions: 1016bc000
         info.dartStackTraceHeaderLines,
         equals(expectedDartStackTraceHeaderLines),
       );
+      expect(info.buildId, 'a8a967193ee33ac7a4852e7160590972');
     });
 
     test('check equals', () {
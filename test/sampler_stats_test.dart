@@ -0,0 +1,94 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:glance/src/sampler_stats.dart';
+
+SamplerHistogram _histogram(List<int> buckets, {int max = 0}) {
+  int count = 0;
+  for (final bucket in buckets) {
+    count += bucket;
+  }
+  return SamplerHistogram(count: count, sum: 0, max: max, buckets: buckets);
+}
+
+void main() {
+  group('SamplerHistogram', () {
+    test('valueAtPercentile returns 0 if empty', () {
+      expect(_histogram([0, 0, 0]).valueAtPercentile(0.5), 0);
+    });
+
+    test('valueAtPercentile returns the upper bound of the bucket', () {
+      // 1 value in [1, 2), 8 values in [4, 8), 1 value in [512, 1024).
+      final histogram = _histogram([
+        0,
+        1,
+        0,
+        8,
+        0,
+        0,
+        0,
+        0,
+        0,
+        0,
+        1,
+      ], max: 1000);
+      expect(histogram.valueAtPercentile(0.1), 1);
+      expect(histogram.valueAtPercentile(0.5), 7);
+      expect(histogram.valueAtPercentile(0.9), 7);
+      expect(histogram.valueAtPercentile(0.99), 1000);
+      expect(histogram.valueAtPercentile(1), 1000);
+    });
+
+    test('subtract', () {
+      final previous = SamplerHistogram(
+        count: 2,
+        sum: 10,
+        max: 6,
+        buckets: [0, 0, 1, 1],
+      );
+      final current = SamplerHistogram(
+        count: 5,
+        sum: 40,
+        max: 12,
+        buckets: [0, 0, 2, 2, 1],
+      );
+
+      final diff = current - previous;
+      expect(diff.count, 3);
+      expect(diff.sum, 30);
+      expect(diff.max, 12);
+      expect(diff.buckets, [0, 0, 1, 1, 1]);
+    });
+  });
+
+  group('SamplerStats', () {
+    test('subtract', () {
+      final empty = _histogram([0]);
+      final previous = SamplerStats(
+        samplesAttempted: 10,
+        samplesSucceeded: 8,
+        samplesTimedOut: 1,
+        samplesFailed: 1,
+        framesTruncated: 2,
+        signalDeliveryInNanoseconds: empty,
+        targetPauseInNanoseconds: empty,
+        walkDepth: empty,
+      );
+      final current = SamplerStats(
+        samplesAttempted: 30,
+        samplesSucceeded: 25,
+        samplesTimedOut: 3,
+        samplesFailed: 2,
+        framesTruncated: 2,
+        signalDeliveryInNanoseconds: empty,
+        targetPauseInNanoseconds: empty,
+        walkDepth: empty,
+      );
+
+      final diff = current - previous;
+      expect(diff.samplesAttempted, 20);
+      expect(diff.samplesSucceeded, 17);
+      expect(diff.samplesTimedOut, 2);
+      expect(diff.samplesFailed, 1);
+      expect(diff.framesTruncated, 0);
+    });
+  });
+}
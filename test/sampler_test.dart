@@ -1,11 +1,14 @@
 import 'dart:developer';
 import 'dart:isolate';
+import 'dart:typed_data';
 
 import 'package:fake_async/fake_async.dart';
 import 'package:flutter_test/flutter_test.dart';
+import 'package:glance/src/calling_context_tree.dart';
 import 'package:glance/src/collect_stack.dart';
 import 'package:glance/src/constants.dart';
 import 'package:glance/src/sampler.dart';
+import 'package:glance/src/sampler_stats.dart';
 
 class _FakeSamplerProcessor implements SamplerProcessor {
   _FakeSamplerProcessor(this.sendPort, this.frames);
@@ -26,6 +29,33 @@ class _FakeSamplerProcessor implements SamplerProcessor {
     stackTraceSendPort.send(GetSamplesResponse(id++, frames));
   }
 
+  @override
+  void getCpuTimeSplit(
+    SendPort sendPort,
+    int messageId,
+    List<int> timestampRange,
+  ) {
+    sendPort.send(GetCpuTimeSplitResponse(messageId, null));
+  }
+
+  @override
+  void getThreadStateSummary(
+    SendPort sendPort,
+    int messageId,
+    List<int> timestampRange,
+  ) {
+    sendPort.send(GetThreadStateResponse(messageId, null));
+  }
+
+  @override
+  void getFramePhases(
+    SendPort sendPort,
+    int messageId,
+    List<int> timestampRange,
+  ) {
+    sendPort.send(GetFramePhasesResponse(messageId, null));
+  }
+
   @override
   Future<void> loop() async {
     sendPort.send('loop');
@@ -36,6 +66,40 @@ class _FakeSamplerProcessor implements SamplerProcessor {
     sendPort.send('setCurrentThreadAsTarget');
   }
 
+  @override
+  SamplerStats getSamplerStats() => throw UnimplementedError();
+
+  @override
+  void markFrameBegin() {}
+
+  @override
+  void markFrameEnd() {}
+
+  @override
+  void setFramePhase(FramePhase phase, int frameNumber) {}
+
+  @override
+  void markUiTaskBegin() {}
+
+  @override
+  void markUiTaskEnd() {}
+
+  @override
+  void requestSampleBurst() {}
+
+  @override
+  RecoveredSamples? recoverPersistedSamples() => null;
+
+  @override
+  void exportProfile(
+    SendPort sendPort,
+    int messageId,
+    ProfileFormat format,
+    List<int>? timestampRange,
+  ) {
+    sendPort.send(ExportProfileResponse(messageId, null));
+  }
+
   @override
   void close() {
     sendPort.send('close');
@@ -71,7 +135,41 @@ class FakeStackCapturer implements StackCapturer {
   bool isCaptureStackOfTargetThread = false;
   bool isSetCurrentThreadAsTarget = false;
   bool isDisposed = false;
+  bool isNativeSamplerSupported = false;
+  bool isNativeSamplerStarted = false;
   NativeStack nativeStack = NativeStack(frames: [], modules: []);
+  List<NativeStack> nativeSamples = [];
+  List<({NativeFrame frame, int occurTimes})> nativeAggregatedFrames = [];
+  int? aggregateOccurTimesThreshold;
+  int? collectStackTimeoutInMicros;
+  int? stackCopySizeInBytes;
+  bool? unwindTablesEnabled;
+  bool? nativeSamplerPerfEventsEnabled;
+  int? nativeSamplerCpuTimeSampleRate;
+  bool? nativeSamplerSchedStateEnabled;
+  List<int>? nativeSamplerBurst;
+  int frameBeginCount = 0;
+  int frameEndCount = 0;
+  (FramePhase, int)? framePhase;
+  int? watchdogTimeoutInMicros;
+  bool isWatchdogStarted = false;
+  List<({int freezeId, int frozenInMicros, int reportIndex, NativeStack stack})>
+  watchdogReports = [];
+  int uiTaskBeginCount = 0;
+  int uiTaskEndCount = 0;
+  int burstRequestCount = 0;
+  bool isPersistentFileSupported = true;
+  String? persistentFilePath;
+  List<Object>? persistentFileHeader;
+  ({
+    bool cleanShutdown,
+    int isolateInstructions,
+    List<String> headerLines,
+    List<NativeStack> stacks,
+  })?
+  persistedSamples;
+  int? persistedSamplesWindowInMicros;
+  ({ProfileFormat format, List<int> timestampRange})? exportedProfile;
 
   @override
   NativeStack captureStackOfTargetThread() {
@@ -84,6 +182,183 @@ class FakeStackCapturer implements StackCapturer {
     isSetCurrentThreadAsTarget = true;
   }
 
+  @override
+  int registerCurrentThread(String name) => 0;
+
+  @override
+  void unregisterCurrentThread() {}
+
+  @override
+  List<({int threadId, String threadName, NativeStack stack})>
+  captureStacksOfAllThreads() => [];
+
+  @override
+  void setModulePathFilters(List<String> modulePathFilters) {}
+
+  @override
+  void setStackCopySize(int sizeInBytes) {
+    stackCopySizeInBytes = sizeInBytes;
+  }
+
+  @override
+  void setUnwindTablesEnabled(bool enabled) {
+    unwindTablesEnabled = enabled;
+  }
+
+  @override
+  void setNativeSamplerPerfEventsEnabled(bool enabled) {
+    nativeSamplerPerfEventsEnabled = enabled;
+  }
+
+  @override
+  void setNativeSamplerCpuTimeSampleRate(int rateInMicros) {
+    nativeSamplerCpuTimeSampleRate = rateInMicros;
+  }
+
+  @override
+  void setNativeSamplerSchedStateEnabled(bool enabled) {
+    nativeSamplerSchedStateEnabled = enabled;
+  }
+
+  @override
+  String? getSyscallName(int number) {
+    return number == 202 ? 'futex' : null;
+  }
+
+  @override
+  void setCollectStackTimeout(int timeoutInMicros) {
+    collectStackTimeoutInMicros = timeoutInMicros;
+  }
+
+  @override
+  SamplerStats getSamplerStats() => throw UnimplementedError();
+
+  @override
+  void setNativeSamplerBurst(
+    int burstRateInMicros,
+    int burstDurationInMicros,
+    int frameBudgetInMicros,
+  ) {
+    nativeSamplerBurst = [
+      burstRateInMicros,
+      burstDurationInMicros,
+      frameBudgetInMicros,
+    ];
+  }
+
+  @override
+  void requestNativeSamplerBurst() {
+    burstRequestCount++;
+  }
+
+  @override
+  void setNativeSamplerPersistentFile(
+    String? path,
+    int isolateInstructions,
+    List<String> headerLines,
+  ) {
+    persistentFilePath = path;
+    persistentFileHeader = [isolateInstructions, headerLines];
+  }
+
+  @override
+  ({
+    bool cleanShutdown,
+    int isolateInstructions,
+    List<String> headerLines,
+    List<NativeStack> stacks,
+  })?
+  loadPersistedSamples(String path, int windowInMicros) {
+    persistedSamplesWindowInMicros = windowInMicros;
+    return persistedSamples;
+  }
+
+  @override
+  void markFrameBegin() {
+    frameBeginCount++;
+  }
+
+  @override
+  void markFrameEnd() {
+    frameEndCount++;
+  }
+
+  @override
+  void setFramePhase(FramePhase phase, int frameNumber) {
+    framePhase = (phase, frameNumber);
+  }
+
+  @override
+  bool startWatchdog(int timeoutInMicros) {
+    watchdogTimeoutInMicros = timeoutInMicros;
+    isWatchdogStarted = true;
+    return true;
+  }
+
+  @override
+  void stopWatchdog() {
+    isWatchdogStarted = false;
+  }
+
+  @override
+  List<({int freezeId, int frozenInMicros, int reportIndex, NativeStack stack})>
+  takeWatchdogReports() {
+    final reports = watchdogReports;
+    watchdogReports = [];
+    return reports;
+  }
+
+  @override
+  void markUiTaskBegin() {
+    uiTaskBeginCount++;
+  }
+
+  @override
+  void markUiTaskEnd() {
+    uiTaskEndCount++;
+  }
+
+  @override
+  bool startNativeSampler(
+    int sampleRateInMicros,
+    int windowInMicros,
+    int memoryBudgetInBytes,
+  ) {
+    isNativeSamplerStarted =
+        isNativeSamplerSupported &&
+        (persistentFilePath == null || isPersistentFileSupported);
+    return isNativeSamplerStarted;
+  }
+
+  @override
+  void stopNativeSampler() {
+    isNativeSamplerStarted = false;
+  }
+
+  @override
+  List<NativeStack> readNativeSamples(List<int> timestampRange) {
+    return nativeSamples;
+  }
+
+  @override
+  List<({NativeFrame frame, int occurTimes})> aggregateNativeSamples(
+    List<int> timestampRange,
+    int occurTimesThreshold,
+    int maxCount,
+  ) {
+    aggregateOccurTimesThreshold = occurTimesThreshold;
+    return nativeAggregatedFrames.take(maxCount).toList();
+  }
+
+  @override
+  Uint8List? exportNativeSamplerProfile(
+    ProfileFormat format,
+    List<int> timestampRange,
+  ) {
+    exportedProfile = (format: format, timestampRange: timestampRange);
+    return Uint8List.fromList([1, 2, 3]);
+  }
+
   @override
   void dispose() {
     isDisposed = true;
@@ -264,6 +539,63 @@ void main() {
       });
     });
 
+    test(
+      'getStackTrace aggregates the native samples into a calling-context tree',
+      () async {
+        stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+        samplerProcessor = SamplerProcessor(
+          SamplerConfig(
+            jankThreshold: 1,
+            stackAggregation: StackAggregation.callingContextTree,
+          ),
+          stackCapturer,
+        );
+        final module = NativeModule(
+          id: 1,
+          path: 'libapp.so',
+          baseAddress: 0x1000,
+          symbolName: '',
+        );
+        NativeStack stack(List<int> pcs) => NativeStack(
+          frames: [
+            for (final pc in pcs)
+              NativeFrame(pc: pc, timestamp: 100, module: module),
+          ],
+          modules: [module],
+        );
+        stackCapturer.nativeSamples = [
+          stack([0x1300, 0x1200, 0x1100]),
+          stack([0x1300, 0x1200, 0x1100]),
+          stack([0x1200, 0x1100]),
+        ];
+
+        await samplerProcessor.loop();
+        expect(stackCapturer.isNativeSamplerStarted, isTrue);
+
+        final receivePort = ReceivePort();
+        final response = receivePort.take(1);
+        await samplerProcessor.getStackTrace(receivePort.sendPort, 1, [
+          0,
+          1000,
+        ]);
+        final stackTraces =
+            (await response.cast<GetSamplesResponse>().first).data;
+
+        // The heaviest path first, each path from the innermost frame.
+        expect(stackTraces.map((e) => e.frame.pc), [
+          0x1300,
+          0x1200,
+          0x1100,
+          0x1200,
+          0x1100,
+        ]);
+        expect(stackTraces.map((e) => e.pathDepth), [0, 1, 2, 0, 1]);
+        expect(stackTraces.map((e) => e.selfOccurTimes), [2, 1, 0, 1, 0]);
+        expect(stackTraces.map((e) => e.occurTimes), [2, 3, 3, 3, 3]);
+        samplerProcessor.close();
+      },
+    );
+
     test('getStackTrace throw error if not call loop', () {
       stackCapturer = FakeStackCapturer();
       samplerProcessor = SamplerProcessor(
@@ -436,6 +768,558 @@ void main() {
       expect(stackTraces[2].frame, frame2);
     });
 
+    test('loop with native sampler', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1, sampleRateInMilliseconds: 1000),
+        stackCapturer,
+      );
+      final now = Timeline.now;
+      final module = NativeModule(
+        id: 1,
+        path: 'libapp.so',
+        baseAddress: 540641718272,
+        symbolName: 'hello',
+      );
+      final frame1 = NativeFrame(pc: 1, timestamp: now - 100, module: module);
+      final frame2 = NativeFrame(pc: 2, timestamp: now - 100, module: module);
+      stackCapturer.nativeAggregatedFrames = [
+        (frame: frame1, occurTimes: 2),
+        (frame: frame2, occurTimes: 3),
+      ];
+
+      samplerProcessor.setCurrentThreadAsTarget();
+      await samplerProcessor.loop();
+      expect(stackCapturer.isNativeSamplerStarted, isTrue);
+      expect(stackCapturer.isCaptureStackOfTargetThread, isFalse);
+      expect(
+        stackCapturer.collectStackTimeoutInMicros,
+        kDefaultCollectStackTimeoutInMicroseconds,
+      );
+      expect(stackCapturer.stackCopySizeInBytes, 0);
+      expect(stackCapturer.unwindTablesEnabled, isNull);
+      expect(stackCapturer.nativeSamplerPerfEventsEnabled, isFalse);
+      expect(stackCapturer.nativeSamplerCpuTimeSampleRate, 0);
+      expect(stackCapturer.nativeSamplerSchedStateEnabled, isFalse);
+      expect(stackCapturer.nativeSamplerBurst, [
+        0,
+        kDefaultBurstDurationInMilliseconds * 1000,
+        1000,
+      ]);
+
+      final receivePort = ReceivePort();
+      final response = receivePort.take(1);
+      await samplerProcessor.getStackTrace(receivePort.sendPort, 1, [
+        now - 1000,
+        now,
+      ]);
+      final stackTraces =
+          (await response.cast<GetSamplesResponse>().first).data;
+
+      samplerProcessor.close();
+      expect(stackCapturer.isNativeSamplerStarted, isFalse);
+
+      expect(stackCapturer.aggregateOccurTimesThreshold, 0);
+      expect(stackTraces.length, 2);
+      expect(stackTraces[0].frame, frame1);
+      expect(stackTraces[0].occurTimes, 2);
+      expect(stackTraces[1].frame, frame2);
+      expect(stackTraces[1].occurTimes, 3);
+    });
+
+    test('loop with unwind tables', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1, useUnwindTables: true),
+        stackCapturer,
+      );
+
+      await samplerProcessor.loop();
+      expect(stackCapturer.unwindTablesEnabled, isTrue);
+      samplerProcessor.close();
+    });
+
+    test('loop with perf events', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1, usePerfEvents: true),
+        stackCapturer,
+      );
+
+      await samplerProcessor.loop();
+      expect(stackCapturer.isNativeSamplerStarted, isTrue);
+      expect(stackCapturer.nativeSamplerPerfEventsEnabled, isTrue);
+      samplerProcessor.close();
+    });
+
+    test('loop with cpu time sampling', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1, cpuTimeSampleRateInMicroseconds: 1000),
+        stackCapturer,
+      );
+
+      await samplerProcessor.loop();
+      expect(stackCapturer.nativeSamplerCpuTimeSampleRate, 1000);
+      samplerProcessor.close();
+    });
+
+    test('loop with cpu time sampling and perf events', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(
+          jankThreshold: 1,
+          usePerfEvents: true,
+          cpuTimeSampleRateInMicroseconds: 1000,
+        ),
+        stackCapturer,
+      );
+
+      await samplerProcessor.loop();
+      // The samples of the perf events are all CPU ticks already.
+      expect(stackCapturer.nativeSamplerCpuTimeSampleRate, 0);
+      samplerProcessor.close();
+    });
+
+    test('loop with sched state', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1, readSchedState: true),
+        stackCapturer,
+      );
+
+      await samplerProcessor.loop();
+      expect(stackCapturer.nativeSamplerSchedStateEnabled, isTrue);
+      samplerProcessor.close();
+    });
+
+    test('loop with sched state and perf events', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(
+          jankThreshold: 1,
+          usePerfEvents: true,
+          readSchedState: true,
+        ),
+        stackCapturer,
+      );
+
+      await samplerProcessor.loop();
+      // The perf events are only sampled while the thread is running.
+      expect(stackCapturer.nativeSamplerSchedStateEnabled, isFalse);
+      samplerProcessor.close();
+    });
+
+    test('getThreadStateSummary', () async {
+      final frame = NativeFrame(pc: 0x1200, timestamp: 100);
+      stackCapturer = FakeStackCapturer()
+        ..isNativeSamplerSupported = true
+        ..nativeSamples = [
+          NativeStack(
+            frames: [frame],
+            modules: [],
+            syscall: 202,
+            runState: 'S'.codeUnitAt(0),
+            voluntaryContextSwitches: 3,
+          ),
+          // The CPU ticks are not counted.
+          NativeStack(
+            frames: [frame],
+            modules: [],
+            isCpuTick: true,
+            runState: 'R'.codeUnitAt(0),
+          ),
+        ];
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1, readSchedState: true),
+        stackCapturer,
+      );
+      await samplerProcessor.loop();
+
+      final receivePort = ReceivePort();
+      final response = receivePort.take(1);
+      samplerProcessor.getThreadStateSummary(receivePort.sendPort, 1, [0, 200]);
+      final summary =
+          (await response.cast<GetThreadStateResponse>().first).data;
+      samplerProcessor.close();
+
+      expect(
+        summary,
+        const ThreadStateSummary(
+          runStates: {'sleeping': 1},
+          syscalls: {'futex': 1},
+          voluntaryContextSwitches: 3,
+          involuntaryContextSwitches: 0,
+        ),
+      );
+    });
+
+    test('getThreadStateSummary returns null if not read', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1),
+        stackCapturer,
+      );
+      await samplerProcessor.loop();
+
+      final receivePort = ReceivePort();
+      final response = receivePort.take(1);
+      samplerProcessor.getThreadStateSummary(receivePort.sendPort, 1, [0, 200]);
+      final summary =
+          (await response.cast<GetThreadStateResponse>().first).data;
+      samplerProcessor.close();
+
+      expect(summary, isNull);
+    });
+
+    test('getFramePhases', () async {
+      final frame = NativeFrame(pc: 0x1200, timestamp: 100);
+      stackCapturer = FakeStackCapturer()
+        ..isNativeSamplerSupported = true
+        ..nativeSamples = [
+          NativeStack(
+            frames: [frame],
+            modules: [],
+            framePhase: FramePhase.layout,
+          ),
+          // The CPU ticks are not counted.
+          NativeStack(
+            frames: [frame],
+            modules: [],
+            isCpuTick: true,
+            framePhase: FramePhase.layout,
+          ),
+        ];
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1, markFramePhases: true),
+        stackCapturer,
+      );
+      await samplerProcessor.loop();
+
+      samplerProcessor.setFramePhase(FramePhase.build, 2);
+      expect(stackCapturer.framePhase, (FramePhase.build, 2));
+
+      final receivePort = ReceivePort();
+      final response = receivePort.take(1);
+      samplerProcessor.getFramePhases(receivePort.sendPort, 1, [0, 200]);
+      final phases =
+          (await response.cast<GetFramePhasesResponse>().first).data;
+      samplerProcessor.close();
+
+      expect(phases, {FramePhase.layout: 1});
+    });
+
+    test('getFramePhases returns null if not marked', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1),
+        stackCapturer,
+      );
+      await samplerProcessor.loop();
+
+      final receivePort = ReceivePort();
+      final response = receivePort.take(1);
+      samplerProcessor.getFramePhases(receivePort.sendPort, 1, [0, 200]);
+      final phases =
+          (await response.cast<GetFramePhasesResponse>().first).data;
+      samplerProcessor.close();
+
+      expect(phases, isNull);
+    });
+
+    test('watchdog reports the aggregated samples of the freeze', () {
+      final module = NativeModule(
+        id: 1,
+        path: 'libapp.so',
+        baseAddress: 540641718272,
+        symbolName: 'hello',
+      );
+      final sampledFrame = NativeFrame(
+        pc: 540642472608,
+        timestamp: 150000,
+        module: module,
+      );
+      final reports = <WatchdogReport>[];
+      stackCapturer = FakeStackCapturer()
+        ..isNativeSamplerSupported = true
+        ..nativeAggregatedFrames = [(frame: sampledFrame, occurTimes: 20)];
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(
+          jankThreshold: 1,
+          watchdogTimeoutInMilliseconds: 200,
+          onWatchdogReport: reports.add,
+        ),
+        stackCapturer,
+      );
+
+      fakeAsync((async) {
+        samplerProcessor.loop();
+        expect(stackCapturer.isWatchdogStarted, isTrue);
+        expect(stackCapturer.watchdogTimeoutInMicros, 200000);
+
+        stackCapturer.watchdogReports = [
+          (
+            freezeId: 3,
+            frozenInMicros: 200000,
+            reportIndex: 0,
+            stack: NativeStack(
+              frames: [
+                NativeFrame(
+                  pc: 540642472605,
+                  timestamp: 300000,
+                  module: module,
+                ),
+              ],
+              modules: [module],
+            ),
+          ),
+        ];
+        // Polled every quarter of the timeout.
+        async.elapse(const Duration(milliseconds: 50));
+      });
+
+      expect(reports.length, 1);
+      expect(reports[0].freezeId, 3);
+      expect(reports[0].frozenInMicroseconds, 200000);
+      expect(reports[0].reportIndex, 0);
+      expect(reports[0].frames.length, 1);
+      expect(reports[0].frames[0].frame, sampledFrame);
+      expect(reports[0].frames[0].occurTimes, 20);
+
+      samplerProcessor.close();
+      expect(stackCapturer.isWatchdogStarted, isFalse);
+    });
+
+    test('watchdog reports the stack of the freeze without samples', () {
+      final module = NativeModule(
+        id: 1,
+        path: 'libapp.so',
+        baseAddress: 540641718272,
+        symbolName: 'hello',
+      );
+      final frame = NativeFrame(
+        pc: 540642472605,
+        timestamp: 300000,
+        module: module,
+      );
+      final reports = <WatchdogReport>[];
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(
+          jankThreshold: 1,
+          watchdogTimeoutInMilliseconds: 200,
+          onWatchdogReport: reports.add,
+        ),
+        stackCapturer,
+      );
+
+      fakeAsync((async) {
+        samplerProcessor.loop();
+        stackCapturer.watchdogReports = [
+          (
+            freezeId: 3,
+            frozenInMicros: 200000,
+            reportIndex: 0,
+            stack: NativeStack(
+              // The frames without a module are dropped.
+              frames: [NativeFrame(pc: 0x10, timestamp: 300000), frame],
+              modules: [module],
+            ),
+          ),
+        ];
+        async.elapse(const Duration(milliseconds: 50));
+        samplerProcessor.close();
+      });
+
+      expect(reports.length, 1);
+      expect(reports[0].frames.length, 1);
+      expect(reports[0].frames[0].frame, frame);
+    });
+
+    test('watchdog is not started by default', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1),
+        stackCapturer,
+      );
+      await samplerProcessor.loop();
+      samplerProcessor.markUiTaskBegin();
+      samplerProcessor.markUiTaskEnd();
+      samplerProcessor.close();
+
+      expect(stackCapturer.watchdogTimeoutInMicros, isNull);
+      // The tasks are still marked, which is a cheap native call.
+      expect(stackCapturer.uiTaskBeginCount, 1);
+      expect(stackCapturer.uiTaskEndCount, 1);
+    });
+
+    test('loop with persistent samples', () async {
+      stackCapturer = FakeStackCapturer()..isNativeSamplerSupported = true;
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(
+          jankThreshold: 1,
+          persistentSamplesPath: 'samples.bin',
+          persistentSamplesIsolateInstructions: 0x1000,
+          persistentSamplesHeaderLines: const ['build_id: \'abc\''],
+        ),
+        stackCapturer,
+      );
+
+      await samplerProcessor.loop();
+      expect(stackCapturer.isNativeSamplerStarted, isTrue);
+      expect(stackCapturer.persistentFilePath, 'samples.bin');
+      expect(stackCapturer.persistentFileHeader, [
+        0x1000,
+        ['build_id: \'abc\''],
+      ]);
+      samplerProcessor.close();
+    });
+
+    test(
+      'loop keeps the samples in memory if the persistent file fails',
+      () async {
+        stackCapturer = FakeStackCapturer()
+          ..isNativeSamplerSupported = true
+          ..isPersistentFileSupported = false;
+        samplerProcessor = SamplerProcessor(
+          SamplerConfig(jankThreshold: 1, persistentSamplesPath: 'samples.bin'),
+          stackCapturer,
+        );
+
+        await samplerProcessor.loop();
+        expect(stackCapturer.isNativeSamplerStarted, isTrue);
+        expect(stackCapturer.persistentFilePath, isNull);
+        samplerProcessor.close();
+      },
+    );
+
+    group('recoverPersistedSamples', () {
+      final module = NativeModule(
+        id: 0,
+        path: 'libapp.so',
+        baseAddress: 0x1000,
+        symbolName: '',
+      );
+      List<NativeStack> stacks(int count) => List.generate(
+        count,
+        (i) => NativeStack(
+          frames: [
+            NativeFrame(pc: 0x1100, timestamp: i, module: module),
+            NativeFrame(pc: 0x1200, timestamp: i, module: module),
+          ],
+          modules: [module],
+        ),
+      );
+
+      test('aggregate the samples of an unclean shutdown', () {
+        stackCapturer = FakeStackCapturer()
+          ..persistedSamples = (
+            cleanShutdown: false,
+            isolateInstructions: 0x1000,
+            headerLines: const ['build_id: \'abc\''],
+            stacks: stacks(5),
+          );
+        samplerProcessor = SamplerProcessor(
+          SamplerConfig(
+            jankThreshold: 20,
+            sampleRateInMilliseconds: 10,
+            persistentSamplesPath: 'samples.bin',
+            recoveredSamplesWindowInMilliseconds: 3000,
+          ),
+          stackCapturer,
+        );
+
+        final recovered = samplerProcessor.recoverPersistedSamples()!;
+        expect(stackCapturer.persistedSamplesWindowInMicros, 3000000);
+        expect(recovered.isolateInstructions, 0x1000);
+        expect(recovered.headerLines, ['build_id: \'abc\'']);
+        expect(recovered.frames.length, 2);
+        expect(recovered.frames[0].frame.pc, 0x1100);
+        expect(recovered.frames[0].occurTimes, 5);
+        expect(recovered.frames[1].frame.pc, 0x1200);
+        expect(recovered.frames[1].occurTimes, 5);
+      });
+
+      test('return null after a clean shutdown', () {
+        stackCapturer = FakeStackCapturer()
+          ..persistedSamples = (
+            cleanShutdown: true,
+            isolateInstructions: 0x1000,
+            headerLines: const [],
+            stacks: stacks(5),
+          );
+        samplerProcessor = SamplerProcessor(
+          SamplerConfig(jankThreshold: 1, persistentSamplesPath: 'samples.bin'),
+          stackCapturer,
+        );
+
+        expect(samplerProcessor.recoverPersistedSamples(), isNull);
+      });
+
+      test('return null if persistentSamplesPath is not set', () {
+        stackCapturer = FakeStackCapturer()
+          ..persistedSamples = (
+            cleanShutdown: false,
+            isolateInstructions: 0x1000,
+            headerLines: const [],
+            stacks: stacks(5),
+          );
+        samplerProcessor = SamplerProcessor(
+          SamplerConfig(jankThreshold: 1),
+          stackCapturer,
+        );
+
+        expect(samplerProcessor.recoverPersistedSamples(), isNull);
+        expect(stackCapturer.persistedSamplesWindowInMicros, isNull);
+      });
+    });
+
+    Future<Uint8List?> exportProfile(
+      ProfileFormat format,
+      List<int>? timestampRange,
+    ) async {
+      final receivePort = ReceivePort();
+      final response = receivePort.take(1);
+      samplerProcessor.exportProfile(
+        receivePort.sendPort,
+        1,
+        format,
+        timestampRange,
+      );
+      final data = (await response.cast<ExportProfileResponse>().first).data;
+      return data?.materialize().asUint8List();
+    }
+
+    test('exportProfile exports all the native samples by default', () async {
+      stackCapturer = FakeStackCapturer();
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1),
+        stackCapturer,
+      );
+
+      expect(await exportProfile(ProfileFormat.pprof, null), [1, 2, 3]);
+      expect(stackCapturer.exportedProfile!.format, ProfileFormat.pprof);
+      expect(stackCapturer.exportedProfile!.timestampRange, [
+        0,
+        0x7FFFFFFFFFFFFFFF,
+      ]);
+
+      await exportProfile(ProfileFormat.collapsed, [100, 200]);
+      expect(stackCapturer.exportedProfile!.format, ProfileFormat.collapsed);
+      expect(stackCapturer.exportedProfile!.timestampRange, [100, 200]);
+    });
+
+    test('exportProfile returns null without the native sampler', () async {
+      stackCapturer = FakeStackCapturer();
+      samplerProcessor = SamplerProcessor(
+        SamplerConfig(jankThreshold: 1, useNativeSampler: false),
+        stackCapturer,
+      );
+
+      expect(await exportProfile(ProfileFormat.pprof, null), isNull);
+      expect(stackCapturer.exportedProfile, isNull);
+    });
+
     test('close', () {
       stackCapturer = FakeStackCapturer();
       samplerProcessor = SamplerProcessor(
@@ -447,6 +1331,213 @@ void main() {
       expect(stackCapturer.isDisposed, isTrue);
     });
 
+    group('aggregateCallingContextTree', () {
+      final module = NativeModule(
+        id: 1,
+        path: 'libapp.so',
+        baseAddress: 0x1000,
+        symbolName: '',
+      );
+      NativeStack stack(List<int> pcs, int timestamp) => NativeStack(
+        frames: [
+          for (final pc in pcs)
+            NativeFrame(pc: pc, timestamp: timestamp, module: module),
+        ],
+        modules: [module],
+      );
+
+      test('only aggregate the stacks within the timestamp range', () {
+        final frames = SamplerProcessor.aggregateCallingContextTree(
+          [
+            stack([0x1200, 0x1100], 100),
+            stack([0x1300, 0x1100], 2000),
+          ],
+          [0, 1000],
+        );
+        expect(frames.map((e) => e.frame.pc), [0x1200, 0x1100]);
+        expect(frames.map((e) => e.pathDepth), [0, 1]);
+      });
+
+      test('limit the number of paths', () {
+        final frames = SamplerProcessor.aggregateCallingContextTree(
+          [
+            for (int i = 0; i < kMaxHeaviestPaths + 1; ++i)
+              stack([0x2000 + i, 0x1100], 100),
+          ],
+          [0, 1000],
+        );
+        expect(
+          frames.where((e) => e.pathDepth == 0).length,
+          kMaxHeaviestPaths,
+        );
+      });
+
+      test('limit the number of frames', () {
+        final frames = SamplerProcessor.aggregateCallingContextTree(
+          [
+            stack([
+              for (int i = 0; i < kMaxStackTraces + 10; ++i) 0x2000 + i,
+            ], 100),
+          ],
+          [0, 1000],
+        );
+        expect(frames.length, kMaxStackTraces);
+      });
+    });
+
+    group('splitCpuTime', () {
+      final module = NativeModule(
+        id: 1,
+        path: 'libapp.so',
+        baseAddress: 0x1000,
+        symbolName: '',
+      );
+      NativeStack stack(
+        List<int> pcs,
+        int timestamp, {
+        bool isCpuTick = false,
+      }) => NativeStack(
+        frames: [
+          for (final pc in pcs)
+            NativeFrame(pc: pc, timestamp: timestamp, module: module),
+        ],
+        modules: [module],
+        isCpuTick: isCpuTick,
+      );
+
+      test('split the running and the blocked frames', () {
+        // 0x1200 spins on the CPU, 0x1300 waits for a lock, for 10 wall ticks
+        // of 1000us each.
+        final split = SamplerProcessor.splitCpuTime(
+          [
+            for (int i = 0; i < 5; ++i) stack([0x1200, 0x1100], i * 1000),
+            for (int i = 0; i < 5; ++i)
+              stack([0x1200, 0x1100], i * 1000 + 500, isCpuTick: true),
+            for (int i = 5; i < 10; ++i) stack([0x1300, 0x1100], i * 1000),
+          ],
+          [0, 10000],
+          1000,
+          1000,
+        );
+        expect({for (final e in split.onCpu) e.frame.pc: e.occurTimes}, {
+          0x1200: 5,
+          0x1100: 5,
+        });
+        expect({for (final e in split.offCpu) e.frame.pc: e.occurTimes}, {
+          0x1300: 5,
+          0x1100: 5,
+        });
+      });
+
+      test('only split the stacks within the timestamp range', () {
+        final split = SamplerProcessor.splitCpuTime(
+          [
+            stack([0x1200], 100, isCpuTick: true),
+            stack([0x1300], 2000, isCpuTick: true),
+          ],
+          [0, 1000],
+          1000,
+          1000,
+        );
+        expect(split.onCpu.map((e) => e.frame.pc), [0x1200]);
+        expect(split.offCpu, isEmpty);
+      });
+    });
+
+    group('summarizeThreadState', () {
+      final frame = NativeFrame(pc: 0x1200, timestamp: 100);
+      NativeStack stack(
+        String runState, {
+        int syscall = kNoSyscall,
+        int voluntaryContextSwitches = 0,
+        int involuntaryContextSwitches = 0,
+      }) => NativeStack(
+        frames: [frame],
+        modules: [],
+        syscall: syscall,
+        runState: runState.isEmpty ? 0 : runState.codeUnitAt(0),
+        voluntaryContextSwitches: voluntaryContextSwitches,
+        involuntaryContextSwitches: involuntaryContextSwitches,
+      );
+
+      test('count the run states and the syscalls', () {
+        final summary = SamplerProcessor.summarizeThreadState(
+          [
+            stack('R', involuntaryContextSwitches: 1),
+            stack('S', syscall: 202, voluntaryContextSwitches: 2),
+            stack('S', syscall: 202),
+            stack('D', syscall: 7, voluntaryContextSwitches: 1),
+          ],
+          (number) => number == 202 ? 'futex' : null,
+        );
+        expect(summary.runStates, {
+          'running': 1,
+          'sleeping': 2,
+          'disk sleep': 1,
+        });
+        // The syscalls without a name are keyed by the number.
+        expect(summary.syscalls, {'futex': 2, '7': 1});
+        expect(summary.voluntaryContextSwitches, 3);
+        expect(summary.involuntaryContextSwitches, 1);
+      });
+
+      test('skip the run states not read', () {
+        final summary = SamplerProcessor.summarizeThreadState([
+          stack(''),
+          stack('?'),
+        ], (number) => null);
+        expect(summary.runStates, {'?': 1});
+        expect(summary.syscalls, isEmpty);
+      });
+    });
+
+    group('summarizeFramePhases', () {
+      final frame = NativeFrame(pc: 0x1200, timestamp: 100);
+      NativeStack stack(FramePhase phase) =>
+          NativeStack(frames: [frame], modules: [], framePhase: phase);
+
+      test('count the samples of each phase', () {
+        final phases = SamplerProcessor.summarizeFramePhases([
+          stack(FramePhase.build),
+          stack(FramePhase.layout),
+          stack(FramePhase.layout),
+          stack(FramePhase.idle),
+        ]);
+        expect(phases, {
+          FramePhase.build: 1,
+          FramePhase.layout: 2,
+          FramePhase.idle: 1,
+        });
+      });
+
+      test('empty', () {
+        expect(SamplerProcessor.summarizeFramePhases([]), isEmpty);
+      });
+    });
+
+    group('wallTicksOf', () {
+      final frame = NativeFrame(pc: 0x1200, timestamp: 100);
+
+      test('drop the cpu ticks', () {
+        final wallTick = NativeStack(frames: [frame], modules: []);
+        final cpuTick = NativeStack(
+          frames: [frame],
+          modules: [],
+          isCpuTick: true,
+        );
+        expect(SamplerProcessor.wallTicksOf([wallTick, cpuTick]), [wallTick]);
+      });
+
+      test('keep the stacks if all of them are cpu ticks', () {
+        final cpuTick = NativeStack(
+          frames: [frame],
+          modules: [],
+          isCpuTick: true,
+        );
+        expect(SamplerProcessor.wallTicksOf([cpuTick]), [cpuTick]);
+      });
+    });
+
     group('aggregateStacks', () {
       test('return aggregated frames with one frame in stack', () {
         stackCapturer = FakeStackCapturer();
@@ -819,6 +1910,55 @@ void main() {
         );
         expect(aggregatedNativeFrames.length, kMaxStackTraces);
       });
+
+      test('weight the stacks of a burst by their intervals', () {
+        stackCapturer = FakeStackCapturer();
+        final config = SamplerConfig(
+          jankThreshold: 8,
+          sampleRateInMilliseconds: 8,
+        );
+        samplerProcessor = SamplerProcessor(config, stackCapturer);
+        final now = Timeline.now;
+        final module = NativeModule(
+          id: 1,
+          path: 'libapp.so',
+          baseAddress: 540641718272,
+          symbolName: 'hello',
+        );
+        final buffer = RingBuffer<NativeStack>(16);
+        NativeStack stackAt(int pc, int timestamp) {
+          return NativeStack(
+            frames: [
+              NativeFrame(pc: pc, timestamp: timestamp, module: module),
+              NativeFrame(pc: 1, timestamp: timestamp, module: module),
+            ],
+            modules: [module, module],
+          );
+        }
+
+        // 2 stacks of the base rate, then a burst of 8 stacks every 1ms, which
+        // covers the same time as 1 stack of the base rate.
+        int timestamp = now - 100000;
+        for (int i = 0; i < 2; ++i) {
+          timestamp += 8000;
+          buffer.write(stackAt(2, timestamp));
+        }
+        for (int i = 0; i < 8; ++i) {
+          timestamp += 1000;
+          buffer.write(stackAt(3, timestamp));
+        }
+
+        final aggregatedNativeFrames = SamplerProcessor.aggregateStacks(
+          config,
+          buffer,
+          [now - 100000, now],
+        );
+        final occurTimes = {
+          for (final frame in aggregatedNativeFrames)
+            frame.frame.pc: frame.occurTimes,
+        };
+        expect(occurTimes, {1: 3, 2: 2});
+      });
     });
   });
 